@@ -6,8 +6,10 @@ class ScopeContext {
 public:
   llvm::IRBuilder<> *Builder;
   llvm::Module *Module;
+  /* The functions that can be called, NULL if only builtins can */
+  ModuleAST *Source;
 
-  ScopeContext() : return_type("void"), parent(NULL) {};
+  ScopeContext() : return_type("void"), parent(NULL), Source(NULL) {};
 
   void setVariable(std::string name, llvm::Value *value);
   void setVariable(nanjit::TypeInfo, std::string name, llvm::Value *value);
@@ -20,6 +22,6 @@ public:
   ScopeContext *createChild();
 };
 
-llvm::Type *typeinfo_get_llvm_type(nanjit::TypeInfo type);
+llvm::Type *typeinfo_get_llvm_type(nanjit::TypeInfo type, llvm::LLVMContext &context);
 void cast_value(ScopeContext *scope, nanjit::TypeInfo to_type, nanjit::TypeInfo from_type, Value **value);
 Function *define_llvm_intrinisic(ScopeContext *scope, string name, nanjit::TypeInfo type);
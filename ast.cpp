@@ -10,12 +10,14 @@
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Metadata.h"
 #include "llvm/IR/Module.h"
 #else
 #include "llvm/DataLayout.h"
 #include "llvm/DerivedTypes.h"
 #include "llvm/IRBuilder.h"
 #include "llvm/LLVMContext.h"
+#include "llvm/Metadata.h"
 #include "llvm/Module.h"
 #endif
 #include "llvm/PassManager.h"
@@ -23,6 +25,7 @@
 #include "llvm/Support/Host.h"
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Transforms/Scalar.h"
+#include <algorithm>
 #include <cstdio>
 #include <map>
 #include <string>
@@ -36,6 +39,7 @@ using namespace std;
 #include "typeinfo.h"
 #include "ast.h"
 #include "ast-internal.h"
+#include "jitmath.h"
 using namespace nanjit;
 
 /* Base types, from lowest to highest precedence */
@@ -48,12 +52,12 @@ static const TypeInfo::BaseTypeEnum BASE_TYPES[] = {
   TypeInfo::TYPE_VOID
 };
 
-llvm::Type *typeinfo_get_llvm_type(nanjit::TypeInfo type)
+llvm::Type *typeinfo_get_llvm_type(nanjit::TypeInfo type, LLVMContext &context)
 {
   if (type.getBaseType() == TypeInfo::TYPE_VOID)
     throw SyntaxErrorException("Could not get LLVM type for " + type.toStr());
 
-  Type *llvm_type = type.getLLVMType();
+  Type *llvm_type = type.getLLVMType(context);
 
   if (!llvm_type)
     throw SyntaxErrorException("Could not get LLVM type for " + type.toStr());
@@ -84,41 +88,41 @@ void cast_value(ScopeContext *scope, nanjit::TypeInfo to_type, nanjit::TypeInfo
            (to_type_base == TypeInfo::TYPE_INT  && from_type_base == TypeInfo::TYPE_USHORT) ||
            (to_type_base == TypeInfo::TYPE_UINT && from_type_base == TypeInfo::TYPE_SHORT))
     {
-      *value = Builder->CreateZExt(*value, typeinfo_get_llvm_type(to_type));
+      *value = Builder->CreateZExt(*value, typeinfo_get_llvm_type(to_type, Builder->getContext()));
     }
   else if ((to_type_base == TypeInfo::TYPE_USHORT && from_type_base == TypeInfo::TYPE_UINT) ||
            (to_type_base == TypeInfo::TYPE_SHORT  && from_type_base == TypeInfo::TYPE_UINT) ||
            (to_type_base == TypeInfo::TYPE_USHORT && from_type_base == TypeInfo::TYPE_INT))
     {
-      *value = Builder->CreateTrunc(*value, typeinfo_get_llvm_type(to_type));
+      *value = Builder->CreateTrunc(*value, typeinfo_get_llvm_type(to_type, Builder->getContext()));
     }
   else if ((to_type_base == TypeInfo::TYPE_INT && from_type_base == TypeInfo::TYPE_SHORT))
     {
-      *value = Builder->CreateSExt(*value, typeinfo_get_llvm_type(to_type));
+      *value = Builder->CreateSExt(*value, typeinfo_get_llvm_type(to_type, Builder->getContext()));
     }
   else if ((to_type_base == TypeInfo::TYPE_SHORT && from_type_base == TypeInfo::TYPE_INT))
     {
-      *value = Builder->CreateTrunc(*value, typeinfo_get_llvm_type(to_type));
+      *value = Builder->CreateTrunc(*value, typeinfo_get_llvm_type(to_type, Builder->getContext()));
     }
   else if ((to_type_base == TypeInfo::TYPE_FLOAT && from_type_base == TypeInfo::TYPE_INT) ||
            (to_type_base == TypeInfo::TYPE_FLOAT && from_type_base == TypeInfo::TYPE_SHORT))
     {
-      *value = Builder->CreateSIToFP(*value, typeinfo_get_llvm_type(to_type));
+      *value = Builder->CreateSIToFP(*value, typeinfo_get_llvm_type(to_type, Builder->getContext()));
     }
   else if ((to_type_base == TypeInfo::TYPE_FLOAT && from_type_base == TypeInfo::TYPE_UINT) ||
            (to_type_base == TypeInfo::TYPE_FLOAT && from_type_base == TypeInfo::TYPE_USHORT))
     {
-      *value = Builder->CreateUIToFP(*value, typeinfo_get_llvm_type(to_type));
+      *value = Builder->CreateUIToFP(*value, typeinfo_get_llvm_type(to_type, Builder->getContext()));
     }
   else if ((to_type_base == TypeInfo::TYPE_INT   && from_type_base == TypeInfo::TYPE_FLOAT) ||
            (to_type_base == TypeInfo::TYPE_SHORT && from_type_base == TypeInfo::TYPE_FLOAT))
     {
-      *value = Builder->CreateFPToSI(*value, typeinfo_get_llvm_type(to_type));
+      *value = Builder->CreateFPToSI(*value, typeinfo_get_llvm_type(to_type, Builder->getContext()));
     }
   else if ((to_type_base == TypeInfo::TYPE_UINT   && from_type_base == TypeInfo::TYPE_FLOAT) ||
            (to_type_base == TypeInfo::TYPE_USHORT && from_type_base == TypeInfo::TYPE_FLOAT))
     {
-      *value = Builder->CreateFPToUI(*value, typeinfo_get_llvm_type(to_type));
+      *value = Builder->CreateFPToUI(*value, typeinfo_get_llvm_type(to_type, Builder->getContext()));
     }
   else
     throw SyntaxErrorException("Could not convert " + from_type.toStr() + " to " + to_type.toStr());
@@ -139,7 +143,7 @@ Function *define_llvm_intrinisic(ScopeContext *scope, string name, TypeInfo type
 
   if (!func)
   {
-    Type *result_type = type.getLLVMType();
+    Type *result_type = type.getLLVMType(scope->Module->getContext());
     vector<Type *> arg_types;
 
     arg_types.push_back(result_type);
@@ -222,6 +226,7 @@ ScopeContext *ScopeContext::createChild()
   ScopeContext *scope = new ScopeContext();
   scope->Builder = Builder;
   scope->Module = Module;
+  scope->Source = Source;
   scope->return_type = return_type;
   scope->parent = this;
   return scope;
@@ -271,7 +276,7 @@ Value *DoubleExprAST::codegen(ScopeContext *scope)
 {
   float v = atof(str_value.c_str());
   cout << "Warning: Double value " << str_value << " will be truncated to float" << endl;
-  return ConstantFP::get(getGlobalContext(), APFloat(v));
+  return ConstantFP::get(scope->Builder->getContext(), APFloat(v));
 }
 
 nanjit::TypeInfo DoubleExprAST::getResultType(ScopeContext *scope)
@@ -292,7 +297,7 @@ FloatExprAST::FloatExprAST(std::string val)
 Value *FloatExprAST::codegen(ScopeContext *scope)
 {
   float v = atof(str_value.c_str());
-  return ConstantFP::get(getGlobalContext(), APFloat(v));
+  return ConstantFP::get(scope->Builder->getContext(), APFloat(v));
 }
 
 nanjit::TypeInfo FloatExprAST::getResultType(ScopeContext *scope)
@@ -331,6 +336,11 @@ Value *IntExprAST::codegen(ScopeContext *scope)
     }
 }
 
+long IntExprAST::getValue()
+{
+  return strtol(str_value.c_str(), NULL, 10);
+}
+
 nanjit::TypeInfo IntExprAST::getResultType(ScopeContext *scope)
 {
   double dval = atof(str_value.c_str());
@@ -617,7 +627,7 @@ Value *VectorConstructorAST::codegen(ScopeContext *scope)
   if (args.size() != width)
     throw genSyntaxError(std::string("Invalid arguments to vector constructor for ") + Type->getName());
 
-  Value *out_value = UndefValue::get(typeinfo_get_llvm_type(vector_type));
+  Value *out_value = UndefValue::get(typeinfo_get_llvm_type(vector_type, Builder->getContext()));
   TypeInfo element_type = TypeInfo(vector_type.getBaseType());
 
   for (int element_index = 0; element_index < width; ++element_index)
@@ -651,6 +661,71 @@ ostream& VectorConstructorAST::print(ostream& os)
   return os;
 }
 
+/* A division the JIT may replace with a reciprocal estimate */
+static Value *create_native_divide(ScopeContext *scope, Value *lhs, Value *rhs)
+{
+  LLVMContext &context = scope->Builder->getContext();
+  Instruction *divide = scope->Builder->Insert(BinaryOperator::CreateFDiv(lhs, rhs));
+
+  divide->setMetadata(NANJIT_NATIVE_METADATA, MDNode::get(context, ArrayRef<Value *>()));
+  return divide;
+}
+
+/* Arguments to the math builtins are all the same width, except that
+ * scalars may be mixed in and are used for every element.
+ */
+static int math_builtin_width(ScopeContext *scope, const std::string &name, std::vector<ExprAST *> &args)
+{
+  int width = 1;
+
+  for (size_t i = 0; i < args.size(); ++i)
+    width = std::max(width, (int)args[i]->getResultType(scope).getWidth());
+
+  for (size_t i = 0; i < args.size(); ++i)
+    {
+      TypeInfo arg_type = args[i]->getResultType(scope);
+
+      if ((arg_type.getWidth() != 1) && (arg_type.getWidth() != width))
+        {
+          std::string error;
+          llvm::raw_string_ostream rso(error);
+          rso << "Type mismatch for " << name << " : ";
+          for (size_t j = 0; j < args.size(); ++j)
+            {
+              if (j)
+                rso << " vs ";
+              rso << args[j]->getResultType(scope).toStr();
+            }
+          throw SyntaxErrorException(rso.str());
+        }
+    }
+
+  return width;
+}
+
+static Value *splat_value(IRBuilder<> *Builder, Value *value, int width)
+{
+  Value *vector = UndefValue::get(VectorType::get(value->getType(), width));
+  Constant *mask = ConstantAggregateZero::get(VectorType::get(Builder->getInt32Ty(), width));
+
+  vector = Builder->CreateInsertElement(vector, value, Builder->getInt32(0));
+  return Builder->CreateShuffleVector(vector, vector, mask);
+}
+
+/* Names CallAST handles itself, which a source function can't reuse */
+static bool is_builtin_function(const std::string &name)
+{
+  static const char *const builtins[] = {
+    "shuffle2", "select", "clamp", "min", "max", "sqrt",
+    "native_divide", "native_recip", "native_rsqrt"
+  };
+
+  for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); ++i)
+    if (name == builtins[i])
+      return true;
+  return math_builtin_arg_count(name) >= 0;
+}
+
 Value *CallAST::codegen(ScopeContext *scope)
 {
   std::vector<ExprAST *> &args = ArgList->getArgsList();
@@ -806,6 +881,116 @@ Value *CallAST::codegen(ScopeContext *scope)
 
       return call_result;
     }
+  else if ((std::string("native_divide") == Target->getName()) ||
+           (std::string("native_recip") == Target->getName()) ||
+           (std::string("native_rsqrt") == Target->getName()))
+    {
+      const int num_args = (std::string("native_divide") == Target->getName()) ? 2 : 1;
+      if (args.size() != num_args)
+        {
+          std::stringstream error_string;
+          error_string << "Called \"" << Target->getName() << "\" with ";
+          error_string << args.size() << " arguments, expected " << num_args;
+        throw SyntaxErrorException(error_string.str());
+        }
+
+      IRBuilder<> *Builder = scope->Builder;
+
+      Value *value       = args[0]->codegen(scope);
+      TypeInfo arg_type  = args[0]->getResultType(scope);
+      TypeInfo call_type = TypeInfo(TypeInfo::TYPE_FLOAT, arg_type.getWidth());
+      cast_value(scope, call_type, arg_type, &value);
+
+      if (std::string("native_divide") == Target->getName())
+        {
+          Value *divisor = args[1]->codegen(scope);
+          TypeInfo divisor_type = args[1]->getResultType(scope);
+
+          if (arg_type.getWidth() != divisor_type.getWidth())
+            {
+              std::string error;
+              llvm::raw_string_ostream rso(error);
+              rso << "Type mismatch for " << Target->getName() << " : ";
+              rso << arg_type.toStr();
+              rso << " vs ";
+              rso << divisor_type.toStr();
+              throw SyntaxErrorException(rso.str());
+            }
+
+          cast_value(scope, call_type, divisor_type, &divisor);
+          return create_native_divide(scope, value, divisor);
+        }
+
+      if (std::string("native_rsqrt") == Target->getName())
+        value = Builder->CreateCall(define_llvm_intrinisic(scope, "llvm.sqrt", call_type), value);
+
+      Value *one = ConstantFP::get(call_type.getLLVMType(Builder->getContext()), 1.0);
+      return create_native_divide(scope, one, value);
+    }
+  else if (math_builtin_arg_count(Target->getName()) >= 0)
+    {
+      const int num_args = math_builtin_arg_count(Target->getName());
+      if (args.size() != num_args)
+        {
+          std::stringstream error_string;
+          error_string << "Called \"" << Target->getName() << "\" with ";
+          error_string << args.size() << " arguments, expected " << num_args;
+        throw SyntaxErrorException(error_string.str());
+        }
+
+      IRBuilder<> *Builder = scope->Builder;
+      int width = math_builtin_width(scope, Target->getName(), args);
+
+      vector<Value *> call_parameters;
+      for (int i = 0; i < num_args; ++i)
+        {
+          Value *value      = args[i]->codegen(scope);
+          TypeInfo arg_type = args[i]->getResultType(scope);
+          cast_value(scope, TypeInfo(TypeInfo::TYPE_FLOAT, arg_type.getWidth()), arg_type, &value);
+
+          if (arg_type.getWidth() != width)
+            value = splat_value(Builder, value, width);
+          call_parameters.push_back(value);
+        }
+
+      return build_math_builtin(*Builder, Target->getName(), call_parameters);
+    }
+  else if (FunctionAST *callee = scope->Source ? scope->Source->getFunction(Target->getName()) : NULL)
+    {
+      std::vector<TypeInfo> arg_types = callee->getArgumentTypes();
+      if (args.size() != arg_types.size())
+        {
+          std::stringstream error_string;
+          error_string << "Called \"" << Target->getName() << "\" with ";
+          error_string << args.size() << " arguments, expected " << arg_types.size();
+        throw SyntaxErrorException(error_string.str());
+        }
+
+      IRBuilder<> *Builder = scope->Builder;
+
+      vector<Value *> call_parameters;
+      for (unsigned int i = 0; i < args.size(); ++i)
+        {
+          Value *value      = args[i]->codegen(scope);
+          TypeInfo arg_type = args[i]->getResultType(scope);
+
+          if (arg_type.getWidth() != arg_types[i].getWidth())
+            {
+              std::string error;
+              llvm::raw_string_ostream rso(error);
+              rso << "Type mismatch for argument " << (i + 1) << " of " << Target->getName() << " : ";
+              rso << arg_type.toStr();
+              rso << " vs ";
+              rso << arg_types[i].toStr();
+              throw SyntaxErrorException(rso.str());
+            }
+
+          cast_value(scope, arg_types[i], arg_type, &value);
+          call_parameters.push_back(value);
+        }
+
+      return Builder->CreateCall(scope->Module->getFunction(Target->getName()), call_parameters);
+    }
 
   throw SyntaxErrorException("Call \"" + Target->getName() + "\" not implemented");
 }
@@ -831,11 +1016,22 @@ nanjit::TypeInfo CallAST::getResultType(ScopeContext *scope)
       TypeInfo arg_type = ArgList->getArgsList()[0]->getResultType(scope);
       return TypeInfo(TypeInfo::TYPE_FLOAT, arg_type.getWidth());
     }
-  else if (std::string("sqrt") == Target->getName())
+  else if ((std::string("sqrt") == Target->getName()) ||
+           (std::string("native_divide") == Target->getName()) ||
+           (std::string("native_recip") == Target->getName()) ||
+           (std::string("native_rsqrt") == Target->getName()))
     {
       TypeInfo arg_type = ArgList->getArgsList()[0]->getResultType(scope);
       return TypeInfo(TypeInfo::TYPE_FLOAT, arg_type.getWidth());
     }
+  else if (math_builtin_arg_count(Target->getName()) >= 0)
+    {
+      return TypeInfo(TypeInfo::TYPE_FLOAT, math_builtin_width(scope, Target->getName(), ArgList->getArgsList()));
+    }
+  else if (FunctionAST *callee = scope->Source ? scope->Source->getFunction(Target->getName()) : NULL)
+    {
+      return callee->getResultType();
+    }
   throw SyntaxErrorException("Call \"" + Target->getName() + "\" result type not implemented");
 }
 
@@ -896,26 +1092,59 @@ Value *ComparisonAST::codegen(ScopeContext *scope)
 {
   IRBuilder<> *Builder = scope->Builder;
 
-  if ((LHS->getResultType(scope).getBaseType() != TypeInfo::TYPE_FLOAT) ||
-      (RHS->getResultType(scope).getBaseType() != TypeInfo::TYPE_FLOAT))
+  TypeInfo lhs_type = LHS->getResultType(scope);
+  TypeInfo rhs_type = RHS->getResultType(scope);
+  TypeInfo type_for_operation = promote_types(lhs_type, rhs_type);
+
+  if ((!lhs_type.isFloatType() && !lhs_type.isIntegerType()) ||
+      (!rhs_type.isFloatType() && !rhs_type.isIntegerType()))
   {
     throw SyntaxErrorException ("Invalid type for ComparisonAST");
   }
 
+  Value *lhs = LHS->codegen(scope);
+  Value *rhs = RHS->codegen(scope);
+  cast_value(scope, type_for_operation, lhs_type, &lhs);
+  cast_value(scope, type_for_operation, rhs_type, &rhs);
+
+  if (lhs->getType() != rhs->getType())
+    throw SyntaxErrorException ("Type mismatch for ComparisonAST: " + lhs_type.toStr() + " vs " + rhs_type.toStr());
+
+  if (type_for_operation.isIntegerType())
+    {
+      bool is_unsigned = type_for_operation.isUnsignedType();
+
+      switch (Op)
+        {
+          case EqualTo:
+            return Builder->CreateICmpEQ(lhs, rhs);
+          case NotEqualTo:
+            return Builder->CreateICmpNE(lhs, rhs);
+          case GreaterThan:
+            return is_unsigned ? Builder->CreateICmpUGT(lhs, rhs) : Builder->CreateICmpSGT(lhs, rhs);
+          case GreaterThanOrEqual:
+            return is_unsigned ? Builder->CreateICmpUGE(lhs, rhs) : Builder->CreateICmpSGE(lhs, rhs);
+          case LessThan:
+            return is_unsigned ? Builder->CreateICmpULT(lhs, rhs) : Builder->CreateICmpSLT(lhs, rhs);
+          case LessThanOrEqual:
+            return is_unsigned ? Builder->CreateICmpULE(lhs, rhs) : Builder->CreateICmpSLE(lhs, rhs);
+        }
+    }
+
   switch (Op)
     {
       case EqualTo:
-        return Builder->CreateFCmpUEQ(LHS->codegen(scope), RHS->codegen(scope));
+        return Builder->CreateFCmpUEQ(lhs, rhs);
       case NotEqualTo:
-        return Builder->CreateFCmpUNE(LHS->codegen(scope), RHS->codegen(scope));
+        return Builder->CreateFCmpUNE(lhs, rhs);
       case GreaterThan:
-        return Builder->CreateFCmpUGT(LHS->codegen(scope), RHS->codegen(scope));
+        return Builder->CreateFCmpUGT(lhs, rhs);
       case GreaterThanOrEqual:
-        return Builder->CreateFCmpUGE(LHS->codegen(scope), RHS->codegen(scope));
+        return Builder->CreateFCmpUGE(lhs, rhs);
       case LessThan:
-        return Builder->CreateFCmpULT(LHS->codegen(scope), RHS->codegen(scope));
+        return Builder->CreateFCmpULT(lhs, rhs);
       case LessThanOrEqual:
-        return Builder->CreateFCmpULE(LHS->codegen(scope), RHS->codegen(scope));
+        return Builder->CreateFCmpULE(lhs, rhs);
     }
 
   throw SyntaxErrorException("Compare op not implemented");
@@ -957,6 +1186,26 @@ ostream& ComparisonAST::print(ostream& os)
   return os;
 }
 
+/* Number if statements in the order they're first generated, which is the
+ * order they appear in the source, so profiles can refer to them. Copies
+ * from unrolling a loop keep the number of the statement they came from.
+ */
+static void tag_branch(ScopeContext *scope, BranchInst *branch, int &branch_index)
+{
+  LLVMContext &context = scope->Module->getContext();
+  NamedMDNode *branches = scope->Module->getOrInsertNamedMetadata(NANJIT_BRANCH_METADATA);
+
+  if (branch_index < 0)
+    branch_index = branches->getNumOperands();
+
+  Value *index = ConstantInt::get(Type::getInt32Ty(context), branch_index);
+  MDNode *node = MDNode::get(context, index);
+
+  if ((unsigned int)branch_index == branches->getNumOperands())
+    branches->addOperand(node);
+  branch->setMetadata(NANJIT_BRANCH_METADATA, node);
+}
+
 Value *IfElseAST::codegen(ScopeContext *scope)
 {
   IRBuilder<> *builder = scope->Builder;
@@ -971,7 +1220,7 @@ Value *IfElseAST::codegen(ScopeContext *scope)
       BasicBlock *merge_block = BasicBlock::Create(builder->getContext(), "ifcont");
       BasicBlock *active_block = NULL;
 
-      builder->CreateCondBr(comparison, if_block, else_block);
+      tag_branch(scope, builder->CreateCondBr(comparison, if_block, else_block), BranchIndex);
 
       builder->SetInsertPoint(if_block);
 
@@ -1008,7 +1257,7 @@ Value *IfElseAST::codegen(ScopeContext *scope)
     {
       BasicBlock *if_block = BasicBlock::Create(builder->getContext(), "if", parent_function);
       BasicBlock *merge_block = BasicBlock::Create(builder->getContext(), "ifcont");
-      builder->CreateCondBr(comparison, if_block, merge_block);
+      tag_branch(scope, builder->CreateCondBr(comparison, if_block, merge_block), BranchIndex);
 
       builder->SetInsertPoint(if_block);
 
@@ -1050,6 +1299,199 @@ ostream& IfElseAST::print(ostream& os)
   return os;
 }
 
+/* Loops with more iterations than this are left as loops even when they
+ * ask to be unrolled.
+ */
+#define MAX_UNROLL_COUNT 64
+
+/* The value of expr if it's made up of integer literals */
+static bool constant_int_value(ExprAST *expr, long &value)
+{
+  if (IntExprAST *literal = dynamic_cast<IntExprAST *>(expr))
+    {
+      value = literal->getValue();
+      return true;
+    }
+
+  BinaryExprAST *binary = dynamic_cast<BinaryExprAST *>(expr);
+  long lhs, rhs;
+
+  if (!binary || !constant_int_value(binary->getLHS(), lhs) || !constant_int_value(binary->getRHS(), rhs))
+    return false;
+
+  switch (binary->getOp())
+    {
+      case '+':
+        value = lhs + rhs;
+        return true;
+      case '-':
+        value = lhs - rhs;
+        return true;
+      case '*':
+        value = lhs * rhs;
+        return true;
+      case '/':
+        value = rhs ? lhs / rhs : 0;
+        return rhs != 0;
+      default:
+        return false;
+    }
+}
+
+static bool compare_constants(ComparisonAST::CompareOp op, long lhs, long rhs)
+{
+  switch (op)
+    {
+      case ComparisonAST::EqualTo:
+        return lhs == rhs;
+      case ComparisonAST::NotEqualTo:
+        return lhs != rhs;
+      case ComparisonAST::GreaterThan:
+        return lhs > rhs;
+      case ComparisonAST::GreaterThanOrEqual:
+        return lhs >= rhs;
+      case ComparisonAST::LessThan:
+        return lhs < rhs;
+      case ComparisonAST::LessThanOrEqual:
+        return lhs <= rhs;
+    }
+
+  return false;
+}
+
+/* How many times a loop like "for (int i = 0; i < 3; i = i + 1)" runs, -1
+ * if that isn't known at compile time or is over MAX_UNROLL_COUNT.
+ */
+int LoopAST::constantTripCount()
+{
+  AssignmentExprAST *init = dynamic_cast<AssignmentExprAST *>(Init.get());
+  AssignmentExprAST *step = dynamic_cast<AssignmentExprAST *>(Step.get());
+  long value, limit, delta;
+
+  if (!init || !step || !constant_int_value(init->getValue(), value))
+    return -1;
+
+  IdentifierExprAST *counter = dynamic_cast<IdentifierExprAST *>(Condition->getLHS());
+  if (!counter || counter->getName() != init->getName() || !constant_int_value(Condition->getRHS(), limit))
+    return -1;
+
+  BinaryExprAST *increment = dynamic_cast<BinaryExprAST *>(step->getValue());
+  IdentifierExprAST *base = increment ? dynamic_cast<IdentifierExprAST *>(increment->getLHS()) : NULL;
+  if (step->getName() != init->getName() || !base || base->getName() != init->getName() ||
+      !constant_int_value(increment->getRHS(), delta))
+    return -1;
+
+  if (increment->getOp() == '-')
+    delta = -delta;
+  else if (increment->getOp() != '+')
+    return -1;
+
+  int count = 0;
+  while (compare_constants(Condition->getOp(), value, limit))
+    {
+      if (++count > MAX_UNROLL_COUNT)
+        return -1;
+      value += delta;
+    }
+
+  return count;
+}
+
+Value *LoopAST::codegenCondition(ScopeContext *scope)
+{
+  if (Condition->getResultType(scope).getWidth() != 1)
+    throw SyntaxErrorException("Loop condition must compare single values");
+
+  return Condition->codegen(scope);
+}
+
+/* The body and step of one iteration */
+void LoopAST::codegenBody(ScopeContext *scope)
+{
+  IRBuilder<> *builder = scope->Builder;
+  auto_ptr<ScopeContext> child_scope(scope->createChild());
+
+  Body->codegen(child_scope.get());
+
+  /* Anything after a return is unreachable, but still needs somewhere to go */
+  BasicBlock *active_block = builder->GetInsertBlock();
+  if (!active_block->empty() && isa<ReturnInst>(active_block->back()))
+    builder->SetInsertPoint(BasicBlock::Create(builder->getContext(), "afterreturn", active_block->getParent()));
+
+  if (Step.get())
+    Step->codegen(scope);
+}
+
+Value *LoopAST::codegen(ScopeContext *scope)
+{
+  IRBuilder<> *builder = scope->Builder;
+  Function *parent_function = builder->GetInsertBlock()->getParent();
+  auto_ptr<ScopeContext> loop_scope(scope->createChild());
+
+  if (Init.get())
+    Init->codegen(loop_scope.get());
+
+  BasicBlock *exit_block = BasicBlock::Create(builder->getContext(), "loopexit");
+
+  int unroll_count = 0;
+  if (Unroll)
+    {
+      unroll_count = constantTripCount();
+      if (unroll_count < 0)
+        {
+          cout << "Warning: Loop can not be unrolled, its trip count is not a constant of at most " << MAX_UNROLL_COUNT << endl;
+          unroll_count = 0;
+        }
+    }
+
+  /* Unrolled copies still test the condition, which folds away once the
+   * counter is known to be a constant. The loop that follows them is never
+   * entered unless the body changes the counter.
+   */
+  for (int i = 0; i < unroll_count; ++i)
+    {
+      BasicBlock *body_block = BasicBlock::Create(builder->getContext(), "unrolled", parent_function);
+
+      builder->CreateCondBr(codegenCondition(loop_scope.get()), body_block, exit_block);
+      builder->SetInsertPoint(body_block);
+      codegenBody(loop_scope.get());
+    }
+
+  BasicBlock *condition_block = BasicBlock::Create(builder->getContext(), "loopcond", parent_function);
+  BasicBlock *body_block = BasicBlock::Create(builder->getContext(), "loop", parent_function);
+
+  builder->CreateBr(condition_block);
+  builder->SetInsertPoint(condition_block);
+  builder->CreateCondBr(codegenCondition(loop_scope.get()), body_block, exit_block);
+
+  builder->SetInsertPoint(body_block);
+  codegenBody(loop_scope.get());
+  builder->CreateBr(condition_block);
+
+  parent_function->getBasicBlockList().push_back(exit_block);
+  builder->SetInsertPoint(exit_block);
+
+  return NULL;
+}
+
+ostream& LoopAST::print(ostream& os)
+{
+  if (Unroll)
+    os << "Unroll ";
+  os << "Loop( ";
+  if (Init.get())
+    Init->print(os);
+  os << "; ";
+  Condition->print(os);
+  os << "; ";
+  if (Step.get())
+    Step->print(os);
+  os << " ) {" << endl;
+  Body->print(os);
+  os << "  }";
+  return os;
+}
+
 std::string FunctionArgAST::getType()
 {
   return Type->getName();
@@ -1105,21 +1547,61 @@ std::string FunctionAST::getName()
   return Name->getName();
 }
 
-Value *FunctionAST::codegen(llvm::Module *module)
+nanjit::TypeInfo FunctionAST::getResultType()
 {
-  IRBuilder<> Builder(getGlobalContext());
-  ScopeContext scope = ScopeContext();
-  scope.Builder = &Builder;
-  scope.Module = module;
+  return TypeInfo(ReturnType->getName());
+}
 
-  scope.setReturnType(ReturnType->getName());
+std::vector<nanjit::TypeInfo> FunctionAST::getArgumentTypes()
+{
+  std::list<FunctionArgAST *> &args = Args->getArgsList();
+  std::vector<nanjit::TypeInfo> types;
+
+  for (std::list<FunctionArgAST *>::iterator args_iter = args.begin(); args_iter != args.end(); ++args_iter)
+    types.push_back(TypeInfo((*args_iter)->getType()));
+
+  return types;
+}
+
+void FunctionAST::addAttribute(std::string name)
+{
+  Attributes.push_back(name);
+}
+
+/* Calls between functions are always inlined unless the callee has the
+ * noinline attribute, so splitting a kernel into helpers costs nothing in
+ * the pixel loop.
+ */
+Function *FunctionAST::declare(llvm::Module *module)
+{
+  bool inline_calls = true;
+
+  for (std::vector<std::string>::iterator it = Attributes.begin(); it != Attributes.end(); ++it)
+    {
+      if (*it == "noinline")
+        inline_calls = false;
+    }
+
+  Type *result_type = typeinfo_get_llvm_type(ReturnType->getName(), module->getContext());
+  Function *func = declareFunction(module, Name->getName(), result_type);
+
+#if ((LLVM_VERSION_MAJOR > 3) || ((LLVM_VERSION_MAJOR == 3) && (LLVM_VERSION_MINOR >= 3)))
+  func->addFnAttr(inline_calls ? Attribute::AlwaysInline : Attribute::NoInline);
+#else
+  func->addFnAttr(inline_calls ? Attributes::AlwaysInline : Attributes::NoInline);
+#endif
+
+  return func;
+}
 
-  /* generate the arguments (all pointers to float4 for now) */
+/* Declare a function taking this function's arguments and returning
+ * result_type.
+ */
+Function *FunctionAST::declareFunction(llvm::Module *module, const std::string &name, llvm::Type *result_type)
+{
   std::list<FunctionArgAST *> &args = Args->getArgsList();
   std::vector<Type*> ArgTypes(args.size());
 
-  Type *result_type = typeinfo_get_llvm_type(ReturnType->getName());
-  
   {
     std::list<FunctionArgAST *>::iterator args_iter;
     std::vector<Type*>::iterator types_iter;
@@ -1128,14 +1610,14 @@ Value *FunctionAST::codegen(llvm::Module *module)
          args_iter != args.end();
          ++args_iter, ++types_iter)
       {
-        *types_iter = typeinfo_get_llvm_type((*args_iter)->getType());
+        *types_iter = typeinfo_get_llvm_type((*args_iter)->getType(), module->getContext());
       }
   }
 
   /* create the function type */
   FunctionType *func_type = FunctionType::get(result_type, ArgTypes, false);
   
-  Function *func = Function::Create(func_type, Function::ExternalLinkage, Name->getName(), module);
+  Function *func = Function::Create(func_type, Function::ExternalLinkage, name, module);
   
   {
     std::list<FunctionArgAST *>::iterator args_iter;
@@ -1149,8 +1631,25 @@ Value *FunctionAST::codegen(llvm::Module *module)
       }
   }
 
-  BasicBlock *func_body_block = BasicBlock::Create(getGlobalContext(), "entry", func);
-  Builder.SetInsertPoint(func_body_block);
+  return func;
+}
+
+/* Create a function taking this function's arguments and returning
+ * result_type, with scope's builder at the start of its body and the
+ * arguments loaded into scope. An existing declaration of name is used if
+ * there is one.
+ */
+Function *FunctionAST::createFunction(llvm::Module *module, const std::string &name,
+                                      llvm::Type *result_type, ScopeContext *scope)
+{
+  std::list<FunctionArgAST *> &args = Args->getArgsList();
+  Function *func = module->getFunction(name);
+
+  if (!func)
+    func = declareFunction(module, name, result_type);
+
+  BasicBlock *func_body_block = BasicBlock::Create(module->getContext(), "entry", func);
+  scope->Builder->SetInsertPoint(func_body_block);
   
   /* load the arguments into the scope */
   {
@@ -1164,20 +1663,108 @@ Value *FunctionAST::codegen(llvm::Module *module)
         std::string arg_name = (*args_iter)->getName();
         std::string arg_type = (*args_iter)->getType();
 
-        scope.setVariable(arg_type, arg_name, func_arg_iter);
+        scope->setVariable(arg_type, arg_name, func_arg_iter);
       }
   }
-  
+
+  return func;
+}
+
+/* Tag every if statement in func with the function's if conversion mode */
+static void tag_if_convert(Function *func, int mode)
+{
+  LLVMContext &context = func->getContext();
+  MDNode *node = MDNode::get(context, ConstantInt::get(Type::getInt32Ty(context), mode));
+
+  for (Function::iterator block = func->begin(); block != func->end(); ++block)
+    {
+      BranchInst *branch = dyn_cast<BranchInst>(block->getTerminator());
+
+      if (branch && branch->isConditional())
+        branch->setMetadata(NANJIT_IF_CONVERT_METADATA, node);
+    }
+}
+
+Value *FunctionAST::codegen(llvm::Module *module, ModuleAST *source)
+{
+  int if_convert_mode = -1;
+
+  for (std::vector<std::string>::iterator it = Attributes.begin(); it != Attributes.end(); ++it)
+    {
+      if (*it == "if_convert")
+        if_convert_mode = 1;
+      else if (*it == "no_if_convert")
+        if_convert_mode = 0;
+      else if (*it == "noinline")
+        continue;
+      else
+        throw genSyntaxError("Unknown attribute \"" + *it + "\"");
+    }
+
+  IRBuilder<> Builder(module->getContext());
+  ScopeContext scope = ScopeContext();
+  scope.Builder = &Builder;
+  scope.Module = module;
+  scope.Source = source;
+
+  scope.setReturnType(ReturnType->getName());
+
+  Type *result_type = typeinfo_get_llvm_type(ReturnType->getName(), module->getContext());
+  Function *func = createFunction(module, Name->getName(), result_type, &scope);
+
   Block->codegen(&scope);
   
   /* return zero if the block was missing a return */
   if (!(isa<ReturnInst>(func->back().back())))
     Builder.CreateRet(ConstantAggregateZero::get(result_type));
+
+  if (if_convert_mode >= 0)
+    tag_if_convert(func, if_convert_mode);
+
   return func;
 }
 
+void FunctionAST::codegenGuard(llvm::Module *module, ModuleAST *source)
+{
+  IfElseAST *guard = dynamic_cast<IfElseAST *>(Block->front());
+  ReturnAST *early_return = guard ? dynamic_cast<ReturnAST *>(guard->getIfBlock()->front()) : NULL;
+  IdentifierExprAST *result = early_return ? dynamic_cast<IdentifierExprAST *>(early_return->getResult()) : NULL;
+
+  if (!result)
+    return;
+
+  /* The argument has to be returned as it is, without a cast */
+  std::list<FunctionArgAST *> &args = Args->getArgsList();
+  std::list<FunctionArgAST *>::iterator args_iter;
+  int arg_index = 0;
+
+  for (args_iter = args.begin(); args_iter != args.end(); ++args_iter, ++arg_index)
+    {
+      if ((*args_iter)->getName() == result->getName())
+        break;
+    }
+
+  if (args_iter == args.end() || TypeInfo((*args_iter)->getType()) != TypeInfo(ReturnType->getName()))
+    return;
+
+  LLVMContext &context = module->getContext();
+  IRBuilder<> Builder(context);
+  ScopeContext scope = ScopeContext();
+  scope.Builder = &Builder;
+  scope.Module = module;
+  scope.Source = source;
+
+  Function *func = createFunction(module, Name->getName() + NANJIT_GUARD_SUFFIX, Builder.getInt1Ty(), &scope);
+  Builder.CreateRet(guard->getComparison()->codegen(&scope));
+
+  Value *operands[2] = { func, ConstantInt::get(Type::getInt32Ty(context), arg_index) };
+  module->getOrInsertNamedMetadata(NANJIT_GUARD_METADATA)->addOperand(MDNode::get(context, operands));
+}
+
 ostream& FunctionAST::print(ostream& os)
 {
+  for (std::vector<std::string>::iterator it = Attributes.begin(); it != Attributes.end(); ++it)
+    os << "Attribute(" << *it << ") ";
   os << "Function ";
   Args->print(os);
   os << " --> " << ReturnType->getName();
@@ -1233,16 +1820,36 @@ void ModuleAST::prependFunction(FunctionAST *func)
   functions.push_front(func);
 }
 
+FunctionAST *ModuleAST::getFunction(const std::string &name)
+{
+  for (std::list<FunctionAST *>::iterator it = functions.begin(); it != functions.end(); ++it)
+    {
+      if ((*it)->getName() == name)
+        return *it;
+    }
+
+  return NULL;
+}
+
 llvm::Module *ModuleAST::codegen(llvm::Module *module = NULL)
 {
   if (!module)
-    module = new Module("Unnamed Module", getGlobalContext());
+    throw SyntaxErrorException("No module to generate code into");
 
+  /* Declare everything first so functions can call ones defined after them */
   for (std::list<FunctionAST *>::iterator it = functions.begin(); it != functions.end(); ++it)
     {
+      if (is_builtin_function((*it)->getName()))
+        throw SyntaxErrorException("Function \"" + (*it)->getName() + "\" has the name of a builtin");
       if (module->getFunction((*it)->getName()))
         throw SyntaxErrorException("Redefinition of function \"" + (*it)->getName() + "\"");
-      (*it)->codegen(module);
+      (*it)->declare(module);
+    }
+
+  for (std::list<FunctionAST *>::iterator it = functions.begin(); it != functions.end(); ++it)
+    {
+      (*it)->codegen(module, this);
+      (*it)->codegenGuard(module, this);
     }
 
   return module;
@@ -9,6 +9,7 @@ typedef struct _FunctionArgAST FunctionArgAST;
 typedef struct _FunctionArgListAST FunctionArgListAST;
 typedef struct _CallArgListAST CallArgListAST;
 typedef struct _ComparisonAST ComparisonAST;
+typedef struct _LoopAST LoopAST;
 #else
 #include <list>
 #include <vector>
@@ -18,6 +19,8 @@ typedef struct _ComparisonAST ComparisonAST;
 #include <ostream>
 
 namespace llvm {
+  class Function;
+  class Type;
   class Value;
   class Module;
 };
@@ -26,6 +29,8 @@ namespace nanjit {
   class TypeInfo;
 }
 
+class ModuleAST;
+
 class ScopeContext;
 
 class SyntaxErrorException : public std::exception
@@ -79,6 +84,7 @@ class IntExprAST : public ExprAST {
   std::string str_value;
 public:
   IntExprAST(std::string val);
+  long getValue();
   virtual llvm::Value *codegen(ScopeContext *scope);
   virtual nanjit::TypeInfo getResultType(ScopeContext *scope);
   virtual std::ostream& print(std::ostream& os);
@@ -100,6 +106,9 @@ class BinaryExprAST : public ExprAST {
 public:
   BinaryExprAST(char op, ExprAST *lhs, ExprAST *rhs) 
     : Op(op), LHS(lhs), RHS(rhs) {}
+  char getOp() { return Op; };
+  ExprAST *getLHS() { return LHS.get(); };
+  ExprAST *getRHS() { return RHS.get(); };
   virtual llvm::Value *codegen(ScopeContext *scope);
   virtual nanjit::TypeInfo getResultType(ScopeContext *scope);
   virtual std::ostream& print(std::ostream& os);
@@ -114,6 +123,8 @@ public:
     : LHS(lhs), RHS(rhs) {}
   AssignmentExprAST(IdentifierExprAST *lhstype, IdentifierExprAST *lhs, ExprAST *rhs)
     : LHSType(lhstype), LHS(lhs), RHS(rhs) {}
+  std::string getName() { return LHS->getName(); };
+  ExprAST *getValue() { return RHS.get(); };
   virtual llvm::Value *codegen(ScopeContext *scope);
   virtual std::ostream& print(std::ostream& os);
 };
@@ -168,6 +179,7 @@ class BlockAST {
 public:
   BlockAST(ExprAST *expr);
   void PrependExpr(ExprAST *expr);
+  ExprAST *front() { return Expressions.empty() ? NULL : Expressions.front(); };
   virtual llvm::Value *codegen(ScopeContext *scope);
   virtual std::ostream& print(std::ostream& os);
 
@@ -190,19 +202,69 @@ private:
 public:
   ComparisonAST(CompareOp op, ExprAST *lhs, ExprAST *rhs)
     : Op(op), LHS(lhs), RHS(rhs) {}
+  CompareOp getOp() { return Op; };
+  ExprAST *getLHS() { return LHS.get(); };
+  ExprAST *getRHS() { return RHS.get(); };
   virtual llvm::Value *codegen(ScopeContext *scope);
   virtual nanjit::TypeInfo getResultType(ScopeContext *scope);
   virtual std::ostream& print(std::ostream& os);
 };
 
+/* The conditional branch generated for each if statement carries this
+ * metadata, a node holding the statement's index in the module.
+ */
+#define NANJIT_BRANCH_METADATA "nanjit.branch"
+
+/* Divisions from native_divide, native_recip and native_rsqrt carry this
+ * metadata, the JIT lowers them to a reciprocal estimate where it can.
+ */
+#define NANJIT_NATIVE_METADATA "nanjit.native"
+
+/* Conditional branches in functions with the if_convert or no_if_convert
+ * attribute carry this metadata, an i32 that is 1 if they should be turned
+ * into selects whenever that's safe and 0 if they must stay branches.
+ */
+#define NANJIT_IF_CONVERT_METADATA "nanjit.if_convert"
+
+/* A function that starts with "if (...) { return arg; }" gets a companion
+ * named with this suffix, taking the same arguments and returning the if's
+ * condition. The named metadata lists a node for each one, holding the guard
+ * function and the index of the argument it returns.
+ */
+#define NANJIT_GUARD_SUFFIX ".guard"
+#define NANJIT_GUARD_METADATA "nanjit.guard"
+
 class IfElseAST : public ExprAST /* FIXME: Not really an expr */ {
   std::auto_ptr<ComparisonAST> Comparison;
   std::auto_ptr<BlockAST> IfBlock;
   std::auto_ptr<BlockAST> ElseBlock;
+  int BranchIndex; /* For profiles, given out the first time it's generated, see tag_branch */
 public:
   IfElseAST(ComparisonAST *comp,
             BlockAST *ifblock,
-            BlockAST *elseblock) : Comparison(comp), IfBlock(ifblock), ElseBlock(elseblock) {}
+            BlockAST *elseblock) : Comparison(comp), IfBlock(ifblock), ElseBlock(elseblock), BranchIndex(-1) {}
+  ComparisonAST *getComparison() { return Comparison.get(); };
+  BlockAST *getIfBlock() { return IfBlock.get(); };
+  virtual llvm::Value *codegen(ScopeContext *scope);
+  virtual std::ostream& print(std::ostream& os);
+};
+
+/* A for loop, or a while loop when there's no Init or Step */
+class LoopAST : public ExprAST /* FIXME: Not really an expr */ {
+  std::auto_ptr<ExprAST> Init;
+  std::auto_ptr<ComparisonAST> Condition;
+  std::auto_ptr<ExprAST> Step;
+  std::auto_ptr<BlockAST> Body;
+  bool Unroll;
+
+  int constantTripCount();
+  llvm::Value *codegenCondition(ScopeContext *scope);
+  void codegenBody(ScopeContext *scope);
+public:
+  LoopAST(ExprAST *init, ComparisonAST *condition, ExprAST *step, BlockAST *body)
+    : Init(init), Condition(condition), Step(step), Body(body), Unroll(false) {}
+  /* From "#pragma unroll" in front of the loop */
+  void setUnroll() { Unroll = true; };
   virtual llvm::Value *codegen(ScopeContext *scope);
   virtual std::ostream& print(std::ostream& os);
 };
@@ -231,12 +293,28 @@ class FunctionAST : public ASTNode {
   std::auto_ptr<IdentifierExprAST> ReturnType;
   std::auto_ptr<FunctionArgListAST> Args;
   std::auto_ptr<BlockAST> Block;
+  std::vector<std::string> Attributes;
+
+  llvm::Function *declareFunction(llvm::Module *module, const std::string &name, llvm::Type *result_type);
+  llvm::Function *createFunction(llvm::Module *module, const std::string &name,
+                                 llvm::Type *result_type, ScopeContext *scope);
 public:
   FunctionAST(IdentifierExprAST *return_type, IdentifierExprAST *name, FunctionArgListAST *args, BlockAST *b) : ReturnType(return_type), Name(name), Args(args), Block(b) {}
 
   std::string getName();
-
-  virtual llvm::Value *codegen(llvm::Module *module = NULL);
+  nanjit::TypeInfo getResultType();
+  std::vector<nanjit::TypeInfo> getArgumentTypes();
+  /* From __attribute__((name)) in front of the function */
+  void addAttribute(std::string name);
+
+  /* Add the function's prototype to module, so it can be called before its
+   * body is generated.
+   */
+  llvm::Function *declare(llvm::Module *module);
+  /* source is searched for the functions this one calls */
+  virtual llvm::Value *codegen(llvm::Module *module = NULL, ModuleAST *source = NULL);
+  /* Emit the function's guard if it has one, see NANJIT_GUARD_SUFFIX */
+  void codegenGuard(llvm::Module *module, ModuleAST *source = NULL);
   virtual std::ostream& print(std::ostream& os);
 
   virtual ~FunctionAST();
@@ -246,6 +324,7 @@ class ReturnAST : public ExprAST /* FIXME: Not really an expr */ {
   std::auto_ptr<ExprAST> Result;
 public:
   ReturnAST(ExprAST *expr = NULL) : Result(expr) {};
+  ExprAST *getResult() { return Result.get(); };
   virtual llvm::Value *codegen(ScopeContext *scope);
 
   virtual std::ostream& print(std::ostream& os);
@@ -257,6 +336,8 @@ public:
   ModuleAST();
 
   void prependFunction(FunctionAST *func);
+  /* NULL if the module doesn't define name */
+  FunctionAST *getFunction(const std::string &name);
 
   virtual llvm::Module *codegen(llvm::Module *module);
   virtual std::ostream& print(std::ostream& os);
@@ -0,0 +1,188 @@
+#include "llvm/Support/Atomic.h"
+using namespace llvm;
+
+#include <cstdio>
+
+#include "jitcache.h"
+
+static const uint32_t FNV_OFFSET_BASIS = 2166136261u;
+static const uint32_t FNV_PRIME = 16777619u;
+
+static inline uint32_t hash_string(uint32_t hash, const char *str)
+{
+  /* The terminating NUL is included so "ab","c" and "a","bc" differ */
+  do
+    {
+      hash ^= (unsigned char)*str;
+      hash *= FNV_PRIME;
+    } while (*str++);
+
+  return hash;
+}
+
+uint32_t IterationCache::hashKey(IterationKind kind, const char *function_name, const char * const *argv, int argc)
+{
+  uint32_t hash = FNV_OFFSET_BASIS;
+
+  hash ^= (unsigned char)kind;
+  hash *= FNV_PRIME;
+
+  hash = hash_string(hash, function_name);
+  for (int i = 0; i < argc; ++i)
+    hash = hash_string(hash, argv[i]);
+
+  return hash;
+}
+
+static inline bool match_string(const char *&key, const char *key_end, const char *str)
+{
+  while (*str)
+    {
+      if (key == key_end || *key != *str)
+        return false;
+      ++key;
+      ++str;
+    }
+
+  if (key == key_end || *key != '\0')
+    return false;
+  ++key;
+
+  return true;
+}
+
+bool IterationCache::keyMatches(const std::string &key, IterationKind kind, const char *function_name,
+                                const char * const *argv, int argc)
+{
+  const char *key_iter = key.data();
+  const char *key_end  = key_iter + key.size();
+
+  if (key_iter == key_end || *key_iter++ != (char)kind)
+    return false;
+
+  if (!match_string(key_iter, key_end, function_name))
+    return false;
+
+  for (int i = 0; i < argc; ++i)
+    if (!match_string(key_iter, key_end, argv[i]))
+      return false;
+
+  return key_iter == key_end;
+}
+
+void *IterationRecord::use(uint32_t epoch)
+{
+  if (evicted)
+    return NULL;
+
+  if (last_used != epoch)
+    last_used = epoch;
+
+  return function;
+}
+
+IterationCache::Table *IterationCache::createTable(unsigned int size)
+{
+  Table *t = new Table;
+  t->mask  = size - 1;
+  t->slots = new IterationCacheEntry * volatile[size];
+
+  for (unsigned int i = 0; i < size; ++i)
+    t->slots[i] = NULL;
+
+  return t;
+}
+
+void IterationCache::destroyTable(Table *t)
+{
+  delete[] t->slots;
+  delete t;
+}
+
+void IterationCache::insertIntoTable(Table *t, IterationCacheEntry *entry)
+{
+  unsigned int index = entry->hash & t->mask;
+
+  while (t->slots[index])
+    index = (index + 1) & t->mask;
+
+  /* Make sure the entry is visible before the slot that points to it */
+  sys::MemoryFence();
+  t->slots[index] = entry;
+}
+
+IterationCache::IterationCache()
+{
+  table = createTable(16);
+}
+
+IterationCache::~IterationCache()
+{
+  destroyTable(table);
+
+  for (std::vector<Table *>::iterator iter = retired_tables.begin(); iter != retired_tables.end(); ++iter)
+    destroyTable(*iter);
+
+  for (std::vector<IterationCacheEntry *>::iterator iter = entries.begin(); iter != entries.end(); ++iter)
+    delete *iter;
+}
+
+IterationRecord *IterationCache::lookup(uint32_t hash, IterationKind kind, const char *function_name,
+                             const char * const *argv, int argc) const
+{
+  /* Slot loads depend on the table load and entry loads depend on the slot
+   * load, so the only ordering needed is the fence on the write side.
+   */
+  Table *t = table;
+  unsigned int index = hash & t->mask;
+
+  while (IterationCacheEntry *entry = t->slots[index])
+    {
+      if (entry->hash == hash && keyMatches(entry->key, kind, function_name, argv, argc))
+        return entry->record;
+
+      index = (index + 1) & t->mask;
+    }
+
+  return NULL;
+}
+
+void IterationCache::insert(uint32_t hash, IterationKind kind, const char *function_name,
+                            const char * const *argv, int argc, IterationRecord *record)
+{
+  if (lookup(hash, kind, function_name, argv, argc))
+    return;
+
+  IterationCacheEntry *entry = new IterationCacheEntry();
+  entry->hash = hash;
+  entry->record = record;
+
+  entry->key.push_back((char)kind);
+  entry->key.append(function_name);
+  entry->key.push_back('\0');
+  for (int i = 0; i < argc; ++i)
+    {
+      entry->key.append(argv[i]);
+      entry->key.push_back('\0');
+    }
+
+  entries.push_back(entry);
+
+  /* Keep the load factor at or below 1/2 so probe sequences stay short */
+  Table *current = table;
+  if (entries.size() * 2 > current->mask + 1)
+    {
+      Table *grown = createTable((current->mask + 1) * 2);
+
+      for (std::vector<IterationCacheEntry *>::iterator iter = entries.begin(); iter != entries.end(); ++iter)
+        insertIntoTable(grown, *iter);
+
+      sys::MemoryFence();
+      table = grown;
+      retired_tables.push_back(current);
+    }
+  else
+    {
+      insertIntoTable(current, entry);
+    }
+}
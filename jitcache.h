@@ -0,0 +1,85 @@
+#ifndef __JITCACHE_HPP__
+#define __JITCACHE_HPP__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/* Maximum number of type strings (including the return type) an iteration
+ * can be requested with.
+ */
+#define ITERATION_CACHE_MAX_ARGS 32
+
+typedef enum {
+  ITERATION_KIND_LINEAR = 'l',
+  ITERATION_KIND_RANGE  = 'r'
+} IterationKind;
+
+/* What cache entries point to. Records belong to the JitModule and are kept
+ * until it is destroyed, an evicted record is reused if its iteration is
+ * compiled again, so a reader can always inspect a record it found.
+ */
+class IterationRecord
+{
+public:
+  void * volatile function;
+  uint32_t refcount;            /* Pins, only changed with the module locked */
+  volatile uint32_t evicted;
+  volatile uint32_t last_used;  /* The module's use epoch when last looked up */
+
+  IterationRecord() : function(NULL), refcount(0), evicted(0), last_used(0) {};
+
+  /* The function for a lookup from any thread, NULL if the record was
+   * evicted. Takes no reference, and only writes last_used when epoch has
+   * moved on so threads sharing a hot iteration don't fight over its line.
+   */
+  void *use(uint32_t epoch);
+};
+
+class IterationCacheEntry
+{
+public:
+  uint32_t hash;
+  std::string key;
+  IterationRecord *record;
+
+  IterationCacheEntry() : hash(0), record(NULL) {};
+};
+
+/* A hash table of compiled iterations keyed on the exact strings they were
+ * requested with. Lookups take no locks and allocate nothing; inserts must be
+ * serialized by the caller. Entries and tables are only published after they
+ * are fully written, and replaced tables are kept until the cache is destroyed
+ * so a reader racing with a resize still sees valid memory.
+ */
+class IterationCache
+{
+  struct Table
+  {
+    unsigned int mask;
+    IterationCacheEntry * volatile *slots;
+  };
+
+  Table * volatile table;
+  std::vector<Table *> retired_tables;
+  std::vector<IterationCacheEntry *> entries;
+
+  static Table *createTable(unsigned int size);
+  static void destroyTable(Table *t);
+  static void insertIntoTable(Table *t, IterationCacheEntry *entry);
+  static bool keyMatches(const std::string &key, IterationKind kind, const char *function_name,
+                         const char * const *argv, int argc);
+
+public:
+  static uint32_t hashKey(IterationKind kind, const char *function_name, const char * const *argv, int argc);
+
+  IterationCache();
+  ~IterationCache();
+
+  IterationRecord *lookup(uint32_t hash, IterationKind kind, const char *function_name,
+                          const char * const *argv, int argc) const;
+  void insert(uint32_t hash, IterationKind kind, const char *function_name,
+              const char * const *argv, int argc, IterationRecord *record);
+};
+
+#endif /* __JITCACHE_HPP__ */
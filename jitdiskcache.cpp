@@ -0,0 +1,160 @@
+#include "llvm/Bitcode/ReaderWriter.h"
+#if ((LLVM_VERSION_MAJOR > 3) || ((LLVM_VERSION_MAJOR == 3) && (LLVM_VERSION_MINOR >= 3)))
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#else
+#include "llvm/LLVMContext.h"
+#include "llvm/Module.h"
+#endif
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/MutexGuard.h"
+#include "llvm/Support/raw_ostream.h"
+using namespace llvm;
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+using namespace std;
+
+#include "jitdiskcache.h"
+
+static const char CACHE_MAGIC[8] = {'N', 'A', 'N', 'J', 'I', 'T', 'C', '1'};
+
+static sys::Mutex cache_lock;
+static bool cache_directory_set = false;
+static std::string cache_directory;
+static unsigned int cache_temp_counter = 0;
+
+static std::string get_directory()
+{
+  MutexGuard locked(cache_lock);
+
+  if (!cache_directory_set)
+    {
+      const char *env_path = getenv("NANJIT_CACHE_DIR");
+      cache_directory = env_path ? env_path : "";
+      cache_directory_set = true;
+    }
+
+  return cache_directory;
+}
+
+static std::string entry_path(const std::string &directory, const std::string &key)
+{
+  /* 64 bit FNV-1a */
+  uint64_t hash = 14695981039346656037ull;
+  for (std::string::const_iterator iter = key.begin(); iter != key.end(); ++iter)
+    {
+      hash ^= (unsigned char)*iter;
+      hash *= 1099511628211ull;
+    }
+
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.njc", (unsigned long long)hash);
+
+  return directory + "/" + name;
+}
+
+void JitDiskCache::setDirectory(const char *path)
+{
+  MutexGuard locked(cache_lock);
+
+  cache_directory = path ? path : "";
+  cache_directory_set = true;
+}
+
+bool JitDiskCache::isEnabled()
+{
+  return !get_directory().empty();
+}
+
+Module *JitDiskCache::load(const std::string &key, LLVMContext &context)
+{
+  std::string directory = get_directory();
+  if (directory.empty())
+    return NULL;
+
+  FILE *file = fopen(entry_path(directory, key).c_str(), "rb");
+  if (!file)
+    return NULL;
+
+  std::string data;
+  char buffer[4096];
+  size_t count;
+
+  while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    data.append(buffer, count);
+  fclose(file);
+
+  size_t header_size = sizeof(CACHE_MAGIC) + sizeof(uint32_t);
+  if (data.size() < header_size || memcmp(data.data(), CACHE_MAGIC, sizeof(CACHE_MAGIC)))
+    return NULL;
+
+  uint32_t key_size;
+  memcpy(&key_size, data.data() + sizeof(CACHE_MAGIC), sizeof(key_size));
+
+  if (data.size() < header_size + key_size || data.compare(header_size, key_size, key))
+    return NULL;
+
+  StringRef bitcode(data.data() + header_size + key_size, data.size() - header_size - key_size);
+  auto_ptr<MemoryBuffer> bitcode_buffer(MemoryBuffer::getMemBufferCopy(bitcode));
+
+  std::string error;
+  Module *module = ParseBitcodeFile(bitcode_buffer.get(), context, &error);
+
+  if (!module)
+    printf("Ignoring bad code cache entry: %s\n", error.c_str());
+
+  return module;
+}
+
+void JitDiskCache::store(const std::string &key, Module *module)
+{
+  std::string directory = get_directory();
+  if (directory.empty())
+    return;
+
+  std::string bitcode;
+  {
+    raw_string_ostream bitcode_stream(bitcode);
+    WriteBitcodeToFile(module, bitcode_stream);
+  }
+
+  mkdir(directory.c_str(), 0755);
+
+  std::string path = entry_path(directory, key);
+  std::stringstream temp_path;
+  {
+    MutexGuard locked(cache_lock);
+    temp_path << path << "." << getpid() << "." << cache_temp_counter++ << ".tmp";
+  }
+
+  FILE *file = fopen(temp_path.str().c_str(), "wb");
+  if (!file)
+    {
+      printf("Could not write code cache entry %s: %s\n", temp_path.str().c_str(), strerror(errno));
+      return;
+    }
+
+  uint32_t key_size = key.size();
+  bool ok = fwrite(CACHE_MAGIC, sizeof(CACHE_MAGIC), 1, file) == 1;
+  ok = ok && fwrite(&key_size, sizeof(key_size), 1, file) == 1;
+  ok = ok && fwrite(key.data(), 1, key.size(), file) == key.size();
+  ok = ok && fwrite(bitcode.data(), 1, bitcode.size(), file) == bitcode.size();
+  ok = (fclose(file) == 0) && ok;
+
+  /* rename() replaces any existing entry atomically */
+  if (!ok || rename(temp_path.str().c_str(), path.c_str()))
+    {
+      printf("Could not write code cache entry %s: %s\n", path.c_str(), strerror(errno));
+      unlink(temp_path.str().c_str());
+    }
+}
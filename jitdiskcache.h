@@ -0,0 +1,35 @@
+#ifndef __JITDISKCACHE_HPP__
+#define __JITDISKCACHE_HPP__
+
+#include <string>
+
+namespace llvm {
+  class Module;
+  class LLVMContext;
+}
+
+/* Bump whenever the code generated for a given source and signature changes,
+ * entries written by other versions are then never matched.
+ */
+#define NANJIT_CODE_CACHE_VERSION 5
+
+/* A directory of optimized bitcode shared between processes. Entries are
+ * named after a hash of their key and store the full key, so a hash collision
+ * is just a miss. Entries are written to a temporary file and renamed into
+ * place so a concurrent reader sees either the whole entry or none of it.
+ */
+class JitDiskCache
+{
+public:
+  /* NULL or "" disables the cache. Until this is called the directory is
+   * taken from the NANJIT_CACHE_DIR environment variable.
+   */
+  static void setDirectory(const char *path);
+  static bool isEnabled();
+
+  /* Returns NULL if there is no valid entry for key */
+  static llvm::Module *load(const std::string &key, llvm::LLVMContext &context);
+  static void store(const std::string &key, llvm::Module *module);
+};
+
+#endif /* __JITDISKCACHE_HPP__ */
@@ -0,0 +1,167 @@
+#include <cstring>
+#include <map>
+#include <string>
+#include <pthread.h>
+#include <stdint.h>
+using namespace std;
+
+#include "jitintern.h"
+
+class JitInternEntry
+{
+public:
+  uint64_t hash;
+  unsigned int flags;
+  JitModuleOptions options;
+  std::string target;
+  std::string source;
+  JitModule *module;
+  int refcount;
+};
+
+typedef std::multimap<uint64_t, JitInternEntry *> JitInternHashMap;
+typedef std::map<JitModule *, JitInternEntry *> JitInternModuleMap;
+
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+static JitInternHashMap interned_by_hash;
+static JitInternModuleMap interned_by_module;
+
+static uint64_t hash_source(const char *source, unsigned int flags, const JitModuleOptions &options,
+                            const std::string &target)
+{
+  /* 64 bit FNV-1a */
+  uint64_t hash = 14695981039346656037ull;
+
+  for (const char *c = source; *c; ++c)
+    {
+      hash ^= (unsigned char)*c;
+      hash *= 1099511628211ull;
+    }
+
+  hash ^= flags;
+  hash *= 1099511628211ull;
+
+  for (size_t i = 0; i < sizeof(options); ++i)
+    {
+      hash ^= ((const unsigned char *)&options)[i];
+      hash *= 1099511628211ull;
+    }
+
+  for (std::string::const_iterator c = target.begin(); c != target.end(); ++c)
+    {
+      hash ^= (unsigned char)*c;
+      hash *= 1099511628211ull;
+    }
+
+  return hash;
+}
+
+/* Must be called with intern_lock held */
+static JitInternEntry *find_entry(uint64_t hash, const char *source, unsigned int flags, const JitModuleOptions &options,
+                                  const std::string &target)
+{
+  std::pair<JitInternHashMap::iterator, JitInternHashMap::iterator> range = interned_by_hash.equal_range(hash);
+
+  for (JitInternHashMap::iterator iter = range.first; iter != range.second; ++iter)
+    {
+      JitInternEntry *entry = iter->second;
+      if (entry->flags == flags && !memcmp(&entry->options, &options, sizeof(options)) &&
+          entry->target == target && entry->source == source)
+        return entry;
+    }
+
+  return NULL;
+}
+
+JitModule *JitModuleInternTable::acquire(const char *source, unsigned int flags, const JitModuleOptions &options)
+{
+  /* Modules built before a jit_set_target call keep their old target */
+  std::string target = JitModule::targetKey();
+  uint64_t hash = hash_source(source, flags, options, target);
+
+  pthread_mutex_lock(&intern_lock);
+  JitInternEntry *entry = find_entry(hash, source, flags, options, target);
+  if (entry)
+    entry->refcount++;
+  pthread_mutex_unlock(&intern_lock);
+
+  if (entry)
+    return entry->module;
+
+  /* Build the module without holding the lock so unrelated modules can still
+   * be created in parallel, if another thread wins the race its module is used.
+   */
+  JitModule *module = new JitModule(source, flags, &options);
+
+  pthread_mutex_lock(&intern_lock);
+  entry = find_entry(hash, source, flags, options, target);
+  if (entry)
+    entry->refcount++;
+  else
+    {
+      entry = new JitInternEntry();
+      entry->hash = hash;
+      entry->flags = flags;
+      entry->options = options;
+      entry->target = target;
+      entry->source = source;
+      entry->module = module;
+      entry->refcount = 1;
+
+      interned_by_hash.insert(std::make_pair(hash, entry));
+      interned_by_module[module] = entry;
+    }
+  pthread_mutex_unlock(&intern_lock);
+
+  if (entry->module != module)
+    delete module;
+
+  return entry->module;
+}
+
+JitModule *JitModuleInternTable::addRef(JitModule *module)
+{
+  pthread_mutex_lock(&intern_lock);
+  JitInternModuleMap::iterator iter = interned_by_module.find(module);
+  if (iter != interned_by_module.end())
+    iter->second->refcount++;
+  pthread_mutex_unlock(&intern_lock);
+
+  return module;
+}
+
+void JitModuleInternTable::release(JitModule *module)
+{
+  bool destroy = true;
+
+  pthread_mutex_lock(&intern_lock);
+
+  JitInternModuleMap::iterator iter = interned_by_module.find(module);
+  if (iter != interned_by_module.end())
+    {
+      JitInternEntry *entry = iter->second;
+
+      if (--entry->refcount > 0)
+        destroy = false;
+      else
+        {
+          std::pair<JitInternHashMap::iterator, JitInternHashMap::iterator> range;
+          range = interned_by_hash.equal_range(entry->hash);
+
+          for (JitInternHashMap::iterator hash_iter = range.first; hash_iter != range.second; ++hash_iter)
+            if (hash_iter->second == entry)
+              {
+                interned_by_hash.erase(hash_iter);
+                break;
+              }
+
+          interned_by_module.erase(iter);
+          delete entry;
+        }
+    }
+
+  pthread_mutex_unlock(&intern_lock);
+
+  if (destroy)
+    delete module;
+}
@@ -0,0 +1,22 @@
+#ifndef __JITINTERN_HPP__
+#define __JITINTERN_HPP__
+
+#include <string>
+
+#include "jitmodule.h"
+
+/* Process wide table of the modules returned by jit_module_for_src, so
+ * identical source compiled with the same flags and options shares one
+ * JitModule and its compiled iterations. Shared modules are reference counted.
+ */
+class JitModuleInternTable
+{
+public:
+  /* Returns a new reference, throws like the JitModule constructor */
+  static JitModule *acquire(const char *source, unsigned int flags, const JitModuleOptions &options);
+  static JitModule *addRef(JitModule *module);
+  /* Drops a reference, modules that were never interned are deleted */
+  static void release(JitModule *module);
+};
+
+#endif /* __JITINTERN_HPP__ */
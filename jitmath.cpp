@@ -0,0 +1,669 @@
+#include "llvm/Config/config.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Target/TargetLowering.h"
+#include "llvm/Target/TargetMachine.h"
+#if ((LLVM_VERSION_MAJOR > 3) || ((LLVM_VERSION_MAJOR == 3) && (LLVM_VERSION_MINOR >= 3)))
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Module.h"
+#else
+#include "llvm/Constants.h"
+#include "llvm/IRBuilder.h"
+#include "llvm/Instructions.h"
+#include "llvm/IntrinsicInst.h"
+#include "llvm/Intrinsics.h"
+#include "llvm/Module.h"
+#endif
+using namespace llvm;
+
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "jitmath.h"
+#include "jitmodule.h"
+
+/* Apply one of the SSE estimate intrinsics to a float or a float vector of
+ * any width, the packed form works on 4 lanes and the scalar form on lane 0.
+ */
+static Value *build_estimate(IRBuilder<> &builder, Intrinsic::ID packed, Intrinsic::ID scalar, Value *value)
+{
+  Module *module = builder.GetInsertBlock()->getParent()->getParent();
+  Type *type = value->getType();
+  Type *chunk_type = VectorType::get(builder.getFloatTy(), 4);
+
+  if (!type->isVectorTy())
+    {
+      Function *estimate = Intrinsic::getDeclaration(module, scalar);
+      Value *chunk = builder.CreateInsertElement(UndefValue::get(chunk_type), value, builder.getInt32(0));
+      return builder.CreateExtractElement(builder.CreateCall(estimate, chunk), builder.getInt32(0));
+    }
+
+  Function *estimate = Intrinsic::getDeclaration(module, packed);
+  unsigned int width = cast<VectorType>(type)->getNumElements();
+
+  if (width == 4)
+    return builder.CreateCall(estimate, value);
+
+  /* Other widths go 4 lanes at a time, lanes past the end are estimated for
+   * 1.0 and thrown away.
+   */
+  Value *padding = ConstantFP::get(type, 1.0);
+  Value *result = UndefValue::get(type);
+
+  for (unsigned int base = 0; base < width; base += 4)
+    {
+      Constant *mask[4];
+      for (unsigned int i = 0; i < 4; ++i)
+        mask[i] = builder.getInt32((base + i < width) ? base + i : width);
+
+      Value *chunk = builder.CreateShuffleVector(value, padding, ConstantVector::get(mask));
+      chunk = builder.CreateCall(estimate, chunk);
+
+      for (unsigned int i = 0; (i < 4) && (base + i < width); ++i)
+        result = builder.CreateInsertElement(result, builder.CreateExtractElement(chunk, builder.getInt32(i)),
+                                             builder.getInt32(base + i));
+    }
+
+  return result;
+}
+
+/* 1 / sqrt(x), a Newton-Raphson step takes the estimate from 12 to 22 bits */
+static Value *build_rsqrt(IRBuilder<> &builder, Value *x, bool refine)
+{
+  Value *estimate = build_estimate(builder, Intrinsic::x86_sse_rsqrt_ps, Intrinsic::x86_sse_rsqrt_ss, x);
+
+  if (!refine)
+    return estimate;
+
+  Type *type = x->getType();
+  Value *half_x = builder.CreateFMul(x, ConstantFP::get(type, 0.5));
+  Value *error = builder.CreateFMul(half_x, builder.CreateFMul(estimate, estimate));
+
+  return builder.CreateFMul(estimate, builder.CreateFSub(ConstantFP::get(type, 1.5), error));
+}
+
+/* 1 / y, refined the same way as build_rsqrt */
+static Value *build_recip(IRBuilder<> &builder, Value *y, bool refine)
+{
+  Value *estimate = build_estimate(builder, Intrinsic::x86_sse_rcp_ps, Intrinsic::x86_sse_rcp_ss, y);
+
+  if (!refine)
+    return estimate;
+
+  Type *type = y->getType();
+  Value *error = builder.CreateFMul(y, estimate);
+
+  return builder.CreateFMul(estimate, builder.CreateFSub(ConstantFP::get(type, 2.0), error));
+}
+
+/* Constants and types shaped like a float or float vector type */
+static Type *int_type_for(Type *type)
+{
+  Type *int_type = Type::getInt32Ty(type->getContext());
+
+  if (VectorType *vector_type = dyn_cast<VectorType>(type))
+    return VectorType::get(int_type, vector_type->getNumElements());
+  return int_type;
+}
+
+static Type *double_type_for(Type *type)
+{
+  Type *double_type = Type::getDoubleTy(type->getContext());
+
+  if (VectorType *vector_type = dyn_cast<VectorType>(type))
+    return VectorType::get(double_type, vector_type->getNumElements());
+  return double_type;
+}
+
+static Constant *int_splat(Type *type, int value)
+{
+  return ConstantInt::get(int_type_for(type), (uint64_t)(int64_t)value, true);
+}
+
+static Constant *build_infinity(Type *type, bool negative = false)
+{
+  return ConstantFP::get(type, negative ? -std::numeric_limits<double>::infinity()
+                                        : std::numeric_limits<double>::infinity());
+}
+
+static Constant *build_nan(Type *type)
+{
+  return ConstantFP::get(type, std::numeric_limits<double>::quiet_NaN());
+}
+
+static Value *build_bits(IRBuilder<> &builder, Value *x)
+{
+  return builder.CreateBitCast(x, int_type_for(x->getType()));
+}
+
+static Value *build_fabs(IRBuilder<> &builder, Value *x)
+{
+  Value *bits = builder.CreateAnd(build_bits(builder, x), int_splat(x->getType(), 0x7fffffff));
+  return builder.CreateBitCast(bits, x->getType());
+}
+
+/* Horner's rule, coeffs start with the highest power */
+static Value *build_poly(IRBuilder<> &builder, Value *x, const double *coeffs, int count)
+{
+  Type *type = x->getType();
+  Value *result = ConstantFP::get(type, coeffs[0]);
+
+  for (int i = 1; i < count; ++i)
+    result = builder.CreateFAdd(builder.CreateFMul(result, x), ConstantFP::get(type, coeffs[i]));
+
+  return result;
+}
+
+/* NaNs pass through */
+static Value *build_clamp(IRBuilder<> &builder, Value *x, double low, double high)
+{
+  Constant *low_value = ConstantFP::get(x->getType(), low);
+  Constant *high_value = ConstantFP::get(x->getType(), high);
+
+  x = builder.CreateSelect(builder.CreateFCmpOLT(x, low_value), low_value, x);
+  return builder.CreateSelect(builder.CreateFCmpOGT(x, high_value), high_value, x);
+}
+
+/* floor() for values that fit in an int */
+static Value *build_floor(IRBuilder<> &builder, Value *x)
+{
+  Type *type = x->getType();
+  Value *truncated = builder.CreateSIToFP(builder.CreateFPToSI(x, int_type_for(type)), type);
+  Value *adjusted = builder.CreateFSub(truncated, ConstantFP::get(type, 1.0));
+
+  return builder.CreateSelect(builder.CreateFCmpOGT(truncated, x), adjusted, truncated);
+}
+
+/* x * 2^n for n in [-252, 254], in two steps so both the largest results
+ * and denormals come out right.
+ */
+static Value *build_scale(IRBuilder<> &builder, Value *x, Value *n)
+{
+  Type *type = x->getType();
+  Value *n1 = builder.CreateAShr(n, int_splat(type, 1));
+  Value *n2 = builder.CreateSub(n, n1);
+  Value *scale1 = builder.CreateShl(builder.CreateAdd(n1, int_splat(type, 127)), int_splat(type, 23));
+  Value *scale2 = builder.CreateShl(builder.CreateAdd(n2, int_splat(type, 127)), int_splat(type, 23));
+
+  x = builder.CreateFMul(x, builder.CreateBitCast(scale1, type));
+  return builder.CreateFMul(x, builder.CreateBitCast(scale2, type));
+}
+
+/* 2^x on [-0.5, 0.5] */
+static const double EXP2_COEFFS[] = {
+  1.535336188319500e-4,
+  1.339887440266574e-3,
+  9.618437357674640e-3,
+  5.550332471162809e-2,
+  2.402264791363012e-1,
+  6.931472028550421e-1,
+  1.0
+};
+
+/* (e^x - 1 - x) / x^2 on [-ln(2)/2, ln(2)/2] */
+static const double EXP_COEFFS[] = {
+  1.9875691500e-4,
+  1.3981999507e-3,
+  8.3334519073e-3,
+  4.1665795894e-2,
+  1.6666665459e-1,
+  5.0000001201e-1
+};
+
+/* (ln(1 + x) - x + x^2 / 2) / x^3 on [sqrt(0.5) - 1, sqrt(2) - 1] */
+static const double LOG_COEFFS[] = {
+  7.0376836292e-2,
+  -1.1514610310e-1,
+  1.1676998740e-1,
+  -1.2420140846e-1,
+  1.4249322787e-1,
+  -1.6668057665e-1,
+  2.0000714765e-1,
+  -2.4999993993e-1,
+  3.3333331174e-1
+};
+
+/* 2 * atanh(s) / s as a series in s^2, s = (m - 1) / (m + 1) is at most
+ * 0.172 so the terms left off are below 2^-44.
+ */
+static const double ATANH_COEFFS[] = {
+  2.0 / 15.0,
+  2.0 / 13.0,
+  2.0 / 11.0,
+  2.0 / 9.0,
+  2.0 / 7.0,
+  2.0 / 5.0,
+  2.0 / 3.0,
+  2.0
+};
+
+static const double SIN_COEFFS[] = {
+  -1.9515295891e-4,
+  8.3321608736e-3,
+  -1.6666654611e-1
+};
+
+static const double COS_COEFFS[] = {
+  2.443315711809948e-5,
+  -1.388731625493765e-3,
+  4.166664568298827e-2
+};
+
+#define LOG2E        1.4426950408889634074
+#define LN2_HIGH     0.693359375
+#define LN2_LOW      -2.12194440e-4
+#define SQRT_HALF    0.707106781186547524
+#define FLT_MIN_NORM 1.17549435e-38
+/* pi / 4 split so that j * PI_4_HIGH is exact in a double for j < 2^21 */
+#define PI_4_HIGH    0.7853981633670628
+#define PI_4_LOW     3.038550253253096e-11
+#define FOUR_OVER_PI 1.2732395447351627
+
+/* The float result of 2^x, x may be a float or a double and is already
+ * clamped to [-151, 129].
+ */
+static Value *build_exp2_core(IRBuilder<> &builder, Value *x, Type *type)
+{
+  Value *n = build_floor(builder, builder.CreateFAdd(x, ConstantFP::get(x->getType(), 0.5)));
+  Value *fraction = builder.CreateFPTrunc(builder.CreateFSub(x, n), type);
+  Value *result = build_poly(builder, fraction, EXP2_COEFFS, 7);
+
+  return build_scale(builder, result, builder.CreateFPToSI(n, int_type_for(type)));
+}
+
+static Value *build_exp2(IRBuilder<> &builder, Value *const *args)
+{
+  Value *x = args[0];
+  Value *result = build_exp2_core(builder, build_clamp(builder, x, -151.0, 129.0), x->getType());
+
+  return builder.CreateSelect(builder.CreateFCmpUNO(x, x), x, result);
+}
+
+static Value *build_exp(IRBuilder<> &builder, Value *const *args)
+{
+  Value *x = args[0];
+  Type *type = x->getType();
+  Value *clamped = build_clamp(builder, x, -104.0, 89.0);
+  Value *n = build_floor(builder, builder.CreateFAdd(builder.CreateFMul(clamped, ConstantFP::get(type, LOG2E)),
+                                                     ConstantFP::get(type, 0.5)));
+
+  /* Cody-Waite reduction, n * LN2_HIGH is exact */
+  Value *r = builder.CreateFSub(clamped, builder.CreateFMul(n, ConstantFP::get(type, LN2_HIGH)));
+  r = builder.CreateFSub(r, builder.CreateFMul(n, ConstantFP::get(type, LN2_LOW)));
+
+  Value *result = build_poly(builder, r, EXP_COEFFS, 6);
+  result = builder.CreateFMul(result, builder.CreateFMul(r, r));
+  result = builder.CreateFAdd(builder.CreateFAdd(result, r), ConstantFP::get(type, 1.0));
+  result = build_scale(builder, result, builder.CreateFPToSI(n, int_type_for(type)));
+
+  return builder.CreateSelect(builder.CreateFCmpUNO(x, x), x, result);
+}
+
+/* Split a positive x into a mantissa in [sqrt(0.5), sqrt(2)) and an exponent */
+static void build_log_split(IRBuilder<> &builder, Value *x, Value *&mantissa, Value *&exponent)
+{
+  Type *type = x->getType();
+  Value *denormal = builder.CreateFCmpOLT(x, ConstantFP::get(type, FLT_MIN_NORM));
+  Value *normal = builder.CreateSelect(denormal, builder.CreateFMul(x, ConstantFP::get(type, 8388608.0)), x);
+  Value *bits = build_bits(builder, normal);
+
+  Value *exponent_bits = builder.CreateAnd(builder.CreateLShr(bits, int_splat(type, 23)), int_splat(type, 0xff));
+  Value *bias = builder.CreateSelect(denormal, int_splat(type, 126 + 23), int_splat(type, 126));
+  Value *exponent_int = builder.CreateSub(exponent_bits, bias);
+
+  Value *mantissa_bits = builder.CreateOr(builder.CreateAnd(bits, int_splat(type, 0x807fffff)),
+                                          int_splat(type, 0x3f000000));
+  mantissa = builder.CreateBitCast(mantissa_bits, type);
+
+  Value *low = builder.CreateFCmpOLT(mantissa, ConstantFP::get(type, SQRT_HALF));
+  mantissa = builder.CreateSelect(low, builder.CreateFAdd(mantissa, mantissa), mantissa);
+  exponent_int = builder.CreateSelect(low, builder.CreateSub(exponent_int, int_splat(type, 1)), exponent_int);
+  exponent = builder.CreateSIToFP(exponent_int, type);
+}
+
+/* log(0) is -inf, negative numbers give NaN, inf and NaN pass through */
+static Value *build_log_special(IRBuilder<> &builder, Value *x, Value *result)
+{
+  Type *type = result->getType();
+  Type *x_type = x->getType();
+
+  result = builder.CreateSelect(builder.CreateFCmpOEQ(x, ConstantFP::get(x_type, 0.0)),
+                                build_infinity(type, true), result);
+  result = builder.CreateSelect(builder.CreateFCmpOLT(x, ConstantFP::get(x_type, 0.0)),
+                                build_nan(type), result);
+  result = builder.CreateSelect(builder.CreateFCmpOEQ(x, build_infinity(x_type)),
+                                build_infinity(type), result);
+  return builder.CreateSelect(builder.CreateFCmpUNO(x, x), build_nan(type), result);
+}
+
+/* Sets m to mantissa - 1 and z to m^2, returns the part of ln(mantissa)
+ * past m - z / 2.
+ */
+static Value *build_log_poly(IRBuilder<> &builder, Value *mantissa, Value *&m, Value *&z)
+{
+  m = builder.CreateFSub(mantissa, ConstantFP::get(mantissa->getType(), 1.0));
+  z = builder.CreateFMul(m, m);
+
+  return builder.CreateFMul(builder.CreateFMul(build_poly(builder, m, LOG_COEFFS, 9), m), z);
+}
+
+static Value *build_log(IRBuilder<> &builder, Value *const *args)
+{
+  Value *x = args[0];
+  Type *type = x->getType();
+  Value *mantissa, *exponent, *m, *z;
+
+  build_log_split(builder, x, mantissa, exponent);
+  Value *y = build_log_poly(builder, mantissa, m, z);
+  y = builder.CreateFAdd(y, builder.CreateFMul(exponent, ConstantFP::get(type, LN2_LOW)));
+  y = builder.CreateFSub(y, builder.CreateFMul(z, ConstantFP::get(type, 0.5)));
+
+  Value *result = builder.CreateFAdd(m, y);
+  result = builder.CreateFAdd(result, builder.CreateFMul(exponent, ConstantFP::get(type, LN2_HIGH)));
+
+  return build_log_special(builder, x, result);
+}
+
+static Value *build_log2(IRBuilder<> &builder, Value *const *args)
+{
+  Value *x = args[0];
+  Type *type = x->getType();
+  Value *mantissa, *exponent, *m, *z;
+
+  build_log_split(builder, x, mantissa, exponent);
+  Value *y = build_log_poly(builder, mantissa, m, z);
+  y = builder.CreateFSub(y, builder.CreateFMul(z, ConstantFP::get(type, 0.5)));
+
+  /* log2(e) - 1, the rest of log2(e) is added exactly as y + m */
+  Constant *log2e_fraction = ConstantFP::get(type, LOG2E - 1.0);
+  Value *result = builder.CreateFMul(y, log2e_fraction);
+  result = builder.CreateFAdd(result, builder.CreateFMul(m, log2e_fraction));
+  result = builder.CreateFAdd(result, y);
+  result = builder.CreateFAdd(result, m);
+  result = builder.CreateFAdd(result, exponent);
+
+  return build_log_special(builder, x, result);
+}
+
+/* log2 of a float as a double, accurate enough that multiplying it by a
+ * float exponent doesn't lose the float result's precision.
+ */
+static Value *build_log2_wide(IRBuilder<> &builder, Value *x)
+{
+  Type *wide_type = double_type_for(x->getType());
+  Value *mantissa, *exponent;
+
+  build_log_split(builder, x, mantissa, exponent);
+
+  Value *m = builder.CreateFPExt(mantissa, wide_type);
+  Constant *one = ConstantFP::get(wide_type, 1.0);
+  Value *s = builder.CreateFDiv(builder.CreateFSub(m, one), builder.CreateFAdd(m, one));
+  Value *series = build_poly(builder, builder.CreateFMul(s, s), ATANH_COEFFS, 8);
+
+  Value *result = builder.CreateFMul(builder.CreateFMul(series, s), ConstantFP::get(wide_type, LOG2E));
+  result = builder.CreateFAdd(result, builder.CreateFPExt(exponent, wide_type));
+
+  return build_log_special(builder, x, result);
+}
+
+/* x^y for x >= 0, without the special cases pow and powr add */
+static Value *build_pow_core(IRBuilder<> &builder, Value *x, Value *y)
+{
+  Type *wide_type = double_type_for(x->getType());
+  Value *exponent = builder.CreateFMul(builder.CreateFPExt(y, wide_type), build_log2_wide(builder, x));
+  Value *result = build_exp2_core(builder, build_clamp(builder, exponent, -151.0, 129.0), x->getType());
+
+  result = builder.CreateSelect(builder.CreateFCmpUNO(exponent, exponent), build_nan(x->getType()), result);
+
+  /* x^0 and 1^y are always 1 */
+  Value *trivial = builder.CreateOr(builder.CreateFCmpOEQ(y, ConstantFP::get(y->getType(), 0.0)),
+                                    builder.CreateFCmpOEQ(x, ConstantFP::get(x->getType(), 1.0)));
+  return builder.CreateSelect(trivial, ConstantFP::get(x->getType(), 1.0), result);
+}
+
+/* Negative x are only defined for powr as NaN */
+static Value *build_powr(IRBuilder<> &builder, Value *const *args)
+{
+  Value *x = args[0];
+  Value *result = build_pow_core(builder, x, args[1]);
+
+  return builder.CreateSelect(builder.CreateFCmpOLT(x, ConstantFP::get(x->getType(), 0.0)),
+                              build_nan(x->getType()), result);
+}
+
+/* Negative x work for integer y, the result is negative when y is odd */
+static Value *build_pow(IRBuilder<> &builder, Value *const *args)
+{
+  Value *x = args[0];
+  Value *y = args[1];
+  Type *type = x->getType();
+  Value *result = build_pow_core(builder, build_fabs(builder, x), y);
+
+  /* Every float from 2^24 up is an even integer */
+  Value *huge = builder.CreateFCmpOGE(build_fabs(builder, y), ConstantFP::get(type, 16777216.0));
+  Value *y_int = builder.CreateFPToSI(y, int_type_for(type));
+  Value *is_int = builder.CreateOr(huge, builder.CreateFCmpOEQ(builder.CreateSIToFP(y_int, type), y));
+  Value *odd_bit = builder.CreateAnd(y_int, int_splat(type, 1));
+  Value *odd = builder.CreateAnd(builder.CreateNot(huge), builder.CreateICmpNE(odd_bit, int_splat(type, 0)));
+
+  Value *negative = builder.CreateICmpSLT(build_bits(builder, x), int_splat(type, 0));
+  Value *negated = builder.CreateFSub(ConstantFP::getNegativeZero(type), result);
+
+  result = builder.CreateSelect(builder.CreateAnd(negative, odd), negated, result);
+  Value *undefined = builder.CreateAnd(builder.CreateFCmpOLT(x, ConstantFP::get(type, 0.0)), builder.CreateNot(is_int));
+  return builder.CreateSelect(undefined, build_nan(type), result);
+}
+
+/* sin and cos share their reduction to [-pi/4, pi/4], done in double so it
+ * stays exact for |x| up to 2^20.
+ */
+static Value *build_sin_cos(IRBuilder<> &builder, Value *x, bool cosine)
+{
+  Type *type = x->getType();
+  Type *wide_type = double_type_for(type);
+  Value *abs_x = build_fabs(builder, x);
+  Value *wide_x = builder.CreateFPExt(abs_x, wide_type);
+
+  /* The octant, rounded up to even */
+  Value *j = builder.CreateFPToSI(builder.CreateFMul(wide_x, ConstantFP::get(wide_type, FOUR_OVER_PI)), int_type_for(type));
+  j = builder.CreateAnd(builder.CreateAdd(j, int_splat(type, 1)), int_splat(type, ~1));
+  Value *wide_j = builder.CreateSIToFP(j, wide_type);
+
+  Value *r = builder.CreateFSub(wide_x, builder.CreateFMul(wide_j, ConstantFP::get(wide_type, PI_4_HIGH)));
+  r = builder.CreateFSub(r, builder.CreateFMul(wide_j, ConstantFP::get(wide_type, PI_4_LOW)));
+  r = builder.CreateFPTrunc(r, type);
+
+  Value *z = builder.CreateFMul(r, r);
+  Value *sin_result = builder.CreateFMul(builder.CreateFMul(build_poly(builder, z, SIN_COEFFS, 3), z), r);
+  sin_result = builder.CreateFAdd(sin_result, r);
+  Value *cos_result = builder.CreateFMul(builder.CreateFMul(build_poly(builder, z, COS_COEFFS, 3), z), z);
+  cos_result = builder.CreateFSub(cos_result, builder.CreateFMul(z, ConstantFP::get(type, 0.5)));
+  cos_result = builder.CreateFAdd(cos_result, ConstantFP::get(type, 1.0));
+
+  /* cos(x) is sin(x + pi/2), two octants on */
+  if (cosine)
+    j = builder.CreateAdd(j, int_splat(type, 2));
+
+  Value *use_cos = builder.CreateICmpNE(builder.CreateAnd(j, int_splat(type, 2)), int_splat(type, 0));
+  Value *result = builder.CreateSelect(use_cos, cos_result, sin_result);
+
+  /* The lower half of the circle is negative, and sin is odd */
+  Value *sign = builder.CreateShl(builder.CreateAnd(j, int_splat(type, 4)), int_splat(type, 29));
+  if (!cosine)
+    sign = builder.CreateXor(sign, builder.CreateAnd(build_bits(builder, x), int_splat(type, 0x80000000)));
+  result = builder.CreateBitCast(builder.CreateXor(build_bits(builder, result), sign), type);
+
+  return builder.CreateSelect(builder.CreateFCmpUGE(abs_x, build_infinity(type)),
+                              build_nan(type), result);
+}
+
+static Value *build_sin(IRBuilder<> &builder, Value *const *args)
+{
+  return build_sin_cos(builder, args[0], false);
+}
+
+static Value *build_cos(IRBuilder<> &builder, Value *const *args)
+{
+  return build_sin_cos(builder, args[0], true);
+}
+
+/* x + (y - x) * a */
+static Value *build_mix(IRBuilder<> &builder, Value *const *args)
+{
+  return builder.CreateFAdd(args[0], builder.CreateFMul(builder.CreateFSub(args[1], args[0]), args[2]));
+}
+
+/* 0 if x < edge, else 1 */
+static Value *build_step(IRBuilder<> &builder, Value *const *args)
+{
+  Type *type = args[1]->getType();
+
+  return builder.CreateSelect(builder.CreateFCmpOLT(args[1], args[0]),
+                              ConstantFP::get(type, 0.0), ConstantFP::get(type, 1.0));
+}
+
+/* Hermite interpolation from 0 at edge0 to 1 at edge1 */
+static Value *build_smoothstep(IRBuilder<> &builder, Value *const *args)
+{
+  Type *type = args[2]->getType();
+  Value *t = builder.CreateFDiv(builder.CreateFSub(args[2], args[0]), builder.CreateFSub(args[1], args[0]));
+  t = build_clamp(builder, t, 0.0, 1.0);
+
+  Value *shape = builder.CreateFSub(ConstantFP::get(type, 3.0), builder.CreateFMul(t, ConstantFP::get(type, 2.0)));
+  return builder.CreateFMul(builder.CreateFMul(t, t), shape);
+}
+
+/* a * b + c, the code generator may fuse it when fast math allows */
+static Value *build_mad(IRBuilder<> &builder, Value *const *args)
+{
+  return builder.CreateFAdd(builder.CreateFMul(args[0], args[1]), args[2]);
+}
+
+/* a * b + c with a single rounding. The product of two floats is exact as a
+ * double, so only the sum is rounded twice.
+ */
+static Value *build_fma(IRBuilder<> &builder, Value *const *args)
+{
+  Type *type = args[0]->getType();
+  Type *wide_type = double_type_for(type);
+  Value *product = builder.CreateFMul(builder.CreateFPExt(args[0], wide_type), builder.CreateFPExt(args[1], wide_type));
+
+  return builder.CreateFPTrunc(builder.CreateFAdd(product, builder.CreateFPExt(args[2], wide_type)), type);
+}
+
+struct MathBuiltin
+{
+  const char *name;
+  int arg_count;
+  Value *(*build)(IRBuilder<> &builder, Value *const *args);
+};
+
+static const MathBuiltin MATH_BUILTINS[] = {
+  { "exp",        1, build_exp },
+  { "exp2",       1, build_exp2 },
+  { "log",        1, build_log },
+  { "log2",       1, build_log2 },
+  { "pow",        2, build_pow },
+  { "powr",       2, build_powr },
+  { "sin",        1, build_sin },
+  { "cos",        1, build_cos },
+  { "mix",        3, build_mix },
+  { "step",       2, build_step },
+  { "smoothstep", 3, build_smoothstep },
+  { "mad",        3, build_mad },
+  { "fma",        3, build_fma },
+};
+
+static const MathBuiltin *find_math_builtin(const std::string &name)
+{
+  for (size_t i = 0; i < sizeof(MATH_BUILTINS) / sizeof(MATH_BUILTINS[0]); ++i)
+    if (name == MATH_BUILTINS[i].name)
+      return &MATH_BUILTINS[i];
+  return NULL;
+}
+
+int math_builtin_arg_count(const std::string &name)
+{
+  const MathBuiltin *builtin = find_math_builtin(name);
+
+  return builtin ? builtin->arg_count : -1;
+}
+
+Value *build_math_builtin(IRBuilder<> &builder, const std::string &name, const std::vector<Value *> &args)
+{
+  const MathBuiltin *builtin = find_math_builtin(name);
+
+  if (!builtin || (args.size() != (size_t)builtin->arg_count))
+    return NULL;
+
+  return builtin->build(builder, &args[0]);
+}
+
+void lower_division(Module *module, TargetMachine *target_machine, unsigned int precision)
+{
+  Triple triple(target_machine->getTargetTriple());
+
+  if ((triple.getArch() != Triple::x86) && (triple.getArch() != Triple::x86_64))
+    return;
+
+  /* The estimates live in SSE registers, which a CPU without SSE or
+   * features like "-sse" leave out.
+   */
+  const TargetLowering *lowering = target_machine->getTargetLowering();
+  if (!lowering || !lowering->isTypeLegal(MVT::v4f32))
+    return;
+
+  std::vector<BinaryOperator *> divisions;
+
+  for (Module::iterator func = module->begin(); func != module->end(); ++func)
+    for (Function::iterator block = func->begin(); block != func->end(); ++block)
+      for (BasicBlock::iterator inst = block->begin(); inst != block->end(); ++inst)
+        {
+          BinaryOperator *division = dyn_cast<BinaryOperator>(inst);
+
+          if (division && (division->getOpcode() == Instruction::FDiv) &&
+              division->getType()->getScalarType()->isFloatTy())
+            divisions.push_back(division);
+        }
+
+  for (std::vector<BinaryOperator *>::iterator iter = divisions.begin(); iter != divisions.end(); ++iter)
+    {
+      BinaryOperator *division = *iter;
+      bool refine;
+
+      if (division->getMetadata(NANJIT_NATIVE_METADATA))
+        refine = false;
+      else if (precision == JIT_DIVISION_22_BIT)
+        refine = true;
+      else if (precision == JIT_DIVISION_12_BIT)
+        refine = false;
+      else
+        continue;
+
+      IRBuilder<> builder(division);
+      Value *numerator = division->getOperand(0);
+      Value *divisor = division->getOperand(1);
+      IntrinsicInst *root = dyn_cast<IntrinsicInst>(divisor);
+      Value *result;
+
+      if (root && (root->getIntrinsicID() == Intrinsic::sqrt))
+        result = build_rsqrt(builder, root->getArgOperand(0), refine);
+      else
+        result = build_recip(builder, divisor, refine);
+
+      if (numerator != ConstantFP::get(division->getType(), 1.0))
+        result = builder.CreateFMul(numerator, result);
+
+      result->takeName(division);
+      division->replaceAllUsesWith(result);
+      division->eraseFromParent();
+
+      if (root && root->use_empty())
+        root->eraseFromParent();
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef __JITMATH_HPP__
+#define __JITMATH_HPP__
+
+#include "llvm/Config/config.h"
+#if ((LLVM_VERSION_MAJOR > 3) || ((LLVM_VERSION_MAJOR == 3) && (LLVM_VERSION_MINOR >= 3)))
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#else
+#include "llvm/IRBuilder.h"
+#include "llvm/Module.h"
+#endif
+
+#include <string>
+#include <vector>
+
+namespace llvm {
+  class TargetMachine;
+}
+
+/* The number of arguments the math builtin name takes, or -1 if there is no
+ * such builtin.
+ */
+int math_builtin_arg_count(const std::string &name);
+
+/* Emit the math builtin name inline at the builder's insert point. args are
+ * floats or float vectors all of the same type, which is also the result's
+ * type. Everything is done with vector arithmetic and selects, nothing calls
+ * out to libm, see the README for the accuracy of each builtin.
+ */
+llvm::Value *build_math_builtin(llvm::IRBuilder<> &builder, const std::string &name,
+                                const std::vector<llvm::Value *> &args);
+
+/* Replace float divisions in module with a hardware reciprocal estimate
+ * refined to the given JitDivisionPrecision. Divisions from the native_*
+ * builtins always use the cheapest estimate. Does nothing when target_machine
+ * has no estimate instruction, the divisions stay exact.
+ */
+void lower_division(llvm::Module *module, llvm::TargetMachine *target_machine, unsigned int precision);
+
+#endif /* __JITMATH_HPP__ */
@@ -0,0 +1,476 @@
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Memory.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/MutexGuard.h"
+using namespace llvm;
+
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "jitmemory.h"
+
+#define DEFAULT_CODE_SLAB_SIZE (256 * 1024)
+#define HUGE_PAGE_SIZE         (2 * 1024 * 1024)
+#define STUB_SLAB_SIZE         (64 * 1024)
+#define DATA_SLAB_SIZE         (64 * 1024)
+
+/* Less space than this is not worth starting a function in, the JIT has to
+ * generate the whole function again if it runs out.
+ */
+#define MIN_FUNCTION_SPACE 1024
+
+static sys::Mutex options_lock;
+static size_t option_slab_size = 0;
+static bool option_huge_pages = false;
+
+static inline uint8_t *align_pointer(uint8_t *ptr, size_t alignment)
+{
+  return (uint8_t *)(((uintptr_t)ptr + alignment - 1) & ~(uintptr_t)(alignment - 1));
+}
+
+static inline size_t round_up(size_t size, size_t alignment)
+{
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+JitCodeArena::JitCodeArena(bool is_executable, size_t slab_bytes, bool use_huge_pages) :
+  executable(is_executable), huge_pages(use_huge_pages), open_slab(-1), open_begin(NULL), open_end(NULL), cursor(NULL)
+{
+  page_size = sysconf(_SC_PAGESIZE);
+  slab_size = round_up(slab_bytes, huge_pages ? HUGE_PAGE_SIZE : page_size);
+}
+
+JitCodeArena::~JitCodeArena()
+{
+  for (std::vector<Slab>::iterator slab = slabs.begin(); slab != slabs.end(); ++slab)
+    munmap(slab->base, slab->size);
+}
+
+int JitCodeArena::slabFor(uint8_t *ptr)
+{
+  for (size_t i = 0; i < slabs.size(); ++i)
+    if (ptr >= slabs[i].base && ptr < slabs[i].base + slabs[i].size)
+      return i;
+
+  return -1;
+}
+
+int JitCodeArena::newSlab(size_t min_size)
+{
+  size_t alignment = huge_pages ? HUGE_PAGE_SIZE : page_size;
+  size_t size = round_up(min_size > slab_size ? min_size : slab_size, alignment);
+  size_t map_size = huge_pages ? size + HUGE_PAGE_SIZE : size;
+
+  /* Executable arenas start out inaccessible, pages are opened as needed */
+  int protection = executable ? PROT_NONE : (PROT_READ | PROT_WRITE);
+  void *mapping = mmap(NULL, map_size, protection, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  if (mapping == MAP_FAILED)
+    report_fatal_error("nanJIT: Could not map memory for generated code");
+
+  uint8_t *base = (uint8_t *)mapping;
+
+  if (huge_pages)
+    {
+      /* Trim the mapping down to a huge page aligned slab */
+      uint8_t *aligned = align_pointer(base, HUGE_PAGE_SIZE);
+
+      if (aligned != base)
+        munmap(base, aligned - base);
+      if (aligned + size != base + map_size)
+        munmap(aligned + size, (base + map_size) - (aligned + size));
+      base = aligned;
+
+#ifdef MADV_HUGEPAGE
+      madvise(base, size, MADV_HUGEPAGE);
+#endif
+    }
+
+  Slab slab;
+  slab.base = base;
+  slab.size = size;
+  slab.page_live.resize(size / page_size, 0);
+  slabs.push_back(slab);
+
+  return slabs.size() - 1;
+}
+
+void JitCodeArena::openRun(size_t min_size)
+{
+  size_t pages_wanted = round_up(min_size ? min_size : 1, page_size) / page_size;
+  int run_slab = -1;
+  size_t run_first = 0;
+  size_t run_pages = 0;
+
+  /* First fit by address keeps live code in as few pages as possible */
+  for (size_t i = 0; i < slabs.size() && run_slab < 0; ++i)
+    {
+      std::vector<uint32_t> &page_live = slabs[i].page_live;
+      size_t page = 0;
+
+      while (page < page_live.size())
+        {
+          if (page_live[page])
+            {
+              page++;
+              continue;
+            }
+
+          size_t first = page;
+          while (page < page_live.size() && !page_live[page])
+            page++;
+
+          if (page - first >= pages_wanted)
+            {
+              run_slab = i;
+              run_first = first;
+              run_pages = page - first;
+              break;
+            }
+        }
+    }
+
+  if (run_slab < 0)
+    {
+      run_slab = newSlab(pages_wanted * page_size);
+      run_first = 0;
+      run_pages = slabs[run_slab].page_live.size();
+    }
+
+  open_slab = run_slab;
+  open_begin = cursor = slabs[run_slab].base + run_first * page_size;
+  open_end = open_begin + run_pages * page_size;
+
+  if (executable)
+    mprotect(open_begin, open_end - open_begin, PROT_READ | PROT_WRITE);
+}
+
+void JitCodeArena::adjustLive(int slab_index, uint8_t *start, size_t size, bool add)
+{
+  Slab &slab = slabs[slab_index];
+  uint8_t *end = start + size;
+  size_t first_page = (start - slab.base) / page_size;
+  size_t last_page = (end - 1 - slab.base) / page_size;
+
+  for (size_t page = first_page; page <= last_page; ++page)
+    {
+      uint8_t *page_start = slab.base + page * page_size;
+      uint8_t *overlap_start = start > page_start ? start : page_start;
+      uint8_t *overlap_end = end < page_start + page_size ? end : page_start + page_size;
+      uint32_t bytes = overlap_end - overlap_start;
+
+      if (add)
+        slab.page_live[page] += bytes;
+      else
+        slab.page_live[page] -= bytes;
+    }
+}
+
+void JitCodeArena::releasePages(Slab &slab, size_t first_page, size_t last_page)
+{
+  for (size_t page = first_page; page <= last_page; ++page)
+    {
+      if (slab.page_live[page])
+        continue;
+
+      uint8_t *page_start = slab.base + page * page_size;
+
+      /* Stale code faults instead of running */
+      if (executable)
+        mprotect(page_start, page_size, PROT_NONE);
+      madvise(page_start, page_size, MADV_DONTNEED);
+    }
+}
+
+uint8_t *JitCodeArena::startBlock(uintptr_t &size)
+{
+  size_t wanted = size > MIN_FUNCTION_SPACE ? size : MIN_FUNCTION_SPACE;
+
+  if (open_slab < 0 || (size_t)(open_end - cursor) < wanted)
+    {
+      seal();
+      openRun(wanted);
+    }
+
+  size = open_end - cursor;
+  return cursor;
+}
+
+void JitCodeArena::endBlock(uint8_t *start, uint8_t *end)
+{
+  size_t size = end > start ? end - start : 1;
+
+  allocations[start] = size;
+  adjustLive(open_slab, start, size, true);
+
+  cursor = align_pointer(start + size, 16);
+  if (cursor > open_end)
+    cursor = open_end;
+}
+
+uint8_t *JitCodeArena::allocate(size_t size, unsigned int alignment)
+{
+  if (!alignment)
+    alignment = 16;
+
+  if (open_slab < 0 || align_pointer(cursor, alignment) + size > open_end)
+    {
+      seal();
+      openRun(size + alignment);
+    }
+
+  uint8_t *start = align_pointer(cursor, alignment);
+  endBlock(start, start + size);
+
+  return start;
+}
+
+void JitCodeArena::free(void *ptr)
+{
+  uint8_t *start = (uint8_t *)ptr;
+  std::map<uint8_t *, size_t>::iterator allocation = allocations.find(start);
+  int slab_index = slabFor(start);
+
+  if (allocation == allocations.end() || slab_index < 0)
+    return;
+
+  size_t size = allocation->second;
+  allocations.erase(allocation);
+  adjustLive(slab_index, start, size, false);
+
+  if (slab_index == open_slab && start >= open_begin && start < open_end)
+    {
+      /* Still being written, which is how the JIT retries with more space */
+      if (align_pointer(start + size, 16) >= cursor)
+        cursor = start;
+      return;
+    }
+
+  Slab &slab = slabs[slab_index];
+  releasePages(slab, (start - slab.base) / page_size, (start + size - 1 - slab.base) / page_size);
+
+  /* Keep one slab around, unmap any other that's completely free */
+  if (slabs.size() > 1)
+    {
+      for (std::vector<uint32_t>::iterator page = slab.page_live.begin(); page != slab.page_live.end(); ++page)
+        if (*page)
+          return;
+
+      if (slab_index == open_slab)
+        return;
+
+      munmap(slab.base, slab.size);
+      slabs.erase(slabs.begin() + slab_index);
+
+      if (open_slab > slab_index)
+        open_slab--;
+    }
+}
+
+void JitCodeArena::seal()
+{
+  if (open_slab < 0 || !executable)
+    return;
+
+  Slab &slab = slabs[open_slab];
+  uint8_t *written_end = align_pointer(cursor, page_size);
+
+  if (written_end > open_begin)
+    {
+      mprotect(open_begin, written_end - open_begin, PROT_READ | PROT_EXEC);
+      sys::Memory::InvalidateInstructionCache(open_begin, written_end - open_begin);
+    }
+
+  /* Pages left unused, or only holding abandoned attempts, go back to the pool */
+  size_t first_page = (open_begin - slab.base) / page_size;
+  size_t last_page = (open_end - slab.base) / page_size - 1;
+  releasePages(slab, first_page, last_page);
+
+  open_slab = -1;
+  open_begin = open_end = cursor = NULL;
+}
+
+void JitCodeArena::addStats(JitCodeMemoryStats *stats, size_t &live_bytes)
+{
+  for (std::map<uint8_t *, size_t>::iterator allocation = allocations.begin(); allocation != allocations.end(); ++allocation)
+    live_bytes += allocation->second;
+
+  if (!executable)
+    return;
+
+  if (huge_pages)
+    stats->huge_pages = 1;
+
+  for (size_t i = 0; i < slabs.size(); ++i)
+    {
+      std::vector<uint32_t> &page_live = slabs[i].page_live;
+      size_t run = 0;
+
+      stats->slab_count++;
+      stats->reserved_bytes += slabs[i].size;
+
+      for (size_t page = 0; page <= page_live.size(); ++page)
+        {
+          bool in_open_run = ((int)i == open_slab &&
+                              slabs[i].base + page * page_size >= open_begin &&
+                              slabs[i].base + page * page_size < open_end);
+
+          if (page < page_live.size() && !page_live[page] && !in_open_run)
+            {
+              run++;
+              continue;
+            }
+
+          if (page < page_live.size() && page_live[page])
+            stats->wasted_bytes += page_size - page_live[page];
+
+          if (run)
+            {
+              stats->free_runs++;
+              stats->free_bytes += run * page_size;
+              if (run * page_size > stats->largest_free_bytes)
+                stats->largest_free_bytes = run * page_size;
+            }
+          run = 0;
+        }
+    }
+}
+
+void JitCodeMemoryManager::setOptions(size_t slab_size, bool huge_pages)
+{
+  MutexGuard locked(options_lock);
+
+  option_slab_size = slab_size;
+  option_huge_pages = huge_pages;
+}
+
+static size_t code_slab_size()
+{
+  MutexGuard locked(options_lock);
+
+  if (option_slab_size)
+    return option_slab_size;
+  return option_huge_pages ? HUGE_PAGE_SIZE : DEFAULT_CODE_SLAB_SIZE;
+}
+
+static bool code_huge_pages()
+{
+  MutexGuard locked(options_lock);
+
+  return option_huge_pages;
+}
+
+JitCodeMemoryManager::JitCodeMemoryManager() :
+  code(true, code_slab_size(), code_huge_pages()),
+  stubs(true, STUB_SLAB_SIZE, false),
+  data(false, DATA_SLAB_SIZE, false),
+  got(NULL),
+  poison(false)
+{
+}
+
+JitCodeMemoryManager::~JitCodeMemoryManager()
+{
+}
+
+void JitCodeMemoryManager::seal()
+{
+  code.seal();
+  stubs.seal();
+}
+
+void JitCodeMemoryManager::getStats(JitCodeMemoryStats *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+
+  code.addStats(stats, stats->code_bytes);
+  stubs.addStats(stats, stats->stub_bytes);
+  data.addStats(stats, stats->data_bytes);
+}
+
+void JitCodeMemoryManager::AllocateGOT()
+{
+  /* Same size as LLVM's default memory manager */
+  got = data.allocate(sizeof(void *) * 8192, sizeof(void *));
+  HasGOT = true;
+}
+
+uint8_t *JitCodeMemoryManager::startFunctionBody(const Function *F, uintptr_t &ActualSize)
+{
+  return code.startBlock(ActualSize);
+}
+
+void JitCodeMemoryManager::endFunctionBody(const Function *F, uint8_t *FunctionStart, uint8_t *FunctionEnd)
+{
+  code.endBlock(FunctionStart, FunctionEnd);
+}
+
+void JitCodeMemoryManager::deallocateFunctionBody(void *Body)
+{
+  code.free(Body);
+}
+
+uint8_t *JitCodeMemoryManager::allocateStub(const GlobalValue *F, unsigned StubSize, unsigned Alignment)
+{
+  return stubs.allocate(StubSize, Alignment);
+}
+
+uint8_t *JitCodeMemoryManager::allocateSpace(intptr_t Size, unsigned Alignment)
+{
+  return stubs.allocate(Size, Alignment);
+}
+
+uint8_t *JitCodeMemoryManager::allocateGlobal(uintptr_t Size, unsigned Alignment)
+{
+  return data.allocate(Size, Alignment);
+}
+
+uint8_t *JitCodeMemoryManager::startExceptionTable(const Function *F, uintptr_t &ActualSize)
+{
+  return data.startBlock(ActualSize);
+}
+
+void JitCodeMemoryManager::endExceptionTable(const Function *F, uint8_t *TableStart, uint8_t *TableEnd, uint8_t *FrameRegister)
+{
+  data.endBlock(TableStart, TableEnd);
+}
+
+void JitCodeMemoryManager::deallocateExceptionTable(void *ET)
+{
+  data.free(ET);
+}
+
+uint8_t *JitCodeMemoryManager::allocateCodeSection(uintptr_t Size, unsigned Alignment, unsigned SectionID)
+{
+  return code.allocate(Size, Alignment);
+}
+
+#if ((LLVM_VERSION_MAJOR > 3) || ((LLVM_VERSION_MAJOR == 3) && (LLVM_VERSION_MINOR >= 3)))
+uint8_t *JitCodeMemoryManager::allocateDataSection(uintptr_t Size, unsigned Alignment, unsigned SectionID, bool IsReadOnly)
+{
+  return data.allocate(Size, Alignment);
+}
+
+bool JitCodeMemoryManager::applyPermissions(std::string *ErrMsg)
+{
+  seal();
+  return false;
+}
+#else
+uint8_t *JitCodeMemoryManager::allocateDataSection(uintptr_t Size, unsigned Alignment, unsigned SectionID)
+{
+  return data.allocate(Size, Alignment);
+}
+#endif
+
+void *JitCodeMemoryManager::getPointerToNamedFunction(const std::string &Name, bool AbortOnFailure)
+{
+  void *result = sys::DynamicLibrary::SearchForAddressOfSymbol(Name);
+
+  if (!result && AbortOnFailure)
+    report_fatal_error("nanJIT: Program used external function '" + Name + "' which could not be resolved!");
+
+  return result;
+}
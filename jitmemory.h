@@ -0,0 +1,121 @@
+#ifndef __JITMEMORY_HPP__
+#define __JITMEMORY_HPP__
+
+#include "llvm/ExecutionEngine/JITMemoryManager.h"
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "jitmodule.h"
+
+/* Pages of memory handed out from large slabs. Allocations are placed one
+ * after another in an open run of pages, which for executable arenas is
+ * writable but not executable until seal() makes the written pages
+ * executable and closes the run. A closed page is never made writable again
+ * while anything on it is live, so other threads can keep running code that
+ * shares a page with code being freed or written. Pages with nothing live on
+ * them are given back to the kernel and reused for later runs, lowest
+ * address first so live code stays packed together.
+ */
+class JitCodeArena
+{
+  struct Slab
+  {
+    uint8_t *base;
+    size_t size;
+    std::vector<uint32_t> page_live; /* Bytes of live allocations on each page */
+  };
+
+  bool executable;
+  size_t page_size;
+  size_t slab_size;
+  bool huge_pages;
+
+  std::vector<Slab> slabs;
+  std::map<uint8_t *, size_t> allocations;
+
+  /* The open run, open_slab is -1 if there is none */
+  int open_slab;
+  uint8_t *open_begin;
+  uint8_t *open_end;
+  uint8_t *cursor;
+
+  int slabFor(uint8_t *ptr);
+  int newSlab(size_t min_size);
+  void openRun(size_t min_size);
+  void adjustLive(int slab_index, uint8_t *start, size_t size, bool add);
+  void releasePages(Slab &slab, size_t first_page, size_t last_page);
+
+public:
+  JitCodeArena(bool is_executable, size_t slab_bytes, bool use_huge_pages);
+  ~JitCodeArena();
+
+  /* Space for an allocation of unknown size, size is the minimum wanted on
+   * input and what's available on output. Finished with endBlock().
+   */
+  uint8_t *startBlock(uintptr_t &size);
+  void endBlock(uint8_t *start, uint8_t *end);
+  uint8_t *allocate(size_t size, unsigned int alignment);
+  void free(void *start);
+
+  void seal();
+  void addStats(JitCodeMemoryStats *stats, size_t &live_bytes);
+};
+
+/* Replaces LLVM's default JIT memory manager, which gives every function its
+ * own block and keeps all code writable. Function bodies, stubs and data each
+ * come from their own arena, only the first two are ever executable.
+ * Nothing is executable until seal() is called, JitModule seals once per
+ * batch of iterations so a batch ends up packed into consecutive pages.
+ */
+class JitCodeMemoryManager : public llvm::JITMemoryManager
+{
+  JitCodeArena code;
+  JitCodeArena stubs;
+  JitCodeArena data;
+  uint8_t *got;
+  bool poison;
+
+public:
+  /* Used by managers created afterwards, 0 selects the default slab size */
+  static void setOptions(size_t slab_size, bool huge_pages);
+
+  JitCodeMemoryManager();
+  ~JitCodeMemoryManager();
+
+  void seal();
+  void getStats(JitCodeMemoryStats *stats);
+
+  /* Protection is changed per page by seal(), see JitCodeArena */
+  void setMemoryWritable() {};
+  void setMemoryExecutable() {};
+  void setPoisonMemory(bool poison_memory) { poison = poison_memory; };
+
+  void AllocateGOT();
+  uint8_t *getGOTBase() const { return got; };
+
+  uint8_t *startFunctionBody(const llvm::Function *F, uintptr_t &ActualSize);
+  void endFunctionBody(const llvm::Function *F, uint8_t *FunctionStart, uint8_t *FunctionEnd);
+  void deallocateFunctionBody(void *Body);
+  uint8_t *allocateStub(const llvm::GlobalValue *F, unsigned StubSize, unsigned Alignment);
+  uint8_t *allocateSpace(intptr_t Size, unsigned Alignment);
+  uint8_t *allocateGlobal(uintptr_t Size, unsigned Alignment);
+
+  uint8_t *startExceptionTable(const llvm::Function *F, uintptr_t &ActualSize);
+  void endExceptionTable(const llvm::Function *F, uint8_t *TableStart, uint8_t *TableEnd, uint8_t *FrameRegister);
+  void deallocateExceptionTable(void *ET);
+
+  /* RuntimeDyld interface, only used by MCJIT */
+  uint8_t *allocateCodeSection(uintptr_t Size, unsigned Alignment, unsigned SectionID);
+#if ((LLVM_VERSION_MAJOR > 3) || ((LLVM_VERSION_MAJOR == 3) && (LLVM_VERSION_MINOR >= 3)))
+  uint8_t *allocateDataSection(uintptr_t Size, unsigned Alignment, unsigned SectionID, bool IsReadOnly);
+  bool applyPermissions(std::string *ErrMsg = 0);
+#else
+  uint8_t *allocateDataSection(uintptr_t Size, unsigned Alignment, unsigned SectionID);
+#endif
+  void *getPointerToNamedFunction(const std::string &Name, bool AbortOnFailure = true);
+};
+
+#endif /* __JITMEMORY_HPP__ */
@@ -17,10 +17,17 @@
 #include "llvm/Module.h"
 #endif
 #include "llvm/PassManager.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/MutexGuard.h"
+#include "llvm/Support/Threading.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/Host.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/FormattedStream.h"
 #include "llvm/Target/TargetFrameLowering.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
@@ -32,9 +39,13 @@
 #include <llvm/Support/raw_os_ostream.h>
 using namespace llvm;
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdarg>
+#include <cstring>
 #include <map>
+#include <set>
+#include <vector>
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -43,15 +54,73 @@ using namespace std;
 #include "ast.h"
 #include "util.h"
 #include "varg.h"
+#include "jitcache.h"
+#include "jitdiskcache.h"
+#include "jitintern.h"
+#include "jitmath.h"
+#include "jitmemory.h"
+#include "jitpattern.h"
+#include "jitprecompiled.h"
+#include "jitpredicate.h"
+#include "jitprofile.h"
+#include "jitqueue.h"
 
 #include "jitmodule.h"
 #include "jitparser.h"
 
+/* Collect return_type and the NULL terminated list of strings following it,
+ * returns the number of strings or -1 if there were too many.
+ */
+static int collect_type_strings(const char **argv, const char *return_type, va_list vargs)
+{
+  int argc = 0;
+  const char *arg_type = return_type;
+
+  while (arg_type)
+  {
+    if (argc == ITERATION_CACHE_MAX_ARGS)
+      return -1;
+
+    argv[argc++] = arg_type;
+    arg_type = va_arg(vargs, char *);
+  }
+
+  return argc;
+}
+
 JitModule *jit_module_for_src(const char *src, unsigned int flags)
 {
+  return jit_module_for_src_with_options(src, flags, NULL);
+}
+
+void jit_module_options_init(JitModuleOptions *options)
+{
+  options->opt_level = 2;
+  options->size_level = 0;
+  options->codegen_opt_level = 2;
+  options->loop_vectorize = 0;
+  options->slp_vectorize = 0;
+  options->unroll_loops = 1;
+  options->unroll_threshold = 0;
+  options->fast_math = JIT_FAST_MATH_NONE;
+  options->division_precision = JIT_DIVISION_FULL;
+  options->if_convert_cost = DEFAULT_IF_CONVERT_COST;
+}
+
+JitModule *jit_module_for_src_with_options(const char *src, unsigned int flags, const JitModuleOptions *options)
+{
+  JitModuleOptions resolved;
+
+  if (options)
+    resolved = *options;
+  else
+    jit_module_options_init(&resolved);
+
   try
   {
-    return new JitModule(src, flags);
+    if (flags & JIT_MODULE_PRIVATE)
+      return new JitModule(src, flags, &resolved);
+    return JitModuleInternTable::acquire(src, flags, resolved);
   }
   catch (std::exception& e)
   {
@@ -62,42 +131,100 @@ JitModule *jit_module_for_src(const char *src, unsigned int flags)
 
 void *jit_module_get_iteration(JitModule *jm, const char *function_name, const char *return_type, ...)
 {
+  const char *argv[ITERATION_CACHE_MAX_ARGS];
+
   va_list vargs;
   va_start(vargs, return_type);
+  int argc = collect_type_strings(argv, return_type, vargs);
+  va_end(vargs);
 
-  std::list<std::string> argstrs;
+  return jm->getIteration(function_name, argv, argc);
+}
 
-  argstrs.push_back(std::string(return_type));
+void *jit_module_get_specialized_iteration(JitModule *jm, const char *function_name,
+                                           const JitArgumentBinding *bindings, unsigned int binding_count,
+                                           const char *return_type, ...)
+{
+  const char *argv[ITERATION_CACHE_MAX_ARGS];
 
-  const char *arg_type = va_arg(vargs, char *);
-  while (arg_type)
-  {
-    argstrs.push_back(std::string(arg_type));
-    arg_type = va_arg(vargs, char *);
-  }
+  va_list vargs;
+  va_start(vargs, return_type);
+  int argc = collect_type_strings(argv, return_type, vargs);
   va_end(vargs);
 
-  return jm->getIteration(function_name, argstrs);
+  return jm->getSpecializedIteration(function_name, bindings, binding_count, argv, argc);
 }
 
 void *jit_module_get_range_iteration(JitModule *jm, const char *function_name, const char *return_type, ...)
 {
+  const char *argv[ITERATION_CACHE_MAX_ARGS];
+
   va_list vargs;
   va_start(vargs, return_type);
+  int argc = collect_type_strings(argv, return_type, vargs);
+  va_end(vargs);
 
-  std::list<std::string> argstrs;
+  return jm->getRangeIteration(function_name, argv, argc);
+}
 
-  argstrs.push_back(std::string(return_type));
+JitIterationRequest *jit_module_request_iteration(JitModule *jm, int priority, const char *function_name, const char *return_type, ...)
+{
+  const char *argv[ITERATION_CACHE_MAX_ARGS];
 
-  const char *arg_type = va_arg(vargs, char *);
-  while (arg_type)
+  va_list vargs;
+  va_start(vargs, return_type);
+  int argc = collect_type_strings(argv, return_type, vargs);
+  va_end(vargs);
+
+  if (argc < 0)
+    argc = 0;
+
+  return jm->requestIteration(priority, function_name, std::list<std::string>(argv, argv + argc));
+}
+
+JitIterationRequest *jit_module_request_range_iteration(JitModule *jm, int priority, const char *function_name, const char *return_type, ...)
+{
+  const char *argv[ITERATION_CACHE_MAX_ARGS];
+
+  va_list vargs;
+  va_start(vargs, return_type);
+  int argc = collect_type_strings(argv, return_type, vargs);
+  va_end(vargs);
+
+  if (argc < 0)
+    argc = 0;
+
+  return jm->requestRangeIteration(priority, function_name, std::list<std::string>(argv, argv + argc));
+}
+
+unsigned int jit_module_get_iterations(JitModule *jm, unsigned int count, const char * const *function_names,
+                                       const char * const * const *signatures, void **functions)
+{
+  std::vector<JitIterationBatchEntry> entries(count);
+
+  for (unsigned int i = 0; i < count; ++i)
   {
-    argstrs.push_back(std::string(arg_type));
-    arg_type = va_arg(vargs, char *);
+    entries[i].function_name = function_names[i];
+    for (const char * const *arg_type = signatures[i]; *arg_type; ++arg_type)
+      entries[i].argstrs.push_back(std::string(*arg_type));
   }
-  va_end(vargs);
 
-  return jm->getRangeIteration(function_name, argstrs);
+  jm->getIterations(entries);
+
+  unsigned int compiled = 0;
+  for (unsigned int i = 0; i < count; ++i)
+  {
+    functions[i] = entries[i].function;
+    if (functions[i] && !jm->isFallbackFunction(functions[i]))
+      compiled++;
+  }
+
+  return compiled;
+}
+
+void jit_set_code_cache_directory(const char *path)
+{
+  JitDiskCache::setDirectory(path);
 }
 
 unsigned int jit_module_is_fallback_function(JitModule *jm, void *func)
@@ -105,24 +232,208 @@ unsigned int jit_module_is_fallback_function(JitModule *jm, void *func)
   return jm->isFallbackFunction(func);
 }
 
+void *jit_module_acquire_iteration(JitModule *jm, void *func)
+{
+  return jm->acquireIteration(func);
+}
+
+void jit_module_release_iteration(JitModule *jm, void *func)
+{
+  jm->releaseIteration(func);
+}
+
+void jit_module_set_memory_budget(JitModule *jm, size_t bytes)
+{
+  jm->setMemoryBudget(bytes);
+}
+
+size_t jit_module_get_memory_usage(JitModule *jm)
+{
+  return jm->getMemoryUsage();
+}
+
+size_t jit_module_get_iteration_memory(JitModule *jm, void *func)
+{
+  return jm->getIterationMemory(func);
+}
+
+void jit_module_set_tier_threshold(JitModule *jm, size_t elements)
+{
+  jm->setTierThreshold(elements);
+}
+
+unsigned int jit_module_is_iteration_optimized(JitModule *jm, void *func)
+{
+  return jm->isIterationOptimized(func);
+}
+
+unsigned int jit_module_get_iteration_profile(JitModule *jm, void *func, unsigned long long *calls, unsigned long long *elements,
+                                              JitBranchProfile *branches, unsigned int max_branches)
+{
+  return jm->getIterationProfile(func, calls, elements, branches, max_branches);
+}
+
+void jit_module_optimize_iteration(JitModule *jm, void *func)
+{
+  jm->optimizeIteration(func);
+}
+
+void jit_set_target(const char *cpu, const char *features)
+{
+  JitModule::setTarget(cpu, features);
+}
+
+void jit_module_set_multiversion_threshold(JitModule *jm, size_t elements)
+{
+  jm->setMultiversionThreshold(elements);
+}
+
+void jit_set_code_memory_options(size_t slab_size, unsigned int huge_pages)
+{
+  JitCodeMemoryManager::setOptions(slab_size, huge_pages != 0);
+}
+
+void jit_module_get_code_memory_stats(JitModule *jm, JitCodeMemoryStats *stats)
+{
+  jm->getCodeMemoryStats(stats);
+}
+
+JitModule *jit_module_ref(JitModule *jm)
+{
+  return JitModuleInternTable::addRef(jm);
+}
+
 void jit_module_destroy(JitModule *jm)
 {
-  delete jm;
+  JitModuleInternTable::release(jm);
 }
 
+/* Elements a tiered iteration processes before it's recompiled */
+#define DEFAULT_TIER_THRESHOLD 100000
+/* Calls with fewer elements than this run the narrow version of a
+ * multiversioned iteration. Short bursts of AVX code can cost more in clock
+ * speed than the wider vectors gain.
+ */
+#define DEFAULT_MULTIVERSION_THRESHOLD 128
+/* What multiversioned iterations are also compiled for, SSE4.2 and no AVX */
+#define NARROW_TARGET_CPU "corei7"
+
+class JitTierState;
+
 class JitModuleState
 {
 public:
+  LLVMContext *context;
   ExecutionEngine *execution_engine;
   TargetMachine *target_machine;
-
-  void optimizeModule(Module *module);
-
-  JitModuleState() : execution_engine(NULL), target_machine(NULL) {};
+  JitCodeMemoryManager *memory_manager; /* Owned by execution_engine */
+
+  /* What execution_engine compiles for, see jit_set_target */
+  std::string cpu;
+  std::vector<std::string> attrs;
+
+  /* Compiles the narrow versions of multiversioned iterations, created
+   * when the first one is needed.
+   */
+  ExecutionEngine *narrow_engine;
+  JitCodeMemoryManager *narrow_memory_manager; /* Owned by narrow_engine */
+  bool narrow_checked;
+  size_t multiversion_threshold;
+  /* The copy of each iteration module compiled by narrow_engine */
+  std::map<Module *, Module *> narrow_modules;
+
+  /* Serializes iteration generation for a single JitModule */
+  sys::Mutex lock;
+
+  /* Read without holding lock, written only while holding it */
+  IterationCache iteration_cache;
+
+  /* The source text the module was built from */
+  std::string source;
+  JitModuleOptions options;
+
+  /* Iterations compiled ahead of time for source */
+  std::vector<const JitPrecompiledIteration *> precompiled;
+
+  /* The argument names of each function in the module, kept when a lean
+   * module drops its IR so bindings can be resolved without rebuilding it.
+   */
+  std::map<std::string, std::vector<std::string> > argument_names;
+
+  /* Everything the iteration cache points to, see IterationRecord */
+  std::map<std::string, IterationRecord *> records;
+  std::map<const JitPrecompiledIteration *, IterationRecord *> precompiled_records;
+
+  /* Number of live iterations compiled into each iteration module */
+  std::map<Module *, int> module_users;
+
+  size_t memory_budget;
+  size_t memory_used;
+  /* Advanced by every locked lookup, lock free ones only read it, see
+   * IterationRecord::use
+   */
+  volatile uint32_t use_epoch;
+
+  size_t tier_threshold;
+  /* Referenced by compiled trampolines, so kept until the module is destroyed */
+  std::map<std::string, JitTierState *> tier_states;
+
+  /* Mark record as used while holding lock, returns its function */
+  void *useLocked(IterationRecord *record);
+
+  std::string codeCacheKey(const std::string &entry);
+
+  /* If functions is given only those functions get the per-function passes,
+   * anything else in the module is assumed to be optimized already. An
+   * opt_level of -1 uses the level from options. keep_profiled leaves the
+   * if statements a profile counts as branches.
+   */
+  void optimizeModule(Module *module, const std::vector<Function *> *functions = NULL, int opt_level = -1,
+                      bool keep_profiled = false);
+  /* Free a module's machine code and the module itself, along with its narrow copy */
+  void freeModule(Module *module);
+  /* NULL if the target has no wider vectors than the narrow one */
+  ExecutionEngine *getNarrowEngine();
+  /* Code generator settings for options.fast_math */
+  TargetOptions targetOptions();
+
+  JitModuleState() : context(NULL), execution_engine(NULL), target_machine(NULL), memory_manager(NULL),
+                     narrow_engine(NULL), narrow_memory_manager(NULL), narrow_checked(false),
+                     multiversion_threshold(DEFAULT_MULTIVERSION_THRESHOLD),
+                     memory_budget(0), memory_used(0), use_epoch(0), tier_threshold(DEFAULT_TIER_THRESHOLD) {};
   ~JitModuleState();
 };
 
-void JitModuleState::optimizeModule(Module *module)
+/* PassManagerBuilder only has an on/off switch for unrolling, this carries
+ * the threshold to add_unroll_pass and the if conversion settings.
+ */
+class JitPassManagerBuilder : public PassManagerBuilder
+{
+public:
+  unsigned int unroll_threshold;
+  unsigned int if_convert_cost;
+  bool keep_profiled_branches;
+};
+
+static void add_unroll_pass(const PassManagerBuilder &builder, PassManagerBase &passes)
+{
+  const JitPassManagerBuilder &jit_builder = static_cast<const JitPassManagerBuilder &>(builder);
+
+  passes.add(createLoopUnrollPass(jit_builder.unroll_threshold));
+}
+
+/* Runs once inlining and mem2reg have left if statements as plain blocks of
+ * arithmetic, the selects it makes are then cleaned up and vectorized.
+ */
+static void add_if_conversion_pass(const PassManagerBuilder &builder, PassManagerBase &passes)
+{
+  const JitPassManagerBuilder &jit_builder = static_cast<const JitPassManagerBuilder &>(builder);
+
+  passes.add(create_if_conversion_pass(jit_builder.if_convert_cost, jit_builder.keep_profiled_branches));
+}
+
+void JitModuleState::optimizeModule(Module *module, const std::vector<Function *> *functions, int opt_level,
+                                    bool keep_profiled)
 {
   auto_ptr<FunctionPassManager> function_optimizer_passes(new FunctionPassManager(module));
   auto_ptr<PassManager> module_optimizer_passes(new PassManager());
@@ -138,9 +449,36 @@ void JitModuleState::optimizeModule(Module *module)
 #endif
 
   {
-    PassManagerBuilder pass_builder;
-    pass_builder.OptLevel = CodeGenOpt::Default; // -O2, CodeGenOpt::Aggressive is -O3
-    pass_builder.Inliner = createFunctionInliningPass();
+    JitPassManagerBuilder pass_builder;
+    pass_builder.OptLevel = (opt_level < 0) ? options.opt_level : opt_level; // 2 is -O2, 3 is -O3
+    pass_builder.SizeLevel = options.size_level;
+
+    /* The thresholds clang uses for -Os and -Oz */
+    if (options.size_level == 1)
+      pass_builder.Inliner = createFunctionInliningPass(75);
+    else if (options.size_level > 1)
+      pass_builder.Inliner = createFunctionInliningPass(25);
+    else
+      pass_builder.Inliner = createFunctionInliningPass();
+
+    pass_builder.LoopVectorize = options.loop_vectorize != 0;
+#if ((LLVM_VERSION_MAJOR > 3) || ((LLVM_VERSION_MAJOR == 3) && (LLVM_VERSION_MINOR >= 3)))
+    pass_builder.SLPVectorize = options.slp_vectorize != 0;
+#endif
+
+    /* A custom threshold replaces the stock unroll pass with one added late,
+     * after the loop vectorizer has seen the loops.
+     */
+    pass_builder.DisableUnrollLoops = !options.unroll_loops || options.unroll_threshold;
+    if (options.unroll_loops && options.unroll_threshold)
+    {
+      pass_builder.unroll_threshold = options.unroll_threshold;
+      pass_builder.addExtension(PassManagerBuilder::EP_ScalarOptimizerLate, add_unroll_pass);
+    }
+
+    pass_builder.if_convert_cost = options.if_convert_cost;
+    pass_builder.keep_profiled_branches = keep_profiled;
+    pass_builder.addExtension(PassManagerBuilder::EP_ScalarOptimizerLate, add_if_conversion_pass);
 
     pass_builder.populateFunctionPassManager(*function_optimizer_passes);
     pass_builder.populateModulePassManager(*module_optimizer_passes);
@@ -160,357 +498,1928 @@ void JitModuleState::optimizeModule(Module *module)
   //cout << "Generated module \"" << module->getModuleIdentifier();
   //cout << "\" contains " << function_list.size() << " functions." << endl;
 
-  for (Module::FunctionListType::iterator it = function_list.begin(); it != function_list.end(); ++it)
+  if (functions)
+    {
+      for (std::vector<Function *>::const_iterator it = functions->begin(); it != functions->end(); ++it)
+        function_optimizer_passes->run(**it);
+    }
+  else
     {
-      //cout << "Pre-optimizing \"" << it->getName().str() << "()\"" << endl;
-      function_optimizer_passes->run(*it);
+      for (Module::FunctionListType::iterator it = function_list.begin(); it != function_list.end(); ++it)
+        {
+          //cout << "Pre-optimizing \"" << it->getName().str() << "()\"" << endl;
+          function_optimizer_passes->run(*it);
+        }
     }
   function_optimizer_passes->doFinalization();
 
   module_optimizer_passes->run(*module);
 }
 
-JitModuleState::~JitModuleState()
+static void free_module(ExecutionEngine *engine, Module *module)
 {
+  /* Not isDeclaration(), lean modules have had their bodies deleted */
+  for (Module::iterator func = module->begin(); func != module->end(); ++func)
+    if (!func->isIntrinsic())
+      engine->freeMachineCodeForFunction(func);
+
+  engine->removeModule(module);
+  delete module;
 }
 
-class JitSingleton;
+TargetOptions JitModuleState::targetOptions()
+{
+  TargetOptions target_options;
+
+  target_options.UnsafeFPMath = (options.fast_math & JIT_FAST_MATH_REASSOC) != 0;
+  target_options.NoNaNsFPMath = (options.fast_math & JIT_FAST_MATH_NO_NANS) != 0;
+  target_options.NoInfsFPMath = (options.fast_math & JIT_FAST_MATH_NO_INFS) != 0;
+  if (options.fast_math & JIT_FAST_MATH_CONTRACT)
+    target_options.AllowFPOpFusion = FPOpFusion::Fast;
 
-static JitSingleton *jit_singleton = NULL;
+  return target_options;
+}
 
-class JitSingleton
+/* This LLVM can't contract individual instructions, JIT_FAST_MATH_CONTRACT
+ * is handled by the code generator through targetOptions().
+ */
+static void apply_fast_math(Module *module, unsigned int fast_math)
 {
-  public:
-    static JitSingleton *get(bool verbose = false);
+  if (!(fast_math & ~JIT_FAST_MATH_CONTRACT))
+    return;
+
+  FastMathFlags math_flags;
+
+  if (fast_math & JIT_FAST_MATH_REASSOC)
+    math_flags.setUnsafeAlgebra();
+  if (fast_math & JIT_FAST_MATH_NO_NANS)
+    math_flags.setNoNaNs();
+  if (fast_math & JIT_FAST_MATH_NO_INFS)
+    math_flags.setNoInfs();
+  if (fast_math & JIT_FAST_MATH_NO_SIGNED_ZEROS)
+    math_flags.setNoSignedZeros();
+  if (fast_math & JIT_FAST_MATH_RECIPROCAL)
+    math_flags.setAllowReciprocal();
+
+  for (Module::iterator func = module->begin(); func != module->end(); ++func)
+    for (Function::iterator block = func->begin(); block != func->end(); ++block)
+      for (BasicBlock::iterator inst = block->begin(); inst != block->end(); ++inst)
+        if (isa<BinaryOperator>(inst) && inst->getType()->isFPOrFPVectorTy())
+          inst->setFastMathFlags(math_flags);
+}
 
-    ExecutionEngine *execution_engine;
-    TargetMachine *target_machine;
-    Module *dummy_module;
+void JitModuleState::freeModule(Module *module)
+{
+  std::map<Module *, Module *>::iterator narrow = narrow_modules.find(module);
 
-    void removeModule(Module *module);
+  if (narrow != narrow_modules.end())
+  {
+    free_module(narrow_engine, narrow->second);
+    narrow_modules.erase(narrow);
+  }
 
-  private:
-    JitSingleton(bool verbose);
-};
+  free_module(execution_engine, module);
+}
 
-JitSingleton *JitSingleton::get(bool verbose)
+/* Whether code for the target may use 256 bit vectors */
+static bool target_has_wide_vectors(const std::string &cpu, const std::vector<std::string> &attrs)
 {
-  if (!jit_singleton)
-    jit_singleton = new JitSingleton(verbose);
-  return jit_singleton;
-};
+  static const char *avx_cpus[] = {
+    "corei7-avx", "core-avx-i", "core-avx2", "btver2", "bdver1", "bdver2", "bdver3", "knl", "skx", NULL
+  };
+
+  for (std::vector<std::string>::const_iterator attr = attrs.begin(); attr != attrs.end(); ++attr)
+  {
+    if (*attr == "-avx")
+      return false;
+    if (!attr->compare(0, 4, "+avx"))
+      return true;
+  }
+
+  for (int i = 0; avx_cpus[i]; ++i)
+    if (cpu == avx_cpus[i])
+      return true;
 
-JitSingleton::JitSingleton(bool verbose)
+  return false;
+}
+
+ExecutionEngine *JitModuleState::getNarrowEngine()
 {
-  InitializeNativeTarget();
+  if (narrow_checked)
+    return narrow_engine;
+  narrow_checked = true;
 
-  dummy_module = new Module("nanJIT Dummy Module", getGlobalContext());
+  if (!target_has_wide_vectors(cpu, attrs))
+    return NULL;
 
   std::string errStr;
-  EngineBuilder engine_builder(dummy_module);
-  target_machine = engine_builder.selectTarget();
-  execution_engine = engine_builder.setErrorStr(&errStr).create();
-
-  if (!execution_engine) {
-    throw JitModuleException("Could not create ExecutionEngine: " + errStr);
+  Module *empty_module = new Module("nanJIT Narrow Module", *context);
+  EngineBuilder engine_builder(empty_module);
+  narrow_memory_manager = new JitCodeMemoryManager();
+  engine_builder.setJITMemoryManager(narrow_memory_manager);
+  engine_builder.setMCPU(NARROW_TARGET_CPU);
+  engine_builder.setOptLevel((CodeGenOpt::Level)options.codegen_opt_level);
+  engine_builder.setTargetOptions(targetOptions());
+  narrow_engine = engine_builder.setErrorStr(&errStr).create();
+
+  if (!narrow_engine)
+  {
+    printf("Could not create the narrow ExecutionEngine: %s\n", errStr.c_str());
+    narrow_memory_manager = NULL;
+    delete empty_module;
   }
 
-  if (verbose)
-    cout << "JIT Target: " << target_machine->getTargetTriple().str() << endl;
-};
-
-void JitSingleton::removeModule(Module *module)
-{
-  if (module != dummy_module)
-    execution_engine->removeModule(module);
+  return narrow_engine;
 }
 
-JitModule::JitModule(const char *sourcecode, unsigned int  module_flags)
+/* Everything that affects the code generated for entry: the source, the
+ * optimization pipeline, the host and the library and LLVM versions.
+ */
+std::string JitModuleState::codeCacheKey(const std::string &entry)
 {
-  flags = module_flags;
-  JitSingleton *singleton = JitSingleton::get(flags & JIT_MODULE_VERBOSE);
+  stringstream key;
 
-  module = singleton->dummy_module;
-  internal = new JitModuleState();
+  key << "nanjit " << NANJIT_CODE_CACHE_VERSION;
+  key << " llvm " << LLVM_VERSION_MAJOR << "." << LLVM_VERSION_MINOR << "\n";
+  key << "triple " << sys::getDefaultTargetTriple() << "\n";
+  key << "cpu " << sys::getHostCPUName().str() << "\n";
+  key << "target " << cpu;
+  for (std::vector<std::string>::iterator attr = attrs.begin(); attr != attrs.end(); ++attr)
+    key << " " << *attr;
+  key << "\n";
+
+  {
+    StringMap<bool> host_features;
+    std::set<std::string> enabled_features;
+
+    if (sys::getHostCPUFeatures(host_features))
+      for (StringMap<bool>::iterator iter = host_features.begin(); iter != host_features.end(); ++iter)
+        if (iter->getValue())
+          enabled_features.insert(iter->getKey().str());
+
+    key << "features";
+    for (std::set<std::string>::iterator iter = enabled_features.begin(); iter != enabled_features.end(); ++iter)
+      key << " +" << *iter;
+    key << "\n";
+  }
+
+  key << "opt " << options.opt_level << " size " << options.size_level << " codegen " << options.codegen_opt_level;
+  key << " vectorize " << options.loop_vectorize << " " << options.slp_vectorize;
+  key << " unroll " << options.unroll_loops << " " << options.unroll_threshold;
+  key << " fast-math " << options.fast_math;
+  key << " division " << options.division_precision;
+  key << " if-convert " << options.if_convert_cost << "\n";
+  key << "entry " << entry << "\n";
+  key << source;
 
-  internal->execution_engine = singleton->execution_engine;
-  internal->target_machine   = singleton->target_machine;
+  return key.str();
+}
 
-  /* Parse the source string */
-  std::stringstream source_code_stream(sourcecode);
-  ModuleAST *ast = nanjit::parse(source_code_stream);
+static IterationRecord *find_precompiled_iteration(JitModuleState *internal, IterationKind kind, const char *function_name,
+                                                   const char * const *argv, int argc)
+{
+  std::vector<const JitPrecompiledIteration *>::iterator iter;
 
-  if (ast)
+  /* Only holds iterations compiled with the module's options, see PrecompiledRegistry::lookup */
+  for (iter = internal->precompiled.begin(); iter != internal->precompiled.end(); ++iter)
   {
-    if (flags & JIT_MODULE_DEBUG_AST)
-        ast->print(cout) << endl;
+    const JitPrecompiledIteration *entry = *iter;
 
-    Module *maybe_module = new Module("nanJIT Module", getGlobalContext());
+    if ((entry->range != 0) != (kind == ITERATION_KIND_RANGE) || strcmp(entry->function_name, function_name))
+      continue;
 
-    try
-      {
-        ast->codegen(maybe_module);
-        module = maybe_module;
-      }
-    catch (std::exception& e)
+    int i = 0;
+    while (i < argc && entry->signature[i] && !strcmp(entry->signature[i], argv[i]))
+      i++;
+
+    if (i == argc && !entry->signature[i])
+    {
+      IterationRecord *&record = internal->precompiled_records[entry];
+      if (!record)
       {
-        cout << "Codegen error: " << e.what() << endl;
-        delete maybe_module;
+        record = new IterationRecord();
+        record->function = entry->function;
       }
+      return record;
+    }
   }
 
-  internal->optimizeModule(module);
-
-  delete ast;
-
-  if (flags & JIT_MODULE_DEBUG_LLVM)
-    module->dump();
+  return NULL;
 }
 
-void *JitModule::getIteration(const char *function_name, const char *return_type, ...)
+class JitPendingIteration
 {
-  va_list vargs;
-  va_start(vargs, return_type);
-
+public:
+  IterationKind kind;
+  std::string function_name;
+  std::string description;
   std::list<std::string> argstrs;
+  std::list<GeneratorArgumentInfo> arginfos;
+  Function *function;
+  bool fallback;
 
-  argstrs.push_back(std::string(return_type));
+  /* Set for tiered iterations, see build_tier_trampoline */
+  Function *trampoline;
+  GlobalVariable *tier_slot;
 
-  const char *arg_type = va_arg(vargs, char *);
-  while (arg_type)
-  {
-    argstrs.push_back(std::string(arg_type));
-    arg_type = va_arg(vargs, char *);
-  }
-  va_end(vargs);
+  /* Set for profiled iterations, see instrument_iteration */
+  GlobalVariable *profile_counters;
+  unsigned int profile_branches;
+
+  /* Set for multiversioned iterations, see JitModule::buildNarrowVersions */
+  Function *dispatcher;
+  Function *narrow_function;
+  size_t narrow_code_bytes;
+
+  JitPendingIteration(IterationKind k, const std::string &name)
+    : kind(k), function_name(name), function(NULL), fallback(false), trampoline(NULL), tier_slot(NULL),
+      profile_counters(NULL), profile_branches(0), dispatcher(NULL), narrow_function(NULL), narrow_code_bytes(0) {};
+};
+
+/* What a tiered iteration's trampoline passes to tier_up_callback */
+class JitTierState
+{
+public:
+  JitModule *module;
+  IterationKind kind;
+  std::string function_name;
+  std::list<std::string> argstrs;
+};
 
-  return getIteration(function_name, argstrs);
+/* Runs on the thread that called the iteration, so the work is handed to the compile queue */
+static void tier_up_callback(JitTierState *state)
+{
+  JitIterationRequest *request = new JitIterationRequest();
+  request->module = state->module;
+  request->kind = state->kind;
+  request->function_name = state->function_name;
+  request->argstrs = state->argstrs;
+  request->priority = JIT_PRIORITY_LOW;
+  request->tier_up = true;
+
+  JitCompileQueue::get()->submit(request);
+  JitCompileQueue::get()->release(request);
 }
 
-void *JitModule::getIteration(const char *function_name, const std::list<std::string> &argstrs)
+/* A function with the same signature as wrapper that counts the elements it's
+ * called with and calls whatever tier_slot points to. tier_up_callback is
+ * called once, by the call that takes the count past threshold.
+ */
+static Function *build_tier_trampoline(Module *module, Function *wrapper, IterationKind kind, size_t threshold,
+                                       JitTierState *state, GlobalVariable *&tier_slot)
 {
-  std::list<GeneratorArgumentInfo> arginfos;
+  LLVMContext &context = module->getContext();
+  IRBuilder<> builder(context);
+  FunctionType *func_type = wrapper->getFunctionType();
+  PointerType *func_ptr_type = PointerType::getUnqual(func_type);
+  IntegerType *intptr_type = builder.getIntNTy(sizeof(void *) * 8);
 
-  stringstream function_description;
+  tier_slot = new GlobalVariable(*module, func_ptr_type, false, GlobalValue::InternalLinkage,
+                                 ConstantPointerNull::get(func_ptr_type), wrapper->getName() + ".tier_slot");
+  tier_slot->setAlignment(sizeof(void *));
 
-  try
-  {
-    for(std::list<std::string>::const_iterator iter = argstrs.begin(); iter != argstrs.end(); ++iter)
-    {
-      arginfos.push_back(GeneratorArgumentInfo(*iter));
-    }
+  GlobalVariable *element_count = new GlobalVariable(*module, builder.getInt64Ty(), false, GlobalValue::InternalLinkage,
+                                                     builder.getInt64(0), wrapper->getName() + ".elements");
+  element_count->setAlignment(8);
 
-    {
-      std::list<GeneratorArgumentInfo>::iterator iter = arginfos.begin();
-      GeneratorArgumentInfo return_info = *iter++; /* Skip the return value when printing args */
+  Function *trampoline = Function::Create(func_type, Function::ExternalLinkage, wrapper->getName() + ".tiered", module);
 
-      function_description << function_name << "(";
-      while(iter != arginfos.end())
-      {
-        function_description << iter->toStr();
+  std::vector<Value *> args;
+  for (Function::arg_iterator arg = trampoline->arg_begin(); arg != trampoline->arg_end(); ++arg)
+    args.push_back(arg);
 
-        if (++iter != arginfos.end())
-          function_description << ", ";
-      }
-      function_description << ") -> " << return_info.toStr();
-    }
+  BasicBlock *entry_block = BasicBlock::Create(context, "entry", trampoline);
+  BasicBlock *tier_up_block = BasicBlock::Create(context, "tier_up", trampoline);
+  BasicBlock *dispatch_block = BasicBlock::Create(context, "dispatch", trampoline);
 
-    if (liveFunctions.find(function_description.str()) != liveFunctions.end())
-    {
-      if (flags & JIT_MODULE_VERBOSE)
-        cout << "Existing function for " << function_description.str() << endl;
-      return liveFunctions[function_description.str()].compiledFunciton;
-    }
-  }
-  catch (std::exception& e)
+  builder.SetInsertPoint(entry_block);
   {
-    printf("Error in getIteration(%s): %s\n", function_name, e.what());
-    return NULL;
+    Value *elements = build_element_count(builder, args, kind);
+    Value *before = builder.CreateAtomicRMW(AtomicRMWInst::Add, element_count, elements, Monotonic);
+    Value *after = builder.CreateAdd(before, elements);
+    Value *crossed = builder.CreateAnd(builder.CreateICmpULT(before, builder.getInt64(threshold)),
+                                       builder.CreateICmpUGE(after, builder.getInt64(threshold)));
+    builder.CreateCondBr(crossed, tier_up_block, dispatch_block);
   }
 
-  Module *cloned_module = CloneModule(module);
+  builder.SetInsertPoint(tier_up_block);
+  {
+    FunctionType *callback_type = FunctionType::get(builder.getVoidTy(), builder.getInt8PtrTy(), false);
+    Value *callback = builder.CreateIntToPtr(ConstantInt::get(intptr_type, (uintptr_t)tier_up_callback),
+                                             PointerType::getUnqual(callback_type));
+    Value *callback_data = builder.CreateIntToPtr(ConstantInt::get(intptr_type, (uintptr_t)state),
+                                                  builder.getInt8PtrTy());
+    builder.CreateCall(callback, callback_data);
+    builder.CreateBr(dispatch_block);
+  }
 
-  try
+  builder.SetInsertPoint(dispatch_block);
   {
-    if (flags & JIT_MODULE_VERBOSE)
-      cout << "Will generate " << function_description.str() << endl;
+    LoadInst *target = builder.CreateLoad(tier_slot);
+    target->setAlignment(sizeof(void *));
+    target->setAtomic(Acquire);
 
-    Function *iter_func = llvm_def_for(cloned_module, std::string(function_name), arginfos);
+    CallInst *call = builder.CreateCall(target, args);
+    call->setTailCall();
+    builder.CreateRetVoid();
+  }
 
-    if (flags & JIT_MODULE_DEBUG_LLVM)
-      cloned_module->dump();
+  return trampoline;
+}
 
-    internal->optimizeModule(cloned_module);
+/* A function with the same signature as wrapper that calls narrow_code for
+ * calls with fewer than threshold elements and wrapper for the rest.
+ */
+static Function *build_dispatcher(Module *module, Function *wrapper, IterationKind kind, size_t threshold,
+                                  void *narrow_code)
+{
+  LLVMContext &context = module->getContext();
+  IRBuilder<> builder(context);
+  FunctionType *func_type = wrapper->getFunctionType();
+  IntegerType *intptr_type = builder.getIntNTy(sizeof(void *) * 8);
 
-    JitModuleIterationData iter_data;
+  Function *dispatcher = Function::Create(func_type, Function::ExternalLinkage, wrapper->getName() + ".dispatch", module);
 
-    iter_data.module = cloned_module;
-    iter_data.function = iter_func;
-    iter_data.voidFunction = false;
+  std::vector<Value *> args;
+  for (Function::arg_iterator arg = dispatcher->arg_begin(); arg != dispatcher->arg_end(); ++arg)
+    args.push_back(arg);
 
-    {
-      MachineCodeInfo machine_code_info;
-      internal->execution_engine->runJITOnFunction(iter_func, &machine_code_info);
-      if (flags & JIT_MODULE_VERBOSE)
-        printf("jit result %lld bytes @ %p\n", (long long)machine_code_info.size(), machine_code_info.address());
-      iter_data.compiledFunciton = internal->execution_engine->getPointerToFunction(iter_func);
-    }
+  BasicBlock *entry_block = BasicBlock::Create(context, "entry", dispatcher);
+  BasicBlock *narrow_block = BasicBlock::Create(context, "narrow", dispatcher);
+  BasicBlock *wide_block = BasicBlock::Create(context, "wide", dispatcher);
 
-    liveFunctions[function_description.str()] = iter_data;
+  builder.SetInsertPoint(entry_block);
+  {
+    Value *elements = build_element_count(builder, args, kind);
+    builder.CreateCondBr(builder.CreateICmpULT(elements, builder.getInt64(threshold)), narrow_block, wide_block);
+  }
 
-    return iter_data.compiledFunciton;
+  builder.SetInsertPoint(narrow_block);
+  {
+    Value *target = builder.CreateIntToPtr(ConstantInt::get(intptr_type, (uintptr_t)narrow_code),
+                                           PointerType::getUnqual(func_type));
+    CallInst *call = builder.CreateCall(target, args);
+    call->setTailCall();
+    builder.CreateRetVoid();
   }
-  catch (std::exception& e)
+
+  builder.SetInsertPoint(wide_block);
   {
-    printf("Error in function_for(%s): %s\n", function_name, e.what());
+    CallInst *call = builder.CreateCall(wrapper, args);
+    call->setTailCall();
+    builder.CreateRetVoid();
+  }
+
+  return dispatcher;
+}
 
-    Function *iter_func = llvm_void_def_for(cloned_module, std::string(function_name), arginfos);
+void *JitModuleState::useLocked(IterationRecord *record)
+{
+  /* Lookups without the lock after this one count as more recent */
+  record->last_used = use_epoch;
+  use_epoch++;
+
+  return record->function;
+}
 
-    internal->optimizeModule(cloned_module);
+JitModuleState::~JitModuleState()
+{
+  for (std::map<std::string, IterationRecord *>::iterator iter = records.begin(); iter != records.end(); ++iter)
+    delete iter->second;
+  for (std::map<const JitPrecompiledIteration *, IterationRecord *>::iterator iter = precompiled_records.begin();
+       iter != precompiled_records.end(); ++iter)
+    delete iter->second;
+  for (std::map<std::string, JitTierState *>::iterator iter = tier_states.begin(); iter != tier_states.end(); ++iter)
+    delete iter->second;
+
+  /* The ExecutionEngines own the base module and every iteration module,
+   * all of which must be gone before their context is destroyed.
+   */
+  delete narrow_engine;
+  delete execution_engine;
+  delete context;
+}
 
-    JitModuleIterationData iter_data;
+static sys::Mutex jit_target_lock;
+static bool jit_target_initialized = false;
 
-    iter_data.module = cloned_module;
-    iter_data.function = iter_func;
-    iter_data.voidFunction = true;
+/* Set by jit_set_target, an empty CPU is the host's */
+static std::string jit_target_cpu;
+static std::string jit_target_features;
+static bool jit_target_features_set = false;
 
-    {
-      MachineCodeInfo machine_code_info;
-      internal->execution_engine->runJITOnFunction(iter_func, &machine_code_info);
-      if (flags & JIT_MODULE_VERBOSE)
-        printf("jit result %lld bytes @ %p\n", (long long)machine_code_info.size(), machine_code_info.address());
-      iter_data.compiledFunciton = internal->execution_engine->getPointerToFunction(iter_func);
-    }
+/* LLVM's target registry and pass registry are process wide, so they are
+ * initialized once no matter how many threads are creating modules.
+ */
+void JitModule::initializeTarget()
+{
+  MutexGuard locked(jit_target_lock);
 
-    liveFunctions[function_description.str()] = iter_data;
+  if (jit_target_initialized)
+    return;
 
-    return iter_data.compiledFunciton;
-  }
+  llvm_start_multithreaded();
+  InitializeNativeTarget();
+  jit_target_initialized = true;
 }
 
-void *JitModule::getRangeIteration(const char *function_name, const char *return_type, ...)
+void JitModule::setTarget(const char *cpu, const char *features)
 {
-  va_list vargs;
-  va_start(vargs, return_type);
+  MutexGuard locked(jit_target_lock);
 
-  std::list<std::string> argstrs;
+  jit_target_cpu = (cpu && strcmp(cpu, "host")) ? cpu : "";
+  jit_target_features = features ? features : "";
+  jit_target_features_set = (features != NULL);
+}
+
+/* The CPU and attributes for EngineBuilder from the jit_set_target settings */
+static void resolve_target(std::string &cpu, std::vector<std::string> &attrs)
+{
+  MutexGuard locked(jit_target_lock);
 
-  argstrs.push_back(std::string(return_type));
+  cpu = jit_target_cpu;
+  attrs.clear();
 
-  const char *arg_type = va_arg(vargs, char *);
-  while (arg_type)
+  if (cpu.empty())
   {
-    argstrs.push_back(std::string(arg_type));
-    arg_type = va_arg(vargs, char *);
+    cpu = sys::getHostCPUName();
+
+    /* Not every LLVM version can list the host's features, the CPU name
+     * alone covers them when it can't.
+     */
+    StringMap<bool> host_features;
+    if (!jit_target_features_set && sys::getHostCPUFeatures(host_features))
+      for (StringMap<bool>::iterator iter = host_features.begin(); iter != host_features.end(); ++iter)
+        attrs.push_back((iter->getValue() ? "+" : "-") + iter->getKey().str());
   }
-  va_end(vargs);
 
-  return getRangeIteration(function_name, argstrs);
+  std::stringstream features(jit_target_features);
+  std::string feature;
+
+  while (std::getline(features, feature, ','))
+  {
+    feature.erase(0, feature.find_first_not_of(" \t"));
+    feature.erase(feature.find_last_not_of(" \t") + 1);
+
+    if (feature.empty())
+      continue;
+    if (feature[0] != '+' && feature[0] != '-')
+      feature = "+" + feature;
+    attrs.push_back(feature);
+  }
 }
 
-void *JitModule::getRangeIteration(const char *function_name, const std::list<std::string> &argstrs)
+void JitModule::clampOptions(JitModuleOptions *options)
 {
-  std::list<GeneratorArgumentInfo> arginfos;
+  options->opt_level = std::min(options->opt_level, 3u);
+  options->size_level = std::min(options->size_level, 2u);
+  options->codegen_opt_level = std::min(options->codegen_opt_level, 3u);
+  options->division_precision = std::min(options->division_precision, 2u);
+}
 
+const JitModuleOptions &JitModule::getOptions()
+{
+  return internal->options;
+}
+
+std::string JitModule::targetKey()
+{
+  std::string cpu;
+  std::vector<std::string> attrs;
+
+  resolve_target(cpu, attrs);
+
+  std::string key = cpu;
+  for (std::vector<std::string>::iterator attr = attrs.begin(); attr != attrs.end(); ++attr)
+    key += " " + *attr;
+
+  return key;
+}
+
+JitModule::JitModule(const char *sourcecode, unsigned int  module_flags, const JitModuleOptions *options)
+{
+  flags = module_flags;
+  module = NULL;
+  internal = new JitModuleState();
+  internal->source = sourcecode;
+
+  if (options)
+    internal->options = *options;
+  else
+    jit_module_options_init(&internal->options);
+
+  clampOptions(&internal->options);
+  resolve_target(internal->cpu, internal->attrs);
+
+  /* Modules with precompiled iterations don't touch LLVM until something
+   * that wasn't precompiled is requested.
+   */
+  PrecompiledRegistry::lookup(sourcecode, internal->options, internal->precompiled);
+
+  if (internal->precompiled.empty())
+  {
+    try
+      {
+        initializeCompiler();
+      }
+    catch (std::exception& e)
+      {
+        delete internal;
+        throw;
+      }
+  }
+}
+
+void JitModule::initializeCompiler()
+{
+  /* Lean modules drop the base module after each compile and come back here
+   * to build it again from the source.
+   */
+  if (module)
+    return;
+
+  initializeTarget();
+
+  /* Every JitModule has a private LLVMContext and ExecutionEngine, nothing
+   * below touches state shared with another JitModule so independent modules
+   * can be built and iterated on different threads at the same time.
+   */
+  if (!internal->context)
+    internal->context = new LLVMContext();
+
+  const char *sourcecode = internal->source.c_str();
+
+  /* A module found in the code cache has already been optimized */
+  bool cached_module = false;
+  bool generated_module = false;
+
+  /* Tiered baselines are made from a module that still has the branches to count */
+  bool tiered = (flags & (JIT_MODULE_TIERED | JIT_MODULE_PROFILE)) != 0;
+  std::string module_key = tiered ? "tiered module" : "module";
+
+  if (JitDiskCache::isEnabled())
+  {
+    module = JitDiskCache::load(internal->codeCacheKey(module_key), *internal->context);
+    cached_module = generated_module = (module != NULL);
+
+    if (cached_module && (flags & JIT_MODULE_VERBOSE))
+      cout << "Loaded module from the code cache" << endl;
+  }
+
+  if (!module)
+  {
+    /* Parse the source string */
+    std::stringstream source_code_stream(sourcecode);
+    ModuleAST *ast = nanjit::parse(source_code_stream);
+
+    if (ast)
+    {
+      if (flags & JIT_MODULE_DEBUG_AST)
+          ast->print(cout) << endl;
+
+      Module *maybe_module = new Module("nanJIT Module", *internal->context);
+
+      try
+        {
+          ast->codegen(maybe_module);
+          apply_fast_math(maybe_module, internal->options.fast_math);
+          module = maybe_module;
+          generated_module = true;
+        }
+      catch (std::exception& e)
+        {
+          cout << "Codegen error: " << e.what() << endl;
+          delete maybe_module;
+        }
+    }
+
+    delete ast;
+  }
+
+  if (!module)
+    module = new Module("nanJIT Empty Module", *internal->context);
+
+  for (Module::iterator func = module->begin(); func != module->end(); ++func)
+  {
+    if (func->isDeclaration())
+      continue;
+
+    std::vector<std::string> &names = internal->argument_names[func->getName()];
+    names.clear();
+    for (Function::arg_iterator arg = func->arg_begin(); arg != func->arg_end(); ++arg)
+      names.push_back(arg->getName());
+  }
+
+  if (internal->execution_engine)
+  {
+    internal->execution_engine->addModule(module);
+  }
+  else
+  {
+    std::string errStr;
+    EngineBuilder engine_builder(module);
+    internal->memory_manager = new JitCodeMemoryManager();
+    engine_builder.setJITMemoryManager(internal->memory_manager);
+    engine_builder.setMCPU(internal->cpu);
+    engine_builder.setMAttrs(internal->attrs);
+    engine_builder.setOptLevel((CodeGenOpt::Level)internal->options.codegen_opt_level);
+    engine_builder.setTargetOptions(internal->targetOptions());
+    internal->target_machine = engine_builder.selectTarget();
+    internal->execution_engine = engine_builder.setErrorStr(&errStr).create(internal->target_machine);
+
+    if (!internal->execution_engine)
+      {
+        internal->memory_manager = NULL;
+        delete module;
+        module = NULL;
+        throw JitModuleException("Could not create ExecutionEngine: " + errStr);
+      }
+  }
+
+  if (flags & JIT_MODULE_VERBOSE)
+    cout << "JIT Target: " << internal->target_machine->getTargetTriple().str() << " " << internal->cpu << endl;
+
+  if (!cached_module)
+  {
+    /* Waits for the target machine to know if the target has estimate instructions */
+    lower_division(module, internal->target_machine, internal->options.division_precision);
+    internal->optimizeModule(module, NULL, -1, tiered);
+
+    /* Modules that failed to generate aren't cached so the error is reported again */
+    if (generated_module)
+      JitDiskCache::store(internal->codeCacheKey(module_key), module);
+  }
+
+  if (flags & JIT_MODULE_DEBUG_LLVM)
+    module->dump();
+}
+
+bool JitIterationBatchEntry::parse(const std::string &signature)
+{
+  std::string rest = signature;
+
+  range = false;
+  argstrs.clear();
+
+  if (rest.compare(0, 6, "range:") == 0)
+  {
+    range = true;
+    rest = rest.substr(6);
+  }
+
+  size_t colon = rest.find(':');
+  if (colon == std::string::npos || colon == 0)
+    return false;
+
+  function_name = rest.substr(0, colon);
+  rest = rest.substr(colon + 1);
+
+  size_t start = 0;
+  while (start <= rest.size())
+  {
+    size_t comma = rest.find(',', start);
+    if (comma == std::string::npos)
+      comma = rest.size();
+
+    std::string argtype = rest.substr(start, comma - start);
+    if (argtype.empty())
+      return false;
+    argstrs.push_back(argtype);
+
+    start = comma + 1;
+  }
+
+  return true;
+}
+
+void *JitModule::getIteration(const char *function_name, const char *return_type, ...)
+{
+  const char *argv[ITERATION_CACHE_MAX_ARGS];
+
+  va_list vargs;
+  va_start(vargs, return_type);
+  int argc = collect_type_strings(argv, return_type, vargs);
+  va_end(vargs);
+
+  return getIteration(function_name, argv, argc);
+}
+
+void *JitModule::getIteration(const char *function_name, const std::list<std::string> &argstrs)
+{
+  const char *argv[ITERATION_CACHE_MAX_ARGS];
+  int argc = 0;
+
+  for(std::list<std::string>::const_iterator iter = argstrs.begin(); iter != argstrs.end(); ++iter)
+  {
+    if (argc == ITERATION_CACHE_MAX_ARGS)
+    {
+      argc = -1;
+      break;
+    }
+    argv[argc++] = iter->c_str();
+  }
+
+  return getIteration(function_name, argv, argc);
+}
+
+void *JitModule::getIteration(const char *function_name, const char * const *argv, int argc)
+{
+  if (argc < 1)
+  {
+    printf("Error in getIteration(%s): Invalid number of argument types\n", function_name);
+    return NULL;
+  }
+
+  /* Fast path: already compiled iterations are found without locking */
+  uint32_t hash = IterationCache::hashKey(ITERATION_KIND_LINEAR, function_name, argv, argc);
+  IterationRecord *record = internal->iteration_cache.lookup(hash, ITERATION_KIND_LINEAR, function_name, argv, argc);
+  void *result = record ? record->use(internal->use_epoch) : NULL;
+
+  if (result)
+    return result;
+
+  MutexGuard locked(internal->lock);
+
+  record = find_precompiled_iteration(internal, ITERATION_KIND_LINEAR, function_name, argv, argc);
+
+  if (!record)
+  {
+    JitPendingIteration iteration(ITERATION_KIND_LINEAR, function_name);
+    if (buildIteration(iteration, std::list<std::string>(argv, argv + argc)))
+      record = internal->records[iteration.description];
+  }
+
+  if (!record)
+    return NULL;
+
+  internal->iteration_cache.insert(hash, ITERATION_KIND_LINEAR, function_name, argv, argc, record);
+  result = internal->useLocked(record);
+
+  /* Making room for the iteration mustn't evict it before the caller has it */
+  record->refcount++;
+  enforceMemoryBudget();
+  record->refcount--;
+
+  return result;
+}
+
+void *JitModule::getSpecializedIteration(const char *function_name, const JitArgumentBinding *bindings,
+                                         unsigned int binding_count, const char * const *argv, int argc)
+{
+  if (argc < 1)
+  {
+    printf("Error in getSpecializedIteration(%s): Invalid number of argument types\n", function_name);
+    return NULL;
+  }
+
+  std::vector<std::string> names;
+
+  {
+    MutexGuard locked(internal->lock);
+
+    try
+    {
+      if (!internal->argument_names.count(function_name))
+        initializeCompiler();
+    }
+    catch (std::exception& e)
+    {
+      printf("Error in getSpecializedIteration(%s): %s\n", function_name, e.what());
+      return NULL;
+    }
+
+    std::map<std::string, std::vector<std::string> >::iterator found = internal->argument_names.find(function_name);
+    if (found != internal->argument_names.end())
+      names = found->second;
+  }
+
+  /* Bound values go into the type strings, so the iteration is cached and
+   * described by them like any other.
+   */
+  std::vector<std::string> argstrs(argv, argv + argc);
+
+  for (unsigned int i = 0; i < binding_count; ++i)
+  {
+    std::vector<std::string>::iterator name = std::find(names.begin(), names.end(), bindings[i].name);
+    size_t index = (name - names.begin()) + 1;
+
+    if (name == names.end() || index >= argstrs.size())
+    {
+      printf("Error in getSpecializedIteration(%s): No argument \"%s\"\n", function_name, bindings[i].name);
+      return NULL;
+    }
+
+    /* Hexadecimal so the value survives the round trip exactly */
+    char value[64];
+    snprintf(value, sizeof(value), "value(%a) ", bindings[i].value);
+    argstrs[index] = value + argstrs[index];
+  }
+
+  return getIteration(function_name, std::list<std::string>(argstrs.begin(), argstrs.end()));
+}
+
+void *JitModule::getRangeIteration(const char *function_name, const char *return_type, ...)
+{
+  const char *argv[ITERATION_CACHE_MAX_ARGS];
+
+  va_list vargs;
+  va_start(vargs, return_type);
+  int argc = collect_type_strings(argv, return_type, vargs);
+  va_end(vargs);
+
+  return getRangeIteration(function_name, argv, argc);
+}
+
+void *JitModule::getRangeIteration(const char *function_name, const std::list<std::string> &argstrs)
+{
+  const char *argv[ITERATION_CACHE_MAX_ARGS];
+  int argc = 0;
+
+  for(std::list<std::string>::const_iterator iter = argstrs.begin(); iter != argstrs.end(); ++iter)
+  {
+    if (argc == ITERATION_CACHE_MAX_ARGS)
+    {
+      argc = -1;
+      break;
+    }
+    argv[argc++] = iter->c_str();
+  }
+
+  return getRangeIteration(function_name, argv, argc);
+}
+
+void *JitModule::getRangeIteration(const char *function_name, const char * const *argv, int argc)
+{
+  if (argc < 1)
+  {
+    printf("Error in getRangeIteration(%s): Invalid number of argument types\n", function_name);
+    return NULL;
+  }
+
+  /* Fast path: already compiled iterations are found without locking */
+  uint32_t hash = IterationCache::hashKey(ITERATION_KIND_RANGE, function_name, argv, argc);
+  IterationRecord *record = internal->iteration_cache.lookup(hash, ITERATION_KIND_RANGE, function_name, argv, argc);
+  void *result = record ? record->use(internal->use_epoch) : NULL;
+
+  if (result)
+    return result;
+
+  MutexGuard locked(internal->lock);
+
+  record = find_precompiled_iteration(internal, ITERATION_KIND_RANGE, function_name, argv, argc);
+
+  if (!record)
+  {
+    JitPendingIteration iteration(ITERATION_KIND_RANGE, function_name);
+    if (buildIteration(iteration, std::list<std::string>(argv, argv + argc)))
+      record = internal->records[iteration.description];
+  }
+
+  if (!record)
+    return NULL;
+
+  internal->iteration_cache.insert(hash, ITERATION_KIND_RANGE, function_name, argv, argc, record);
+  result = internal->useLocked(record);
+
+  /* Making room for the iteration mustn't evict it before the caller has it */
+  record->refcount++;
+  enforceMemoryBudget();
+  record->refcount--;
+
+  return result;
+}
+
+/* The function if the iteration is already compiled */
+static void *find_cached_iteration(JitModuleState *internal, IterationKind kind, const char *function_name,
+                                   const std::list<std::string> &argstrs)
+{
+  const char *argv[ITERATION_CACHE_MAX_ARGS];
+  int argc = 0;
+
+  for(std::list<std::string>::const_iterator iter = argstrs.begin(); iter != argstrs.end(); ++iter)
+  {
+    if (argc == ITERATION_CACHE_MAX_ARGS)
+      return NULL;
+    argv[argc++] = iter->c_str();
+  }
+
+  uint32_t hash = IterationCache::hashKey(kind, function_name, argv, argc);
+  IterationRecord *record = internal->iteration_cache.lookup(hash, kind, function_name, argv, argc);
+
+  return record ? record->use(internal->use_epoch) : NULL;
+}
+
+static void cache_iteration(JitModuleState *internal, IterationKind kind, const char *function_name,
+                            const std::list<std::string> &argstrs, IterationRecord *record)
+{
+  const char *argv[ITERATION_CACHE_MAX_ARGS];
+  int argc = 0;
+
+  for(std::list<std::string>::const_iterator iter = argstrs.begin(); iter != argstrs.end(); ++iter)
+  {
+    if (argc == ITERATION_CACHE_MAX_ARGS)
+      return;
+    argv[argc++] = iter->c_str();
+  }
+
+  uint32_t hash = IterationCache::hashKey(kind, function_name, argv, argc);
+  internal->iteration_cache.insert(hash, kind, function_name, argv, argc, record);
+}
+
+/* Parse argstrs into arginfos and build the description liveFunctions is keyed on */
+static std::string describe_iteration(IterationKind kind, const std::string &function_name,
+                                      const std::list<std::string> &argstrs,
+                                      std::list<GeneratorArgumentInfo> &arginfos)
+{
   stringstream function_description;
 
+  for(std::list<std::string>::const_iterator iter = argstrs.begin(); iter != argstrs.end(); ++iter)
+  {
+    arginfos.push_back(GeneratorArgumentInfo(*iter));
+  }
+
+  if (arginfos.empty())
+    throw GeneratorException("No return type given");
+
+  std::list<GeneratorArgumentInfo>::iterator iter = arginfos.begin();
+  GeneratorArgumentInfo return_info = *iter++; /* Skip the return value when printing args */
+
+  if (kind == ITERATION_KIND_RANGE)
+    function_description << function_name << ".range1D(";
+  else
+    function_description << function_name << "(";
+
+  while(iter != arginfos.end())
+  {
+    function_description << iter->toStr();
+
+    if (++iter != arginfos.end())
+      function_description << ", ";
+  }
+  function_description << ") -> " << return_info.toStr();
+
+  return function_description.str();
+}
+
+/* Copy function_name and everything it calls from source into dest. Copied
+ * definitions are given internal linkage so they are discarded once they've
+ * been inlined into the iteration wrappers.
+ */
+static void import_function(Module *dest, Module *source, const std::string &function_name)
+{
+  Function *root = source->getFunction(function_name);
+
+  if (!root || dest->getFunction(function_name))
+    return;
+
+  ValueToValueMapTy value_map;
+  std::vector<Function *> to_declare(1, root);
+  std::vector<Function *> to_clone;
+
+  /* Declare everything first so the cloned bodies can refer to each other */
+  while (!to_declare.empty())
+    {
+      Function *source_func = to_declare.back();
+      to_declare.pop_back();
+
+      if (value_map.count(source_func))
+        continue;
+
+      Function *dest_func = dest->getFunction(source_func->getName());
+      if (!dest_func)
+        {
+          dest_func = Function::Create(source_func->getFunctionType(), source_func->getLinkage(),
+                                       source_func->getName(), dest);
+          dest_func->copyAttributesFrom(source_func);
+        }
+      value_map[source_func] = dest_func;
+
+      if (source_func->isDeclaration() || !dest_func->isDeclaration())
+        continue;
+
+      dest_func->setLinkage(GlobalValue::InternalLinkage);
+      to_clone.push_back(source_func);
+
+      for (Function::iterator block = source_func->begin(); block != source_func->end(); ++block)
+        for (BasicBlock::iterator inst = block->begin(); inst != block->end(); ++inst)
+          for (User::op_iterator op = inst->op_begin(); op != inst->op_end(); ++op)
+            if (Function *callee = dyn_cast<Function>(op->get()))
+              to_declare.push_back(callee);
+    }
+
+  for (std::vector<Function *>::iterator iter = to_clone.begin(); iter != to_clone.end(); ++iter)
+    {
+      Function *source_func = *iter;
+      Function *dest_func = cast<Function>(value_map[source_func]);
+
+      Function::arg_iterator dest_arg = dest_func->arg_begin();
+      for (Function::arg_iterator arg = source_func->arg_begin(); arg != source_func->arg_end(); ++arg, ++dest_arg)
+        {
+          dest_arg->setName(arg->getName());
+          value_map[arg] = dest_arg;
+        }
+
+      SmallVector<ReturnInst*, 8> returns;
+      CloneFunctionInto(dest_func, source_func, value_map, true, returns);
+    }
+}
+
+void *JitModule::buildIteration(JitPendingIteration &iteration, const std::list<std::string> &argstrs)
+{
+  try
+  {
+    iteration.description = describe_iteration(iteration.kind, iteration.function_name, argstrs, iteration.arginfos);
+    iteration.argstrs = argstrs;
+  }
+  catch (std::exception& e)
+  {
+    printf("Error in getIteration(%s): %s\n", iteration.function_name.c_str(), e.what());
+    return NULL;
+  }
+
+  std::map<std::string, JitModuleIterationData>::iterator existing = liveFunctions.find(iteration.description);
+  if (existing != liveFunctions.end())
+  {
+    if (flags & JIT_MODULE_VERBOSE)
+      cout << "Existing function for " << iteration.description << endl;
+    return existing->second.compiledFunciton;
+  }
+
+  try
+  {
+    initializeCompiler();
+  }
+  catch (std::exception& e)
+  {
+    printf("Error in getIteration(%s): %s\n", iteration.function_name.c_str(), e.what());
+    return NULL;
+  }
+
+  std::vector<JitPendingIteration *> pending(1, &iteration);
+  compileIterations(pending);
+
+  if (flags & JIT_MODULE_LEAN)
+    discardIR();
+
+  return liveFunctions[iteration.description].compiledFunciton;
+}
+
+/* The only externally visible definition in a cached iteration module is its wrapper */
+static Function *find_cached_wrapper(Module *cached_module)
+{
+  for (Module::iterator func = cached_module->begin(); func != cached_module->end(); ++func)
+    if (!func->isDeclaration() && !func->hasLocalLinkage())
+      return func;
+
+  return NULL;
+}
+
+/* Write a module holding just wrapper and what it calls to the code cache */
+static void store_cached_wrapper(const std::string &key, Module *batch_module, Function *wrapper,
+                                 const std::vector<Function *> &wrappers)
+{
+  if (wrappers.size() == 1)
+    {
+      JitDiskCache::store(key, batch_module);
+      return;
+    }
+
+  ValueToValueMapTy value_map;
+  auto_ptr<Module> entry_module(CloneModule(batch_module, value_map));
+
+  for (std::vector<Function *>::const_iterator iter = wrappers.begin(); iter != wrappers.end(); ++iter)
+    {
+      if (*iter == wrapper)
+        continue;
+
+      Value *other_wrapper = value_map[*iter];
+      cast<Function>(other_wrapper)->eraseFromParent();
+    }
+
+  PassManager cleanup_passes;
+  cleanup_passes.add(createGlobalDCEPass());
+  cleanup_passes.run(*entry_module);
+
+  JitDiskCache::store(key, entry_module.get());
+}
+
+Module *JitModule::generateIterations(std::vector<JitPendingIteration *> &pending, std::vector<Function *> &wrappers,
+                                      bool profiled)
+{
+  /* Every wrapper goes into the same module so the optimizer and the
+   * JIT's setup costs are paid once per batch instead of once per iteration.
+   * Only the functions the wrappers call are copied in, the rest of the
+   * source module was optimized in the constructor and is left alone.
+   */
+  Module *iteration_module = new Module("nanJIT Iteration Module", *internal->context);
+  iteration_module->setDataLayout(module->getDataLayout());
+  iteration_module->setTargetTriple(module->getTargetTriple());
+
+  for (std::vector<JitPendingIteration *>::iterator iter = pending.begin(); iter != pending.end(); ++iter)
+  {
+    JitPendingIteration *iteration = *iter;
+
+    if (flags & JIT_MODULE_VERBOSE)
+      cout << "Will generate " << iteration->description << endl;
+
+    import_function(iteration_module, module, iteration->function_name);
+
+    /* Kernels that start by returning an argument unchanged skip ahead over
+     * runs of elements like that, which needs the guard too. Kernels that do
+     * nothing but copy, fill or scale don't need to be called at all.
+     */
+    int guard_arg = -1;
+    KernelPattern pattern;
+    if (iteration->kind != ITERATION_KIND_RANGE)
+      {
+        classify_kernel(module->getFunction(iteration->function_name), pattern);
+
+        /* Profiled code has to run the kernel on skipped elements too, or
+         * their way through its if statements isn't counted.
+         */
+        guard_arg = profiled ? -1 : llvm_guard_argument(module, iteration->function_name);
+        if (guard_arg >= 0)
+          import_function(iteration_module, module, iteration->function_name + NANJIT_GUARD_SUFFIX);
+      }
+
+    try
+    {
+      if (iteration->kind == ITERATION_KIND_RANGE)
+        {
+          iteration->function = llvm_def_for_range(iteration_module, iteration->function_name, iteration->arginfos);
+        }
+      else
+        {
+          iteration->function = llvm_def_for_pattern(iteration_module, iteration->function_name, iteration->arginfos, pattern);
+
+          if (!iteration->function)
+            iteration->function = llvm_def_for(iteration_module, iteration->function_name, iteration->arginfos, guard_arg);
+          else if (flags & JIT_MODULE_VERBOSE)
+            cout << "Generated " << iteration->description << " without calling " << iteration->function_name << endl;
+        }
+      iteration->fallback = false;
+    }
+    catch (std::exception& e)
+    {
+      printf("Error in function_for(%s): %s\n", iteration->function_name.c_str(), e.what());
+
+      if (iteration->kind == ITERATION_KIND_RANGE)
+        iteration->function = llvm_void_def_for_range(iteration_module, iteration->function_name, iteration->arginfos);
+      else
+        iteration->function = llvm_void_def_for(iteration_module, iteration->function_name, iteration->arginfos);
+      iteration->fallback = true;
+    }
+
+    wrappers.push_back(iteration->function);
+  }
+
+  return iteration_module;
+}
+
+/* Rough size of the IR held by module */
+static size_t estimate_ir_bytes(Module *module)
+{
+  size_t bytes = sizeof(Module);
+
+  for (Module::iterator func = module->begin(); func != module->end(); ++func)
+  {
+    bytes += sizeof(Function) + func->arg_size() * sizeof(Argument);
+
+    for (Function::iterator block = func->begin(); block != func->end(); ++block)
+    {
+      bytes += sizeof(BasicBlock);
+
+      for (BasicBlock::iterator inst = block->begin(); inst != block->end(); ++inst)
+        bytes += sizeof(Instruction) + inst->getNumOperands() * sizeof(Use);
+    }
+  }
+
+  return bytes;
+}
+
+void JitModule::jitIteration(JitPendingIteration *iteration, Module *iteration_module, size_t ir_bytes)
+{
+  JitModuleIterationData iter_data;
+
+  iter_data.module = iteration_module;
+  iter_data.function = iteration->function;
+  iter_data.voidFunction = iteration->fallback;
+  iter_data.ir_bytes = ir_bytes;
+
+  {
+    MachineCodeInfo machine_code_info;
+    internal->execution_engine->runJITOnFunction(iteration->function, &machine_code_info);
+    if (flags & JIT_MODULE_VERBOSE)
+      printf("jit result %lld bytes @ %p\n", (long long)machine_code_info.size(), machine_code_info.address());
+    iter_data.compiledFunciton = internal->execution_engine->getPointerToFunction(iteration->function);
+    iter_data.code_bytes = machine_code_info.size();
+  }
+
+  if (iteration->dispatcher)
+  {
+    /* Callers get the dispatcher, the narrow version is already compiled */
+    MachineCodeInfo machine_code_info;
+    internal->execution_engine->runJITOnFunction(iteration->dispatcher, &machine_code_info);
+
+    iter_data.wide_function = iteration->function;
+    iter_data.narrow_function = iteration->narrow_function;
+    iter_data.function = iteration->dispatcher;
+
+    iter_data.compiledFunciton = internal->execution_engine->getPointerToFunction(iteration->dispatcher);
+    iter_data.code_bytes += machine_code_info.size() + iteration->narrow_code_bytes;
+  }
+
+  if (iteration->trampoline)
+  {
+    /* Callers get the trampoline, which starts out calling the baseline code */
+    MachineCodeInfo machine_code_info;
+    internal->execution_engine->runJITOnFunction(iteration->trampoline, &machine_code_info);
+
+    iter_data.baseline_function = iteration->function;
+    iter_data.function = iteration->trampoline;
+    iter_data.tier_slot = (void * volatile *)internal->execution_engine->getPointerToGlobal(iteration->tier_slot);
+    *iter_data.tier_slot = iter_data.compiledFunciton;
+
+    iter_data.compiledFunciton = internal->execution_engine->getPointerToFunction(iteration->trampoline);
+    iter_data.code_bytes += machine_code_info.size();
+  }
+
+  if (iteration->profile_counters)
+  {
+    iter_data.profile = (unsigned long long *)internal->execution_engine->getPointerToGlobal(iteration->profile_counters);
+    iter_data.profile_branches = iteration->profile_branches;
+  }
+
+  /* Iterations that were evicted and are compiled again reuse their record */
+  IterationRecord *&record = internal->records[iteration->description];
+  if (!record)
+    record = new IterationRecord();
+
+  record->function = iter_data.compiledFunciton;
+  sys::MemoryFence();
+  record->evicted = 0;
+  iter_data.record = record;
+
+  internal->module_users[iteration_module]++;
+  internal->memory_used += iter_data.code_bytes + iter_data.ir_bytes;
+
+  liveFunctions[iteration->description] = iter_data;
+}
+
+bool JitModule::evictIteration(std::map<std::string, JitModuleIterationData>::iterator iter)
+{
+  JitModuleIterationData &iter_data = iter->second;
+  IterationRecord *record = iter_data.record;
+
+  if (record->refcount)
+    return false;
+
+  /* Lock free lookups stop handing out the function before it's freed */
+  record->evicted = 1;
+  sys::MemoryFence();
+
+  if (flags & JIT_MODULE_VERBOSE)
+    cout << "Evicting " << iter->first << endl;
+
+  Module *iteration_module = iter_data.module;
+
+  if (iter_data.tier_module)
+  {
+    internal->module_users.erase(iter_data.tier_module);
+    internal->freeModule(iter_data.tier_module);
+  }
+
+  if (--internal->module_users[iteration_module] == 0)
+  {
+    /* Last iteration in its module, free everything the module compiled */
+    internal->module_users.erase(iteration_module);
+    internal->freeModule(iteration_module);
+  }
+  else
+  {
+    internal->execution_engine->freeMachineCodeForFunction(iter_data.function);
+    if (iter_data.baseline_function)
+      internal->execution_engine->freeMachineCodeForFunction(iter_data.baseline_function);
+    if (iter_data.wide_function)
+      internal->execution_engine->freeMachineCodeForFunction(iter_data.wide_function);
+    if (iter_data.narrow_function)
+      internal->narrow_engine->freeMachineCodeForFunction(iter_data.narrow_function);
+  }
+
+  internal->memory_used -= iter_data.code_bytes + iter_data.ir_bytes;
+  liveFunctions.erase(iter);
+
+  return true;
+}
+
+static void delete_bodies(Module *module)
+{
+  for (Module::iterator func = module->begin(); func != module->end(); ++func)
+    if (!func->isDeclaration())
+      func->deleteBody();
+}
+
+void JitModule::discardIR()
+{
+  /* Everything an iteration calls was compiled along with it, once the
+   * machine code exists only the Function objects are needed to free it.
+   */
+  std::map<Module *, size_t> shares;
+
+  for (std::map<Module *, int>::iterator user = internal->module_users.begin(); user != internal->module_users.end(); ++user)
+  {
+    Module *iteration_module = user->first;
+
+    delete_bodies(iteration_module);
+    size_t ir_bytes = estimate_ir_bytes(iteration_module);
+
+    std::map<Module *, Module *>::iterator narrow = internal->narrow_modules.find(iteration_module);
+    if (narrow != internal->narrow_modules.end())
+    {
+      delete_bodies(narrow->second);
+      ir_bytes += estimate_ir_bytes(narrow->second);
+    }
+
+    shares[iteration_module] = ir_bytes / user->second;
+  }
+
+  for (std::map<std::string, JitModuleIterationData>::iterator iter = liveFunctions.begin(); iter != liveFunctions.end(); ++iter)
+  {
+    JitModuleIterationData &iter_data = iter->second;
+    size_t ir_bytes = shares[iter_data.module];
+
+    if (iter_data.tier_module)
+      ir_bytes += shares[iter_data.tier_module];
+
+    internal->memory_used = internal->memory_used - iter_data.ir_bytes + ir_bytes;
+    iter_data.ir_bytes = ir_bytes;
+  }
+
+  if (module)
+  {
+    internal->execution_engine->removeModule(module);
+    delete module;
+    module = NULL;
+  }
+}
+
+void JitModule::enforceMemoryBudget()
+{
+  if (!internal->memory_budget || internal->memory_used <= internal->memory_budget)
+    return;
+
+  /* Unreferenced iterations, least recently used first */
+  std::multimap<uint32_t, std::string> candidates;
+  std::map<std::string, JitModuleIterationData>::iterator iter;
+
+  for (iter = liveFunctions.begin(); iter != liveFunctions.end(); ++iter)
+    if (!iter->second.record->refcount)
+      candidates.insert(std::make_pair((uint32_t)iter->second.record->last_used, iter->first));
+
+  for (std::multimap<uint32_t, std::string>::iterator candidate = candidates.begin();
+       candidate != candidates.end() && internal->memory_used > internal->memory_budget;
+       ++candidate)
+  {
+    iter = liveFunctions.find(candidate->second);
+    if (iter != liveFunctions.end())
+      evictIteration(iter);
+  }
+}
+
+void *JitModule::acquireIteration(void *function)
+{
+  MutexGuard locked(internal->lock);
+
+  std::map<std::string, JitModuleIterationData>::iterator iter;
+
+  for (iter = liveFunctions.begin(); iter != liveFunctions.end(); ++iter)
+  {
+    if (iter->second.compiledFunciton != function)
+      continue;
+
+    iter->second.record->refcount++;
+    return function;
+  }
+
+  /* Precompiled iterations are never evicted */
+  std::map<const JitPrecompiledIteration *, IterationRecord *>::iterator precompiled;
+  for (precompiled = internal->precompiled_records.begin(); precompiled != internal->precompiled_records.end(); ++precompiled)
+    if (precompiled->second->function == function)
+      return function;
+
+  return NULL;
+}
+
+void JitModule::releaseIteration(void *function)
+{
+  MutexGuard locked(internal->lock);
+
+  std::map<std::string, JitModuleIterationData>::iterator iter;
+
+  for (iter = liveFunctions.begin(); iter != liveFunctions.end(); ++iter)
+  {
+    if (iter->second.compiledFunciton != function)
+      continue;
+
+    IterationRecord *record = iter->second.record;
+    if (record->refcount)
+      record->refcount--;
+    break;
+  }
+
+  enforceMemoryBudget();
+}
+
+void JitModule::setMemoryBudget(size_t bytes)
+{
+  MutexGuard locked(internal->lock);
+
+  internal->memory_budget = bytes;
+  enforceMemoryBudget();
+}
+
+size_t JitModule::getMemoryUsage()
+{
+  MutexGuard locked(internal->lock);
+
+  return internal->memory_used;
+}
+
+void JitModule::setTierThreshold(size_t elements)
+{
+  MutexGuard locked(internal->lock);
+
+  internal->tier_threshold = elements;
+}
+
+void JitModule::setMultiversionThreshold(size_t elements)
+{
+  MutexGuard locked(internal->lock);
+
+  internal->multiversion_threshold = elements;
+}
+
+bool JitModule::isIterationOptimized(void *function)
+{
+  MutexGuard locked(internal->lock);
+
+  std::map<std::string, JitModuleIterationData>::iterator iter;
+
+  for (iter = liveFunctions.begin(); iter != liveFunctions.end(); ++iter)
+    if (iter->second.compiledFunciton == function)
+      return !iter->second.tier_slot || iter->second.tier_module;
+
+  return true;
+}
+
+void JitModule::tierUpIteration(int kind, const char *function_name, const std::list<std::string> &argstrs)
+{
+  MutexGuard locked(internal->lock);
+
+  JitPendingIteration iteration((IterationKind)kind, function_name);
+
+  try
+  {
+    iteration.description = describe_iteration(iteration.kind, iteration.function_name, argstrs, iteration.arginfos);
+    iteration.argstrs = argstrs;
+  }
+  catch (std::exception& e)
+  {
+    return;
+  }
+
+  /* The iteration may have been evicted since it asked */
+  std::map<std::string, JitModuleIterationData>::iterator live = liveFunctions.find(iteration.description);
+  if (live == liveFunctions.end() || !live->second.tier_slot || live->second.tier_module)
+    return;
+
+  if (flags & JIT_MODULE_VERBOSE)
+    cout << "Optimizing " << iteration.description << endl;
+
+  Module *tier_module = NULL;
+
   try
   {
-    for(std::list<std::string>::const_iterator iter = argstrs.begin(); iter != argstrs.end(); ++iter)
+    initializeCompiler();
+
+    std::vector<JitPendingIteration *> pending(1, &iteration);
+    std::vector<Function *> wrappers;
+    tier_module = generateIterations(pending, wrappers);
+
+    if (iteration.fallback)
+    {
+      delete tier_module;
+      return;
+    }
+
+    /* The counts keep changing while this runs, which doesn't matter for a profile */
+    if (live->second.profile)
+      apply_branch_profile(tier_module, live->second.profile, live->second.profile_branches,
+                           internal->options.if_convert_cost);
+
+    internal->optimizeModule(tier_module, &wrappers, std::max(internal->options.opt_level, 3u));
+  }
+  catch (std::exception& e)
+  {
+    printf("Error optimizing %s: %s\n", iteration.description.c_str(), e.what());
+    delete tier_module;
+    return;
+  }
+
+  internal->execution_engine->addModule(tier_module);
+
+  MachineCodeInfo machine_code_info;
+  internal->execution_engine->runJITOnFunction(iteration.function, &machine_code_info);
+  void *optimized = internal->execution_engine->getPointerToFunction(iteration.function);
+  internal->memory_manager->seal();
+
+  /* Calls already running the baseline code finish with it, which is why it
+   * stays around until the iteration is evicted.
+   */
+  JitModuleIterationData &iter_data = live->second;
+  sys::MemoryFence();
+  *iter_data.tier_slot = optimized;
+
+  size_t ir_bytes = estimate_ir_bytes(tier_module);
+
+  iter_data.tier_module = tier_module;
+  iter_data.code_bytes += machine_code_info.size();
+  iter_data.ir_bytes += ir_bytes;
+  internal->module_users[tier_module] = 1;
+  internal->memory_used += machine_code_info.size() + ir_bytes;
+
+  if (flags & JIT_MODULE_LEAN)
+    discardIR();
+
+  enforceMemoryBudget();
+}
+
+void JitModule::optimizeIteration(void *function)
+{
+  MutexGuard locked(internal->lock);
+
+  std::map<std::string, JitModuleIterationData>::iterator iter;
+
+  for (iter = liveFunctions.begin(); iter != liveFunctions.end(); ++iter)
+    if (iter->second.compiledFunciton == function)
+    {
+      std::map<std::string, JitTierState *>::iterator state = internal->tier_states.find(iter->first);
+
+      if (state != internal->tier_states.end())
+        tierUpIteration(state->second->kind, state->second->function_name.c_str(), state->second->argstrs);
+      return;
+    }
+}
+
+unsigned int JitModule::getIterationProfile(void *function, unsigned long long *calls, unsigned long long *elements,
+                                            JitBranchProfile *branches, unsigned int max_branches)
+{
+  MutexGuard locked(internal->lock);
+
+  std::map<std::string, JitModuleIterationData>::iterator iter;
+  const unsigned long long *profile = NULL;
+  unsigned int branch_count = 0;
+
+  for (iter = liveFunctions.begin(); iter != liveFunctions.end(); ++iter)
+    if (iter->second.compiledFunciton == function)
     {
-      arginfos.push_back(GeneratorArgumentInfo(*iter));
+      profile = iter->second.profile;
+      branch_count = iter->second.profile_branches;
+      break;
     }
 
+  if (calls)
+    *calls = profile ? profile[PROFILE_CALLS] : 0;
+  if (elements)
+    *elements = profile ? profile[PROFILE_ELEMENTS] : 0;
+
+  for (unsigned int i = 0; branches && i < branch_count && i < max_branches; ++i)
+  {
+    branches[i].not_taken = profile[PROFILE_BRANCHES + 2 * i];
+    branches[i].taken = profile[PROFILE_BRANCHES + 2 * i + 1];
+  }
+
+  return branch_count;
+}
+
+void JitModule::getCodeMemoryStats(JitCodeMemoryStats *stats)
+{
+  MutexGuard locked(internal->lock);
+
+  if (internal->memory_manager)
+    internal->memory_manager->getStats(stats);
+  else
+    memset(stats, 0, sizeof(*stats));
+}
+
+size_t JitModule::getIterationMemory(void *function)
+{
+  MutexGuard locked(internal->lock);
+
+  std::map<std::string, JitModuleIterationData>::iterator iter;
+
+  for (iter = liveFunctions.begin(); iter != liveFunctions.end(); ++iter)
+    if (iter->second.compiledFunciton == function)
+      return iter->second.code_bytes + iter->second.ir_bytes;
+
+  return 0;
+}
+
+void JitModule::compileIterations(std::vector<JitPendingIteration *> &pending)
+{
+  std::vector<JitPendingIteration *> uncached;
+
+  /* Tiered modules start with cheap code and recompile whatever gets hot */
+  bool tiered = (flags & (JIT_MODULE_TIERED | JIT_MODULE_PROFILE)) != 0;
+
+  /* Cached iterations are fully optimized, tiered ones need their trampoline
+   * and counters so they're never loaded, just as they're never stored.
+   */
+  if (!JitDiskCache::isEnabled() || tiered)
+    uncached = pending;
+  else
+  {
+    /* Iterations found in the code cache are already optimized and go straight to the JIT */
+    for (std::vector<JitPendingIteration *>::iterator iter = pending.begin(); iter != pending.end(); ++iter)
     {
-      std::list<GeneratorArgumentInfo>::iterator iter = arginfos.begin();
-      GeneratorArgumentInfo return_info = *iter++; /* Skip the return value when printing args */
+      JitPendingIteration *iteration = *iter;
+      Module *cached_module = JitDiskCache::load(internal->codeCacheKey(iteration->description), *internal->context);
+
+      if (cached_module)
+        iteration->function = find_cached_wrapper(cached_module);
 
-      function_description << function_name << ".range1D(";
-      while(iter != arginfos.end())
+      if (!cached_module || !iteration->function)
       {
-        function_description << iter->toStr();
+        delete cached_module;
+        uncached.push_back(iteration);
+        continue;
+      }
+
+      if (flags & JIT_MODULE_VERBOSE)
+        cout << "Loaded " << iteration->description << " from the code cache" << endl;
+
+      iteration->fallback = false;
+      internal->execution_engine->addModule(cached_module);
 
-        if (++iter != arginfos.end())
-          function_description << ", ";
+      size_t ir_bytes = estimate_ir_bytes(cached_module);
+      if (flags & JIT_MODULE_MULTIVERSION)
+      {
+        std::vector<JitPendingIteration *> cached(1, iteration);
+        ir_bytes += buildNarrowVersions(cached_module, cached);
       }
-      function_description << ") -> " << return_info.toStr();
+
+      jitIteration(iteration, cached_module, ir_bytes);
     }
 
-    if (liveFunctions.find(function_description.str()) != liveFunctions.end())
+    if (uncached.empty())
     {
-      if (flags & JIT_MODULE_VERBOSE)
-        cout << "Existing function for " << function_description.str() << endl;
-      return liveFunctions[function_description.str()].compiledFunciton;
+      internal->memory_manager->seal();
+      return;
     }
   }
-  catch (std::exception& e)
+
+  std::vector<Function *> wrappers;
+  Module *iteration_module = generateIterations(uncached, wrappers, (flags & JIT_MODULE_PROFILE) != 0);
+
+  if (flags & JIT_MODULE_DEBUG_LLVM)
+    iteration_module->dump();
+
+  internal->optimizeModule(iteration_module, &wrappers, tiered ? (int)std::min(internal->options.opt_level, 1u) : -1, tiered);
+
+  if (tiered)
   {
-    printf("Error in getIteration(%s): %s\n", function_name, e.what());
-    return NULL;
+    for (std::vector<JitPendingIteration *>::iterator iter = uncached.begin(); iter != uncached.end(); ++iter)
+    {
+      JitPendingIteration *iteration = *iter;
+
+      if (iteration->fallback)
+        continue;
+
+      JitTierState *&state = internal->tier_states[iteration->description];
+      if (!state)
+      {
+        state = new JitTierState();
+        state->module = this;
+        state->kind = iteration->kind;
+        state->function_name = iteration->function_name;
+        state->argstrs = iteration->argstrs;
+      }
+
+      iteration->trampoline = build_tier_trampoline(iteration_module, iteration->function, iteration->kind,
+                                                    internal->tier_threshold, state, iteration->tier_slot);
+
+      /* Counted after optimizing so only branches the optimizer kept are counted */
+      if (flags & JIT_MODULE_PROFILE)
+        iteration->profile_branches = instrument_iteration(iteration->function, iteration->kind,
+                                                           iteration->profile_counters);
+    }
+  }
+  else if (JitDiskCache::isEnabled())
+  {
+    /* Fallbacks aren't cached so their errors are reported again */
+    for (std::vector<JitPendingIteration *>::iterator iter = uncached.begin(); iter != uncached.end(); ++iter)
+      if (!(*iter)->fallback)
+        store_cached_wrapper(internal->codeCacheKey((*iter)->description), iteration_module, (*iter)->function, wrappers);
   }
 
-  Module *cloned_module = CloneModule(module);
+  internal->execution_engine->addModule(iteration_module);
 
-  try
+  /* The module's IR is shared out between the iterations in it */
+  size_t ir_bytes = estimate_ir_bytes(iteration_module);
+
+  /* After the code cache store, dispatchers hold addresses in this process.
+   * Tiered iterations are left alone, the trampoline already sits in front
+   * of them.
+   */
+  if ((flags & JIT_MODULE_MULTIVERSION) && !tiered)
+    ir_bytes += buildNarrowVersions(iteration_module, uncached);
+
+  ir_bytes /= uncached.size();
+
+  for (std::vector<JitPendingIteration *>::iterator iter = uncached.begin(); iter != uncached.end(); ++iter)
+    jitIteration(*iter, iteration_module, ir_bytes);
+
+  /* Nothing compiled above can run until it's sealed, the whole batch
+   * shares as few pages as possible.
+   */
+  internal->memory_manager->seal();
+}
+
+/* Compile a copy of iteration_module for NARROW_TARGET_CPU and give each
+ * iteration in it a dispatcher that picks a version by element count.
+ * Returns the IR bytes of the copy.
+ */
+size_t JitModule::buildNarrowVersions(Module *iteration_module, std::vector<JitPendingIteration *> &iterations)
+{
+  ExecutionEngine *narrow_engine = internal->getNarrowEngine();
+
+  if (!narrow_engine)
+    return 0;
+
+  Module *narrow_module = CloneModule(iteration_module);
+  narrow_engine->addModule(narrow_module);
+  internal->narrow_modules[iteration_module] = narrow_module;
+
+  for (std::vector<JitPendingIteration *>::iterator iter = iterations.begin(); iter != iterations.end(); ++iter)
   {
-    if (flags & JIT_MODULE_VERBOSE)
-      cout << "Will generate " << function_description.str() << endl;
+    JitPendingIteration *iteration = *iter;
+
+    if (iteration->fallback)
+      continue;
+
+    MachineCodeInfo machine_code_info;
+    Function *narrow_function = narrow_module->getFunction(iteration->function->getName());
+    narrow_engine->runJITOnFunction(narrow_function, &machine_code_info);
+    void *narrow_code = narrow_engine->getPointerToFunction(narrow_function);
+
+    iteration->narrow_function = narrow_function;
+    iteration->narrow_code_bytes = machine_code_info.size();
+    iteration->dispatcher = build_dispatcher(iteration_module, iteration->function, iteration->kind,
+                                             internal->multiversion_threshold, narrow_code);
+  }
 
-    Function *iter_func = llvm_def_for_range(cloned_module, std::string(function_name), arginfos);
+  internal->narrow_memory_manager->seal();
 
-    if (flags & JIT_MODULE_DEBUG_LLVM)
-      cloned_module->dump();
+  return estimate_ir_bytes(narrow_module);
+}
+
+void JitModule::getIterations(std::vector<JitIterationBatchEntry> &entries)
+{
+  MutexGuard locked(internal->lock);
 
-    internal->optimizeModule(cloned_module);
+  std::vector<JitPendingIteration> iterations;
+  std::vector<JitPendingIteration *> pending;
+  std::set<std::string> pending_descriptions;
+  std::vector<IterationRecord *> precompiled(entries.size(), (IterationRecord *)NULL);
+  std::vector<IterationRecord *> handed_out;
 
-    JitModuleIterationData iter_data;
+  for (std::vector<JitIterationBatchEntry>::iterator entry = entries.begin(); entry != entries.end(); ++entry)
+    iterations.push_back(JitPendingIteration(entry->range ? ITERATION_KIND_RANGE : ITERATION_KIND_LINEAR,
+                                             entry->function_name));
 
-    iter_data.module = cloned_module;
-    iter_data.function = iter_func;
-    iter_data.voidFunction = false;
+  for (size_t i = 0; i < entries.size(); ++i)
+  {
+    JitPendingIteration &iteration = iterations[i];
 
     {
-      MachineCodeInfo machine_code_info;
-      internal->execution_engine->runJITOnFunction(iter_func, &machine_code_info);
-      if (flags & JIT_MODULE_VERBOSE)
-        printf("jit result %lld bytes @ %p\n", (long long)machine_code_info.size(), machine_code_info.address());
-      iter_data.compiledFunciton = internal->execution_engine->getPointerToFunction(iter_func);
+      std::vector<const char *> argv;
+      for (std::list<std::string>::iterator iter = entries[i].argstrs.begin(); iter != entries[i].argstrs.end(); ++iter)
+        argv.push_back(iter->c_str());
+
+      if (!argv.empty())
+        precompiled[i] = find_precompiled_iteration(internal, iteration.kind, iteration.function_name.c_str(),
+                                                    &argv[0], argv.size());
+      if (precompiled[i])
+        continue;
+    }
+
+    try
+    {
+      iteration.description = describe_iteration(iteration.kind, iteration.function_name, entries[i].argstrs, iteration.arginfos);
+      iteration.argstrs = entries[i].argstrs;
+    }
+    catch (std::exception& e)
+    {
+      printf("Error in getIteration(%s): %s\n", iteration.function_name.c_str(), e.what());
+      continue;
     }
 
-    liveFunctions[function_description.str()] = iter_data;
+    if (liveFunctions.find(iteration.description) != liveFunctions.end())
+      continue;
 
-    return iter_data.compiledFunciton;
+    /* The same signature may be requested more than once in a batch */
+    if (pending_descriptions.insert(iteration.description).second)
+      pending.push_back(&iteration);
   }
-  catch (std::exception& e)
+
+  if (!pending.empty())
   {
-    printf("Error in function_for(%s): %s\n", function_name, e.what());
+    try
+    {
+      initializeCompiler();
+      compileIterations(pending);
 
-    Function *iter_func = llvm_void_def_for_range(cloned_module, std::string(function_name), arginfos);
+      if (flags & JIT_MODULE_LEAN)
+        discardIR();
+    }
+    catch (std::exception& e)
+    {
+      printf("Error in getIterations(): %s\n", e.what());
+    }
+  }
 
-    internal->optimizeModule(cloned_module);
+  for (size_t i = 0; i < entries.size(); ++i)
+  {
+    IterationRecord *record = precompiled[i];
+    entries[i].function = NULL;
 
-    JitModuleIterationData iter_data;
+    if (!record)
+    {
+      std::map<std::string, JitModuleIterationData>::iterator live = liveFunctions.find(iterations[i].description);
 
-    iter_data.module = cloned_module;
-    iter_data.function = iter_func;
-    iter_data.voidFunction = true;
+      if (iterations[i].description.empty() || live == liveFunctions.end())
+        continue;
 
-    {
-      MachineCodeInfo machine_code_info;
-      internal->execution_engine->runJITOnFunction(iter_func, &machine_code_info);
-      if (flags & JIT_MODULE_VERBOSE)
-        printf("jit result %lld bytes @ %p\n", (long long)machine_code_info.size(), machine_code_info.address());
-      iter_data.compiledFunciton = internal->execution_engine->getPointerToFunction(iter_func);
+      record = live->second.record;
     }
 
-    liveFunctions[function_description.str()] = iter_data;
+    entries[i].function = internal->useLocked(record);
+    cache_iteration(internal, iterations[i].kind, iterations[i].function_name.c_str(), entries[i].argstrs, record);
 
-    return iter_data.compiledFunciton;
+    handed_out.push_back(record);
   }
+
+  /* Making room for the batch mustn't evict any of it */
+  for (std::vector<IterationRecord *>::iterator iter = handed_out.begin(); iter != handed_out.end(); ++iter)
+    (*iter)->refcount++;
+  enforceMemoryBudget();
+  for (std::vector<IterationRecord *>::iterator iter = handed_out.begin(); iter != handed_out.end(); ++iter)
+    (*iter)->refcount--;
+}
+
+JitIterationRequest *JitModule::requestIteration(int priority, const char *function_name, const std::list<std::string> &argstrs)
+{
+  JitIterationRequest *request = new JitIterationRequest();
+  request->module = this;
+  request->kind = ITERATION_KIND_LINEAR;
+  request->function_name = function_name;
+  request->argstrs = argstrs;
+  request->priority = priority;
+
+  /* Requests for existing iterations finish without a trip through the queue */
+  void *existing = find_cached_iteration(internal, ITERATION_KIND_LINEAR, function_name, argstrs);
+
+  if (existing)
+    JitCompileQueue::get()->complete(request, existing);
+  else
+    JitCompileQueue::get()->submit(request);
+
+  return request;
+}
+
+JitIterationRequest *JitModule::requestRangeIteration(int priority, const char *function_name, const std::list<std::string> &argstrs)
+{
+  JitIterationRequest *request = new JitIterationRequest();
+  request->module = this;
+  request->kind = ITERATION_KIND_RANGE;
+  request->function_name = function_name;
+  request->argstrs = argstrs;
+  request->priority = priority;
+
+  void *existing = find_cached_iteration(internal, ITERATION_KIND_RANGE, function_name, argstrs);
+
+  if (existing)
+    JitCompileQueue::get()->complete(request, existing);
+  else
+    JitCompileQueue::get()->submit(request);
+
+  return request;
 }
 
 bool JitModule::isFallbackFunction(void *function)
 {
+  MutexGuard locked(internal->lock);
+
   std::map<std::string, JitModuleIterationData>::iterator iter;
 
   for(iter = liveFunctions.begin();
@@ -524,9 +2433,196 @@ bool JitModule::isFallbackFunction(void *function)
   return false;
 }
 
+/* C spelling of the LLVM types used in iteration wrapper signatures */
+static std::string c_type_for(Type *type)
+{
+  if (type->isFloatTy())
+    return "float";
+  if (type->isIntegerTy(32))
+    return "int32_t";
+  if (type->isIntegerTy(16))
+    return "int16_t";
+  if (type->isIntegerTy(8))
+    return "int8_t";
+
+  if (VectorType *vector_type = dyn_cast<VectorType>(type))
+  {
+    stringstream vector_str;
+    vector_str << c_type_for(vector_type->getElementType());
+    vector_str << " __attribute__((vector_size(" << vector_type->getBitWidth() / 8 << ")))";
+    return vector_str.str();
+  }
+
+  if (PointerType *pointer_type = dyn_cast<PointerType>(type))
+  {
+    Type *element_type = pointer_type->getElementType();
+
+    /* Arrays of vectors are declared as pointers to their elements */
+    if (VectorType *vector_type = dyn_cast<VectorType>(element_type))
+      element_type = vector_type->getElementType();
+
+    return c_type_for(element_type) + " *";
+  }
+
+  throw GeneratorException("No C type for " + llvm_type_to_string(type));
+}
+
+static std::string c_declaration_for(Function *wrapper, IterationKind kind)
+{
+  stringstream declaration;
+  FunctionType *func_type = wrapper->getFunctionType();
+
+  /* The trailing count or range parameters are unsigned */
+  unsigned int count_params = (kind == ITERATION_KIND_RANGE) ? 2 : 1;
+  unsigned int param_count = func_type->getNumParams();
+
+  declaration << "void " << wrapper->getName().str() << "(";
+  for (unsigned int i = 0; i < param_count; ++i)
+  {
+    if (i >= param_count - count_params)
+      declaration << "uint32_t";
+    else
+      declaration << c_type_for(func_type->getParamType(i));
+
+    if (i + 1 != param_count)
+      declaration << ", ";
+  }
+  declaration << ");\n";
+
+  return declaration.str();
+}
+
+bool JitModule::compileToObject(std::vector<JitIterationBatchEntry> &entries, const std::vector<std::string> &symbols,
+                                const char *cpu, const char *object_path, std::string &declarations, std::string &error)
+{
+  MutexGuard locked(internal->lock);
+
+  error.clear();
+
+  if (entries.size() != symbols.size())
+  {
+    error = "Every iteration needs a symbol name";
+    return false;
+  }
+
+  std::vector<JitPendingIteration> iterations;
+  std::vector<JitPendingIteration *> pending;
+
+  try
+  {
+    initializeCompiler();
+
+    for (std::vector<JitIterationBatchEntry>::iterator entry = entries.begin(); entry != entries.end(); ++entry)
+    {
+      iterations.push_back(JitPendingIteration(entry->range ? ITERATION_KIND_RANGE : ITERATION_KIND_LINEAR,
+                                               entry->function_name));
+      iterations.back().description = describe_iteration(iterations.back().kind, entry->function_name,
+                                                         entry->argstrs, iterations.back().arginfos);
+    }
+  }
+  catch (std::exception& e)
+  {
+    error = e.what();
+    return false;
+  }
+
+  for (std::vector<JitPendingIteration>::iterator iter = iterations.begin(); iter != iterations.end(); ++iter)
+    pending.push_back(&*iter);
+
+  std::vector<Function *> wrappers;
+  auto_ptr<Module> object_module(generateIterations(pending, wrappers));
+
+  declarations.clear();
+
+  for (size_t i = 0; i < iterations.size(); ++i)
+  {
+    if (iterations[i].fallback)
+    {
+      error = "Could not generate " + iterations[i].description;
+      return false;
+    }
+
+    wrappers[i]->setName(symbols[i]);
+    if (wrappers[i]->getName() != symbols[i])
+    {
+      error = "Duplicate symbol " + symbols[i];
+      return false;
+    }
+
+    try
+    {
+      declarations += c_declaration_for(wrappers[i], iterations[i].kind);
+    }
+    catch (std::exception& e)
+    {
+      error = e.what();
+      return false;
+    }
+  }
+
+  if (flags & JIT_MODULE_DEBUG_LLVM)
+    object_module->dump();
+
+  internal->optimizeModule(object_module.get(), &wrappers);
+
+  /* The JIT's TargetMachine is set up for in-memory code, objects get their own */
+  InitializeNativeTargetAsmPrinter();
+
+  std::string triple = sys::getDefaultTargetTriple();
+  const Target *target = TargetRegistry::lookupTarget(triple, error);
+  if (!target)
+    return false;
+
+  TargetOptions target_options = internal->targetOptions();
+  auto_ptr<TargetMachine> object_target(target->createTargetMachine(triple, cpu ? cpu : "", "", target_options,
+                                                                    Reloc::PIC_, CodeModel::Default,
+                                                                    (CodeGenOpt::Level)internal->options.codegen_opt_level));
+  if (!object_target.get())
+  {
+    error = "Could not create a TargetMachine for " + triple;
+    return false;
+  }
+
+  object_module->setTargetTriple(triple);
+  object_module->setDataLayout(object_target->getDataLayout()->getStringRepresentation());
+
+  raw_fd_ostream object_stream(object_path, error, raw_fd_ostream::F_Binary);
+  if (!error.empty())
+    return false;
+
+  {
+    PassManager emit_passes;
+    emit_passes.add(new DataLayout(*object_target->getDataLayout()));
+
+    formatted_raw_ostream formatted_stream(object_stream);
+    if (object_target->addPassesToEmitFile(emit_passes, formatted_stream, TargetMachine::CGFT_ObjectFile))
+    {
+      error = "Target can't emit object files";
+      return false;
+    }
+
+    emit_passes.run(*object_module);
+  }
+
+  return true;
+}
+
 std::string JitModule::getLLVMCode()
 {
+  MutexGuard locked(internal->lock);
+
   std::string result;
+
+  try
+    {
+      initializeCompiler();
+    }
+  catch (std::exception& e)
+    {
+      printf("Error in getLLVMCode(): %s\n", e.what());
+      return result;
+    }
+
   llvm::raw_string_ostream rso(result);
 
   PassManager PM;
@@ -538,18 +2634,7 @@ std::string JitModule::getLLVMCode()
 
 JitModule::~JitModule()
 {
-  JitSingleton *singleton = JitSingleton::get();
-
-  std::map<std::string, JitModuleIterationData>::iterator iter;
-
-  for(iter = liveFunctions.begin();
-      iter != liveFunctions.end();
-      ++iter)
-  {
-    singleton->removeModule(iter->second.module);
-  }
-
-  singleton->removeModule(module);
+  JitCompileQueue::cancelRequestsFor(this);
 
   delete internal;
 }
@@ -1,9 +1,15 @@
 #ifndef __JITMODULE_HPP__
 #define __JITMODULE_HPP__
+#include <stddef.h>
+
 #ifndef __cplusplus
 typedef struct _JitModule JitModule;
+typedef struct _JitIterationRequest JitIterationRequest;
+typedef struct _JitPrewarm JitPrewarm;
 #else
 class JitModule;
+class JitIterationRequest;
+class JitPrewarm;
 #endif
 
 #ifdef __cplusplus
@@ -14,13 +20,235 @@ extern "C" {
     JIT_MODULE_DEFAULT_FLAGS = 0x0,
     JIT_MODULE_DEBUG_AST  = 0x0100,
     JIT_MODULE_DEBUG_LLVM = 0x0200,
-    JIT_MODULE_VERBOSE    = 0x0400
+    JIT_MODULE_VERBOSE    = 0x0400,
+    JIT_MODULE_PRIVATE    = 0x0800, /* Don't share the module with other callers using the same source */
+    JIT_MODULE_LEAN       = 0x1000, /* Free IR once it's compiled, regenerating it from the source when needed */
+    JIT_MODULE_TIERED     = 0x2000, /* Compile iterations quickly first, optimize them once they've processed enough elements */
+    JIT_MODULE_PROFILE    = 0x4000, /* Tiered, with the quick code counting which way each if statement goes */
+    JIT_MODULE_MULTIVERSION = 0x8000 /* Also compile untiered iterations without AVX, for calls with few elements */
   } JitModuleFlags;
 
+  typedef enum
+  {
+    JIT_PRIORITY_LOW    = 0,
+    JIT_PRIORITY_NORMAL = 1,
+    JIT_PRIORITY_HIGH   = 2
+  } JitRequestPriority;
+
+  /* Called once when a request finishes, from the compile thread or from
+   * jit_request_set_callback if the request was already finished. function is
+   * NULL if the module was destroyed before the request ran.
+   */
+  typedef void (*JitIterationReadyCallback)(JitIterationRequest *request, void *function, void *user_data);
+
+  typedef enum
+  {
+    JIT_FAST_MATH_NONE            = 0x0,
+    JIT_FAST_MATH_REASSOC         = 0x1,  /* Any algebraically equivalent rewrite, implies the rest for the optimizer */
+    JIT_FAST_MATH_CONTRACT        = 0x2,  /* Fuse multiplies and adds */
+    JIT_FAST_MATH_NO_NANS         = 0x4,
+    JIT_FAST_MATH_NO_INFS         = 0x8,
+    JIT_FAST_MATH_NO_SIGNED_ZEROS = 0x10,
+    JIT_FAST_MATH_RECIPROCAL      = 0x20, /* Division may use a multiply by the reciprocal */
+    JIT_FAST_MATH_ALL             = 0x3f
+  } JitFastMathFlags;
+
+  /* How float division is done, the approximations use the CPU's reciprocal
+   * estimate and are only available on x86, elsewhere division stays exact.
+   */
+  typedef enum
+  {
+    JIT_DIVISION_FULL   = 0, /* Correctly rounded */
+    JIT_DIVISION_22_BIT = 1, /* Estimate plus one Newton-Raphson step, dividing by 0 gives NaN */
+    JIT_DIVISION_12_BIT = 2  /* Estimate only */
+  } JitDivisionPrecision;
+
+  typedef struct
+  {
+    unsigned int opt_level;         /* IR optimization, 0 to 3 like -O0 to -O3 */
+    unsigned int size_level;        /* 0 optimizes for speed, 1 is like -Os and 2 like -Oz */
+    unsigned int codegen_opt_level; /* Machine code optimization, 0 to 3 */
+    unsigned int loop_vectorize;
+    unsigned int slp_vectorize;     /* Needs LLVM 3.3 */
+    unsigned int unroll_loops;
+    unsigned int unroll_threshold;  /* 0 uses LLVM's default */
+    unsigned int fast_math;         /* JitFastMathFlags for all floating point math in the module */
+    unsigned int division_precision; /* JitDivisionPrecision, native_divide and friends are always 12 bit */
+    unsigned int if_convert_cost;   /* Largest if statement turned into selects, 0 only obeys __attribute__((if_convert)) */
+  } JitModuleOptions;
+
+  /* Fill options with the defaults jit_module_for_src uses */
+  void jit_module_options_init(JitModuleOptions *options);
+
+  /* Modules for identical source, flags and options are shared unless
+   * JIT_MODULE_PRIVATE is set, every call must be matched by a
+   * jit_module_destroy. Options apply to the module and every iteration
+   * compiled from it, NULL options are the defaults.
+   */
   JitModule *jit_module_for_src(const char *src, unsigned int module_flags);
+  JitModule *jit_module_for_src_with_options(const char *src, unsigned int module_flags, const JitModuleOptions *options);
+  /* Take another reference to jm, released with jit_module_destroy */
+  JitModule *jit_module_ref(JitModule *jm);
   void *jit_module_get_iteration(JitModule *jm, const char *function_name, const char *return_type, ...);
   void *jit_module_get_range_iteration(JitModule *jm, const char *function_name, const char *return_type, ...);
   unsigned int jit_module_is_fallback_function(JitModule *jm, void *func);
+
+  typedef struct
+  {
+    const char *name;  /* An argument passed as a single value */
+    double value;
+  } JitArgumentBinding;
+
+  /* Like jit_module_get_iteration, with the arguments named in bindings
+   * replaced by constants that are folded into the compiled code. The
+   * iteration still takes those arguments but ignores what's passed. Each set
+   * of values gets its own cached iteration. Equivalent to prefixing the type
+   * strings with "value(1.0)", for example "value(1.0) float".
+   */
+  void *jit_module_get_specialized_iteration(JitModule *jm, const char *function_name,
+                                             const JitArgumentBinding *bindings, unsigned int binding_count,
+                                             const char *return_type, ...);
+
+  /* Generate count iterations with a single optimization pass. signatures[i] is a
+   * NULL terminated list of type strings for function_names[i], starting with the
+   * return type. Returns the number of results that are not fallback functions.
+   */
+  unsigned int jit_module_get_iterations(JitModule *jm, unsigned int count, const char * const *function_names,
+                                         const char * const * const *signatures, void **functions);
+
+  typedef struct
+  {
+    const char *function_name;
+    int range;                      /* Non-zero for range iterations */
+    const char * const *signature;  /* NULL terminated type strings, return type first */
+    void *function;
+    const JitModuleOptions *options; /* What it was compiled with, NULL for the defaults */
+  } JitPrecompiledIteration;
+
+  /* Make iterations compiled by nanjit-compile available to modules created
+   * from exactly the same source text and options. Modules with precompiled iterations
+   * don't initialize LLVM until an iteration that wasn't precompiled is
+   * requested. Register before creating the modules, iterations is not copied.
+   */
+  void jit_register_precompiled(const char *source, const JitPrecompiledIteration *iterations, unsigned int count);
+
+  /* Keep optimized modules and iterations in path so later processes can skip
+   * parsing and optimizing them. NULL disables the cache, by default the
+   * NANJIT_CACHE_DIR environment variable is used.
+   */
+  void jit_set_code_cache_directory(const char *path);
+
+  /* Asynchronous versions of jit_module_get_iteration, the iteration is generated
+   * on a background thread. The returned request must be freed with
+   * jit_request_release.
+   */
+  JitIterationRequest *jit_module_request_iteration(JitModule *jm, int priority, const char *function_name, const char *return_type, ...);
+  JitIterationRequest *jit_module_request_range_iteration(JitModule *jm, int priority, const char *function_name, const char *return_type, ...);
+  unsigned int jit_request_is_ready(JitIterationRequest *request);
+  void *jit_request_wait(JitIterationRequest *request);
+  void jit_request_set_callback(JitIterationRequest *request, JitIterationReadyCallback callback, void *user_data);
+  void jit_request_release(JitIterationRequest *request);
+
+  /* Initialize LLVM and compile the iterations listed in manifest_path on a
+   * background thread. The manifest is a list of "source FILE" lines, each
+   * followed by the iterations to compile from that file written as
+   * "[range:]function:return_type,arg_type,...". Relative paths are relative
+   * to the manifest, lines starting with '#' are ignored. manifest_path may be
+   * NULL to only initialize LLVM. Returns NULL if the manifest can't be read.
+   */
+  JitPrewarm *jit_prewarm_start(const char *manifest_path, unsigned int module_flags);
+  /* Number of manifest iterations, and how many have been compiled or have failed */
+  unsigned int jit_prewarm_entry_count(JitPrewarm *prewarm);
+  unsigned int jit_prewarm_completed_count(JitPrewarm *prewarm);
+  /* The function for manifest iteration index, NULL until it's ready or if it
+   * failed. Prewarming holds no reference on it, under a memory budget it has
+   * to be acquired from its module like any other iteration.
+   */
+  void *jit_prewarm_entry_function(JitPrewarm *prewarm, unsigned int index);
+  unsigned int jit_prewarm_entry_is_ready(JitPrewarm *prewarm, unsigned int index);
+  void jit_prewarm_wait(JitPrewarm *prewarm);
+  /* The module for a manifest source file, as written in the manifest. Waits
+   * for the module to be created, the module belongs to prewarm.
+   */
+  JitModule *jit_prewarm_get_module(JitPrewarm *prewarm, const char *source_path);
+  /* Waits for the background thread and destroys the prewarmed modules */
+  void jit_prewarm_release(JitPrewarm *prewarm);
+
+  /* Iterations nobody has acquired may be evicted to stay under the module's
+   * memory budget while other iterations are compiled, after which their
+   * functions must not be called. Acquiring a function returned by
+   * jit_module_get_iteration and friends keeps it until it's released, NULL
+   * means it was already evicted and has to be requested again. Lookups
+   * themselves take no reference. A budget of 0 (the default) never evicts
+   * anything.
+   */
+  void *jit_module_acquire_iteration(JitModule *jm, void *func);
+  void jit_module_release_iteration(JitModule *jm, void *func);
+  void jit_module_set_memory_budget(JitModule *jm, size_t bytes);
+  /* Approximate IR and machine code bytes held for compiled iterations */
+  size_t jit_module_get_memory_usage(JitModule *jm);
+  size_t jit_module_get_iteration_memory(JitModule *jm, void *func);
+
+  /* Tiered modules recompile an iteration with full optimization in the
+   * background once it has processed this many elements in total, the
+   * function returned for it doesn't change. Affects iterations compiled
+   * afterwards.
+   */
+  void jit_module_set_tier_threshold(JitModule *jm, size_t elements);
+  /* Zero while func is still running its quickly compiled code */
+  unsigned int jit_module_is_iteration_optimized(JitModule *jm, void *func);
+  /* Optimize a tiered iteration now instead of waiting for the threshold */
+  void jit_module_optimize_iteration(JitModule *jm, void *func);
+
+  typedef struct
+  {
+    unsigned long long taken;     /* Times the if block ran */
+    unsigned long long not_taken;
+  } JitBranchProfile;
+
+  /* What a JIT_MODULE_PROFILE iteration's quickly compiled code has counted so
+   * far, the optimized code is built from the same counts. branches[i] is the
+   * i-th if statement in the module's source, which adds up every copy of it
+   * that unrolling or calls put in the iteration, and stays 0 for statements
+   * the iteration doesn't contain. At most max_branches are written. Any of
+   * the pointers may be NULL. Returns the number of if statements counted, if
+   * statements after the last one the optimizer kept aren't included.
+   */
+  unsigned int jit_module_get_iteration_profile(JitModule *jm, void *func, unsigned long long *calls, unsigned long long *elements,
+                                                JitBranchProfile *branches, unsigned int max_branches);
+
+  /* Compile for cpu with features, a comma separated list of LLVM attributes
+   * like "+avx2,-fma". A NULL or "host" cpu selects the host's CPU, which
+   * NULL features then leave at the host's features. Only affects modules
+   * created afterwards.
+   */
+  void jit_set_target(const char *cpu, const char *features);
+  /* JIT_MODULE_MULTIVERSION iterations run their narrow version for calls
+   * with fewer elements than this. Affects iterations compiled afterwards.
+   */
+  void jit_module_set_multiversion_threshold(JitModule *jm, size_t elements);
+
+  typedef struct
+  {
+    unsigned int slab_count;
+    size_t reserved_bytes;      /* Address space mapped for code and stubs */
+    size_t code_bytes;          /* Live function bodies */
+    size_t stub_bytes;
+    size_t data_bytes;          /* Globals and other non-executable allocations */
+    size_t free_bytes;          /* Code pages with nothing live on them */
+    size_t largest_free_bytes;  /* Largest run of free pages, close to free_bytes means little fragmentation */
+    unsigned int free_runs;
+    size_t wasted_bytes;        /* Unused space on pages holding live code */
+    unsigned int huge_pages;
+  } JitCodeMemoryStats;
+
+  /* Generated code is packed into slabs of slab_size bytes, optionally backed
+   * by 2 MiB huge pages. Only affects modules created afterwards, a slab_size
+   * of 0 selects the default.
+   */
+  void jit_set_code_memory_options(size_t slab_size, unsigned int huge_pages);
+  void jit_module_get_code_memory_stats(JitModule *jm, JitCodeMemoryStats *stats);
+
   void jit_module_destroy(JitModule *jm);
 #ifdef __cplusplus
 };
@@ -29,6 +257,8 @@ extern "C" {
 #ifdef __cplusplus
 #include <map>
 #include <list>
+#include <string>
+#include <vector>
 
 namespace llvm {
   class Module;
@@ -45,6 +275,8 @@ public:
   const char* what() const throw() { return error_string.c_str(); }
 };
 
+class IterationRecord;
+
 class JitModuleIterationData
 {
 public:
@@ -52,11 +284,49 @@ public:
   llvm::Function *function;
   void *compiledFunciton;
   bool voidFunction;
+  IterationRecord *record;
+  size_t code_bytes;
+  size_t ir_bytes; /* This iteration's share of module */
+
+  /* Tiered iterations: function is a trampoline that calls through tier_slot,
+   * which points at baseline_function until tier_module replaces it.
+   */
+  llvm::Function *baseline_function;
+  void * volatile *tier_slot;
+  llvm::Module *tier_module;
 
-  JitModuleIterationData() : module(NULL), function(NULL), compiledFunciton(NULL), voidFunction(false) {};
+  /* Profiled iterations: the baseline code's counters, see jitprofile.h */
+  unsigned long long *profile;
+  unsigned int profile_branches;
+
+  /* Multiversioned iterations: function is a dispatcher calling either
+   * wide_function or narrow_function, which lives in the module's narrow copy.
+   */
+  llvm::Function *wide_function;
+  llvm::Function *narrow_function;
+
+  JitModuleIterationData() : module(NULL), function(NULL), compiledFunciton(NULL), voidFunction(false),
+                             record(NULL), code_bytes(0), ir_bytes(0),
+                             baseline_function(NULL), tier_slot(NULL), tier_module(NULL),
+                             profile(NULL), profile_branches(0), wide_function(NULL), narrow_function(NULL) {};
+};
+
+class JitIterationBatchEntry
+{
+public:
+  std::string function_name;
+  std::list<std::string> argstrs;
+  bool range;
+  void *function;
+
+  JitIterationBatchEntry() : range(false), function(NULL) {};
+
+  /* Parse "[range:]function:return_type,arg_type,..." */
+  bool parse(const std::string &signature);
 };
 
 class JitModuleState;
+class JitPendingIteration;
 
 class JitModule
 {
@@ -66,13 +336,63 @@ class JitModule
 
   std::map<std::string, JitModuleIterationData> liveFunctions;
 
+  void initializeCompiler();
+  void *buildIteration(JitPendingIteration &iteration, const std::list<std::string> &argstrs);
+  llvm::Module *generateIterations(std::vector<JitPendingIteration *> &pending, std::vector<llvm::Function *> &wrappers,
+                                   bool profiled = false);
+  void compileIterations(std::vector<JitPendingIteration *> &pending);
+  void jitIteration(JitPendingIteration *iteration, llvm::Module *iteration_module, size_t ir_bytes);
+  size_t buildNarrowVersions(llvm::Module *iteration_module, std::vector<JitPendingIteration *> &iterations);
+  bool evictIteration(std::map<std::string, JitModuleIterationData>::iterator iter);
+  void enforceMemoryBudget();
+  void discardIR();
+
 public:
-  JitModule(const char *sourcecode, unsigned int module_flags);
+  /* One time process wide LLVM setup, done by the first module if nobody called it earlier */
+  static void initializeTarget();
+  /* See jit_set_target */
+  static void setTarget(const char *cpu, const char *features);
+  /* The CPU and attributes new modules would be compiled for */
+  static std::string targetKey();
+  /* Bring out of range options into range, as modules do */
+  static void clampOptions(JitModuleOptions *options);
+
+  JitModule(const char *sourcecode, unsigned int module_flags, const JitModuleOptions *options = NULL);
+  /* With out of range values clamped, as the module uses them */
+  const JitModuleOptions &getOptions();
   void *getIteration(const char *function_name, const char *return_type, ...) __attribute__ ((sentinel));
   void *getIteration(const char *function_name, const std::list<std::string> &argstrs);
+  void *getIteration(const char *function_name, const char * const *argv, int argc);
+  void *getSpecializedIteration(const char *function_name, const JitArgumentBinding *bindings, unsigned int binding_count,
+                                const char * const *argv, int argc);
   void *getRangeIteration(const char *function_name, const char *return_type, ...) __attribute__ ((sentinel));
   void *getRangeIteration(const char *function_name, const std::list<std::string> &argstrs);
+  void *getRangeIteration(const char *function_name, const char * const *argv, int argc);
+  void getIterations(std::vector<JitIterationBatchEntry> &entries);
+  JitIterationRequest *requestIteration(int priority, const char *function_name, const std::list<std::string> &argstrs);
+  JitIterationRequest *requestRangeIteration(int priority, const char *function_name, const std::list<std::string> &argstrs);
   bool isFallbackFunction(void *function);
+  void *acquireIteration(void *function);
+  void releaseIteration(void *function);
+  void setMemoryBudget(size_t bytes);
+  size_t getMemoryUsage();
+  size_t getIterationMemory(void *function);
+  void getCodeMemoryStats(JitCodeMemoryStats *stats);
+  void setTierThreshold(size_t elements);
+  void setMultiversionThreshold(size_t elements);
+  bool isIterationOptimized(void *function);
+  void optimizeIteration(void *function);
+  unsigned int getIterationProfile(void *function, unsigned long long *calls, unsigned long long *elements,
+                                   JitBranchProfile *branches, unsigned int max_branches);
+  /* Called from the compile thread when a tiered iteration gets hot */
+  void tierUpIteration(int kind, const char *function_name, const std::list<std::string> &argstrs);
+
+  /* Compile entries into a relocatable object with the given symbol names for
+   * the current host's architecture, cpu may be NULL for a generic target.
+   * declarations is set to C prototypes for the symbols.
+   */
+  bool compileToObject(std::vector<JitIterationBatchEntry> &entries, const std::vector<std::string> &symbols,
+                       const char *cpu, const char *object_path, std::string &declarations, std::string &error);
 
   ~JitModule();
   
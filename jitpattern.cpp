@@ -0,0 +1,83 @@
+#include "llvm/Config/config.h"
+#if ((LLVM_VERSION_MAJOR > 3) || ((LLVM_VERSION_MAJOR == 3) && (LLVM_VERSION_MINOR >= 3)))
+#include "llvm/IR/Instructions.h"
+#else
+#include "llvm/Instructions.h"
+#endif
+using namespace llvm;
+
+#include <algorithm>
+
+#include "jitpattern.h"
+
+/* The operand of step that isn't a constant, NULL if it has none or two */
+static Value *affine_input(BinaryOperator *step)
+{
+  switch (step->getOpcode())
+    {
+      case Instruction::Add:
+      case Instruction::FAdd:
+      case Instruction::Mul:
+      case Instruction::FMul:
+        if (isa<Constant>(step->getOperand(0)) && !isa<Constant>(step->getOperand(1)))
+          return step->getOperand(1);
+        /* Fall through */
+      case Instruction::Sub:
+      case Instruction::FSub:
+        if (!isa<Constant>(step->getOperand(0)) && isa<Constant>(step->getOperand(1)))
+          return step->getOperand(0);
+        return NULL;
+      default:
+        return NULL;
+    }
+}
+
+bool classify_kernel(Function *func, KernelPattern &pattern)
+{
+  pattern = KernelPattern();
+
+  if (!func || func->isDeclaration() || func->size() != 1)
+    return false;
+
+  /* Nothing the language can express has side effects, so only what's
+   * returned matters.
+   */
+  ReturnInst *ret = dyn_cast<ReturnInst>(func->getEntryBlock().getTerminator());
+  Value *value = ret ? ret->getReturnValue() : NULL;
+
+  if (!value)
+    return false;
+
+  if (Constant *constant = dyn_cast<Constant>(value))
+    {
+      /* A constant expression may still have to be computed */
+      if (isa<ConstantExpr>(constant))
+        return false;
+
+      pattern.kind = KERNEL_CONSTANT;
+      pattern.value = constant;
+      return true;
+    }
+
+  std::vector<BinaryOperator *> steps;
+
+  while (BinaryOperator *step = dyn_cast<BinaryOperator>(value))
+    {
+      value = affine_input(step);
+      if (!value)
+        return false;
+
+      steps.push_back(step);
+    }
+
+  Argument *argument = dyn_cast<Argument>(value);
+  if (!argument)
+    return false;
+
+  std::reverse(steps.begin(), steps.end());
+
+  pattern.kind = steps.empty() ? KERNEL_IDENTITY : KERNEL_AFFINE;
+  pattern.argument = argument->getArgNo();
+  pattern.steps = steps;
+  return true;
+}
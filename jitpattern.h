@@ -0,0 +1,47 @@
+#ifndef __JITPATTERN_HPP__
+#define __JITPATTERN_HPP__
+
+#include "llvm/Config/config.h"
+#if ((LLVM_VERSION_MAJOR > 3) || ((LLVM_VERSION_MAJOR == 3) && (LLVM_VERSION_MINOR >= 3)))
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstrTypes.h"
+#else
+#include "llvm/Constants.h"
+#include "llvm/Function.h"
+#include "llvm/InstrTypes.h"
+#endif
+
+#include <vector>
+
+typedef enum {
+  KERNEL_GENERIC,
+  KERNEL_IDENTITY, /* Returns an argument unchanged */
+  KERNEL_CONSTANT, /* Always returns the same value */
+  KERNEL_AFFINE    /* Adds, subtracts or multiplies an argument by constants */
+} KernelKind;
+
+/* What an optimized function computes, when it's simple enough for an
+ * iteration to do the same thing without calling it per element.
+ */
+struct KernelPattern
+{
+  KernelKind kind;
+  /* The argument returned by identity and affine kernels */
+  unsigned int argument;
+  /* The value returned by constant kernels */
+  llvm::Constant *value;
+  /* The operations applied to the argument of an affine kernel, innermost
+   * first. Each has a constant for its other operand.
+   */
+  std::vector<llvm::BinaryOperator *> steps;
+
+  KernelPattern() : kind(KERNEL_GENERIC), argument(0), value(NULL) {}
+};
+
+/* Classify func, which should already have been optimized. Returns false and
+ * leaves pattern generic if it computes anything more complicated.
+ */
+bool classify_kernel(llvm::Function *func, KernelPattern &pattern);
+
+#endif /* __JITPATTERN_HPP__ */
@@ -0,0 +1,57 @@
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/MutexGuard.h"
+using namespace llvm;
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "jitprecompiled.h"
+
+typedef std::map<std::string, std::vector<const JitPrecompiledIteration *> > PrecompiledMap;
+
+static sys::Mutex registry_lock;
+static PrecompiledMap registry;
+
+void jit_register_precompiled(const char *source, const JitPrecompiledIteration *iterations, unsigned int count)
+{
+  PrecompiledRegistry::add(source, iterations, count);
+}
+
+void PrecompiledRegistry::add(const char *source, const JitPrecompiledIteration *iterations, unsigned int count)
+{
+  MutexGuard locked(registry_lock);
+
+  std::vector<const JitPrecompiledIteration *> &entries = registry[source];
+
+  for (unsigned int i = 0; i < count; ++i)
+    entries.push_back(&iterations[i]);
+}
+
+void PrecompiledRegistry::lookup(const char *source, const JitModuleOptions &options,
+                                 std::vector<const JitPrecompiledIteration *> &result)
+{
+  MutexGuard locked(registry_lock);
+
+  PrecompiledMap::iterator entries = registry.find(source);
+
+  if (entries == registry.end())
+    return;
+
+  JitModuleOptions defaults;
+  jit_module_options_init(&defaults);
+  JitModule::clampOptions(&defaults);
+
+  for (std::vector<const JitPrecompiledIteration *>::iterator iter = entries->second.begin();
+       iter != entries->second.end(); ++iter)
+    {
+      JitModuleOptions compiled = (*iter)->options ? *(*iter)->options : defaults;
+      JitModule::clampOptions(&compiled);
+
+      /* Code built with other settings would silently ignore the module's */
+      if (!memcmp(&compiled, &options, sizeof(options)))
+        result.push_back(*iter);
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef __JITPRECOMPILED_HPP__
+#define __JITPRECOMPILED_HPP__
+
+#include <string>
+#include <vector>
+
+#include "jitmodule.h"
+
+/* Iterations compiled ahead of time by nanjit-compile, keyed on the exact
+ * source text they were compiled from. The registered tables are not copied
+ * and must stay valid for the life of the process.
+ */
+class PrecompiledRegistry
+{
+public:
+  static void add(const char *source, const JitPrecompiledIteration *iterations, unsigned int count);
+  /* Only iterations compiled with options, which must already be clamped */
+  static void lookup(const char *source, const JitModuleOptions &options,
+                     std::vector<const JitPrecompiledIteration *> &result);
+};
+
+#endif /* __JITPRECOMPILED_HPP__ */
@@ -0,0 +1,314 @@
+#include "llvm/Config/config.h"
+#include "llvm/Analysis/ValueTracking.h"
+#if ((LLVM_VERSION_MAJOR > 3) || ((LLVM_VERSION_MAJOR == 3) && (LLVM_VERSION_MINOR >= 3)))
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/LLVMContext.h"
+#else
+#include "llvm/Constants.h"
+#include "llvm/Function.h"
+#include "llvm/Instructions.h"
+#include "llvm/IntrinsicInst.h"
+#include "llvm/LLVMContext.h"
+#endif
+#include "llvm/Pass.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+using namespace llvm;
+
+#include <algorithm>
+#include <climits>
+
+#include "ast.h"
+#include "jitpredicate.h"
+
+/* Roughly how many simple instructions inst is worth */
+static unsigned int instruction_cost(Instruction *inst)
+{
+  switch (inst->getOpcode())
+    {
+      case Instruction::FDiv:
+      case Instruction::FRem:
+      case Instruction::SDiv:
+      case Instruction::UDiv:
+      case Instruction::SRem:
+      case Instruction::URem:
+      case Instruction::Call:
+        return 4;
+      default:
+        return 1;
+    }
+}
+
+/* Calls to intrinsics that don't touch memory, like llvm.sqrt, are as safe
+ * to run unconditionally as arithmetic is.
+ */
+static bool is_safe_to_speculate(Instruction *inst)
+{
+  if (IntrinsicInst *intrinsic = dyn_cast<IntrinsicInst>(inst))
+    return intrinsic->doesNotAccessMemory();
+
+  return isSafeToSpeculativelyExecute(inst);
+}
+
+/* Add what running the body of block unconditionally costs to cost, false
+ * if it can't be done or cost goes over max_cost.
+ */
+static bool can_speculate(BasicBlock *block, unsigned int &cost, unsigned int max_cost)
+{
+  if (!block)
+    return true;
+
+  for (BasicBlock::iterator inst = block->begin(); &*inst != block->getTerminator(); ++inst)
+    {
+      if (!is_safe_to_speculate(inst))
+        return false;
+
+      cost += instruction_cost(inst);
+      if (cost > max_cost)
+        return false;
+    }
+
+  return true;
+}
+
+/* If side only computes something and jumps on, set arm to it and return
+ * where it jumps to. Otherwise the branch goes straight to side.
+ */
+static BasicBlock *branch_side_target(BasicBlock *head, BasicBlock *side, BasicBlock *&arm)
+{
+  arm = NULL;
+
+  if (side == head || side->getSinglePredecessor() != head || isa<PHINode>(side->begin()))
+    return side;
+
+  BranchInst *exit = dyn_cast<BranchInst>(side->getTerminator());
+  if (!exit || exit->isConditional())
+    return side;
+
+  arm = side;
+  return exit->getSuccessor(0);
+}
+
+/* The mode from the if_convert or no_if_convert attribute, -1 if neither */
+static int branch_mode(BranchInst *branch)
+{
+  MDNode *node = branch->getMetadata(NANJIT_IF_CONVERT_METADATA);
+  ConstantInt *mode = node ? dyn_cast_or_null<ConstantInt>(node->getOperand(0)) : NULL;
+
+  return mode ? (int)mode->getZExtValue() : -1;
+}
+
+static void hoist_body(BasicBlock *block, Instruction *before)
+{
+  while (&block->front() != block->getTerminator())
+    block->front().moveBefore(before);
+}
+
+bool predicate_branch(BranchInst *branch, unsigned int max_cost)
+{
+  BasicBlock *head = branch->getParent();
+  BasicBlock *true_arm;
+  BasicBlock *false_arm;
+  BasicBlock *merge = branch_side_target(head, branch->getSuccessor(0), true_arm);
+  unsigned int cost = 0;
+
+  if (branch_mode(branch) == 0)
+    return false;
+
+  if (merge != branch_side_target(head, branch->getSuccessor(1), false_arm))
+    return false;
+
+  if (merge == head || (!true_arm && !false_arm))
+    return false;
+
+  if (!can_speculate(true_arm, cost, max_cost) || !can_speculate(false_arm, cost, max_cost))
+    return false;
+
+  Value *condition = branch->getCondition();
+  BasicBlock *true_pred = true_arm ? true_arm : head;
+  BasicBlock *false_pred = false_arm ? false_arm : head;
+
+  if (true_arm)
+    hoist_body(true_arm, branch);
+  if (false_arm)
+    hoist_body(false_arm, branch);
+
+  for (BasicBlock::iterator inst = merge->begin(); isa<PHINode>(inst); ++inst)
+    {
+      PHINode *phi = cast<PHINode>(inst);
+      Value *true_value = phi->getIncomingValueForBlock(true_pred);
+      Value *false_value = phi->getIncomingValueForBlock(false_pred);
+      Value *value = true_value;
+
+      if (true_value != false_value)
+        value = SelectInst::Create(condition, true_value, false_value, phi->getName(), branch);
+
+      phi->removeIncomingValue(true_pred, false);
+      phi->removeIncomingValue(false_pred, false);
+      phi->addIncoming(value, head);
+    }
+
+  BranchInst::Create(merge, branch);
+  branch->eraseFromParent();
+
+  if (true_arm)
+    true_arm->eraseFromParent();
+  if (false_arm)
+    false_arm->eraseFromParent();
+
+  return true;
+}
+
+/* The side of a branch that ends the function, NULL unless it's only
+ * reached from head.
+ */
+static ReturnInst *branch_side_return(BasicBlock *head, BasicBlock *side)
+{
+  if (side == head || side->getSinglePredecessor() != head || isa<PHINode>(side->begin()))
+    return NULL;
+
+  ReturnInst *exit = dyn_cast<ReturnInst>(side->getTerminator());
+  if (!exit || !exit->getReturnValue())
+    return NULL;
+
+  return exit;
+}
+
+/* An if with a return in it and the rest of the function both returning,
+ * becomes a single return of a select.
+ */
+static bool predicate_return(BranchInst *branch, unsigned int max_cost)
+{
+  BasicBlock *head = branch->getParent();
+  BasicBlock *true_side = branch->getSuccessor(0);
+  BasicBlock *false_side = branch->getSuccessor(1);
+  ReturnInst *true_return = branch_side_return(head, true_side);
+  ReturnInst *false_return = branch_side_return(head, false_side);
+  unsigned int cost = 0;
+
+  if (!true_return || !false_return || true_side == false_side || branch_mode(branch) == 0)
+    return false;
+
+  if (!can_speculate(true_side, cost, max_cost) || !can_speculate(false_side, cost, max_cost))
+    return false;
+
+  hoist_body(true_side, branch);
+  hoist_body(false_side, branch);
+
+  Value *value = SelectInst::Create(branch->getCondition(), true_return->getReturnValue(),
+                                    false_return->getReturnValue(), "", branch);
+  ReturnInst::Create(head->getContext(), value, branch);
+  branch->eraseFromParent();
+
+  true_side->eraseFromParent();
+  false_side->eraseFromParent();
+
+  return true;
+}
+
+/* How much branch may cost to predicate, 0 if it should stay a branch */
+static unsigned int branch_cost_limit(BranchInst *branch, unsigned int max_cost, bool keep_profiled)
+{
+  int mode = branch_mode(branch);
+
+  if (mode >= 0)
+    return mode ? UINT_MAX : 0;
+
+  /* Baseline code has to keep the if statements it counts, the recompile
+   * decides with the counts.
+   */
+  if (keep_profiled && branch->getMetadata(NANJIT_BRANCH_METADATA))
+    return 0;
+
+  /* Leave branches a profile says mostly go one way to the branch predictor */
+  if (MDNode *node = branch->getMetadata(LLVMContext::MD_prof))
+    {
+      if (node->getNumOperands() == 3)
+        {
+          ConstantInt *taken = dyn_cast_or_null<ConstantInt>(node->getOperand(1));
+          ConstantInt *not_taken = dyn_cast_or_null<ConstantInt>(node->getOperand(2));
+
+          if (taken && not_taken)
+            {
+              uint64_t total = taken->getZExtValue() + not_taken->getZExtValue();
+              uint64_t minority = std::min(taken->getZExtValue(), not_taken->getZExtValue());
+
+              if (minority * PREDICTABLE_RATIO < total)
+                return 0;
+            }
+        }
+    }
+
+  return max_cost;
+}
+
+bool if_convert_function(Function *func, unsigned int max_cost, bool keep_profiled)
+{
+  bool converted = false;
+  bool changed;
+
+  /* Start over after every change, an inner if that's been flattened can
+   * let the one around it be predicated too.
+   */
+  do
+    {
+      changed = false;
+
+      for (Function::iterator block = func->begin(); block != func->end(); ++block)
+        {
+          BranchInst *branch = dyn_cast<BranchInst>(block->getTerminator());
+
+          if (!branch || !branch->isConditional())
+            continue;
+
+          unsigned int limit = branch_cost_limit(branch, max_cost, keep_profiled);
+          if (!limit)
+            continue;
+
+          BasicBlock *head = block;
+          if (predicate_branch(branch, limit))
+            {
+              BasicBlock *merge = head->getTerminator()->getSuccessor(0);
+              if (merge->getSinglePredecessor() == head)
+                MergeBlockIntoPredecessor(merge);
+              changed = true;
+              break;
+            }
+
+          if (predicate_return(branch, limit))
+            {
+              changed = true;
+              break;
+            }
+        }
+
+      converted = converted || changed;
+    }
+  while (changed);
+
+  return converted;
+}
+
+class IfConversionPass : public FunctionPass
+{
+  unsigned int max_cost;
+  bool keep_profiled;
+public:
+  static char ID;
+
+  IfConversionPass(unsigned int cost, bool keep) : FunctionPass(ID), max_cost(cost), keep_profiled(keep) {}
+
+  virtual bool runOnFunction(Function &func)
+  {
+    return if_convert_function(&func, max_cost, keep_profiled);
+  }
+};
+
+char IfConversionPass::ID = 0;
+
+FunctionPass *create_if_conversion_pass(unsigned int max_cost, bool keep_profiled)
+{
+  return new IfConversionPass(max_cost, keep_profiled);
+}
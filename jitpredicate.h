@@ -0,0 +1,39 @@
+#ifndef __JITPREDICATE_HPP__
+#define __JITPREDICATE_HPP__
+
+#include "llvm/Config/config.h"
+#if ((LLVM_VERSION_MAJOR > 3) || ((LLVM_VERSION_MAJOR == 3) && (LLVM_VERSION_MINOR >= 3)))
+#include "llvm/IR/Instructions.h"
+#else
+#include "llvm/Instructions.h"
+#endif
+#include "llvm/Pass.h"
+
+/* A branch whose less common side is taken less than once every this many
+ * times according to its profile is kept as a branch.
+ */
+#define PREDICTABLE_RATIO 5
+
+/* Largest if statement predicated by default, in instructions with divisions
+ * and calls counting as 4. Enough for the early outs in the blend modes.
+ */
+#define DEFAULT_IF_CONVERT_COST 40
+
+/* Turn an if or if/else that joins up again right after into straight line
+ * code, with selects picking the values the branch would have. Only done if
+ * both sides are safe to always run and cost at most max_cost together.
+ */
+bool predicate_branch(llvm::BranchInst *branch, unsigned int max_cost);
+
+/* Predicate the small if statements in func, including ones that return
+ * early, see predicate_branch. Branches tagged by the if_convert and
+ * no_if_convert function attributes ignore max_cost, as do ones a profile
+ * has shown to be predictable, which are left alone. With keep_profiled
+ * the if statements profiling counts are left alone too.
+ */
+bool if_convert_function(llvm::Function *func, unsigned int max_cost, bool keep_profiled = false);
+
+/* A pass running if_convert_function on every function */
+llvm::FunctionPass *create_if_conversion_pass(unsigned int max_cost, bool keep_profiled = false);
+
+#endif /* __JITPREDICATE_HPP__ */
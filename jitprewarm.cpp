@@ -0,0 +1,292 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+using namespace std;
+
+#include "jitintern.h"
+#include "jitprewarm.h"
+
+JitPrewarm *jit_prewarm_start(const char *manifest_path, unsigned int module_flags)
+{
+  JitPrewarm *prewarm = new JitPrewarm(module_flags);
+
+  if (manifest_path && !prewarm->loadManifest(manifest_path))
+    {
+      delete prewarm;
+      return NULL;
+    }
+
+  prewarm->start();
+
+  return prewarm;
+}
+
+unsigned int jit_prewarm_entry_count(JitPrewarm *prewarm)
+{
+  return prewarm->entryCount();
+}
+
+unsigned int jit_prewarm_completed_count(JitPrewarm *prewarm)
+{
+  return prewarm->completedCount();
+}
+
+void *jit_prewarm_entry_function(JitPrewarm *prewarm, unsigned int index)
+{
+  return prewarm->entryFunction(index);
+}
+
+unsigned int jit_prewarm_entry_is_ready(JitPrewarm *prewarm, unsigned int index)
+{
+  return prewarm->isReady(index);
+}
+
+void jit_prewarm_wait(JitPrewarm *prewarm)
+{
+  prewarm->wait();
+}
+
+JitModule *jit_prewarm_get_module(JitPrewarm *prewarm, const char *source_path)
+{
+  return prewarm->getModule(source_path);
+}
+
+void jit_prewarm_release(JitPrewarm *prewarm)
+{
+  delete prewarm;
+}
+
+static std::string trim(const std::string &str)
+{
+  size_t start = str.find_first_not_of(" \t\r\n");
+  size_t end = str.find_last_not_of(" \t\r\n");
+
+  if (start == std::string::npos)
+    return std::string();
+  return str.substr(start, end - start + 1);
+}
+
+JitPrewarm::JitPrewarm(unsigned int module_flags) : thread_started(false), flags(module_flags), completed(0), finished(false)
+{
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&progress, NULL);
+}
+
+JitPrewarm::~JitPrewarm()
+{
+  if (thread_started)
+    pthread_join(thread, NULL);
+
+  for (std::vector<JitPrewarmSource>::iterator source = sources.begin(); source != sources.end(); ++source)
+    if (source->module)
+      JitModuleInternTable::release(source->module);
+
+  pthread_cond_destroy(&progress);
+  pthread_mutex_destroy(&mutex);
+}
+
+bool JitPrewarm::loadManifest(const char *manifest_path)
+{
+  std::ifstream manifest(manifest_path);
+
+  if (!manifest.good())
+    {
+      cout << "Error reading prewarm manifest \"" << manifest_path << "\"" << endl;
+      return false;
+    }
+
+  std::string manifest_dir;
+  {
+    std::string path = manifest_path;
+    size_t slash = path.rfind('/');
+    if (slash != std::string::npos)
+      manifest_dir = path.substr(0, slash + 1);
+  }
+
+  std::string line;
+  int line_number = 0;
+
+  while (std::getline(manifest, line))
+    {
+      line_number++;
+      line = trim(line);
+
+      if (line.empty() || line[0] == '#')
+        continue;
+
+      if (line.compare(0, 7, "source ") == 0)
+        {
+          JitPrewarmSource source;
+          source.path = trim(line.substr(7));
+          source.file_path = (source.path[0] == '/') ? source.path : manifest_dir + source.path;
+          sources.push_back(source);
+          continue;
+        }
+
+      JitPrewarmEntry entry;
+
+      if (sources.empty() || !entry.iteration.parse(line))
+        {
+          cout << "Error in prewarm manifest \"" << manifest_path << "\" line " << line_number << endl;
+          return false;
+        }
+
+      sources.back().entries.push_back(entries.size());
+      entries.push_back(entry);
+    }
+
+  return true;
+}
+
+void JitPrewarm::start()
+{
+  thread_started = (pthread_create(&thread, NULL, threadMain, this) == 0);
+
+  /* Do the work here rather than not at all */
+  if (!thread_started)
+    run();
+}
+
+void *JitPrewarm::threadMain(void *data)
+{
+  static_cast<JitPrewarm *>(data)->run();
+  return NULL;
+}
+
+void JitPrewarm::run()
+{
+  JitModule::initializeTarget();
+
+  for (std::vector<JitPrewarmSource>::iterator source = sources.begin(); source != sources.end(); ++source)
+    {
+      JitModule *module = NULL;
+
+      std::ifstream source_file(source->file_path.c_str(), std::ifstream::binary);
+      if (source_file.good())
+        {
+          std::stringstream sourcecode;
+          sourcecode << source_file.rdbuf();
+
+          /* Shared like jit_module_for_src's modules, so the application
+           * finds this one when it asks for the same source.
+           */
+          try
+            {
+              if (flags & JIT_MODULE_PRIVATE)
+                module = new JitModule(sourcecode.str().c_str(), flags);
+              else
+                {
+                  JitModuleOptions options;
+                  jit_module_options_init(&options);
+                  module = JitModuleInternTable::acquire(sourcecode.str().c_str(), flags, options);
+                }
+            }
+          catch (std::exception& e)
+            {
+              cout << "Error prewarming \"" << source->path << "\": " << e.what() << endl;
+            }
+        }
+      else
+        cout << "Error reading \"" << source->file_path << "\"" << endl;
+
+      pthread_mutex_lock(&mutex);
+      source->module = module;
+      source->module_ready = true;
+      pthread_cond_broadcast(&progress);
+      pthread_mutex_unlock(&mutex);
+
+      /* Everything from one source is compiled as a single batch */
+      std::vector<JitIterationBatchEntry> batch;
+      for (std::vector<unsigned int>::iterator index = source->entries.begin(); index != source->entries.end(); ++index)
+        batch.push_back(entries[*index].iteration);
+
+      if (module && !batch.empty())
+        module->getIterations(batch);
+
+      pthread_mutex_lock(&mutex);
+      for (size_t i = 0; i < batch.size(); ++i)
+        {
+          JitPrewarmEntry &entry = entries[source->entries[i]];
+          entry.iteration.function = module ? batch[i].function : NULL;
+          entry.ready = true;
+          completed++;
+        }
+      pthread_cond_broadcast(&progress);
+      pthread_mutex_unlock(&mutex);
+    }
+
+  pthread_mutex_lock(&mutex);
+  finished = true;
+  pthread_cond_broadcast(&progress);
+  pthread_mutex_unlock(&mutex);
+}
+
+unsigned int JitPrewarm::entryCount()
+{
+  return entries.size();
+}
+
+unsigned int JitPrewarm::completedCount()
+{
+  pthread_mutex_lock(&mutex);
+  unsigned int result = completed;
+  pthread_mutex_unlock(&mutex);
+
+  return result;
+}
+
+bool JitPrewarm::isReady(unsigned int index)
+{
+  if (index >= entries.size())
+    return false;
+
+  pthread_mutex_lock(&mutex);
+  bool result = entries[index].ready;
+  pthread_mutex_unlock(&mutex);
+
+  return result;
+}
+
+void *JitPrewarm::entryFunction(unsigned int index)
+{
+  if (index >= entries.size())
+    return NULL;
+
+  pthread_mutex_lock(&mutex);
+  void *result = entries[index].ready ? entries[index].iteration.function : NULL;
+  pthread_mutex_unlock(&mutex);
+
+  return result;
+}
+
+void JitPrewarm::wait()
+{
+  pthread_mutex_lock(&mutex);
+  while (!finished)
+    pthread_cond_wait(&progress, &mutex);
+  pthread_mutex_unlock(&mutex);
+}
+
+JitModule *JitPrewarm::getModule(const char *source_path)
+{
+  JitModule *result = NULL;
+
+  pthread_mutex_lock(&mutex);
+
+  for (std::vector<JitPrewarmSource>::iterator source = sources.begin(); source != sources.end(); ++source)
+    {
+      if (source->path != source_path)
+        continue;
+
+      while (!source->module_ready)
+        pthread_cond_wait(&progress, &mutex);
+
+      result = source->module;
+      break;
+    }
+
+  pthread_mutex_unlock(&mutex);
+
+  return result;
+}
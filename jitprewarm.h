@@ -0,0 +1,65 @@
+#ifndef __JITPREWARM_HPP__
+#define __JITPREWARM_HPP__
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+#include "jitmodule.h"
+
+class JitPrewarmSource
+{
+public:
+  std::string path;      /* As written in the manifest */
+  std::string file_path; /* Resolved against the manifest's directory */
+  JitModule *module;
+  bool module_ready;
+  std::vector<unsigned int> entries;
+
+  JitPrewarmSource() : module(NULL), module_ready(false) {};
+};
+
+class JitPrewarmEntry
+{
+public:
+  JitIterationBatchEntry iteration;
+  bool ready;
+
+  JitPrewarmEntry() : ready(false) {};
+};
+
+/* Compiles a manifest of iterations on its own thread, one batch per source */
+class JitPrewarm
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t progress;
+  pthread_t thread;
+  bool thread_started;
+
+  unsigned int flags;
+  std::vector<JitPrewarmSource> sources;
+  std::vector<JitPrewarmEntry> entries;
+
+  /* Protected by mutex */
+  unsigned int completed;
+  bool finished;
+
+  static void *threadMain(void *data);
+  void run();
+
+public:
+  JitPrewarm(unsigned int module_flags);
+  ~JitPrewarm();
+
+  bool loadManifest(const char *manifest_path);
+  void start();
+
+  unsigned int entryCount();
+  unsigned int completedCount();
+  bool isReady(unsigned int index);
+  void *entryFunction(unsigned int index);
+  void wait();
+  JitModule *getModule(const char *source_path);
+};
+
+#endif /* __JITPREWARM_HPP__ */
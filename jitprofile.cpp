@@ -0,0 +1,159 @@
+#include "llvm/Config/config.h"
+#if ((LLVM_VERSION_MAJOR > 3) || ((LLVM_VERSION_MAJOR == 3) && (LLVM_VERSION_MINOR >= 3)))
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Module.h"
+#else
+#include "llvm/Constants.h"
+#include "llvm/GlobalVariable.h"
+#include "llvm/Instructions.h"
+#include "llvm/MDBuilder.h"
+#include "llvm/Module.h"
+#endif
+using namespace llvm;
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "ast.h"
+#include "jitpredicate.h"
+#include "jitprofile.h"
+
+/* Branches that ran fewer times than this keep their default weights */
+#define PROFILE_MIN_SAMPLES 64
+
+typedef std::vector<std::pair<BranchInst *, unsigned int> > BranchList;
+
+/* The conditional branches in func generated for if statements, with their indexes */
+static void find_branches(Function *func, BranchList &branches)
+{
+  for (Function::iterator block = func->begin(); block != func->end(); ++block)
+    {
+      BranchInst *branch = dyn_cast_or_null<BranchInst>(block->getTerminator());
+
+      if (!branch || !branch->isConditional())
+        continue;
+
+      MDNode *node = branch->getMetadata(NANJIT_BRANCH_METADATA);
+      if (!node || node->getNumOperands() != 1)
+        continue;
+
+      if (ConstantInt *index = dyn_cast_or_null<ConstantInt>(node->getOperand(0)))
+        branches.push_back(std::make_pair(branch, (unsigned int)index->getZExtValue()));
+    }
+}
+
+Value *build_element_count(IRBuilder<> &builder, const std::vector<Value *> &args, IterationKind kind)
+{
+  Value *elements;
+
+  if (kind == ITERATION_KIND_RANGE)
+    {
+      Value *x_from = args[args.size() - 2];
+      Value *x_to = args[args.size() - 1];
+      elements = builder.CreateSelect(builder.CreateICmpSLT(x_from, x_to),
+                                      builder.CreateSub(x_to, x_from), builder.getInt32(0));
+    }
+  else
+    {
+      elements = args.back();
+    }
+
+  return builder.CreateZExt(elements, builder.getInt64Ty());
+}
+
+static void increment_counter(IRBuilder<> &builder, GlobalVariable *counters, Value *index, Value *amount)
+{
+  Value *indices[2] = { builder.getInt64(0), index };
+  Value *counter = builder.CreateInBoundsGEP(counters, indices);
+
+  builder.CreateStore(builder.CreateAdd(builder.CreateLoad(counter), amount), counter);
+}
+
+unsigned int instrument_iteration(Function *wrapper, IterationKind kind, GlobalVariable *&counters)
+{
+  IRBuilder<> builder(wrapper->getContext());
+  BranchList branches;
+  unsigned int branch_count = 0;
+
+  find_branches(wrapper, branches);
+  for (BranchList::iterator iter = branches.begin(); iter != branches.end(); ++iter)
+    branch_count = std::max(branch_count, iter->second + 1);
+
+  ArrayType *counters_type = ArrayType::get(builder.getInt64Ty(), PROFILE_BRANCHES + 2 * branch_count);
+  counters = new GlobalVariable(*wrapper->getParent(), counters_type, false, GlobalValue::InternalLinkage,
+                                ConstantAggregateZero::get(counters_type), wrapper->getName() + ".profile");
+  counters->setAlignment(8);
+
+  /* The counters aren't atomic, losing the odd update to another thread
+   * doesn't change what the profile says and this code doesn't live long.
+   */
+  BasicBlock &entry_block = wrapper->getEntryBlock();
+  builder.SetInsertPoint(&entry_block, entry_block.getFirstInsertionPt());
+  {
+    std::vector<Value *> args;
+    for (Function::arg_iterator arg = wrapper->arg_begin(); arg != wrapper->arg_end(); ++arg)
+      args.push_back(arg);
+
+    increment_counter(builder, counters, builder.getInt64(PROFILE_CALLS), builder.getInt64(1));
+    increment_counter(builder, counters, builder.getInt64(PROFILE_ELEMENTS), build_element_count(builder, args, kind));
+  }
+
+  for (BranchList::iterator iter = branches.begin(); iter != branches.end(); ++iter)
+    {
+      BranchInst *branch = iter->first;
+      builder.SetInsertPoint(branch);
+
+      Value *taken = builder.CreateZExt(branch->getCondition(), builder.getInt64Ty());
+      Value *index = builder.CreateAdd(builder.getInt64(PROFILE_BRANCHES + 2 * iter->second), taken);
+      increment_counter(builder, counters, index, builder.getInt64(1));
+    }
+
+  return branch_count;
+}
+
+void apply_branch_profile(Module *module, const unsigned long long *counters, unsigned int branch_count,
+                          unsigned int max_cost)
+{
+  MDBuilder md_builder(module->getContext());
+  std::vector<BranchInst *> unpredictable;
+
+  for (Module::iterator func = module->begin(); func != module->end(); ++func)
+    {
+      BranchList branches;
+      find_branches(func, branches);
+
+      for (BranchList::iterator iter = branches.begin(); iter != branches.end(); ++iter)
+        {
+          if (iter->second >= branch_count)
+            continue;
+
+          unsigned long long not_taken = counters[PROFILE_BRANCHES + 2 * iter->second];
+          unsigned long long taken = counters[PROFILE_BRANCHES + 2 * iter->second + 1];
+
+          if (taken + not_taken < PROFILE_MIN_SAMPLES)
+            continue;
+
+          if (std::min(taken, not_taken) * PREDICTABLE_RATIO >= taken + not_taken)
+            unpredictable.push_back(iter->first);
+
+          /* Weights are 32 bits and only their ratio matters, neither may be 0 */
+          while ((taken | not_taken) >> 31)
+            {
+              taken >>= 1;
+              not_taken >>= 1;
+            }
+
+          iter->first->setMetadata(LLVMContext::MD_prof, md_builder.createBranchWeights(taken + 1, not_taken + 1));
+        }
+    }
+
+  /* Branches that are usually taken the same way stay branches, with the
+   * weights above moving the common path into the fall through.
+   */
+  for (std::vector<BranchInst *>::iterator iter = unpredictable.begin(); iter != unpredictable.end(); ++iter)
+    predicate_branch(*iter, max_cost);
+}
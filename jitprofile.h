@@ -0,0 +1,42 @@
+#ifndef __JITPROFILE_HPP__
+#define __JITPROFILE_HPP__
+
+#include "llvm/Config/config.h"
+#if ((LLVM_VERSION_MAJOR > 3) || ((LLVM_VERSION_MAJOR == 3) && (LLVM_VERSION_MINOR >= 3)))
+#include "llvm/IR/IRBuilder.h"
+#else
+#include "llvm/IRBuilder.h"
+#endif
+
+#include <vector>
+
+#include "jitcache.h"
+
+/* Layout of the 64 bit counters a profiled wrapper updates, each branch has a
+ * not taken count followed by a taken count, starting at PROFILE_BRANCHES.
+ */
+#define PROFILE_CALLS    0
+#define PROFILE_ELEMENTS 1
+#define PROFILE_BRANCHES 2
+
+/* The number of elements a wrapper of the given kind was called with as an
+ * i64, args are the wrapper's arguments.
+ */
+llvm::Value *build_element_count(llvm::IRBuilder<> &builder, const std::vector<llvm::Value *> &args, IterationKind kind);
+
+/* Make an already optimized wrapper count its calls, elements and the outcome
+ * of every if statement inlined into it. counters is set to the global the
+ * counts are kept in, the return value is the number of if statements it has
+ * room for.
+ */
+unsigned int instrument_iteration(llvm::Function *wrapper, IterationKind kind, llvm::GlobalVariable *&counters);
+
+/* Give the if statements in module branch weights from counters written by
+ * instrument_iteration. Branches that often go both ways, see
+ * PREDICTABLE_RATIO, are replaced by selects when both sides together cost at
+ * most max_cost, the module's if_convert_cost.
+ */
+void apply_branch_profile(llvm::Module *module, const unsigned long long *counters, unsigned int branch_count,
+                          unsigned int max_cost);
+
+#endif /* __JITPROFILE_HPP__ */
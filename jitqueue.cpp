@@ -0,0 +1,248 @@
+#include <cstdio>
+#include <algorithm>
+#include <iostream>
+using namespace std;
+
+#include "jitqueue.h"
+
+static pthread_mutex_t jit_queue_instance_lock = PTHREAD_MUTEX_INITIALIZER;
+static JitCompileQueue *jit_queue_instance = NULL;
+
+/* Orders the pending heap so the front is the highest priority, oldest request */
+static bool request_runs_after(const JitIterationRequest *a, const JitIterationRequest *b)
+{
+  if (a->priority != b->priority)
+    return a->priority < b->priority;
+  return a->sequence > b->sequence;
+}
+
+static void *run_request(JitIterationRequest *request)
+{
+  if (request->tier_up)
+    {
+      request->module->tierUpIteration(request->kind, request->function_name.c_str(), request->argstrs);
+      return NULL;
+    }
+
+  if (request->kind == ITERATION_KIND_RANGE)
+    return request->module->getRangeIteration(request->function_name.c_str(), request->argstrs);
+  return request->module->getIteration(request->function_name.c_str(), request->argstrs);
+}
+
+JitCompileQueue::JitCompileQueue() : thread_started(false), active(NULL), next_sequence(0)
+{
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&work_available, NULL);
+  pthread_cond_init(&work_finished, NULL);
+}
+
+JitCompileQueue *JitCompileQueue::get()
+{
+  pthread_mutex_lock(&jit_queue_instance_lock);
+  if (!jit_queue_instance)
+    jit_queue_instance = new JitCompileQueue();
+  pthread_mutex_unlock(&jit_queue_instance_lock);
+
+  return jit_queue_instance;
+}
+
+void JitCompileQueue::cancelRequestsFor(JitModule *module)
+{
+  pthread_mutex_lock(&jit_queue_instance_lock);
+  JitCompileQueue *queue = jit_queue_instance;
+  pthread_mutex_unlock(&jit_queue_instance_lock);
+
+  if (queue)
+    queue->cancelModule(module);
+}
+
+void *JitCompileQueue::threadMain(void *data)
+{
+  static_cast<JitCompileQueue *>(data)->run();
+  return NULL;
+}
+
+void JitCompileQueue::run()
+{
+  pthread_mutex_lock(&mutex);
+
+  while (true)
+    {
+      while (pending.empty())
+        pthread_cond_wait(&work_available, &mutex);
+
+      std::pop_heap(pending.begin(), pending.end(), request_runs_after);
+      JitIterationRequest *request = pending.back();
+      pending.pop_back();
+      active = request;
+
+      pthread_mutex_unlock(&mutex);
+
+      void *result = run_request(request);
+
+      pthread_mutex_lock(&mutex);
+
+      active = NULL;
+      request->result = result;
+      request->ready = true;
+      JitIterationReadyCallback callback = request->callback;
+      void *callback_data = request->callback_data;
+      pthread_cond_broadcast(&work_finished);
+
+      /* Callbacks may call back into the queue, so never hold the lock for them */
+      if (callback)
+        {
+          pthread_mutex_unlock(&mutex);
+          callback(request, result, callback_data);
+          pthread_mutex_lock(&mutex);
+        }
+
+      unrefLocked(request);
+    }
+}
+
+void JitCompileQueue::unrefLocked(JitIterationRequest *request)
+{
+  if (--request->refcount == 0)
+    delete request;
+}
+
+void JitCompileQueue::submit(JitIterationRequest *request)
+{
+  pthread_mutex_lock(&mutex);
+
+  if (!thread_started)
+    {
+      if (0 != pthread_create(&thread, NULL, threadMain, this))
+        {
+          pthread_mutex_unlock(&mutex);
+          cout << "Could not start compile thread, compiling request synchronously" << endl;
+
+          complete(request, run_request(request));
+          return;
+        }
+      pthread_detach(thread);
+      thread_started = true;
+    }
+
+  request->refcount++;
+  request->sequence = next_sequence++;
+  pending.push_back(request);
+  std::push_heap(pending.begin(), pending.end(), request_runs_after);
+
+  pthread_cond_signal(&work_available);
+  pthread_mutex_unlock(&mutex);
+}
+
+void JitCompileQueue::complete(JitIterationRequest *request, void *result)
+{
+  pthread_mutex_lock(&mutex);
+  request->result = result;
+  request->ready = true;
+  JitIterationReadyCallback callback = request->callback;
+  void *callback_data = request->callback_data;
+  pthread_cond_broadcast(&work_finished);
+  pthread_mutex_unlock(&mutex);
+
+  if (callback)
+    callback(request, result, callback_data);
+}
+
+bool JitCompileQueue::isReady(JitIterationRequest *request)
+{
+  pthread_mutex_lock(&mutex);
+  bool ready = request->ready;
+  pthread_mutex_unlock(&mutex);
+
+  return ready;
+}
+
+void *JitCompileQueue::wait(JitIterationRequest *request)
+{
+  pthread_mutex_lock(&mutex);
+  while (!request->ready)
+    pthread_cond_wait(&work_finished, &mutex);
+  void *result = request->result;
+  pthread_mutex_unlock(&mutex);
+
+  return result;
+}
+
+void JitCompileQueue::setCallback(JitIterationRequest *request, JitIterationReadyCallback callback, void *user_data)
+{
+  pthread_mutex_lock(&mutex);
+  request->callback = callback;
+  request->callback_data = user_data;
+  bool ready = request->ready;
+  void *result = request->result;
+  pthread_mutex_unlock(&mutex);
+
+  /* If the request already finished the callback fires right away on this thread */
+  if (ready && callback)
+    callback(request, result, user_data);
+}
+
+void JitCompileQueue::release(JitIterationRequest *request)
+{
+  pthread_mutex_lock(&mutex);
+  unrefLocked(request);
+  pthread_mutex_unlock(&mutex);
+}
+
+void JitCompileQueue::cancelModule(JitModule *module)
+{
+  std::vector<JitIterationRequest *> cancelled;
+  std::vector<JitIterationReadyCallback> callbacks;
+
+  pthread_mutex_lock(&mutex);
+
+  std::vector<JitIterationRequest *>::iterator iter = pending.begin();
+  while (iter != pending.end())
+    {
+      if ((*iter)->module == module)
+        {
+          (*iter)->result = NULL;
+          (*iter)->ready = true;
+          cancelled.push_back(*iter);
+          callbacks.push_back((*iter)->callback);
+          iter = pending.erase(iter);
+        }
+      else
+        ++iter;
+    }
+  std::make_heap(pending.begin(), pending.end(), request_runs_after);
+  pthread_cond_broadcast(&work_finished);
+
+  /* The module can't go away while the compile thread is generating code for it */
+  while (active && active->module == module)
+    pthread_cond_wait(&work_finished, &mutex);
+
+  pthread_mutex_unlock(&mutex);
+
+  for (size_t i = 0; i < cancelled.size(); ++i)
+    {
+      if (callbacks[i])
+        callbacks[i](cancelled[i], NULL, cancelled[i]->callback_data);
+      release(cancelled[i]);
+    }
+}
+
+unsigned int jit_request_is_ready(JitIterationRequest *request)
+{
+  return JitCompileQueue::get()->isReady(request);
+}
+
+void *jit_request_wait(JitIterationRequest *request)
+{
+  return JitCompileQueue::get()->wait(request);
+}
+
+void jit_request_set_callback(JitIterationRequest *request, JitIterationReadyCallback callback, void *user_data)
+{
+  JitCompileQueue::get()->setCallback(request, callback, user_data);
+}
+
+void jit_request_release(JitIterationRequest *request)
+{
+  JitCompileQueue::get()->release(request);
+}
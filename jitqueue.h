@@ -0,0 +1,71 @@
+#ifndef __JITQUEUE_HPP__
+#define __JITQUEUE_HPP__
+
+#include <list>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+#include "jitmodule.h"
+#include "jitcache.h"
+
+class JitIterationRequest
+{
+public:
+  JitModule *module;
+  IterationKind kind;
+  std::string function_name;
+  std::list<std::string> argstrs;
+  int priority;
+  unsigned long sequence;
+  bool tier_up; /* Optimize an existing tiered iteration instead */
+
+  /* Everything below is protected by the queue's mutex */
+  bool ready;
+  void *result;
+  JitIterationReadyCallback callback;
+  void *callback_data;
+  int refcount;
+
+  JitIterationRequest() : module(NULL), kind(ITERATION_KIND_LINEAR), priority(JIT_PRIORITY_NORMAL), sequence(0), tier_up(false),
+                          ready(false), result(NULL), callback(NULL), callback_data(NULL), refcount(1) {};
+};
+
+/* A single background thread that generates requested iterations, highest
+ * priority first and in submission order within a priority.
+ */
+class JitCompileQueue
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t work_available;
+  pthread_cond_t work_finished;
+  pthread_t thread;
+  bool thread_started;
+
+  std::vector<JitIterationRequest *> pending;
+  JitIterationRequest *active;
+  unsigned long next_sequence;
+
+  JitCompileQueue();
+
+  static void *threadMain(void *data);
+  void run();
+  void unrefLocked(JitIterationRequest *request);
+
+public:
+  static JitCompileQueue *get();
+  static void cancelRequestsFor(JitModule *module);
+
+  /* Takes a new reference to request for the queue */
+  void submit(JitIterationRequest *request);
+  /* Marks request as ready without compiling anything, used for cache hits */
+  void complete(JitIterationRequest *request, void *result);
+
+  bool isReady(JitIterationRequest *request);
+  void *wait(JitIterationRequest *request);
+  void setCallback(JitIterationRequest *request, JitIterationReadyCallback callback, void *user_data);
+  void release(JitIterationRequest *request);
+  void cancelModule(JitModule *module);
+};
+
+#endif /* __JITQUEUE_HPP__ */
@@ -48,6 +48,10 @@ typedef nanjit::BisonParser::token token;
 "return"             { return token::RETURN; };
 "if"                 { return token::IF; };
 "else"               { return token::ELSE; };
+"__attribute__"      { return token::ATTRIBUTE; };
+"for"                { return token::FOR; };
+"while"              { return token::WHILE; };
+"#pragma"[ \t]+"unroll" { return token::PRAGMA_UNROLL; };
 "float"[234]?        { yylval->sval = strdup(yytext); return token::TYPENAME; };
 "int"[234]?          { yylval->sval = strdup(yytext); return token::TYPENAME; };
 "uint"[234]?         { yylval->sval = strdup(yytext); return token::TYPENAME; };
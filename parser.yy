@@ -27,6 +27,7 @@ using namespace std;
   ExprAST *expr_ast;
   IdentifierExprAST *identifier_ast;
   ComparisonAST *comparison_ast;
+  LoopAST *loop_ast;
   BlockAST *block_ast;
   FunctionAST *function_ast;
   FunctionArgAST *function_arg;
@@ -71,6 +72,10 @@ using namespace std;
 %token RETURN
 %token IF
 %token ELSE
+%token ATTRIBUTE
+%token FOR
+%token WHILE
+%token PRAGMA_UNROLL
 
 %type <function_ast> function
 %type <function_arg> argument
@@ -79,6 +84,7 @@ using namespace std;
 %type <expr_ast> statement
 %type <expr_ast> expression
 %type <comparison_ast> comparison
+%type <loop_ast> loop
 %type <expr_ast> value
 %type <identifier_ast> identifier
 %type <identifier_ast> type_name
@@ -88,7 +94,7 @@ using namespace std;
 %destructor { free ($$); } IDENTIFIER
 %destructor { free ($$); } TYPENAME
 %destructor { delete $$; } function argument arguments block
-%destructor { delete $$; } comparison
+%destructor { delete $$; } comparison loop
 %destructor { delete $$; } statement expression value
 %destructor { delete $$; } identifier type_name call_arguments
 
@@ -110,6 +116,7 @@ module:
 
 function:
   type_name identifier LPAREN arguments RPAREN LCURL block RCURL { $$ = new FunctionAST($1, $2, $4, $7); SETLOC($$, @$); }
+  | ATTRIBUTE LPAREN LPAREN IDENTIFIER RPAREN RPAREN function { $7->addAttribute($4); free($4); $$ = $7; }
 
 arguments:
   argument { $$ = new FunctionArgListAST($1); }
@@ -128,6 +135,12 @@ statement:
   | IF LPAREN comparison RPAREN LCURL block RCURL ELSE LCURL block RCURL { $$ = new IfElseAST($3, $6, $10); SETLOC($$, @$); }
   | RETURN SEMICOLON  { $$ = new ReturnAST(); SETLOC($$, @$); }
   | RETURN expression SEMICOLON { $$ = new ReturnAST($2); SETLOC($$, @$); }
+  | loop { $$ = $1; }
+  | PRAGMA_UNROLL loop { $2->setUnroll(); $$ = $2; }
+
+loop:
+  FOR LPAREN expression SEMICOLON comparison SEMICOLON expression RPAREN LCURL block RCURL { $$ = new LoopAST($3, $5, $7, $10); SETLOC($$, @$); }
+  | WHILE LPAREN comparison RPAREN LCURL block RCURL { $$ = new LoopAST(NULL, $3, NULL, $6); SETLOC($$, @$); }
 
 comparison:
   expression PAIR_EQUAL expression { $$ = new ComparisonAST(ComparisonAST::EqualTo, $1, $3); SETLOC($$, @$); }
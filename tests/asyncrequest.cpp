@@ -0,0 +1,143 @@
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <stdint.h>
+#include <unistd.h>
+using namespace std;
+
+#include "jitmodule.h"
+
+typedef void (*AddFunction)(int *out, int *a, int *b, uint32_t count);
+
+static const char *shader_src = \
+  "int4 process(int4 a, int4 b) "
+  "{ "
+  "return a + b; "
+  "}";
+
+bool test_wait()
+{
+  JitModule *jm = jit_module_for_src(shader_src, 0);
+
+  if (!jm)
+    return false;
+
+  JitIterationRequest *request = jit_module_request_iteration(jm, JIT_PRIORITY_NORMAL, "process", "int4[]", "int4[]", "int4[]", NULL);
+  void *jitfunc = jit_request_wait(request);
+  bool ready = jit_request_is_ready(request);
+  jit_request_release(request);
+
+  bool result = true;
+
+  if (!ready || NULL == jitfunc || jit_module_is_fallback_function(jm, jitfunc))
+    {
+      cout << "Request did not produce a function" << endl;
+      result = false;
+    }
+  else
+    {
+      int a[4] = { 1, 2, 3, 4 };
+      int b[4] = { 10, 20, 30, 40 };
+      int out[4] = { 0, 0, 0, 0 };
+
+      ((AddFunction)jitfunc)(out, a, b, 1);
+
+      if (out[0] != 11 || out[3] != 44)
+        result = false;
+
+      if (jitfunc != jit_module_get_iteration(jm, "process", "int4[]", "int4[]", "int4[]", NULL))
+        {
+          cout << "Request and getIteration returned different functions" << endl;
+          result = false;
+        }
+    }
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+static volatile int callback_count = 0;
+static void * volatile callback_function = NULL;
+
+static void count_callback(JitIterationRequest *request, void *function, void *user_data)
+{
+  callback_function = function;
+  callback_count++;
+}
+
+bool test_callback()
+{
+  JitModule *jm = jit_module_for_src(shader_src, 0);
+
+  if (!jm)
+    return false;
+
+  callback_count = 0;
+  callback_function = NULL;
+
+  JitIterationRequest *request = jit_module_request_iteration(jm, JIT_PRIORITY_HIGH, "process", "int4[]", "int4[]", "int4[]", NULL);
+  jit_request_set_callback(request, count_callback, NULL);
+  void *jitfunc = jit_request_wait(request);
+
+  /* The callback runs after waiters are woken */
+  for (int i = 0; i < 1000 && callback_count == 0; ++i)
+    usleep(1000);
+
+  jit_request_release(request);
+  jit_module_destroy(jm);
+
+  if (callback_count != 1 || callback_function != jitfunc)
+    {
+      cout << "Callback ran " << callback_count << " times" << endl;
+      return false;
+    }
+
+  return true;
+}
+
+bool test_destroy_pending()
+{
+  JitModule *jm = jit_module_for_src(shader_src, 0);
+
+  if (!jm)
+    return false;
+
+  JitIterationRequest *requests[4];
+  requests[0] = jit_module_request_iteration(jm, JIT_PRIORITY_LOW, "process", "int4[]", "int4[]", "int4[]", NULL);
+  requests[1] = jit_module_request_iteration(jm, JIT_PRIORITY_LOW, "process", "aligned int4[]", "int4[]", "int4[]", NULL);
+  requests[2] = jit_module_request_range_iteration(jm, JIT_PRIORITY_LOW, "process", "int4[]", "int4[]", "int4[]", NULL);
+  requests[3] = jit_module_request_range_iteration(jm, JIT_PRIORITY_LOW, "process", "aligned int4[]", "int4[]", "int4[]", NULL);
+
+  jit_module_destroy(jm);
+
+  /* Every request must be finished (or cancelled) once its module is gone */
+  bool result = true;
+  for (int i = 0; i < 4; ++i)
+    {
+      if (!jit_request_is_ready(requests[i]))
+        result = false;
+      jit_request_release(requests[i]);
+    }
+
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int pass_count = 0;
+  int fail_count = 0;
+
+  test_wait() ? pass_count++ : fail_count++;
+  test_callback() ? pass_count++ : fail_count++;
+  test_destroy_pending() ? pass_count++ : fail_count++;
+
+  cout << "ran " << (pass_count + fail_count) << " tests: " << pass_count << " ok, " << fail_count << " failures" << endl;
+
+  if (!fail_count)
+    cout << "OK" << endl;
+  else
+    cout << "FAIL" << endl;
+
+  return fail_count;
+}
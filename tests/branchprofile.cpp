@@ -0,0 +1,269 @@
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <stdint.h>
+using namespace std;
+
+#include "jitmodule.h"
+
+typedef void (*BlendFunction)(float *out, float *in, float *aux, uint32_t count);
+
+/* Shaped like the blend kernels, which skip the work where aux is
+ * transparent. The if is a guard, see llvm_guard_argument.
+ */
+static const char *shader_src = \
+  "float4 process(float4 in, float4 aux) "
+  "{ "
+  "  if (aux.s3 == 0.0f) "
+  "    { "
+  "      return in; "
+  "    } "
+  "  return sqrt(in) * aux; "
+  "}";
+
+/* The if in the loop is generated twice but is still one if statement */
+static const char *unrolled_src = \
+  "float4 process(float4 in, float4 aux) "
+  "{ "
+  "  float4 acc = in; "
+  "  #pragma unroll "
+  "  for (int i = 0; i < 2; i = i + 1) "
+  "    { "
+  "      if (acc.s0 > 64.0f) "
+  "        { "
+  "          return acc; "
+  "        } "
+  "      acc = acc + in; "
+  "    } "
+  "  if (aux.s3 == 0.0f) "
+  "    { "
+  "      return in; "
+  "    } "
+  "  return sqrt(acc) * aux; "
+  "}";
+
+/* Every element with an index divisible by skip_every has a transparent aux */
+static bool check_blend(void *jitfunc, uint32_t count, uint32_t skip_every)
+{
+  float in[64 * 4];
+  float aux[64 * 4];
+  float out[64 * 4];
+
+  for (int i = 0; i < 64 * 4; ++i)
+    {
+      in[i] = (float)(i + 1);
+      aux[i] = ((i / 4) % skip_every == 0) ? 0.0f : 2.0f;
+      out[i] = 0.0f;
+    }
+
+  ((BlendFunction)jitfunc)(out, in, aux, count);
+
+  for (uint32_t i = 0; i < count * 4; ++i)
+    {
+      float expected = ((i / 4) % skip_every == 0) ? in[i] : sqrtf(in[i]) * 2.0f;
+      if (fabsf(out[i] - expected) > 0.0001f * expected)
+        return false;
+    }
+
+  return true;
+}
+
+bool test_profile_counts()
+{
+  JitModule *jm = jit_module_for_src(shader_src, JIT_MODULE_PROFILE | JIT_MODULE_PRIVATE);
+  bool result = true;
+
+  jit_module_set_tier_threshold(jm, 1000000);
+
+  void *jitfunc = jit_module_get_iteration(jm, "process", "float4[]", "float4[]", "float4[]", NULL);
+
+  /* Every 4th element is transparent */
+  if (!jitfunc || !check_blend(jitfunc, 64, 4) || !check_blend(jitfunc, 32, 4))
+    {
+      cout << "Profiled iteration failed" << endl;
+      jit_module_destroy(jm);
+      return false;
+    }
+
+  unsigned long long calls = 0;
+  unsigned long long elements = 0;
+  JitBranchProfile branches[4];
+  unsigned int branch_count = jit_module_get_iteration_profile(jm, jitfunc, &calls, &elements, branches, 4);
+
+  if (calls != 2 || elements != 96)
+    {
+      cout << "Counted " << calls << " calls and " << elements << " elements" << endl;
+      result = false;
+    }
+
+  if (branch_count != 1 || branches[0].taken != 24 || branches[0].not_taken != 72)
+    {
+      cout << "Wrong branch profile" << endl;
+      result = false;
+    }
+
+  jit_module_optimize_iteration(jm, jitfunc);
+
+  if (!jit_module_is_iteration_optimized(jm, jitfunc))
+    {
+      cout << "Iteration was not optimized" << endl;
+      result = false;
+    }
+
+  if (!check_blend(jitfunc, 64, 4) || !check_blend(jitfunc, 0, 4))
+    {
+      cout << "Optimized iteration failed" << endl;
+      result = false;
+    }
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+bool test_unpredictable()
+{
+  JitModule *jm = jit_module_for_src(shader_src, JIT_MODULE_PROFILE | JIT_MODULE_PRIVATE);
+  bool result = true;
+
+  jit_module_set_tier_threshold(jm, 1000000);
+
+  void *jitfunc = jit_module_get_iteration(jm, "process", "float4[]", "float4[]", "float4[]", NULL);
+
+  /* Half the elements go each way, which the optimized code may predicate */
+  for (int i = 0; i < 4; ++i)
+    result = jitfunc && check_blend(jitfunc, 64, 2) && result;
+
+  jit_module_optimize_iteration(jm, jitfunc);
+
+  if (!jit_module_is_iteration_optimized(jm, jitfunc) ||
+      !check_blend(jitfunc, 64, 2) || !check_blend(jitfunc, 64, 3) || !check_blend(jitfunc, 7, 2))
+    {
+      cout << "Optimized iteration failed" << endl;
+      result = false;
+    }
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+/* Skipping runs of transparent elements would leave them out of the counts */
+bool test_guard_counted()
+{
+  JitModule *jm = jit_module_for_src(shader_src, JIT_MODULE_PROFILE | JIT_MODULE_PRIVATE);
+  bool result = true;
+
+  jit_module_set_tier_threshold(jm, 1000000);
+
+  void *jitfunc = jit_module_get_iteration(jm, "process", "float4[]", "float4[]", "float4[]", NULL);
+
+  /* Every element is transparent */
+  if (!jitfunc || !check_blend(jitfunc, 64, 1))
+    {
+      cout << "Profiled iteration failed" << endl;
+      jit_module_destroy(jm);
+      return false;
+    }
+
+  JitBranchProfile branches[1];
+  unsigned int branch_count = jit_module_get_iteration_profile(jm, jitfunc, NULL, NULL, branches, 1);
+
+  if (branch_count != 1 || branches[0].taken != 64 || branches[0].not_taken != 0)
+    {
+      cout << "Skipped elements weren't counted" << endl;
+      result = false;
+    }
+
+  jit_module_optimize_iteration(jm, jitfunc);
+
+  if (!jit_module_is_iteration_optimized(jm, jitfunc) || !check_blend(jitfunc, 64, 1) || !check_blend(jitfunc, 64, 4))
+    {
+      cout << "Optimized iteration failed" << endl;
+      result = false;
+    }
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+bool test_unrolled_counts()
+{
+  JitModule *jm = jit_module_for_src(unrolled_src, JIT_MODULE_PROFILE | JIT_MODULE_PRIVATE);
+  bool result = true;
+
+  jit_module_set_tier_threshold(jm, 1000000);
+
+  void *jitfunc = jm ? jit_module_get_iteration(jm, "process", "float4[]", "float4[]", "float4[]", NULL) : NULL;
+
+  if (!jitfunc)
+    {
+      cout << "Unrolled iteration failed" << endl;
+      if (jm)
+        jit_module_destroy(jm);
+      return false;
+    }
+
+  float in[64 * 4];
+  float aux[64 * 4];
+  float out[64 * 4];
+
+  for (int i = 0; i < 64 * 4; ++i)
+    {
+      in[i] = (float)(i + 1);
+      aux[i] = ((i / 4) % 4 == 0) ? 0.0f : 2.0f;
+    }
+
+  ((BlendFunction)jitfunc)(out, in, aux, 64);
+
+  JitBranchProfile branches[4];
+  unsigned int branch_count = jit_module_get_iteration_profile(jm, jitfunc, NULL, NULL, branches, 4);
+
+  /* Both copies of the loop's if count towards the first statement. Element
+   * e starts with acc.s0 = 4e + 1, so the first copy returns from e = 16 on
+   * and the second, with twice that, from e = 8 on. The 8 elements left
+   * reach the second statement, every 4th of them transparent.
+   */
+  if (branch_count != 2 ||
+      branches[0].taken != 48 + 8 || branches[0].not_taken != 16 + 8 ||
+      branches[1].taken != 2 || branches[1].not_taken != 6)
+    {
+      cout << "Wrong profile for unrolled if statements" << endl;
+      result = false;
+    }
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+bool test_unprofiled()
+{
+  JitModule *jm = jit_module_for_src(shader_src, JIT_MODULE_TIERED | JIT_MODULE_PRIVATE);
+  void *jitfunc = jit_module_get_iteration(jm, "process", "float4[]", "float4[]", "float4[]", NULL);
+  unsigned long long calls = 1;
+
+  /* Tiered modules without JIT_MODULE_PROFILE don't count anything */
+  bool result = jitfunc && check_blend(jitfunc, 16, 4) &&
+                jit_module_get_iteration_profile(jm, jitfunc, &calls, NULL, NULL, 0) == 0 && calls == 0;
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int pass_count = 0;
+  int fail_count = 0;
+
+  test_profile_counts() ? pass_count++ : fail_count++;
+  test_unpredictable() ? pass_count++ : fail_count++;
+  test_guard_counted() ? pass_count++ : fail_count++;
+  test_unrolled_counts() ? pass_count++ : fail_count++;
+  test_unprofiled() ? pass_count++ : fail_count++;
+
+  cout << "ran " << (pass_count + fail_count) << " tests: " << pass_count << " ok, " << fail_count << " failures" << endl;
+
+  if (!fail_count)
+    cout << "OK" << endl;
+  else
+    cout << "FAIL" << endl;
+
+  return fail_count;
+}
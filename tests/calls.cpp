@@ -0,0 +1,168 @@
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <stdint.h>
+using namespace std;
+
+#include "jitmodule.h"
+
+typedef void (*BlendFunction)(float *out, float *in, float *aux, uint32_t count);
+
+#define COUNT 32
+
+/* Two blend modes sharing the same compositing helper, which is defined
+ * after the first one uses it.
+ */
+static const char *blend_src = \
+  "float4 multiply(float4 in, float4 aux) "
+  "{ "
+  "  return porter_duff_over(in, aux, in * aux); "
+  "} "
+  "float4 porter_duff_over(float4 in, float4 aux, float4 blended) "
+  "{ "
+  "  float4 one = (float4)(1.0f, 1.0f, 1.0f, 1.0f); "
+  "  return blended * aux.s3333 + in * (one - aux.s3333); "
+  "} "
+  "float4 screen(float4 in, float4 aux) "
+  "{ "
+  "  float4 one = (float4)(1.0f, 1.0f, 1.0f, 1.0f); "
+  "  return porter_duff_over(in, aux, one - (one - in) * (one - aux)); "
+  "}";
+
+static void fill(float *in, float *aux)
+{
+  for (int i = 0; i < COUNT * 4; ++i)
+    {
+      in[i] = (i % 9) / 8.0f;
+      aux[i] = (i % 5) / 4.0f;
+    }
+}
+
+static float over(float in, float alpha, float blended)
+{
+  return blended * alpha + in * (1.0f - alpha);
+}
+
+static float expected_multiply(const float *in, const float *aux, int i)
+{
+  return over(in[i], aux[i / 4 * 4 + 3], in[i] * aux[i]);
+}
+
+static float expected_screen(const float *in, const float *aux, int i)
+{
+  return over(in[i], aux[i / 4 * 4 + 3], 1.0f - (1.0f - in[i]) * (1.0f - aux[i]));
+}
+
+static float expected_scaled(const float *in, const float *aux, int i)
+{
+  return in[i] * 2.0f + aux[i];
+}
+
+static bool check_blend(const char *src, const char *name,
+                        float (*expected)(const float *, const float *, int))
+{
+  JitModule *jm = jit_module_for_src(src, JIT_MODULE_PRIVATE);
+  void *jitfunc = jm ? jit_module_get_iteration(jm, name, "float4[]", "float4[]", "float4[]", NULL) : NULL;
+  bool result = jitfunc && !jit_module_is_fallback_function(jm, jitfunc);
+
+  if (result)
+    {
+      float in[COUNT * 4];
+      float aux[COUNT * 4];
+      float out[COUNT * 4];
+
+      fill(in, aux);
+      ((BlendFunction)jitfunc)(out, in, aux, COUNT);
+
+      for (int i = 0; i < COUNT * 4; ++i)
+        {
+          if (out[i] != expected(in, aux, i))
+            {
+              cout << name << " element " << i << " was " << out[i] << ", expected " << expected(in, aux, i) << endl;
+              result = false;
+              break;
+            }
+        }
+    }
+  else
+    {
+      cout << "Failed to compile " << name << endl;
+    }
+
+  if (jm)
+    jit_module_destroy(jm);
+  return result;
+}
+
+/* Returns true if src doesn't give a working iteration of process */
+static bool check_rejected(const char *src)
+{
+  JitModule *jm = jit_module_for_src(src, JIT_MODULE_PRIVATE);
+  void *jitfunc = jm ? jit_module_get_iteration(jm, "process", "float4[]", "float4[]", "float4[]", NULL) : NULL;
+  bool result = !jm || jit_module_is_fallback_function(jm, jitfunc);
+
+  if (jm)
+    jit_module_destroy(jm);
+  return result;
+}
+
+bool test_shared_helper()
+{
+  return check_blend(blend_src, "multiply", expected_multiply) &&
+         check_blend(blend_src, "screen", expected_screen);
+}
+
+/* Arguments are converted to the parameter types like a return value is */
+bool test_argument_conversion()
+{
+  return check_blend("float4 scale(float4 v, float s) { return v * (float4)(s, s, s, s); } "
+                     "float4 process(float4 in, float4 aux) { return scale(in, 2) + aux; }",
+                     "process", expected_scaled);
+}
+
+bool test_noinline()
+{
+  return check_blend("__attribute__((noinline)) float4 scale(float4 v, float s) { return v * (float4)(s, s, s, s); } "
+                     "float4 process(float4 in, float4 aux) { return scale(in, 2.0f) + aux; }",
+                     "process", expected_scaled);
+}
+
+bool test_bad_calls()
+{
+  static const char *helper = "float4 scale(float4 v, float s) { return v * (float4)(s, s, s, s); } ";
+
+  return check_rejected((std::string(helper) + "float4 process(float4 in, float4 aux) { return scale(in); }").c_str()) &&
+         check_rejected((std::string(helper) + "float4 process(float4 in, float4 aux) { return scale(in, aux); }").c_str()) &&
+         check_rejected("float4 process(float4 in, float4 aux) { return undefined(in, aux); }");
+}
+
+/* A function named like a builtin would never be called, so it's an error */
+bool test_builtin_names()
+{
+  return check_rejected("float4 sqrt(float4 v) { return v; } "
+                        "float4 process(float4 in, float4 aux) { return sqrt(in) + aux; }") &&
+         check_rejected("float4 mix(float4 a, float4 b, float4 t) { return a; } "
+                        "float4 process(float4 in, float4 aux) { return mix(in, aux, in); }") &&
+         check_rejected("float4 native_recip(float4 v) { return v; } "
+                        "float4 process(float4 in, float4 aux) { return in + aux; }");
+}
+
+int main(int argc, char **argv) {
+  int pass_count = 0;
+  int fail_count = 0;
+
+  test_shared_helper() ? pass_count++ : fail_count++;
+  test_argument_conversion() ? pass_count++ : fail_count++;
+  test_noinline() ? pass_count++ : fail_count++;
+  test_bad_calls() ? pass_count++ : fail_count++;
+  test_builtin_names() ? pass_count++ : fail_count++;
+
+  cout << "ran " << (pass_count + fail_count) << " tests: " << pass_count << " ok, " << fail_count << " failures" << endl;
+
+  if (!fail_count)
+    cout << "OK" << endl;
+  else
+    cout << "FAIL" << endl;
+
+  return fail_count;
+}
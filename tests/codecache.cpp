@@ -0,0 +1,240 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <stdint.h>
+#include <dirent.h>
+#include <unistd.h>
+using namespace std;
+
+#include "jitmodule.h"
+
+typedef void (*AddFunction)(int *out, int *a, int *b, uint32_t count);
+
+static const char *shader_src = \
+  "int4 process(int4 a, int4 b) "
+  "{ "
+  "return a + b; "
+  "}";
+
+typedef void (*BlendFunction)(float *out, float *in, float *aux, uint32_t count);
+
+static const char *branch_src = \
+  "float4 process(float4 in, float4 aux) "
+  "{ "
+  "  if (aux.s3 == 0.0f) "
+  "    { "
+  "      return in; "
+  "    } "
+  "  return in * aux; "
+  "}";
+
+static int count_entries(const string &path)
+{
+  DIR *dir = opendir(path.c_str());
+  int count = 0;
+
+  if (!dir)
+    return 0;
+
+  while (struct dirent *entry = readdir(dir))
+    {
+      string name = entry->d_name;
+      if (name.size() > 4 && name.substr(name.size() - 4) == ".njc")
+        count++;
+    }
+  closedir(dir);
+
+  return count;
+}
+
+static void clear_entries(const string &path)
+{
+  DIR *dir = opendir(path.c_str());
+
+  if (!dir)
+    return;
+
+  while (struct dirent *entry = readdir(dir))
+    {
+      string name = entry->d_name;
+      if (name != "." && name != "..")
+        unlink((path + "/" + name).c_str());
+    }
+  closedir(dir);
+  rmdir(path.c_str());
+}
+
+static bool run_process(const char *label)
+{
+  JitModule *jm = jit_module_for_src(shader_src, 0);
+
+  if (!jm)
+    return false;
+
+  void *jitfunc = jit_module_get_iteration(jm, "process", "int4[]", "int4[]", "int4[]", NULL);
+  bool result = true;
+
+  if (NULL == jitfunc || jit_module_is_fallback_function(jm, jitfunc))
+    {
+      cout << label << ": no function" << endl;
+      result = false;
+    }
+  else
+    {
+      int a[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+      int b[8] = { 10, 20, 30, 40, 50, 60, 70, 80 };
+      int out[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+      ((AddFunction)jitfunc)(out, a, b, 2);
+
+      if (out[0] != 11 || out[7] != 88)
+        {
+          cout << label << ": wrong result" << endl;
+          result = false;
+        }
+    }
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+bool test_reload()
+{
+  char path_template[] = "/tmp/nanjit-codecache-XXXXXX";
+  char *path = mkdtemp(path_template);
+
+  if (!path)
+    return false;
+
+  jit_set_code_cache_directory(path);
+
+  bool result = run_process("cold");
+
+  /* One entry for the module and one for the iteration */
+  if (count_entries(path) != 2)
+    {
+      cout << "Expected 2 cache entries, found " << count_entries(path) << endl;
+      result = false;
+    }
+
+  result = run_process("warm") && result;
+
+  if (count_entries(path) != 2)
+    {
+      cout << "Cache hits added entries" << endl;
+      result = false;
+    }
+
+  jit_set_code_cache_directory(NULL);
+  clear_entries(path);
+
+  return result;
+}
+
+bool test_bad_entry()
+{
+  char path_template[] = "/tmp/nanjit-codecache-XXXXXX";
+  char *path = mkdtemp(path_template);
+
+  if (!path)
+    return false;
+
+  jit_set_code_cache_directory(path);
+
+  bool result = run_process("cold");
+
+  /* Truncate every entry, loading must fall back to compiling */
+  DIR *dir = opendir(path);
+  while (struct dirent *entry = readdir(dir))
+    {
+      string name = entry->d_name;
+      if (name != "." && name != "..")
+        truncate((string(path) + "/" + name).c_str(), 20);
+    }
+  closedir(dir);
+
+  result = run_process("truncated") && result;
+
+  jit_set_code_cache_directory(NULL);
+  clear_entries(path);
+
+  return result;
+}
+
+/* A profiled module must not pick up the untiered iteration a warm cache has */
+bool test_profiled_warm()
+{
+  char path_template[] = "/tmp/nanjit-codecache-XXXXXX";
+  char *path = mkdtemp(path_template);
+
+  if (!path)
+    return false;
+
+  jit_set_code_cache_directory(path);
+
+  JitModule *jm = jit_module_for_src(branch_src, JIT_MODULE_PRIVATE);
+  bool result = jm && jit_module_get_iteration(jm, "process", "float4[]", "float4[]", "float4[]", NULL);
+  if (jm)
+    jit_module_destroy(jm);
+
+  jm = jit_module_for_src(branch_src, JIT_MODULE_PROFILE | JIT_MODULE_PRIVATE);
+  if (jm)
+    jit_module_set_tier_threshold(jm, 1000000);
+  void *jitfunc = jm ? jit_module_get_iteration(jm, "process", "float4[]", "float4[]", "float4[]", NULL) : NULL;
+
+  if (jitfunc)
+    {
+      float in[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+      float aux[8] = { 2, 2, 2, 0, 2, 2, 2, 1 };
+      float out[8];
+      unsigned long long calls = 0;
+      JitBranchProfile branches[1];
+
+      ((BlendFunction)jitfunc)(out, in, aux, 2);
+
+      if (jit_module_get_iteration_profile(jm, jitfunc, &calls, NULL, branches, 1) != 1 || calls != 1 ||
+          branches[0].taken != 1 || branches[0].not_taken != 1)
+        {
+          cout << "Profiled module loaded an uninstrumented iteration" << endl;
+          result = false;
+        }
+
+      jit_module_optimize_iteration(jm, jitfunc);
+      if (!jit_module_is_iteration_optimized(jm, jitfunc))
+        {
+          cout << "Profiled iteration was not optimized" << endl;
+          result = false;
+        }
+    }
+  else
+    {
+      result = false;
+    }
+
+  if (jm)
+    jit_module_destroy(jm);
+
+  jit_set_code_cache_directory(NULL);
+  clear_entries(path);
+
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int pass_count = 0;
+  int fail_count = 0;
+
+  test_reload() ? pass_count++ : fail_count++;
+  test_bad_entry() ? pass_count++ : fail_count++;
+  test_profiled_warm() ? pass_count++ : fail_count++;
+
+  cout << "ran " << (pass_count + fail_count) << " tests: " << pass_count << " ok, " << fail_count << " failures" << endl;
+
+  if (!fail_count)
+    cout << "OK" << endl;
+  else
+    cout << "FAIL" << endl;
+
+  return fail_count;
+}
@@ -0,0 +1,149 @@
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <stdint.h>
+using namespace std;
+
+#include "jitmodule.h"
+
+typedef void (*DivideFunction)(float *out, float *a, float *b, uint32_t count);
+
+static const char *divide_src = \
+  "float4 process(float4 a, float4 b) "
+  "{ "
+  "  return a / b; "
+  "}";
+
+/* Scalars use the single lane estimates, dividing by a sqrt uses rsqrt */
+static const char *scalar_src = \
+  "float process(float a, float b) "
+  "{ "
+  "  return a / b + a / sqrt(b); "
+  "}";
+
+static const char *native_src = \
+  "float4 process(float4 a, float4 b) "
+  "{ "
+  "  return native_divide(a, b) + native_recip(b) + native_rsqrt(b); "
+  "}";
+
+static float divide_expected(float a, float b)
+{
+  return a / b;
+}
+
+static float scalar_expected(float a, float b)
+{
+  return a / b + a / sqrtf(b);
+}
+
+static float native_expected(float a, float b)
+{
+  return a / b + 1.0f / b + 1.0f / sqrtf(b);
+}
+
+/* Run an iteration over count elements of the given width and compare each
+ * result to expected within a relative tolerance, 0 means exact.
+ */
+static bool check_divide(JitModule *jm, const char *type, int width, float (*expected)(float, float), float tolerance)
+{
+  void *jitfunc = jm ? jit_module_get_iteration(jm, "process", type, type, type, NULL) : NULL;
+  const uint32_t count = 61;
+  float a[61 * 4];
+  float b[61 * 4];
+  float out[61 * 4];
+
+  if (!jitfunc)
+    return false;
+
+  for (uint32_t i = 0; i < count * width; ++i)
+    {
+      a[i] = (float)i * 0.75f - 11.0f;
+      b[i] = (float)(i % 17) * 1.375f + 0.125f;
+      out[i] = 0.0f;
+    }
+
+  ((DivideFunction)jitfunc)(out, a, b, count);
+
+  for (uint32_t i = 0; i < count * width; ++i)
+    {
+      float value = expected(a[i], b[i]);
+      if (fabsf(out[i] - value) > tolerance * fabsf(value) + tolerance)
+        {
+          cout << "Element " << i << " was " << out[i] << ", expected " << value << endl;
+          return false;
+        }
+    }
+
+  return true;
+}
+
+static JitModule *module_with_precision(const char *src, unsigned int precision)
+{
+  JitModuleOptions options;
+  jit_module_options_init(&options);
+
+  options.division_precision = precision;
+
+  return jit_module_for_src_with_options(src, JIT_MODULE_PRIVATE, &options);
+}
+
+bool test_full_precision()
+{
+  JitModule *jm = module_with_precision(divide_src, JIT_DIVISION_FULL);
+  bool result = check_divide(jm, "float4[]", 4, divide_expected, 0.0f);
+
+  if (jm)
+    jit_module_destroy(jm);
+  return result;
+}
+
+bool test_approximate()
+{
+  bool result = true;
+  unsigned int precisions[2] = { JIT_DIVISION_22_BIT, JIT_DIVISION_12_BIT };
+  float tolerances[2] = { 1.0e-5f, 1.0e-3f };
+
+  for (int i = 0; i < 2; ++i)
+    {
+      JitModule *jm = module_with_precision(divide_src, precisions[i]);
+      result = check_divide(jm, "float4[]", 4, divide_expected, tolerances[i]) && result;
+      if (jm)
+        jit_module_destroy(jm);
+
+      jm = module_with_precision(scalar_src, precisions[i]);
+      result = check_divide(jm, "float[]", 1, scalar_expected, tolerances[i]) && result;
+      if (jm)
+        jit_module_destroy(jm);
+    }
+
+  return result;
+}
+
+bool test_native()
+{
+  JitModule *jm = module_with_precision(native_src, JIT_DIVISION_FULL);
+  bool result = check_divide(jm, "float4[]", 4, native_expected, 1.0e-3f);
+
+  if (jm)
+    jit_module_destroy(jm);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int pass_count = 0;
+  int fail_count = 0;
+
+  test_full_precision() ? pass_count++ : fail_count++;
+  test_approximate() ? pass_count++ : fail_count++;
+  test_native() ? pass_count++ : fail_count++;
+
+  cout << "ran " << (pass_count + fail_count) << " tests: " << pass_count << " ok, " << fail_count << " failures" << endl;
+
+  if (!fail_count)
+    cout << "OK" << endl;
+  else
+    cout << "FAIL" << endl;
+
+  return fail_count;
+}
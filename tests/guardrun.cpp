@@ -0,0 +1,170 @@
+#include <cstdio>
+#include <iostream>
+#include <stdint.h>
+using namespace std;
+
+#include "jitmodule.h"
+
+typedef void (*BlendFunction)(float *out, float *in, float *aux, uint32_t count);
+typedef void (*InPlaceFunction)(float *in, float *aux, uint32_t count);
+
+#define COUNT 203
+
+/* Most of the layer is transparent, and transparent pixels are left as
+ * they are.
+ */
+static const char *guard_src = \
+  "float4 process(float4 in, float4 aux) "
+  "{ "
+  "  float4 one = (float4)(1.0f, 1.0f, 1.0f, 1.0f); "
+  "  if (aux.s3 == 0.0f) "
+  "    { "
+  "      return in; "
+  "    } "
+  "  return aux + in * (one - aux.s3333); "
+  "}";
+
+/* Runs of every length from 1 to 12, transparent and opaque in turn,
+ * starting with a transparent run.
+ */
+static void fill(float *in, float *aux)
+{
+  int run = 1;
+  int left = run;
+  bool transparent = true;
+
+  for (int i = 0; i < COUNT; ++i)
+    {
+      for (int j = 0; j < 4; ++j)
+        {
+          in[i * 4 + j] = (float)(i * 4 + j);
+          aux[i * 4 + j] = transparent ? 0.0f : 0.5f;
+        }
+
+      if (--left == 0)
+        {
+          transparent = !transparent;
+          run = (run % 12) + 1;
+          left = run;
+        }
+    }
+}
+
+static bool check_result(const float *out, const float *in, const float *aux, uint32_t count)
+{
+  for (uint32_t i = 0; i < count * 4; ++i)
+    {
+      float alpha = aux[i / 4 * 4 + 3];
+      float expected = (alpha == 0.0f) ? in[i] : aux[i] + in[i] * (1.0f - alpha);
+
+      if (out[i] != expected)
+        {
+          cout << "Element " << i << " was " << out[i] << ", expected " << expected << endl;
+          return false;
+        }
+    }
+
+  return true;
+}
+
+bool test_copy_runs()
+{
+  JitModule *jm = jit_module_for_src(guard_src, JIT_MODULE_PRIVATE);
+  void *jitfunc = jm ? jit_module_get_iteration(jm, "process", "float4[]", "float4[]", "float4[]", NULL) : NULL;
+  bool result = jitfunc && !jit_module_is_fallback_function(jm, jitfunc);
+
+  /* Every starting point, so runs are cut off at both ends of the call */
+  for (uint32_t start = 0; result && start < 16; ++start)
+    {
+      float in[COUNT * 4];
+      float aux[COUNT * 4];
+      float out[COUNT * 4];
+
+      fill(in, aux);
+      for (int i = 0; i < COUNT * 4; ++i)
+        out[i] = -1.0f;
+
+      ((BlendFunction)jitfunc)(out + start * 4, in + start * 4, aux + start * 4, COUNT - 1 - start);
+      result = check_result(out + start * 4, in + start * 4, aux + start * 4, COUNT - 1 - start);
+
+      /* Nothing outside the array is written */
+      if (out[(COUNT - 1) * 4] != -1.0f || (start && out[start * 4 - 1] != -1.0f))
+        {
+          cout << "Wrote past the array starting at " << start << endl;
+          result = false;
+        }
+    }
+
+  if (jm)
+    jit_module_destroy(jm);
+  return result;
+}
+
+bool test_in_place_runs()
+{
+  JitModule *jm = jit_module_for_src(guard_src, JIT_MODULE_PRIVATE);
+  void *jitfunc = jm ? jit_module_get_iteration(jm, "process", "alias(1) float4[]", "float4[]", "float4[]", NULL) : NULL;
+  bool result = jitfunc && !jit_module_is_fallback_function(jm, jitfunc);
+
+  if (result)
+    {
+      float in[COUNT * 4];
+      float aux[COUNT * 4];
+      float out[COUNT * 4];
+
+      fill(out, aux);
+      fill(in, aux);
+
+      ((InPlaceFunction)jitfunc)(out, aux, COUNT);
+      result = check_result(out, in, aux, COUNT);
+    }
+
+  if (jm)
+    jit_module_destroy(jm);
+  return result;
+}
+
+/* Guards returning an argument that isn't an array still work */
+bool test_pointer_argument()
+{
+  JitModule *jm = jit_module_for_src(guard_src, JIT_MODULE_PRIVATE);
+  void *jitfunc = jm ? jit_module_get_iteration(jm, "process", "float4[]", "*float4", "float4[]", NULL) : NULL;
+  bool result = jitfunc && !jit_module_is_fallback_function(jm, jitfunc);
+
+  if (result)
+    {
+      float in[COUNT * 4];
+      float aux[COUNT * 4];
+      float out[COUNT * 4];
+      float single[COUNT * 4];
+
+      fill(in, aux);
+      for (int i = 0; i < COUNT * 4; ++i)
+        single[i] = in[i % 4];
+
+      ((BlendFunction)jitfunc)(out, in, aux, COUNT);
+      result = check_result(out, single, aux, COUNT);
+    }
+
+  if (jm)
+    jit_module_destroy(jm);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int pass_count = 0;
+  int fail_count = 0;
+
+  test_copy_runs() ? pass_count++ : fail_count++;
+  test_in_place_runs() ? pass_count++ : fail_count++;
+  test_pointer_argument() ? pass_count++ : fail_count++;
+
+  cout << "ran " << (pass_count + fail_count) << " tests: " << pass_count << " ok, " << fail_count << " failures" << endl;
+
+  if (!fail_count)
+    cout << "OK" << endl;
+  else
+    cout << "FAIL" << endl;
+
+  return fail_count;
+}
@@ -0,0 +1,171 @@
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <stdint.h>
+using namespace std;
+
+#include "jitmodule.h"
+
+typedef void (*BlendFunction)(float *out, float *in, float *aux, uint32_t count);
+
+#define COUNT 64
+
+/* Like color burn, the early return for a transparent layer is cheaper to
+ * compute alongside the blend than to branch around.
+ */
+static const char *burn_src = \
+  "float4 process(float4 in, float4 aux) "
+  "{ "
+  "  float4 one = (float4)(1.0f, 1.0f, 1.0f, 1.0f); "
+  "  if (aux.s3 == 0.0f) "
+  "    { "
+  "      return in; "
+  "    } "
+  "  return one - (one - in) / (aux + one); "
+  "}";
+
+/* An if/else that joins up again, with a division on one side */
+static const char *diamond_src = \
+  "float4 process(float4 in, float4 aux) "
+  "{ "
+  "  float4 result = in; "
+  "  if (aux.s0 > in.s0) "
+  "    { "
+  "      result = in / aux; "
+  "    } "
+  "  else "
+  "    { "
+  "      result = in * aux; "
+  "    } "
+  "  return result; "
+  "}";
+
+static void fill(float *in, float *aux)
+{
+  for (int i = 0; i < COUNT * 4; ++i)
+    {
+      in[i] = (i % 7) / 8.0f;
+      aux[i] = ((i / 4) % 3) ? 0.25f + (i % 5) / 4.0f : 0.0f;
+    }
+}
+
+static float expected_burn(const float *in, const float *aux, int i)
+{
+  if (aux[i / 4 * 4 + 3] == 0.0f)
+    return in[i];
+  return 1.0f - (1.0f - in[i]) / (aux[i] + 1.0f);
+}
+
+static float expected_diamond(const float *in, const float *aux, int i)
+{
+  if (aux[i / 4 * 4] > in[i / 4 * 4])
+    return in[i] / aux[i];
+  return in[i] * aux[i];
+}
+
+static bool check_blend(const char *src, const JitModuleOptions *options,
+                        float (*expected)(const float *, const float *, int))
+{
+  JitModule *jm = jit_module_for_src_with_options(src, JIT_MODULE_PRIVATE, options);
+  void *jitfunc = jm ? jit_module_get_iteration(jm, "process", "float4[]", "float4[]", "float4[]", NULL) : NULL;
+  bool result = jitfunc && !jit_module_is_fallback_function(jm, jitfunc);
+
+  if (result)
+    {
+      float in[COUNT * 4];
+      float aux[COUNT * 4];
+      float out[COUNT * 4];
+
+      fill(in, aux);
+      ((BlendFunction)jitfunc)(out, in, aux, COUNT);
+
+      for (int i = 0; i < COUNT * 4; ++i)
+        {
+          if (out[i] != expected(in, aux, i))
+            {
+              cout << "Element " << i << " was " << out[i] << ", expected " << expected(in, aux, i) << endl;
+              result = false;
+              break;
+            }
+        }
+    }
+  else
+    {
+      cout << "Failed to compile " << src << endl;
+    }
+
+  if (jm)
+    jit_module_destroy(jm);
+  return result;
+}
+
+bool test_early_return()
+{
+  JitModuleOptions options;
+  jit_module_options_init(&options);
+
+  if (!check_blend(burn_src, &options, expected_burn))
+    return false;
+
+  /* Only attributes convert, the branch is kept */
+  options.if_convert_cost = 0;
+  return check_blend(burn_src, &options, expected_burn);
+}
+
+bool test_diamond()
+{
+  JitModuleOptions options;
+  jit_module_options_init(&options);
+
+  if (!check_blend(diamond_src, &options, expected_diamond))
+    return false;
+
+  options.if_convert_cost = 1;
+  return check_blend(diamond_src, &options, expected_diamond);
+}
+
+bool test_attributes()
+{
+  JitModuleOptions options;
+  jit_module_options_init(&options);
+  options.if_convert_cost = 0;
+
+  std::string forced = std::string("__attribute__((if_convert)) ") + burn_src;
+  if (!check_blend(forced.c_str(), &options, expected_burn))
+    return false;
+
+  jit_module_options_init(&options);
+  std::string kept = std::string("__attribute__((no_if_convert)) ") + diamond_src;
+  return check_blend(kept.c_str(), &options, expected_diamond);
+}
+
+bool test_unknown_attribute()
+{
+  std::string src = std::string("__attribute__((sometimes_convert)) ") + burn_src;
+  JitModule *jm = jit_module_for_src(src.c_str(), JIT_MODULE_PRIVATE);
+  void *jitfunc = jm ? jit_module_get_iteration(jm, "process", "float4[]", "float4[]", "float4[]", NULL) : NULL;
+  bool result = !jm || jit_module_is_fallback_function(jm, jitfunc);
+
+  if (jm)
+    jit_module_destroy(jm);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int pass_count = 0;
+  int fail_count = 0;
+
+  test_early_return() ? pass_count++ : fail_count++;
+  test_diamond() ? pass_count++ : fail_count++;
+  test_attributes() ? pass_count++ : fail_count++;
+  test_unknown_attribute() ? pass_count++ : fail_count++;
+
+  cout << "ran " << (pass_count + fail_count) << " tests: " << pass_count << " ok, " << fail_count << " failures" << endl;
+
+  if (!fail_count)
+    cout << "OK" << endl;
+  else
+    cout << "FAIL" << endl;
+
+  return fail_count;
+}
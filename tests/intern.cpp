@@ -0,0 +1,134 @@
+#include <cstdio>
+#include <iostream>
+#include <stdint.h>
+using namespace std;
+
+#include "jitmodule.h"
+
+typedef void (*AddFunction)(int *out, int *a, int *b, uint32_t count);
+
+static const char *shader_src = \
+  "int4 process(int4 a, int4 b) "
+  "{ "
+  "return a + b; "
+  "}";
+
+static bool check_add(void *jitfunc)
+{
+  int a[4] = { 1, 2, 3, 4 };
+  int b[4] = { 10, 20, 30, 40 };
+  int out[4] = { 0, 0, 0, 0 };
+
+  if (!jitfunc)
+    return false;
+
+  ((AddFunction)jitfunc)(out, a, b, 1);
+
+  return out[0] == 11 && out[3] == 44;
+}
+
+bool test_shared()
+{
+  JitModule *first = jit_module_for_src(shader_src, 0);
+  JitModule *second = jit_module_for_src(shader_src, 0);
+  bool result = true;
+
+  if (!first || first != second)
+    {
+      cout << "Identical source was not shared" << endl;
+      result = false;
+    }
+
+  void *jitfunc = jit_module_get_iteration(first, "process", "int4[]", "int4[]", "int4[]", NULL);
+
+  /* The first handle going away must not affect the second */
+  jit_module_destroy(first);
+
+  if (jitfunc != jit_module_get_iteration(second, "process", "int4[]", "int4[]", "int4[]", NULL) || !check_add(jitfunc))
+    result = false;
+
+  jit_module_destroy(second);
+  return result;
+}
+
+bool test_not_shared()
+{
+  JitModule *shared = jit_module_for_src(shader_src, 0);
+  JitModule *priv = jit_module_for_src(shader_src, JIT_MODULE_PRIVATE);
+  JitModule *other_flags = jit_module_for_src(shader_src, JIT_MODULE_VERBOSE);
+  JitModule *other_src = jit_module_for_src("int4 process(int4 a, int4 b) { return a - b; }", 0);
+  bool result = true;
+
+  if (!shared || !priv || !other_flags || !other_src)
+    result = false;
+  else if (shared == priv || shared == other_flags || shared == other_src)
+    {
+      cout << "Different modules were shared" << endl;
+      result = false;
+    }
+
+  jit_module_destroy(shared);
+  jit_module_destroy(priv);
+  jit_module_destroy(other_flags);
+  jit_module_destroy(other_src);
+  return result;
+}
+
+bool test_ref()
+{
+  JitModule *jm = jit_module_for_src(shader_src, 0);
+
+  if (!jm)
+    return false;
+
+  JitModule *ref = jit_module_ref(jm);
+  jit_module_destroy(jm);
+
+  bool result = (ref == jm) && check_add(jit_module_get_iteration(ref, "process", "int4[]", "int4[]", "int4[]", NULL));
+
+  jit_module_destroy(ref);
+  return result;
+}
+
+/* A module compiled for another target isn't shared */
+bool test_target_change()
+{
+  JitModule *before = jit_module_for_src(shader_src, 0);
+
+  jit_set_target("host", "-avx2");
+  JitModule *after = jit_module_for_src(shader_src, 0);
+  jit_set_target(NULL, NULL);
+
+  JitModule *restored = jit_module_for_src(shader_src, 0);
+  bool result = before && after && before != after && restored == before;
+
+  if (after)
+    result = result && check_add(jit_module_get_iteration(after, "process", "int4[]", "int4[]", "int4[]", NULL));
+
+  if (before)
+    jit_module_destroy(before);
+  if (after)
+    jit_module_destroy(after);
+  if (restored)
+    jit_module_destroy(restored);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int pass_count = 0;
+  int fail_count = 0;
+
+  test_shared() ? pass_count++ : fail_count++;
+  test_not_shared() ? pass_count++ : fail_count++;
+  test_ref() ? pass_count++ : fail_count++;
+  test_target_change() ? pass_count++ : fail_count++;
+
+  cout << "ran " << (pass_count + fail_count) << " tests: " << pass_count << " ok, " << fail_count << " failures" << endl;
+
+  if (!fail_count)
+    cout << "OK" << endl;
+  else
+    cout << "FAIL" << endl;
+
+  return fail_count;
+}
@@ -0,0 +1,159 @@
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <list>
+#include <string>
+#include <stdint.h>
+using namespace std;
+
+#include "jitmodule.h"
+
+static const char *shader_src = \
+  "float4 process(float4 a, float4 b) "
+  "{ "
+  "return a + b; "
+  "}";
+
+bool test_repeat_lookup()
+{
+  auto_ptr<JitModule> jitmod;
+
+  try
+    {
+      jitmod.reset(new JitModule(shader_src, 0));
+    }
+  catch (JitModuleException &e)
+    {
+      cout << e.what() << endl;
+      return false;
+    }
+
+  void *first = jitmod->getIteration("process", "float4[]", "float4[]", "float4[]", NULL);
+  void *second = jitmod->getIteration("process", "float4[]", "float4[]", "float4[]", NULL);
+
+  if (NULL == first || first != second)
+    {
+      cout << "Repeated lookup returned a different function" << endl;
+      return false;
+    }
+
+  std::list<std::string> argstrs;
+  argstrs.push_back("float4[]");
+  argstrs.push_back("float4[]");
+  argstrs.push_back("float4[]");
+
+  if (first != jitmod->getIteration("process", argstrs))
+    {
+      cout << "List lookup returned a different function" << endl;
+      return false;
+    }
+
+  return true;
+}
+
+bool test_distinct_signatures()
+{
+  auto_ptr<JitModule> jitmod;
+
+  try
+    {
+      jitmod.reset(new JitModule(shader_src, 0));
+    }
+  catch (JitModuleException &e)
+    {
+      cout << e.what() << endl;
+      return false;
+    }
+
+  void *unaligned = jitmod->getIteration("process", "float4[]", "float4[]", "float4[]", NULL);
+  void *aligned = jitmod->getIteration("process", "aligned float4[]", "aligned float4[]", "aligned float4[]", NULL);
+  void *range = jitmod->getRangeIteration("process", "float4[]", "float4[]", "float4[]", NULL);
+
+  if (NULL == unaligned || NULL == aligned || NULL == range)
+    return false;
+
+  if (unaligned == aligned || unaligned == range || aligned == range)
+    {
+      cout << "Different signatures share a function" << endl;
+      return false;
+    }
+
+  if (aligned != jitmod->getIteration("process", "aligned float4[]", "aligned float4[]", "aligned float4[]", NULL))
+    return false;
+
+  return true;
+}
+
+bool test_batch()
+{
+  auto_ptr<JitModule> jitmod;
+
+  try
+    {
+      jitmod.reset(new JitModule(shader_src, 0));
+    }
+  catch (JitModuleException &e)
+    {
+      cout << e.what() << endl;
+      return false;
+    }
+
+  const char *linear_sig[] = {"float4[]", "float4[]", "float4[]", NULL};
+  const char *aligned_sig[] = {"aligned float4[]", "aligned float4[]", "aligned float4[]", NULL};
+  const char *missing_sig[] = {"float4[]", "float4[]", NULL};
+
+  const char *names[] = {"process", "process", "process", "missing"};
+  const char * const *signatures[] = {linear_sig, aligned_sig, linear_sig, missing_sig};
+  void *functions[4];
+
+  unsigned int compiled = jit_module_get_iterations(jitmod.get(), 4, names, signatures, functions);
+
+  if (compiled != 3)
+    {
+      cout << "Batch compiled " << compiled << " iterations, expected 3" << endl;
+      return false;
+    }
+
+  if (NULL == functions[0] || NULL == functions[1] || functions[0] == functions[1])
+    return false;
+
+  if (functions[0] != functions[2])
+    {
+      cout << "Duplicate batch entries returned different functions" << endl;
+      return false;
+    }
+
+  if (!jitmod->isFallbackFunction(functions[3]))
+    {
+      cout << "Missing function did not fall back" << endl;
+      return false;
+    }
+
+  if (functions[1] != jitmod->getIteration("process", "aligned float4[]", "aligned float4[]", "aligned float4[]", NULL))
+    {
+      cout << "Batch result not found by lookup" << endl;
+      return false;
+    }
+
+  return true;
+}
+
+int main(int argc, char **argv) {
+  int pass_count = 0;
+  int fail_count = 0;
+
+  test_repeat_lookup() ? pass_count++ : fail_count++;
+  test_distinct_signatures() ? pass_count++ : fail_count++;
+  test_batch() ? pass_count++ : fail_count++;
+
+  cout << "ran " << (pass_count + fail_count) << " tests: " << pass_count << " ok, " << fail_count << " failures" << endl;
+
+  if (!fail_count)
+    cout << "OK" << endl;
+  else
+    cout << "FAIL" << endl;
+
+  return fail_count;
+}
@@ -0,0 +1,151 @@
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <stdint.h>
+using namespace std;
+
+#include "jitmodule.h"
+
+typedef void (*BlendFunction)(float *out, float *in, float *aux, uint32_t count);
+
+#define COUNT 32
+
+/* Evaluate a polynomial in "in" with every coefficient "aux" */
+static const char *horner_body = \
+  "for (int i = 0; i < 4; i = i + 1) "
+  "  { "
+  "    float4 scaled = acc * in; "
+  "    acc = scaled + aux; "
+  "  } "
+  "return acc; ";
+
+static void fill(float *in, float *aux)
+{
+  for (int i = 0; i < COUNT * 4; ++i)
+    {
+      in[i] = (i % 4) * 0.5f;
+      aux[i] = (i % 3) * 0.25f;
+    }
+}
+
+static float expected_horner(const float *in, const float *aux, int i)
+{
+  float acc = 0.0f;
+  for (int j = 0; j < 4; ++j)
+    acc = acc * in[i] + aux[i];
+  return acc;
+}
+
+static float expected_power(const float *in, const float *aux, int i)
+{
+  return in[i] * aux[i] * aux[i] * aux[i];
+}
+
+static float expected_in(const float *in, const float *aux, int i)
+{
+  return in[i];
+}
+
+static float expected_double_in(const float *in, const float *aux, int i)
+{
+  return in[i] + in[i];
+}
+
+/* Compile "float4 process(float4 in, float4 aux) { body }" and check it */
+static bool check_loop(const std::string &body, float (*expected)(const float *, const float *, int))
+{
+  std::string src = "float4 process(float4 in, float4 aux) { " + body + " }";
+  JitModule *jm = jit_module_for_src(src.c_str(), JIT_MODULE_PRIVATE);
+  void *jitfunc = jm ? jit_module_get_iteration(jm, "process", "float4[]", "float4[]", "float4[]", NULL) : NULL;
+  bool result = jitfunc && !jit_module_is_fallback_function(jm, jitfunc);
+
+  if (result)
+    {
+      float in[COUNT * 4];
+      float aux[COUNT * 4];
+      float out[COUNT * 4];
+
+      fill(in, aux);
+      ((BlendFunction)jitfunc)(out, in, aux, COUNT);
+
+      for (int i = 0; i < COUNT * 4; ++i)
+        {
+          if (out[i] != expected(in, aux, i))
+            {
+              cout << "Element " << i << " was " << out[i] << ", expected " << expected(in, aux, i) << endl;
+              result = false;
+              break;
+            }
+        }
+    }
+  else
+    {
+      cout << "Failed to compile " << src << endl;
+    }
+
+  if (jm)
+    jit_module_destroy(jm);
+  return result;
+}
+
+bool test_for()
+{
+  std::string body = std::string("float4 acc = (float4)(0.0f, 0.0f, 0.0f, 0.0f); ") + horner_body;
+
+  return check_loop(body, expected_horner) &&
+         check_loop("float4 acc = (float4)(0.0f, 0.0f, 0.0f, 0.0f); #pragma unroll " + std::string(horner_body),
+                    expected_horner);
+}
+
+bool test_while()
+{
+  static const char *loop = \
+    "while (n < 3) "
+    "  { "
+    "    x = x * aux; "
+    "    n = n + 1; "
+    "  } "
+    "return x; ";
+
+  /* Can't be unrolled, so it stays a loop */
+  return check_loop(std::string("float4 x = in; int n = 0; ") + loop, expected_power) &&
+         check_loop(std::string("float4 x = in; int n = 0; #pragma unroll ") + loop, expected_power);
+}
+
+/* Unrolling keeps the loop right when the body moves the counter itself */
+bool test_unroll_counter_changed()
+{
+  return check_loop("float4 acc = (float4)(0.0f, 0.0f, 0.0f, 0.0f); "
+                    "#pragma unroll "
+                    "for (int i = 0; i < 4; i = i + 1) "
+                    "  { "
+                    "    acc = acc + in; "
+                    "    i = i + 1; "
+                    "  } "
+                    "return acc; ", expected_double_in);
+}
+
+bool test_return_in_loop()
+{
+  return check_loop("for (int i = 0; i < 4; i = i + 1) { return in; } return aux;", expected_in) &&
+         check_loop("#pragma unroll for (int i = 0; i < 4; i = i + 1) { return in; } return aux;", expected_in);
+}
+
+int main(int argc, char **argv) {
+  int pass_count = 0;
+  int fail_count = 0;
+
+  test_for() ? pass_count++ : fail_count++;
+  test_while() ? pass_count++ : fail_count++;
+  test_unroll_counter_changed() ? pass_count++ : fail_count++;
+  test_return_in_loop() ? pass_count++ : fail_count++;
+
+  cout << "ran " << (pass_count + fail_count) << " tests: " << pass_count << " ok, " << fail_count << " failures" << endl;
+
+  if (!fail_count)
+    cout << "OK" << endl;
+  else
+    cout << "FAIL" << endl;
+
+  return fail_count;
+}
@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <stdint.h>
+using namespace std;
+
+#include "jitmodule.h"
+
+typedef void (*MathFunction)(float *out, float *a, float *b, uint32_t count);
+
+#define COUNT 256
+
+/* Distance from value to the correctly rounded float result in units of
+ * its last place.
+ */
+static double ulp_error(float value, double expected)
+{
+  if (isnan(expected))
+    return isnan(value) ? 0.0 : INFINITY;
+  if (isinf(expected) || isinf(value))
+    return (value == expected) ? 0.0 : INFINITY;
+
+  int exponent;
+  frexp((float)expected, &exponent);
+  double ulp = ldexp(1.0, std::max(exponent - 24, -149));
+
+  return fabs((double)value - expected) / ulp;
+}
+
+/* Run "return expr;" over a and b as width wide vectors and compare it to
+ * expected, element by element.
+ */
+static bool check_math(const char *expr, int width, double (*expected)(double, double),
+                       const float *a, const float *b, double max_ulp)
+{
+  std::string type = (width == 1) ? "float" : "float4";
+  std::string src = type + " process(" + type + " a, " + type + " b) { return " + expr + "; }";
+  std::string arg_type = type + "[]";
+
+  JitModule *jm = jit_module_for_src(src.c_str(), JIT_MODULE_PRIVATE);
+  void *jitfunc = jm ? jit_module_get_iteration(jm, "process", arg_type.c_str(), arg_type.c_str(),
+                                                arg_type.c_str(), NULL) : NULL;
+  bool result = jitfunc != NULL;
+
+  if (jitfunc)
+    {
+      float in_a[COUNT];
+      float in_b[COUNT];
+      float out[COUNT];
+
+      for (int i = 0; i < COUNT; ++i)
+        {
+          in_a[i] = a[i];
+          in_b[i] = b[i];
+          out[i] = 0.0f;
+        }
+
+      ((MathFunction)jitfunc)(out, in_a, in_b, COUNT / width);
+
+      for (int i = 0; i < COUNT && result; ++i)
+        {
+          double value = expected(a[i], b[i]);
+          if (ulp_error(out[i], value) > max_ulp)
+            {
+              cout << expr << " with a = " << a[i] << ", b = " << b[i] << " gave " << out[i];
+              cout << ", expected " << value << endl;
+              result = false;
+            }
+        }
+    }
+  else
+    {
+      cout << "Failed to compile " << src << endl;
+    }
+
+  if (jm)
+    jit_module_destroy(jm);
+  return result;
+}
+
+static void fill(float *values, float from, float to)
+{
+  for (int i = 0; i < COUNT; ++i)
+    values[i] = from + (to - from) * i / (COUNT - 1);
+}
+
+static double ref_exp(double a, double b) { return exp(a); }
+static double ref_exp2(double a, double b) { return exp2(a); }
+static double ref_log(double a, double b) { return log(a); }
+static double ref_log2(double a, double b) { return log2(a); }
+static double ref_pow(double a, double b) { return pow(a, b); }
+static double ref_powr(double a, double b) { return (a < 0.0) ? NAN : pow(a, b); }
+static double ref_sin(double a, double b) { return sin(a); }
+static double ref_cos(double a, double b) { return cos(a); }
+static double ref_fma(double a, double b) { return (float)(a * b + 0.5); }
+
+bool test_exp_log()
+{
+  float a[COUNT];
+  float b[COUNT];
+  bool result = true;
+
+  fill(b, 0.0f, 0.0f);
+
+  fill(a, -87.0f, 88.0f);
+  result = check_math("exp(a)", 4, ref_exp, a, b, 1.0) && result;
+  fill(a, -140.0f, 127.5f);
+  result = check_math("exp2(a)", 4, ref_exp2, a, b, 2.0) && result;
+
+  /* Denormals, zero, negatives and infinity included */
+  for (int i = 0; i < COUNT; ++i)
+    a[i] = ldexpf(1.0f + i / 256.0f, i - 150);
+  a[0] = 0.0f;
+  a[1] = -1.0f;
+  a[2] = INFINITY;
+  result = check_math("log(a)", 4, ref_log, a, b, 1.0) && result;
+  result = check_math("log2(a)", 4, ref_log2, a, b, 2.0) && result;
+  result = check_math("log2(a)", 1, ref_log2, a, b, 2.0) && result;
+
+  return result;
+}
+
+bool test_pow()
+{
+  float a[COUNT];
+  float b[COUNT];
+  bool result = true;
+
+  for (int i = 0; i < COUNT; ++i)
+    {
+      a[i] = 0.01f + i * 0.37f;
+      b[i] = -14.0f + i * 0.11f;
+    }
+  result = check_math("powr(a, b)", 4, ref_powr, a, b, 2.0) && result;
+  result = check_math("pow(a, b)", 4, ref_pow, a, b, 2.0) && result;
+
+  /* Negative bases are only defined for integer exponents */
+  for (int i = 0; i < COUNT; ++i)
+    {
+      a[i] = -0.5f - i * 0.25f;
+      b[i] = (float)(i % 9) - 4.0f + ((i % 5) ? 0.0f : 0.5f);
+    }
+  result = check_math("pow(a, b)", 4, ref_pow, a, b, 2.0) && result;
+  result = check_math("powr(a, b)", 4, ref_powr, a, b, 2.0) && result;
+
+  return result;
+}
+
+bool test_sin_cos()
+{
+  float a[COUNT];
+  float b[COUNT];
+  bool result = true;
+
+  fill(b, 0.0f, 0.0f);
+
+  fill(a, -7.0f, 7.0f);
+  result = check_math("sin(a)", 4, ref_sin, a, b, 2.0) && result;
+  result = check_math("cos(a)", 4, ref_cos, a, b, 2.0) && result;
+
+  fill(a, -100000.0f, 100000.0f);
+  result = check_math("sin(a)", 4, ref_sin, a, b, 2.0) && result;
+  result = check_math("cos(a)", 1, ref_cos, a, b, 2.0) && result;
+
+  return result;
+}
+
+bool test_fma()
+{
+  float a[COUNT];
+  float b[COUNT];
+
+  /* The product needs more than a float's precision to round right */
+  for (int i = 0; i < COUNT; ++i)
+    {
+      a[i] = 1.0f + ldexpf((float)(i + 1), -20);
+      b[i] = 1.0f - ldexpf((float)(i + 3), -19);
+    }
+
+  return check_math("fma(a, b, 0.5f)", 4, ref_fma, a, b, 0.5);
+}
+
+/* mix, step and smoothstep with scalar arguments used for every element */
+bool test_interpolation()
+{
+  static const char *src = \
+    "float4 process(float4 a, float4 b) "
+    "{ "
+    "  return mix(a, b, 0.25f) + step(0.5f, a) + smoothstep(0.0f, 2.0f, b) + mad(a, b, 1.0f); "
+    "}";
+
+  JitModule *jm = jit_module_for_src(src, JIT_MODULE_PRIVATE);
+  void *jitfunc = jm ? jit_module_get_iteration(jm, "process", "float4[]", "float4[]", "float4[]", NULL) : NULL;
+  bool result = jitfunc != NULL;
+
+  if (jitfunc)
+    {
+      float a[16 * 4];
+      float b[16 * 4];
+      float out[16 * 4];
+
+      for (int i = 0; i < 16 * 4; ++i)
+        {
+          a[i] = i / 32.0f;
+          b[i] = 3.0f - i / 16.0f;
+        }
+
+      ((MathFunction)jitfunc)(out, a, b, 16);
+
+      for (int i = 0; i < 16 * 4; ++i)
+        {
+          float t = std::min(std::max(b[i] / 2.0f, 0.0f), 1.0f);
+          float expected = a[i] + (b[i] - a[i]) * 0.25f + ((a[i] < 0.5f) ? 0.0f : 1.0f) +
+                           t * t * (3.0f - 2.0f * t) + (a[i] * b[i] + 1.0f);
+          if (fabsf(out[i] - expected) > 1.0e-5f * fabsf(expected) + 1.0e-6f)
+            {
+              cout << "Element " << i << " was " << out[i] << ", expected " << expected << endl;
+              result = false;
+              break;
+            }
+        }
+    }
+
+  if (jm)
+    jit_module_destroy(jm);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int pass_count = 0;
+  int fail_count = 0;
+
+  test_exp_log() ? pass_count++ : fail_count++;
+  test_pow() ? pass_count++ : fail_count++;
+  test_sin_cos() ? pass_count++ : fail_count++;
+  test_fma() ? pass_count++ : fail_count++;
+  test_interpolation() ? pass_count++ : fail_count++;
+
+  cout << "ran " << (pass_count + fail_count) << " tests: " << pass_count << " ok, " << fail_count << " failures" << endl;
+
+  if (!fail_count)
+    cout << "OK" << endl;
+  else
+    cout << "FAIL" << endl;
+
+  return fail_count;
+}
@@ -0,0 +1,348 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <stdint.h>
+using namespace std;
+
+#include "jitmodule.h"
+
+typedef void (*AddFunction)(int *out, int *a, int *b, uint32_t count);
+typedef void (*AddFloatFunction)(float *out, float *a, float *b, uint32_t count);
+
+static const char *shader_src = \
+  "int4 process(int4 a, int4 b) "
+  "{ "
+  "return a + b; "
+  "} "
+  "float4 process_float(float4 a, float4 b) "
+  "{ "
+  "return a + b; "
+  "}";
+
+static bool check_int(void *jitfunc)
+{
+  int a[4] = { 1, 2, 3, 4 };
+  int b[4] = { 10, 20, 30, 40 };
+  int out[4] = { 0, 0, 0, 0 };
+
+  ((AddFunction)jitfunc)(out, a, b, 1);
+
+  return out[0] == 11 && out[3] == 44;
+}
+
+static bool check_float(void *jitfunc)
+{
+  float a[4] = { 1.0f, 2.0f, 3.0f, 4.0f };
+  float b[4] = { 0.5f, 0.5f, 0.5f, 0.5f };
+  float out[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+  ((AddFloatFunction)jitfunc)(out, a, b, 1);
+
+  return out[0] == 1.5f && out[3] == 4.5f;
+}
+
+bool test_usage()
+{
+  JitModule *jm = jit_module_for_src(shader_src, JIT_MODULE_PRIVATE);
+  bool result = true;
+
+  if (jit_module_get_memory_usage(jm) != 0)
+    {
+      cout << "Usage before any iterations" << endl;
+      result = false;
+    }
+
+  void *int_func = jit_module_get_iteration(jm, "process", "int4[]", "int4[]", "int4[]", NULL);
+  size_t int_usage = jit_module_get_memory_usage(jm);
+
+  void *float_func = jit_module_get_iteration(jm, "process_float", "float4[]", "float4[]", "float4[]", NULL);
+  size_t total_usage = jit_module_get_memory_usage(jm);
+
+  if (!int_usage || total_usage <= int_usage)
+    {
+      cout << "Usage not counted: " << int_usage << ", " << total_usage << endl;
+      result = false;
+    }
+
+  if (jit_module_get_iteration_memory(jm, int_func) + jit_module_get_iteration_memory(jm, float_func) != total_usage)
+    {
+      cout << "Iteration memory doesn't add up to the module's usage" << endl;
+      result = false;
+    }
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+bool test_eviction()
+{
+  JitModule *jm = jit_module_for_src(shader_src, JIT_MODULE_PRIVATE);
+  bool result = true;
+
+  void *int_func = jit_module_get_iteration(jm, "process", "int4[]", "int4[]", "int4[]", NULL);
+  void *float_func = jit_module_get_iteration(jm, "process_float", "float4[]", "float4[]", "float4[]", NULL);
+
+  if (!int_func || !float_func || !check_int(int_func) || !check_float(float_func))
+    {
+      cout << "Initial iterations failed" << endl;
+      jit_module_destroy(jm);
+      return false;
+    }
+
+  /* Both iterations are acquired, nothing can be freed */
+  if (jit_module_acquire_iteration(jm, int_func) != int_func || jit_module_acquire_iteration(jm, float_func) != float_func)
+    {
+      cout << "Could not acquire the iterations" << endl;
+      jit_module_destroy(jm);
+      return false;
+    }
+
+  jit_module_set_memory_budget(jm, 1);
+
+  if (!jit_module_get_iteration_memory(jm, int_func) || !jit_module_get_iteration_memory(jm, float_func))
+    {
+      cout << "Acquired iteration was evicted" << endl;
+      result = false;
+    }
+
+  if (!check_int(int_func) || !check_float(float_func))
+    {
+      cout << "Acquired iteration stopped working" << endl;
+      result = false;
+    }
+
+  jit_module_release_iteration(jm, int_func);
+
+  if (jit_module_get_iteration_memory(jm, int_func) != 0 ||
+      jit_module_get_memory_usage(jm) != jit_module_get_iteration_memory(jm, float_func))
+    {
+      cout << "Released iteration was not evicted" << endl;
+      result = false;
+    }
+
+  if (jit_module_acquire_iteration(jm, int_func))
+    {
+      cout << "Acquired an evicted iteration" << endl;
+      result = false;
+    }
+
+  /* Evicted iterations are compiled again on request, and a new iteration
+   * isn't evicted to make room for itself.
+   */
+  int_func = jit_module_get_iteration(jm, "process", "int4[]", "int4[]", "int4[]", NULL);
+
+  if (!int_func || !check_int(int_func))
+    {
+      cout << "Recompiled iteration failed" << endl;
+      result = false;
+    }
+
+  /* Usage only goes back under the budget the next time it's enforced */
+  jit_module_release_iteration(jm, float_func);
+
+  if (jit_module_get_memory_usage(jm) != 0)
+    {
+      cout << "Usage left after releasing everything" << endl;
+      result = false;
+    }
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+bool test_lru()
+{
+  JitModule *jm = jit_module_for_src(shader_src, JIT_MODULE_PRIVATE);
+  bool result = true;
+
+  void *int_func = jit_module_get_iteration(jm, "process", "int4[]", "int4[]", "int4[]", NULL);
+  void *float_func = jit_module_get_iteration(jm, "process_float", "float4[]", "float4[]", "float4[]", NULL);
+  size_t float_bytes = jit_module_get_iteration_memory(jm, float_func);
+
+  /* Use the int iteration again, without the lock, so the float one is the oldest */
+  jit_module_get_iteration(jm, "process", "int4[]", "int4[]", "int4[]", NULL);
+
+  jit_module_set_memory_budget(jm, jit_module_get_memory_usage(jm) - float_bytes);
+
+  if (jit_module_get_iteration_memory(jm, float_func) != 0 || jit_module_get_iteration_memory(jm, int_func) == 0)
+    {
+      cout << "Evicted the wrong iteration" << endl;
+      result = false;
+    }
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+/* Fetching an iteration over and over doesn't keep it around */
+bool test_lookup_unreferenced()
+{
+  JitModule *jm = jit_module_for_src(shader_src, JIT_MODULE_PRIVATE);
+  bool result = true;
+
+  for (int i = 0; i < 100; ++i)
+    {
+      void *int_func = jit_module_get_iteration(jm, "process", "int4[]", "int4[]", "int4[]", NULL);
+      if (!int_func || !check_int(int_func))
+        {
+          cout << "Lookup " << i << " failed" << endl;
+          result = false;
+          break;
+        }
+    }
+
+  jit_module_set_memory_budget(jm, 1);
+
+  if (jit_module_get_memory_usage(jm) != 0)
+    {
+      cout << "Lookups kept the iteration" << endl;
+      result = false;
+    }
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+bool test_lean()
+{
+  JitModule *full = jit_module_for_src(shader_src, JIT_MODULE_PRIVATE);
+  JitModule *lean = jit_module_for_src(shader_src, JIT_MODULE_PRIVATE | JIT_MODULE_LEAN);
+  bool result = true;
+
+  void *full_func = jit_module_get_iteration(full, "process", "int4[]", "int4[]", "int4[]", NULL);
+  void *lean_func = jit_module_get_iteration(lean, "process", "int4[]", "int4[]", "int4[]", NULL);
+
+  if (!lean_func || !check_int(lean_func))
+    {
+      cout << "Lean iteration failed" << endl;
+      result = false;
+    }
+
+  if (jit_module_get_iteration_memory(lean, lean_func) >= jit_module_get_iteration_memory(full, full_func))
+    {
+      cout << "Lean iteration kept its IR" << endl;
+      result = false;
+    }
+
+  /* Needs the base module that was freed after the first iteration */
+  void *float_func = jit_module_get_iteration(lean, "process_float", "float4[]", "float4[]", "float4[]", NULL);
+
+  if (!float_func || !check_float(float_func) || !check_int(lean_func))
+    {
+      cout << "Lean iteration after discarding IR failed" << endl;
+      result = false;
+    }
+
+  jit_module_set_memory_budget(lean, 1);
+
+  if (jit_module_get_memory_usage(lean) != 0)
+    {
+      cout << "Lean iterations were not evicted" << endl;
+      result = false;
+    }
+
+  jit_module_destroy(lean);
+  jit_module_destroy(full);
+  return result;
+}
+
+/* Permissions of the mapping holding ptr, from /proc/self/maps */
+static string mapping_permissions(void *ptr)
+{
+  ifstream maps("/proc/self/maps");
+  string line;
+
+  while (getline(maps, line))
+    {
+      unsigned long start, end;
+      string range, permissions;
+      istringstream fields(line);
+
+      fields >> range >> permissions;
+      if (sscanf(range.c_str(), "%lx-%lx", &start, &end) == 2 &&
+          (unsigned long)ptr >= start && (unsigned long)ptr < end)
+        return permissions;
+    }
+
+  return "";
+}
+
+bool test_code_memory()
+{
+  JitModule *jm = jit_module_for_src(shader_src, JIT_MODULE_PRIVATE);
+  bool result = true;
+
+  static const char * const int_signature[] = { "int4[]", "int4[]", "int4[]", NULL };
+  static const char * const float_signature[] = { "float4[]", "float4[]", "float4[]", NULL };
+  const char * const names[] = { "process", "process_float" };
+  const char * const * const signatures[] = { int_signature, float_signature };
+  void *functions[2] = { NULL, NULL };
+
+  if (jit_module_get_iterations(jm, 2, names, signatures, functions) != 2 ||
+      !check_int(functions[0]) || !check_float(functions[1]))
+    {
+      cout << "Batch iterations failed" << endl;
+      jit_module_destroy(jm);
+      return false;
+    }
+
+  JitCodeMemoryStats stats;
+  jit_module_get_code_memory_stats(jm, &stats);
+
+  if (!stats.slab_count || !stats.code_bytes || stats.reserved_bytes < stats.code_bytes + stats.free_bytes)
+    {
+      cout << "Bad code memory stats: " << stats.slab_count << " slabs, " << stats.code_bytes << " code bytes" << endl;
+      result = false;
+    }
+
+  /* W^X, generated code must not be writable */
+  string permissions = mapping_permissions(functions[0]);
+  if (permissions.size() < 3 || permissions[1] != '-' || permissions[2] != 'x')
+    {
+      cout << "Code mapped as " << permissions << endl;
+      result = false;
+    }
+
+  /* A batch is packed together */
+  long distance = (char *)functions[1] - (char *)functions[0];
+  if (distance < -16384 || distance > 16384)
+    {
+      cout << "Batch iterations are " << distance << " bytes apart" << endl;
+      result = false;
+    }
+
+  jit_module_set_memory_budget(jm, 1);
+  jit_module_get_code_memory_stats(jm, &stats);
+
+  if (stats.code_bytes != 0)
+    {
+      cout << "Evicted code still allocated: " << stats.code_bytes << " bytes" << endl;
+      result = false;
+    }
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int pass_count = 0;
+  int fail_count = 0;
+
+  test_usage() ? pass_count++ : fail_count++;
+  test_eviction() ? pass_count++ : fail_count++;
+  test_lru() ? pass_count++ : fail_count++;
+  test_lookup_unreferenced() ? pass_count++ : fail_count++;
+  test_lean() ? pass_count++ : fail_count++;
+  test_code_memory() ? pass_count++ : fail_count++;
+
+  cout << "ran " << (pass_count + fail_count) << " tests: " << pass_count << " ok, " << fail_count << " failures" << endl;
+
+  if (!fail_count)
+    cout << "OK" << endl;
+  else
+    cout << "FAIL" << endl;
+
+  return fail_count;
+}
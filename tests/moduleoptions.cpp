@@ -0,0 +1,144 @@
+#include <cstdio>
+#include <iostream>
+#include <stdint.h>
+using namespace std;
+
+#include "jitmodule.h"
+
+typedef void (*MixFunction)(float *out, float *a, float *b, uint32_t count);
+
+static const char *shader_src = \
+  "float4 process(float4 a, float4 b) "
+  "{ "
+  "  float4 half = (float4)(0.5f, 0.5f, 0.5f, 0.5f); "
+  "  if (b.s3 == 0.0f) "
+  "    { "
+  "      return a; "
+  "    } "
+  "  return a * half + b * half; "
+  "}";
+
+static bool check_mix(void *jitfunc, uint32_t count)
+{
+  float a[100 * 4];
+  float b[100 * 4];
+  float out[100 * 4];
+
+  for (int i = 0; i < 100 * 4; ++i)
+    {
+      a[i] = (float)i;
+      b[i] = ((i / 4) % 3) ? 2.0f : 0.0f;
+      out[i] = 0.0f;
+    }
+
+  ((MixFunction)jitfunc)(out, a, b, count);
+
+  for (uint32_t i = 0; i < count * 4; ++i)
+    {
+      float expected = ((i / 4) % 3) ? (float)i * 0.5f + 1.0f : (float)i;
+      if (out[i] != expected)
+        return false;
+    }
+
+  return true;
+}
+
+static bool check_options(const JitModuleOptions *options)
+{
+  JitModule *jm = jit_module_for_src_with_options(shader_src, JIT_MODULE_PRIVATE, options);
+  void *jitfunc = jm ? jit_module_get_iteration(jm, "process", "float4[]", "float4[]", "float4[]", NULL) : NULL;
+  bool result = jitfunc && check_mix(jitfunc, 100) && check_mix(jitfunc, 3);
+
+  if (jm)
+    jit_module_destroy(jm);
+  return result;
+}
+
+bool test_preview_options()
+{
+  JitModuleOptions options;
+  jit_module_options_init(&options);
+
+  /* Fast to compile, slow to run */
+  options.opt_level = 0;
+  options.codegen_opt_level = 0;
+  options.unroll_loops = 0;
+
+  return check_options(&options);
+}
+
+bool test_export_options()
+{
+  JitModuleOptions options;
+  jit_module_options_init(&options);
+
+  options.opt_level = 3;
+  options.codegen_opt_level = 3;
+  options.loop_vectorize = 1;
+  options.slp_vectorize = 1;
+  options.unroll_threshold = 400;
+
+  return check_options(&options);
+}
+
+bool test_size_options()
+{
+  JitModuleOptions options;
+  jit_module_options_init(&options);
+
+  options.size_level = 2;
+
+  return check_options(&options);
+}
+
+bool test_fast_math()
+{
+  JitModuleOptions options;
+  jit_module_options_init(&options);
+
+  /* The mix is exact in any order, so relaxed math still matches */
+  options.fast_math = JIT_FAST_MATH_ALL;
+
+  return check_options(&options);
+}
+
+bool test_sharing()
+{
+  JitModuleOptions options;
+  jit_module_options_init(&options);
+
+  /* The defaults are the same as passing no options */
+  JitModule *a = jit_module_for_src(shader_src, 0);
+  JitModule *b = jit_module_for_src_with_options(shader_src, 0, &options);
+
+  options.opt_level = 1;
+  JitModule *c = jit_module_for_src_with_options(shader_src, 0, &options);
+
+  bool result = a && a == b && c && c != a;
+
+  jit_module_destroy(a);
+  jit_module_destroy(b);
+  jit_module_destroy(c);
+
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int pass_count = 0;
+  int fail_count = 0;
+
+  test_preview_options() ? pass_count++ : fail_count++;
+  test_export_options() ? pass_count++ : fail_count++;
+  test_size_options() ? pass_count++ : fail_count++;
+  test_fast_math() ? pass_count++ : fail_count++;
+  test_sharing() ? pass_count++ : fail_count++;
+
+  cout << "ran " << (pass_count + fail_count) << " tests: " << pass_count << " ok, " << fail_count << " failures" << endl;
+
+  if (!fail_count)
+    cout << "OK" << endl;
+  else
+    cout << "FAIL" << endl;
+
+  return fail_count;
+}
@@ -0,0 +1,111 @@
+#include <cstdio>
+#include <iostream>
+#include <stdint.h>
+using namespace std;
+
+#include "jitmodule.h"
+
+typedef void (*ScaleFunction)(float *out, float *a, float *b, uint32_t count);
+
+static const char *shader_src = \
+  "float4 process(float4 a, float4 b) "
+  "{ "
+  "return a * b + a; "
+  "}";
+
+static bool check_scale(void *jitfunc, uint32_t count)
+{
+  float a[128 * 4];
+  float b[128 * 4];
+  float out[128 * 4];
+
+  for (int i = 0; i < 128 * 4; ++i)
+    {
+      a[i] = (float)i;
+      b[i] = 0.5f;
+      out[i] = -1.0f;
+    }
+
+  ((ScaleFunction)jitfunc)(out, a, b, count);
+
+  for (uint32_t i = 0; i < 128 * 4; ++i)
+    {
+      float expected = (i < count * 4) ? (float)i * 1.5f : -1.0f;
+      if (out[i] != expected)
+        return false;
+    }
+
+  return true;
+}
+
+bool test_multiversion()
+{
+  JitModule *jm = jit_module_for_src(shader_src, JIT_MODULE_MULTIVERSION | JIT_MODULE_PRIVATE);
+  bool result = true;
+
+  jit_module_set_multiversion_threshold(jm, 16);
+
+  void *jitfunc = jit_module_get_iteration(jm, "process", "float4[]", "float4[]", "float4[]", NULL);
+
+  /* Both sides of the threshold, whether or not the host has a narrower target */
+  uint32_t counts[] = {0, 1, 15, 16, 17, 128};
+  for (int i = 0; i < 6; ++i)
+    if (!jitfunc || !check_scale(jitfunc, counts[i]))
+      {
+        cout << "Multiversioned iteration failed for " << counts[i] << " elements" << endl;
+        result = false;
+      }
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+bool test_target_override()
+{
+  bool result = true;
+
+  /* Generic x86-64 code runs anywhere the tests do */
+  jit_set_target("x86-64", "sse2, -avx");
+
+  JitModule *jm = jit_module_for_src(shader_src, JIT_MODULE_PRIVATE);
+  void *jitfunc = jit_module_get_iteration(jm, "process", "float4[]", "float4[]", "float4[]", NULL);
+
+  if (!jitfunc || !check_scale(jitfunc, 100))
+    {
+      cout << "Iteration compiled for an explicit target failed" << endl;
+      result = false;
+    }
+
+  jit_module_destroy(jm);
+
+  jit_set_target(NULL, NULL);
+
+  jm = jit_module_for_src(shader_src, JIT_MODULE_PRIVATE);
+  jitfunc = jit_module_get_iteration(jm, "process", "float4[]", "float4[]", "float4[]", NULL);
+
+  if (!jitfunc || !check_scale(jitfunc, 100))
+    {
+      cout << "Iteration compiled for the host failed" << endl;
+      result = false;
+    }
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int pass_count = 0;
+  int fail_count = 0;
+
+  test_multiversion() ? pass_count++ : fail_count++;
+  test_target_override() ? pass_count++ : fail_count++;
+
+  cout << "ran " << (pass_count + fail_count) << " tests: " << pass_count << " ok, " << fail_count << " failures" << endl;
+
+  if (!fail_count)
+    cout << "OK" << endl;
+  else
+    cout << "FAIL" << endl;
+
+  return fail_count;
+}
@@ -0,0 +1,177 @@
+#include <cstdio>
+#include <iostream>
+#include <stdint.h>
+using namespace std;
+
+#include "jitmodule.h"
+
+typedef void (*FloatFunction)(float *out, float *in, float *aux, uint32_t count);
+typedef void (*InPlaceFunction)(float *in, float *aux, uint32_t count);
+typedef void (*IntFunction)(int *out, int *in, uint32_t count);
+
+#define COUNT 37
+
+typedef float (*ExpectedFunction)(const float *in, const float *aux, int i);
+
+static float expect_in(const float *in, const float *aux, int i) { return in[i]; }
+static float expect_aux(const float *in, const float *aux, int i) { return aux[i]; }
+static float expect_zero(const float *in, const float *aux, int i) { return 0.0f; }
+static float expect_constant(const float *in, const float *aux, int i) { return (float)(i % 4) + 0.5f; }
+static float expect_first_aux(const float *in, const float *aux, int i) { return aux[i % 4]; }
+static float expect_affine(const float *in, const float *aux, int i) { return (in[i] * 0.5f + 1.0f) - 2.0f; }
+
+static void fill(float *out, float *in, float *aux)
+{
+  for (int i = 0; i < COUNT * 4; ++i)
+    {
+      out[i] = -1.0f;
+      in[i] = (float)i;
+      aux[i] = 1000.0f - i;
+    }
+}
+
+static bool check_out(const float *out, const float *in, const float *aux, uint32_t count, ExpectedFunction expected)
+{
+  for (uint32_t i = 0; i < COUNT * 4; ++i)
+    {
+      float value = (i < count * 4) ? expected(in, aux, i) : -1.0f;
+
+      if (out[i] != value)
+        {
+          cout << "Element " << i << " was " << out[i] << ", expected " << value << endl;
+          return false;
+        }
+    }
+
+  return true;
+}
+
+/* Run "float4 process(float4 in, float4 aux) { body }" with the given
+ * argument types and check every element.
+ */
+static bool check_kernel(const char *body, const char *in_type, const char *aux_type, ExpectedFunction expected)
+{
+  std::string src = std::string("float4 process(float4 in, float4 aux) { ") + body + " }";
+  JitModule *jm = jit_module_for_src(src.c_str(), JIT_MODULE_PRIVATE);
+  void *jitfunc = jm ? jit_module_get_iteration(jm, "process", "float4[]", in_type, aux_type, NULL) : NULL;
+  bool result = jitfunc && !jit_module_is_fallback_function(jm, jitfunc);
+
+  if (result)
+    {
+      float out[COUNT * 4];
+      float in[COUNT * 4];
+      float aux[COUNT * 4];
+
+      fill(out, in, aux);
+      ((FloatFunction)jitfunc)(out, in, aux, COUNT - 1);
+      result = check_out(out, in, aux, COUNT - 1, expected);
+
+      fill(out, in, aux);
+      ((FloatFunction)jitfunc)(out, in, aux, 0);
+      result = result && check_out(out, in, aux, 0, expected);
+    }
+  else
+    {
+      cout << "Failed to compile " << src << endl;
+    }
+
+  if (jm)
+    jit_module_destroy(jm);
+  return result;
+}
+
+bool test_identity()
+{
+  return check_kernel("return in;", "float4[]", "float4[]", expect_in) &&
+         check_kernel("return aux;", "float4[]", "float4[]", expect_aux) &&
+         check_kernel("return aux;", "float4[]", "*float4", expect_first_aux);
+}
+
+bool test_identity_in_place()
+{
+  JitModule *jm = jit_module_for_src("float4 process(float4 in, float4 aux) { return in; }", JIT_MODULE_PRIVATE);
+  void *same = jm ? jit_module_get_iteration(jm, "process", "alias(1) float4[]", "float4[]", "float4[]", NULL) : NULL;
+  void *other = jm ? jit_module_get_iteration(jm, "process", "alias(2) float4[]", "float4[]", "float4[]", NULL) : NULL;
+  bool result = same && other && !jit_module_is_fallback_function(jm, same) && !jit_module_is_fallback_function(jm, other);
+
+  if (result)
+    {
+      float out[COUNT * 4];
+      float in[COUNT * 4];
+      float aux[COUNT * 4];
+
+      fill(out, in, aux);
+      ((InPlaceFunction)same)(in, aux, COUNT);
+      result = check_out(in, in, aux, COUNT, expect_in);
+
+      /* Writing to aux copies in over it */
+      fill(out, in, aux);
+      ((InPlaceFunction)other)(in, aux, COUNT);
+      result = result && check_out(aux, in, aux, COUNT, expect_in);
+    }
+
+  if (jm)
+    jit_module_destroy(jm);
+  return result;
+}
+
+bool test_constant()
+{
+  return check_kernel("return (float4)(0.0f, 0.0f, 0.0f, 0.0f);", "float4[]", "float4[]", expect_zero) &&
+         check_kernel("return (float4)(0.5f, 1.5f, 2.5f, 3.5f);", "float4[]", "float4[]", expect_constant) &&
+         check_kernel("float4 a = aux * (float4)(0.0f, 0.0f, 0.0f, 0.0f); return (float4)(0.5f, 1.5f, 2.5f, 3.5f);",
+                      "float4[]", "float4[]", expect_constant);
+}
+
+bool test_affine()
+{
+  return check_kernel("float4 half = (float4)(0.5f, 0.5f, 0.5f, 0.5f); "
+                      "float4 one = (float4)(1.0f, 1.0f, 1.0f, 1.0f); "
+                      "return (in * half + one) - (one + one);", "float4[]", "float4[]", expect_affine);
+}
+
+bool test_int_affine()
+{
+  static const char *src = "int4 process(int4 in) { return in * (int4)(2, 3, 4, 5) + (int4)(1, 1, 1, 1); }";
+  JitModule *jm = jit_module_for_src(src, JIT_MODULE_PRIVATE);
+  void *jitfunc = jm ? jit_module_get_iteration(jm, "process", "int4[]", "int4[]", NULL) : NULL;
+  bool result = jitfunc && !jit_module_is_fallback_function(jm, jitfunc);
+
+  if (result)
+    {
+      int in[COUNT * 4];
+      int out[COUNT * 4];
+
+      for (int i = 0; i < COUNT * 4; ++i)
+        in[i] = i - 20;
+
+      ((IntFunction)jitfunc)(out, in, COUNT);
+
+      for (int i = 0; i < COUNT * 4 && result; ++i)
+        result = out[i] == in[i] * (2 + i % 4) + 1;
+    }
+
+  if (jm)
+    jit_module_destroy(jm);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int pass_count = 0;
+  int fail_count = 0;
+
+  test_identity() ? pass_count++ : fail_count++;
+  test_identity_in_place() ? pass_count++ : fail_count++;
+  test_constant() ? pass_count++ : fail_count++;
+  test_affine() ? pass_count++ : fail_count++;
+  test_int_affine() ? pass_count++ : fail_count++;
+
+  cout << "ran " << (pass_count + fail_count) << " tests: " << pass_count << " ok, " << fail_count << " failures" << endl;
+
+  if (!fail_count)
+    cout << "OK" << endl;
+  else
+    cout << "FAIL" << endl;
+
+  return fail_count;
+}
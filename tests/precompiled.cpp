@@ -0,0 +1,157 @@
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <stdint.h>
+using namespace std;
+
+#include "jitmodule.h"
+
+typedef void (*AddFunction)(int *out, int *a, int *b, uint32_t count);
+
+static const char *shader_src = \
+  "int4 process(int4 a, int4 b) "
+  "{ "
+  "return a + b; "
+  "}";
+
+static int native_calls = 0;
+
+/* Stands in for an object built by nanjit-compile */
+static void native_process(int *out, int *a, int *b, uint32_t count)
+{
+  for (uint32_t i = 0; i < count * 4; ++i)
+    out[i] = a[i] + b[i];
+  native_calls++;
+}
+
+static const char * const native_signature[] = {"int4[]", "int4[]", "int4[]", NULL};
+static const JitPrecompiledIteration native_iterations[] = {
+  {"process", 0, native_signature, (void *)native_process},
+};
+
+bool test_precompiled_lookup()
+{
+  JitModule *jm = jit_module_for_src(shader_src, 0);
+
+  if (!jm)
+    return false;
+
+  bool result = true;
+  void *jitfunc = jit_module_get_iteration(jm, "process", "int4[]", "int4[]", "int4[]", NULL);
+
+  if (jitfunc != (void *)native_process)
+    {
+      cout << "Precompiled iteration was not used" << endl;
+      result = false;
+    }
+
+  if (jit_module_is_fallback_function(jm, jitfunc))
+    result = false;
+
+  if (jitfunc != jit_module_get_iteration(jm, "process", "int4[]", "int4[]", "int4[]", NULL))
+    result = false;
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+bool test_fallback_to_jit()
+{
+  JitModule *jm = jit_module_for_src(shader_src, 0);
+
+  if (!jm)
+    return false;
+
+  bool result = true;
+
+  /* Not precompiled, the compiler is started on demand */
+  void *jitfunc = jit_module_get_iteration(jm, "process", "aligned int4[]", "aligned int4[]", "aligned int4[]", NULL);
+
+  if (NULL == jitfunc || jitfunc == (void *)native_process || jit_module_is_fallback_function(jm, jitfunc))
+    {
+      cout << "Iteration was not compiled" << endl;
+      result = false;
+    }
+  else
+    {
+      int a[4] __attribute__ ((aligned (16))) = { 1, 2, 3, 4 };
+      int b[4] __attribute__ ((aligned (16))) = { 10, 20, 30, 40 };
+      int out[4] __attribute__ ((aligned (16))) = { 0, 0, 0, 0 };
+
+      native_calls = 0;
+      ((AddFunction)jitfunc)(out, a, b, 1);
+
+      if (out[0] != 11 || out[3] != 44 || native_calls != 0)
+        result = false;
+    }
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+bool test_other_source()
+{
+  /* Precompiled iterations only apply to the exact source they were built from */
+  JitModule *jm = jit_module_for_src("int4 process(int4 a, int4 b) { return a - b; }", 0);
+
+  if (!jm)
+    return false;
+
+  void *jitfunc = jit_module_get_iteration(jm, "process", "int4[]", "int4[]", "int4[]", NULL);
+  bool result = (NULL != jitfunc && jitfunc != (void *)native_process);
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+bool test_other_options()
+{
+  JitModuleOptions options;
+  jit_module_options_init(&options);
+  options.opt_level = 0;
+
+  /* Built with the default options, so a module asking for -O0 compiles its own */
+  JitModule *jm = jit_module_for_src_with_options(shader_src, 0, &options);
+
+  if (!jm)
+    return false;
+
+  void *jitfunc = jit_module_get_iteration(jm, "process", "int4[]", "int4[]", "int4[]", NULL);
+  bool result = (NULL != jitfunc && jitfunc != (void *)native_process && !jit_module_is_fallback_function(jm, jitfunc));
+
+  jit_module_destroy(jm);
+
+  /* Explicit defaults are the same as none */
+  jit_module_options_init(&options);
+  jm = jit_module_for_src_with_options(shader_src, JIT_MODULE_PRIVATE, &options);
+
+  if (!jm)
+    return false;
+
+  result = result && jit_module_get_iteration(jm, "process", "int4[]", "int4[]", "int4[]", NULL) == (void *)native_process;
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int pass_count = 0;
+  int fail_count = 0;
+
+  jit_register_precompiled(shader_src, native_iterations, 1);
+
+  test_precompiled_lookup() ? pass_count++ : fail_count++;
+  test_fallback_to_jit() ? pass_count++ : fail_count++;
+  test_other_source() ? pass_count++ : fail_count++;
+  test_other_options() ? pass_count++ : fail_count++;
+
+  cout << "ran " << (pass_count + fail_count) << " tests: " << pass_count << " ok, " << fail_count << " failures" << endl;
+
+  if (!fail_count)
+    cout << "OK" << endl;
+  else
+    cout << "FAIL" << endl;
+
+  return fail_count;
+}
@@ -0,0 +1,151 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <stdint.h>
+#include <unistd.h>
+using namespace std;
+
+#include "jitmodule.h"
+
+typedef void (*AddFunction)(int *out, int *a, int *b, uint32_t count);
+
+static const char *shader_src = \
+  "int4 process(int4 a, int4 b) "
+  "{ "
+  "return a + b; "
+  "}";
+
+bool test_manifest()
+{
+  char path_template[] = "/tmp/nanjit-prewarm-XXXXXX";
+  char *path = mkdtemp(path_template);
+
+  if (!path)
+    return false;
+
+  string source_path = string(path) + "/add.vl";
+  string manifest_path = string(path) + "/manifest";
+
+  {
+    ofstream source(source_path.c_str());
+    source << shader_src;
+
+    ofstream manifest(manifest_path.c_str());
+    manifest << "# Test manifest" << endl;
+    manifest << "source add.vl" << endl;
+    manifest << "process:int4[],int4[],int4[]" << endl;
+    manifest << "range:process:int4[],int4[],int4[]" << endl;
+    manifest << "missing:int4[],int4[]" << endl;
+  }
+
+  bool result = true;
+  JitPrewarm *prewarm = jit_prewarm_start(manifest_path.c_str(), 0);
+
+  if (!prewarm)
+    result = false;
+  else
+    {
+      jit_prewarm_wait(prewarm);
+
+      if (jit_prewarm_entry_count(prewarm) != 3 || jit_prewarm_completed_count(prewarm) != 3)
+        {
+          cout << "Wrong prewarm progress" << endl;
+          result = false;
+        }
+
+      for (unsigned int i = 0; i < 3; ++i)
+        if (!jit_prewarm_entry_is_ready(prewarm, i))
+          result = false;
+
+      JitModule *jm = jit_prewarm_get_module(prewarm, "add.vl");
+      void *jitfunc = jit_prewarm_entry_function(prewarm, 0);
+
+      if (!jm || !jitfunc || jit_module_is_fallback_function(jm, jitfunc))
+        {
+          cout << "Prewarmed iteration missing" << endl;
+          result = false;
+        }
+      else
+        {
+          int a[4] = { 1, 2, 3, 4 };
+          int b[4] = { 10, 20, 30, 40 };
+          int out[4] = { 0, 0, 0, 0 };
+
+          ((AddFunction)jitfunc)(out, a, b, 1);
+
+          if (out[0] != 11 || out[3] != 44)
+            result = false;
+
+          if (jitfunc != jit_module_get_iteration(jm, "process", "int4[]", "int4[]", "int4[]", NULL))
+            {
+              cout << "Prewarmed iteration was compiled again" << endl;
+              result = false;
+            }
+
+          if (!jit_module_is_fallback_function(jm, jit_prewarm_entry_function(prewarm, 2)))
+            result = false;
+
+          /* The application's own lookup of the source finds the prewarmed module */
+          JitModule *shared = jit_module_for_src(shader_src, 0);
+          if (shared != jm)
+            {
+              cout << "Prewarmed module isn't shared" << endl;
+              result = false;
+            }
+          if (shared)
+            jit_module_destroy(shared);
+
+          /* Prewarming holds no references, so a budget can free everything */
+          jit_module_set_memory_budget(jm, 1);
+          if (jit_module_get_memory_usage(jm) != 0)
+            {
+              cout << "Prewarmed iterations can't be evicted" << endl;
+              result = false;
+            }
+        }
+
+      jit_prewarm_release(prewarm);
+    }
+
+  unlink(source_path.c_str());
+  unlink(manifest_path.c_str());
+  rmdir(path);
+
+  return result;
+}
+
+bool test_bad_manifest()
+{
+  if (jit_prewarm_start("/nonexistent/nanjit-manifest", 0))
+    return false;
+
+  /* No manifest just initializes LLVM */
+  JitPrewarm *prewarm = jit_prewarm_start(NULL, 0);
+  if (!prewarm)
+    return false;
+
+  jit_prewarm_wait(prewarm);
+  bool result = (jit_prewarm_entry_count(prewarm) == 0);
+  jit_prewarm_release(prewarm);
+
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int pass_count = 0;
+  int fail_count = 0;
+
+  test_manifest() ? pass_count++ : fail_count++;
+  test_bad_manifest() ? pass_count++ : fail_count++;
+
+  cout << "ran " << (pass_count + fail_count) << " tests: " << pass_count << " ok, " << fail_count << " failures" << endl;
+
+  if (!fail_count)
+    cout << "OK" << endl;
+  else
+    cout << "FAIL" << endl;
+
+  return fail_count;
+}
@@ -0,0 +1,118 @@
+#include <cstdio>
+#include <iostream>
+#include <stdint.h>
+using namespace std;
+
+#include "jitmodule.h"
+
+typedef void (*OpacityFunction)(float *out, float *in, float *aux, float opacity, uint32_t count);
+
+#define COUNT 16
+
+static const char *opacity_src = \
+  "float4 process(float4 in, float4 aux, float opacity) "
+  "{ "
+  "  return in + (aux - in) * opacity; "
+  "}";
+
+/* Run jitfunc passing passed_opacity and check it behaved as if it got opacity */
+static bool check_opacity(void *jitfunc, float passed_opacity, float opacity)
+{
+  float in[COUNT * 4];
+  float aux[COUNT * 4];
+  float out[COUNT * 4];
+
+  for (int i = 0; i < COUNT * 4; ++i)
+    {
+      in[i] = (float)i;
+      aux[i] = 100.0f - i;
+    }
+
+  ((OpacityFunction)jitfunc)(out, in, aux, passed_opacity, COUNT);
+
+  for (int i = 0; i < COUNT * 4; ++i)
+    {
+      float expected = in[i] + (aux[i] - in[i]) * opacity;
+      if (out[i] != expected)
+        {
+          cout << "Element " << i << " was " << out[i] << ", expected " << expected << endl;
+          return false;
+        }
+    }
+
+  return true;
+}
+
+bool test_bound_values()
+{
+  JitModule *jm = jit_module_for_src(opacity_src, JIT_MODULE_PRIVATE);
+  JitArgumentBinding opaque = { "opacity", 1.0 };
+  JitArgumentBinding half = { "opacity", 0.5 };
+
+  void *generic = jit_module_get_iteration(jm, "process", "float4[]", "float4[]", "float4[]", "float", NULL);
+  void *opaque_func = jit_module_get_specialized_iteration(jm, "process", &opaque, 1,
+                                                           "float4[]", "float4[]", "float4[]", "float", NULL);
+  void *half_func = jit_module_get_specialized_iteration(jm, "process", &half, 1,
+                                                         "float4[]", "float4[]", "float4[]", "float", NULL);
+  void *half_again = jit_module_get_specialized_iteration(jm, "process", &half, 1,
+                                                          "float4[]", "float4[]", "float4[]", "float", NULL);
+
+  bool result = generic && opaque_func && half_func && !jit_module_is_fallback_function(jm, opaque_func) &&
+                !jit_module_is_fallback_function(jm, half_func);
+
+  /* Each value gets its own iteration, and asking again gives the same one */
+  result = result && generic != opaque_func && opaque_func != half_func && half_func == half_again;
+
+  result = result && check_opacity(generic, 0.25f, 0.25f);
+  result = result && check_opacity(opaque_func, 0.25f, 1.0f);
+  result = result && check_opacity(half_func, 0.25f, 0.5f);
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+bool test_value_type_string()
+{
+  JitModule *jm = jit_module_for_src(opacity_src, JIT_MODULE_PRIVATE);
+  void *jitfunc = jit_module_get_iteration(jm, "process", "float4[]", "float4[]", "float4[]", "value(0.75) float", NULL);
+  bool result = jitfunc && !jit_module_is_fallback_function(jm, jitfunc) && check_opacity(jitfunc, 0.0f, 0.75f);
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+bool test_bad_bindings()
+{
+  JitModule *jm = jit_module_for_src(opacity_src, JIT_MODULE_PRIVATE);
+  JitArgumentBinding unknown = { "alpha", 1.0 };
+  JitArgumentBinding array = { "aux", 1.0 };
+
+  void *unknown_func = jit_module_get_specialized_iteration(jm, "process", &unknown, 1,
+                                                            "float4[]", "float4[]", "float4[]", "float", NULL);
+  void *array_func = jit_module_get_specialized_iteration(jm, "process", &array, 1,
+                                                          "float4[]", "float4[]", "float4[]", "float", NULL);
+
+  /* Only single values can be bound */
+  bool result = !unknown_func && (!array_func || jit_module_is_fallback_function(jm, array_func));
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int pass_count = 0;
+  int fail_count = 0;
+
+  test_bound_values() ? pass_count++ : fail_count++;
+  test_value_type_string() ? pass_count++ : fail_count++;
+  test_bad_bindings() ? pass_count++ : fail_count++;
+
+  cout << "ran " << (pass_count + fail_count) << " tests: " << pass_count << " ok, " << fail_count << " failures" << endl;
+
+  if (!fail_count)
+    cout << "OK" << endl;
+  else
+    cout << "FAIL" << endl;
+
+  return fail_count;
+}
@@ -0,0 +1,116 @@
+#include <cstdio>
+#include <iostream>
+#include <stdint.h>
+#include <unistd.h>
+using namespace std;
+
+#include "jitmodule.h"
+
+typedef void (*AddFunction)(int *out, int *a, int *b, uint32_t count);
+
+static const char *shader_src = \
+  "int4 process(int4 a, int4 b) "
+  "{ "
+  "return a + b; "
+  "}";
+
+static bool check_add(void *jitfunc, uint32_t count)
+{
+  int a[64 * 4];
+  int b[64 * 4];
+  int out[64 * 4];
+
+  for (int i = 0; i < 64 * 4; ++i)
+    {
+      a[i] = i;
+      b[i] = 1000;
+      out[i] = 0;
+    }
+
+  ((AddFunction)jitfunc)(out, a, b, count);
+
+  for (uint32_t i = 0; i < count * 4; ++i)
+    if (out[i] != (int)i + 1000)
+      return false;
+
+  return true;
+}
+
+bool test_tier_up()
+{
+  JitModule *jm = jit_module_for_src(shader_src, JIT_MODULE_TIERED | JIT_MODULE_PRIVATE);
+  bool result = true;
+
+  jit_module_set_tier_threshold(jm, 100);
+
+  void *jitfunc = jit_module_get_iteration(jm, "process", "int4[]", "int4[]", "int4[]", NULL);
+
+  if (!jitfunc || !check_add(jitfunc, 64))
+    {
+      cout << "Baseline iteration failed" << endl;
+      jit_module_destroy(jm);
+      return false;
+    }
+
+  if (jit_module_is_iteration_optimized(jm, jitfunc))
+    {
+      cout << "Optimized before reaching the threshold" << endl;
+      result = false;
+    }
+
+  /* Crosses the threshold, the optimized version is compiled in the background */
+  result = check_add(jitfunc, 64) && result;
+
+  for (int i = 0; i < 500 && !jit_module_is_iteration_optimized(jm, jitfunc); ++i)
+    usleep(10000);
+
+  if (!jit_module_is_iteration_optimized(jm, jitfunc))
+    {
+      cout << "Iteration was not optimized" << endl;
+      result = false;
+    }
+
+  if (jitfunc != jit_module_get_iteration(jm, "process", "int4[]", "int4[]", "int4[]", NULL))
+    {
+      cout << "Function changed after tiering up" << endl;
+      result = false;
+    }
+
+  if (!check_add(jitfunc, 64) || !check_add(jitfunc, 0))
+    {
+      cout << "Optimized iteration failed" << endl;
+      result = false;
+    }
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+bool test_untiered()
+{
+  JitModule *jm = jit_module_for_src(shader_src, JIT_MODULE_PRIVATE);
+  void *jitfunc = jit_module_get_iteration(jm, "process", "int4[]", "int4[]", "int4[]", NULL);
+
+  /* Modules without JIT_MODULE_TIERED optimize everything up front */
+  bool result = jitfunc && jit_module_is_iteration_optimized(jm, jitfunc) && check_add(jitfunc, 16);
+
+  jit_module_destroy(jm);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int pass_count = 0;
+  int fail_count = 0;
+
+  test_tier_up() ? pass_count++ : fail_count++;
+  test_untiered() ? pass_count++ : fail_count++;
+
+  cout << "ran " << (pass_count + fail_count) << " tests: " << pass_count << " ok, " << fail_count << " failures" << endl;
+
+  if (!fail_count)
+    cout << "OK" << endl;
+  else
+    cout << "FAIL" << endl;
+
+  return fail_count;
+}
@@ -0,0 +1,294 @@
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+using namespace std;
+
+#include "jitmodule.h"
+
+static void usage()
+{
+  cout << "Usage: nanjit-compile [options] source.vl signature..." << endl;
+  cout << endl;
+  cout << "Signatures are written as [symbol=][range:]function:return_type,arg_type,..." << endl;
+  cout << "for example \"svg_over=process:float4[],float4[],float4[]\"." << endl;
+  cout << endl;
+  cout << "Options:" << endl;
+  cout << "  -o FILE      object file to write (default: source.o)" << endl;
+  cout << "  -H FILE      header file to write (default: source.h)" << endl;
+  cout << "  -p PREFIX    prefix for generated names (default: from the source name)" << endl;
+  cout << "  -mcpu NAME   cpu to generate code for (default: generic)" << endl;
+}
+
+static bool read_file(const char *path, std::string &contents)
+{
+  std::ifstream read_file_stream(path, std::ifstream::binary);
+  if (!read_file_stream.good())
+    return false;
+
+  std::stringstream sourcecode_stream;
+  sourcecode_stream << read_file_stream.rdbuf();
+  contents = sourcecode_stream.str();
+
+  return true;
+}
+
+static std::string strip_extension(const std::string &path)
+{
+  size_t dot = path.rfind('.');
+  size_t slash = path.rfind('/');
+
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    return path;
+  return path.substr(0, dot);
+}
+
+static std::string c_identifier(const std::string &str)
+{
+  std::string result;
+
+  for (size_t i = 0; i < str.size(); ++i)
+    {
+      char c = str[i];
+      if (isalnum((unsigned char)c) || c == '_')
+        result += c;
+      else
+        result += '_';
+    }
+
+  if (result.empty() || isdigit((unsigned char)result[0]))
+    result = "_" + result;
+
+  return result;
+}
+
+static std::string c_string_literal(const std::string &str)
+{
+  std::stringstream literal;
+
+  literal << "\"";
+  for (size_t i = 0; i < str.size(); ++i)
+    {
+      char c = str[i];
+      if (c == '\n')
+        literal << "\\n\"\n  \"";
+      else if (c == '"' || c == '\\')
+        literal << "\\" << c;
+      else if (c == '\t')
+        literal << "\\t";
+      else if (isprint((unsigned char)c))
+        literal << c;
+      else
+        {
+          char escaped[8];
+          snprintf(escaped, sizeof(escaped), "\\%03o", (unsigned char)c);
+          literal << escaped;
+        }
+    }
+  literal << "\"";
+
+  return literal.str();
+}
+
+/* [symbol=][range:]function:return_type,arg_type,... */
+static bool parse_signature(const std::string &signature, const std::string &prefix, int index,
+                            JitIterationBatchEntry &entry, std::string &symbol)
+{
+  std::string rest = signature;
+
+  size_t equals = rest.find('=');
+  size_t colon = rest.find(':');
+  if (equals != std::string::npos && equals < colon)
+    {
+      symbol = rest.substr(0, equals);
+      rest = rest.substr(equals + 1);
+    }
+
+  if (!entry.parse(rest))
+    return false;
+
+  if (symbol.empty())
+    {
+      std::stringstream symbol_stream;
+      symbol_stream << prefix << "_" << entry.function_name << "_" << index;
+      symbol = symbol_stream.str();
+    }
+
+  return true;
+}
+
+int main(int argc, char **argv) {
+  std::string object_path;
+  std::string header_path;
+  std::string prefix;
+  std::string cpu;
+  const char *source_path = NULL;
+  std::vector<std::string> signatures;
+
+  for (int i = 1; i < argc; ++i)
+    {
+      std::string arg = argv[i];
+
+      if ((arg == "-o" || arg == "-H" || arg == "-p" || arg == "-mcpu") && i + 1 < argc)
+        {
+          std::string value = argv[++i];
+          if (arg == "-o")
+            object_path = value;
+          else if (arg == "-H")
+            header_path = value;
+          else if (arg == "-p")
+            prefix = value;
+          else
+            cpu = value;
+        }
+      else if (arg == "-h" || arg == "--help")
+        {
+          usage();
+          return 0;
+        }
+      else if (!source_path)
+        source_path = argv[i];
+      else
+        signatures.push_back(arg);
+    }
+
+  if (!source_path || signatures.empty())
+    {
+      usage();
+      return 1;
+    }
+
+  std::string sourcecode;
+  if (!read_file(source_path, sourcecode))
+    {
+      cout << "Error reading \"" << source_path << "\"" << endl;
+      return 1;
+    }
+
+  std::string base_path = strip_extension(source_path);
+  if (object_path.empty())
+    object_path = base_path + ".o";
+  if (header_path.empty())
+    header_path = base_path + ".h";
+  if (prefix.empty())
+    {
+      size_t slash = base_path.rfind('/');
+      prefix = base_path.substr(slash == std::string::npos ? 0 : slash + 1);
+    }
+  prefix = c_identifier(prefix);
+
+  std::vector<JitIterationBatchEntry> entries(signatures.size());
+  std::vector<std::string> symbols(signatures.size());
+
+  for (size_t i = 0; i < signatures.size(); ++i)
+    {
+      if (!parse_signature(signatures[i], prefix, i, entries[i], symbols[i]))
+        {
+          cout << "Invalid signature \"" << signatures[i] << "\"" << endl;
+          return 1;
+        }
+    }
+
+  /* The module decides things like using the SSE estimates for division
+   * from its own target, so it has to match the object file's.
+   */
+  JitModule::setTarget(cpu.empty() ? "generic" : cpu.c_str(), NULL);
+
+  auto_ptr<JitModule> jitmod;
+
+  try
+    {
+      jitmod.reset(new JitModule(sourcecode.c_str(), 0));
+    }
+  catch (JitModuleException &e)
+    {
+      cout << e.what() << endl;
+      return 1;
+    }
+
+  std::string declarations;
+  std::string error;
+
+  if (!jitmod->compileToObject(entries, symbols, cpu.empty() ? NULL : cpu.c_str(),
+                               object_path.c_str(), declarations, error))
+    {
+      cout << "Error compiling \"" << source_path << "\": " << error << endl;
+      return 1;
+    }
+
+  std::ofstream header(header_path.c_str());
+  std::string guard = "__" + c_identifier(prefix) + "_NANJIT_H__";
+
+  for (size_t i = 0; i < guard.size(); ++i)
+    guard[i] = toupper((unsigned char)guard[i]);
+
+  header << "/* Generated by nanjit-compile from " << source_path << ", do not edit */" << endl;
+  header << "#ifndef " << guard << endl;
+  header << "#define " << guard << endl;
+  header << endl;
+  header << "#include <stddef.h>" << endl;
+  header << "#include <stdint.h>" << endl;
+  header << "#include <nanjit/jitmodule.h>" << endl;
+  header << endl;
+  header << "#ifdef __cplusplus" << endl;
+  header << "extern \"C\" {" << endl;
+  header << "#endif" << endl;
+  header << endl;
+  header << declarations;
+  header << endl;
+  header << "static const char " << prefix << "_source[] =" << endl;
+  header << "  " << c_string_literal(sourcecode) << ";" << endl;
+  header << endl;
+  header << "/* Makes the iterations above available to modules created from " << prefix << "_source */" << endl;
+  header << "static void " << prefix << "_register(void) __attribute__ ((unused));" << endl;
+  header << "static void " << prefix << "_register(void)" << endl;
+  header << "{" << endl;
+
+  for (size_t i = 0; i < entries.size(); ++i)
+    {
+      header << "  static const char * const signature_" << i << "[] = {";
+      for (std::list<std::string>::iterator iter = entries[i].argstrs.begin(); iter != entries[i].argstrs.end(); ++iter)
+        header << c_string_literal(*iter) << ", ";
+      header << "NULL};" << endl;
+    }
+
+  /* Modules only use the iterations if they ask for the same options */
+  const JitModuleOptions &options = jitmod->getOptions();
+  header << "  static const JitModuleOptions options = {" << endl;
+  header << "    " << options.opt_level << ", " << options.size_level << ", " << options.codegen_opt_level << ", ";
+  header << options.loop_vectorize << ", " << options.slp_vectorize << ", " << options.unroll_loops << ", ";
+  header << options.unroll_threshold << ", " << options.fast_math << ", " << options.division_precision << ", ";
+  header << options.if_convert_cost << endl;
+  header << "  };" << endl;
+
+  header << "  static const JitPrecompiledIteration iterations[] = {" << endl;
+  for (size_t i = 0; i < entries.size(); ++i)
+    {
+      header << "    {" << c_string_literal(entries[i].function_name) << ", " << (entries[i].range ? 1 : 0);
+      header << ", signature_" << i << ", (void *)" << symbols[i] << ", &options}," << endl;
+    }
+  header << "  };" << endl;
+  header << endl;
+  header << "  jit_register_precompiled(" << prefix << "_source, iterations, " << entries.size() << ");" << endl;
+  header << "}" << endl;
+  header << endl;
+  header << "#ifdef __cplusplus" << endl;
+  header << "}" << endl;
+  header << "#endif" << endl;
+  header << endl;
+  header << "#endif /* " << guard << " */" << endl;
+
+  if (!header.good())
+    {
+      cout << "Error writing \"" << header_path << "\"" << endl;
+      return 1;
+    }
+
+  return 0;
+}
@@ -87,32 +87,32 @@ unsigned int TypeInfo::getWidth() const
   return width;
 }
 
-llvm::Type *TypeInfo::getLLVMType() const
+llvm::Type *TypeInfo::getLLVMType(LLVMContext &context) const
 {
   Type *llvm_type = NULL;
 
   switch (base_type)
     {
       case TypeInfo::TYPE_FLOAT:
-        llvm_type = Type::getFloatTy(getGlobalContext());
+        llvm_type = Type::getFloatTy(context);
         break;
       case TypeInfo::TYPE_INT:
       case TypeInfo::TYPE_UINT:
-        llvm_type = Type::getInt32Ty(getGlobalContext());
+        llvm_type = Type::getInt32Ty(context);
         break;
       case TypeInfo::TYPE_SHORT:
       case TypeInfo::TYPE_USHORT:
-        llvm_type = Type::getInt16Ty(getGlobalContext());
+        llvm_type = Type::getInt16Ty(context);
         break;
       case TypeInfo::TYPE_CHAR:
       case TypeInfo::TYPE_UCHAR:
-        llvm_type = Type::getInt8Ty(getGlobalContext());
+        llvm_type = Type::getInt8Ty(context);
         break;
       case TypeInfo::TYPE_BOOL:
-        llvm_type = Type::getInt1Ty(getGlobalContext());
+        llvm_type = Type::getInt1Ty(context);
         break;
       case TypeInfo::TYPE_VOID:
-        llvm_type = Type::getVoidTy(getGlobalContext());
+        llvm_type = Type::getVoidTy(context);
         break;
     }
 
@@ -6,6 +6,7 @@
 namespace llvm
 {
   class Type;
+  class LLVMContext;
 };
 
 namespace nanjit
@@ -33,7 +34,7 @@ namespace nanjit
 
     BaseTypeEnum getBaseType() const;
     unsigned int getWidth() const;
-    virtual llvm::Type *getLLVMType() const;
+    virtual llvm::Type *getLLVMType(llvm::LLVMContext &context) const;
     virtual std::string toStr() const;
 
     virtual bool isFloatType() const;
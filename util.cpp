@@ -31,7 +31,7 @@ using namespace llvm;
 
 Function *createIteration(Function *target_func, Module *module)
 {
-  IRBuilder<> Builder(getGlobalContext());
+  IRBuilder<> Builder(module->getContext());
 
   Function::ArgumentListType &target_arg_list = target_func->getArgumentList();
   std::vector<Type*>  call_arg_types(target_arg_list.size() + 1);
@@ -53,11 +53,11 @@ Function *createIteration(Function *target_func, Module *module)
   }
 
   /* create the function type */
-  FunctionType *func_type = FunctionType::get(Type::getVoidTy(getGlobalContext()), call_arg_types, false);
+  FunctionType *func_type = FunctionType::get(Type::getVoidTy(module->getContext()), call_arg_types, false);
 
   Function *func = Function::Create(func_type, Function::ExternalLinkage, "function", module);
   
-  BasicBlock *func_body_block = BasicBlock::Create(getGlobalContext(), "entry", func);
+  BasicBlock *func_body_block = BasicBlock::Create(module->getContext(), "entry", func);
   Builder.SetInsertPoint(func_body_block);
   
   /* Stack allocations */
@@ -94,9 +94,9 @@ Function *createIteration(Function *target_func, Module *module)
   }
 
   /* Make the call */
-  BasicBlock *BodyBB = BasicBlock::Create(getGlobalContext(), "loop_body", func);
-  BasicBlock *LoopCondBB = BasicBlock::Create(getGlobalContext(), "loop_cond", func);
-  BasicBlock *ExitBB = BasicBlock::Create(getGlobalContext(), "exit", func);
+  BasicBlock *BodyBB = BasicBlock::Create(module->getContext(), "loop_body", func);
+  BasicBlock *LoopCondBB = BasicBlock::Create(module->getContext(), "loop_cond", func);
+  BasicBlock *ExitBB = BasicBlock::Create(module->getContext(), "exit", func);
   Builder.CreateBr(LoopCondBB);
   {
     std::vector<Value*> call_arguments(target_arg_list.size());
@@ -27,6 +27,7 @@
 #include <llvm/Support/raw_os_ostream.h>
 using namespace llvm;
 
+#include <iomanip>
 #include <list>
 #include <string>
 #include <memory>
@@ -46,6 +47,8 @@ GeneratorArgumentInfo::GeneratorArgumentInfo()
   type = TypeInfo(TypeInfo::TYPE_VOID);
   aligned = false;
   alias_index = -1;
+  bound = false;
+  bound_value = 0.0;
 }
 
 GeneratorArgumentInfo::GeneratorArgumentInfo(string str)
@@ -54,6 +57,8 @@ GeneratorArgumentInfo::GeneratorArgumentInfo(string str)
   type = TypeInfo(TypeInfo::TYPE_VOID);
   aligned = false;
   alias_index = -1;
+  bound = false;
+  bound_value = 0.0;
 
   parse(str);
 }
@@ -84,6 +89,22 @@ bool GeneratorArgumentInfo::getIsAlias() const
   return alias_index != -1;
 }
 
+void GeneratorArgumentInfo::setBoundValue(double value)
+{
+  bound = true;
+  bound_value = value;
+}
+
+bool GeneratorArgumentInfo::getIsBound() const
+{
+  return bound;
+}
+
+double GeneratorArgumentInfo::getBoundValue() const
+{
+  return bound_value;
+}
+
 void GeneratorArgumentInfo::setAggregation(ArgAggEnum agg)
 {
   aggregation = agg;
@@ -116,6 +137,10 @@ string GeneratorArgumentInfo::toStr() const
   if (alias_index !=  -1)
     result << "alias(" << alias_index << ") ";
 
+  /* Enough digits that different values never print the same */
+  if (bound)
+    result << "value(" << setprecision(17) << bound_value << ") ";
+
   if (type.getBaseType() == TypeInfo::TYPE_FLOAT)
     result << "float";
   else if (type.getBaseType() == TypeInfo::TYPE_INT)
@@ -135,14 +160,14 @@ string GeneratorArgumentInfo::toStr() const
   return result.str();
 }
 
-llvm::Type *GeneratorArgumentInfo::getLLVMBaseType() const
+llvm::Type *GeneratorArgumentInfo::getLLVMBaseType(LLVMContext &context) const
 {
-  return type.getLLVMType();
+  return type.getLLVMType(context);
 }
 
-llvm::Type *GeneratorArgumentInfo::getLLVMType() const
+llvm::Type *GeneratorArgumentInfo::getLLVMType(LLVMContext &context) const
 {
-  llvm::Type *our_type = getLLVMBaseType();
+  llvm::Type *our_type = getLLVMBaseType(context);
 
   if(aggregation == GeneratorArgumentInfo::ARG_AGG_SINGLE)
     ;
@@ -160,6 +185,8 @@ void GeneratorArgumentInfo::parse(string in_str)
   type = TypeInfo(TypeInfo::TYPE_VOID);
   aligned = false;
   alias_index = -1;
+  bound = false;
+  bound_value = 0.0;
 
   int argument_aggregation = GeneratorArgumentInfo::ARG_AGG_SINGLE;
   int attribute_offset = 0;
@@ -178,11 +205,14 @@ void GeneratorArgumentInfo::parse(string in_str)
         attribute_offset++;
 
       int alias_value;
+      double value;
 
       if (maybe_attribute == "aligned")
         setAligned(true);
       else if (1 == sscanf(maybe_attribute.c_str(), "alias(%d)", &alias_value))
         setAlias(alias_value);
+      else if (1 == sscanf(maybe_attribute.c_str(), "value(%lf)", &value))
+        setBoundValue(value);
       else
         reading_attributes = false;
 
@@ -27,6 +27,8 @@
 #include <llvm/Support/raw_os_ostream.h>
 using namespace llvm;
 
+#include <algorithm>
+#include <iterator>
 #include <list>
 #include <string>
 #include <memory>
@@ -37,9 +39,14 @@ using namespace std;
 #include <stdarg.h>
 #include <stdio.h>
 
+#include "ast.h"
+#include "jitpattern.h"
 #include "varg.h"
 using namespace nanjit;
 
+/* Elements a run of guarded elements is scanned ahead by at once */
+#define GUARD_SCAN_WIDTH 4
+
 string llvm_type_to_string(const Type *type)
 {
   string type_str;
@@ -50,7 +57,7 @@ string llvm_type_to_string(const Type *type)
 
 static Function *define_for_function(Module *module, const string &function_name, list<GeneratorArgumentInfo> &target_arg_list)
 {
-  IRBuilder<> Builder(getGlobalContext());
+  IRBuilder<> Builder(module->getContext());
 
   vector<Type*> call_arg_types;
 
@@ -59,7 +66,7 @@ static Function *define_for_function(Module *module, const string &function_name
        ++args_iter)
     {
       if(!args_iter->getIsAlias())
-        call_arg_types.push_back(args_iter->getLLVMType());
+        call_arg_types.push_back(args_iter->getLLVMType(module->getContext()));
     }
 
   /* Add the count parameter */
@@ -76,11 +83,11 @@ llvm::Function *llvm_void_def_for(Module *module,
                                   const string &function_name,
                                   list<GeneratorArgumentInfo> &target_arg_list)
 {
-  IRBuilder<> Builder(getGlobalContext());
+  IRBuilder<> Builder(module->getContext());
 
   Function *func = define_for_function(module, function_name, target_arg_list);
 
-  BasicBlock *func_body_block = BasicBlock::Create(getGlobalContext(), "entry", func);
+  BasicBlock *func_body_block = BasicBlock::Create(module->getContext(), "entry", func);
   Builder.SetInsertPoint(func_body_block);
   Builder.CreateRetVoid();
 
@@ -99,7 +106,7 @@ static void validate_arguments(Function *target_func,
     const Function::ArgumentListType &target_func_args = target_func->getArgumentList();
 
     list<GeneratorArgumentInfo>::iterator args_iter = target_arg_list.begin();
-    Type *return_type = target_arg_list.begin()->getLLVMBaseType();
+    Type *return_type = target_arg_list.begin()->getLLVMBaseType(target_func->getContext());
 
     if (target_func->getReturnType() != return_type)
     {
@@ -144,18 +151,22 @@ static void validate_arguments(Function *target_func,
 
     while (args_iter != target_arg_list.end())
     {
-      const Type *in_type = args_iter->getLLVMBaseType();
+      const Type *in_type = args_iter->getLLVMBaseType(target_func->getContext());
       const Type *out_type = target_func_args_iter->getType();
       if (in_type != out_type)
         {
           throw GeneratorException("Function \"" + target_func->getName().str() +
                                    "\" takes \"" + llvm_type_to_string(target_func_args_iter->getType()) +
-                                   "\" but iteration requested \"" + llvm_type_to_string(args_iter->getLLVMBaseType()) + "\"");
+                                   "\" but iteration requested \"" + llvm_type_to_string(args_iter->getLLVMBaseType(target_func->getContext())) + "\"");
         }
       if (args_iter->getIsAlias())
         {
           throw GeneratorException("Alias requested for argument");
         }
+      if (args_iter->getIsBound() && args_iter->getAggregation() != GeneratorArgumentInfo::ARG_AGG_SINGLE)
+        {
+          throw GeneratorException("Only single value arguments can be bound to a value");
+        }
       
       args_iter++;
       target_func_args_iter++;
@@ -218,7 +229,7 @@ static void load_referance_arguments(IRBuilder<> &builder,
         {
           /* Load the pointer off of the stack */
           Value *ptr_value = builder.CreateLoad(*loop_variables_iter);
-          SequentialType *ptr_type = dyn_cast<SequentialType>(args_iter->getLLVMType());
+          SequentialType *ptr_type = dyn_cast<SequentialType>(args_iter->getLLVMType(builder.getContext()));
           Type *base_type = ptr_type->getElementType();
           *loop_variables_iter = builder.CreateAlloca(base_type);
 
@@ -232,9 +243,11 @@ static void load_referance_arguments(IRBuilder<> &builder,
     }
 }
 
+/* Step every array by amount elements, or by one if amount is NULL */
 static void increment_array_variables(IRBuilder<> &builder,
                                       vector<Value*> &loop_variables,
-                                      const vector<GeneratorArgumentInfo> &target_arg_list)
+                                      const vector<GeneratorArgumentInfo> &target_arg_list,
+                                      Value *amount = NULL)
 {
   vector<GeneratorArgumentInfo>::const_iterator args_iter = target_arg_list.begin();
   vector<Value*>::iterator loop_variables_iter = loop_variables.begin();
@@ -245,7 +258,7 @@ static void increment_array_variables(IRBuilder<> &builder,
       if (args_iter->getAggregation() == GeneratorArgumentInfo::ARG_AGG_ARRAY)
         {
           Value *load_var = builder.CreateLoad(*loop_variables_iter);
-          Value *gep_var  = builder.CreateGEP(load_var, builder.getInt32(1));
+          Value *gep_var  = builder.CreateGEP(load_var, amount ? amount : builder.getInt32(1));
           builder.CreateStore(gep_var, *loop_variables_iter);
         }
       ++loop_variables_iter;
@@ -304,12 +317,27 @@ static vector<LocalVariablePair> inject_magic_arguments(Function *target_func,
   return result;
 }
 
+/* The constant a bound argument is replaced with, the same value in every
+ * element of a vector.
+ */
+static Value *bound_argument_value(LLVMContext &context, const GeneratorArgumentInfo &arg_info)
+{
+  Type *type = arg_info.getLLVMBaseType(context);
+
+  if (arg_info.getType().isFloatType())
+    return ConstantFP::get(type, arg_info.getBoundValue());
+  else
+    return ConstantInt::get(type, (uint64_t)(int64_t)arg_info.getBoundValue(), true);
+}
+
 /* Load values indicated by target_arg_list out of
    loop_variables and into a vector sutable for a
-   function call.
+   function call. Arrays are read index elements ahead
+   if it's given.
  */
 static vector<Value*> pack_call_parameters(IRBuilder<> &builder,
-                                           vector<LocalVariablePair> &argument_pairs)
+                                           vector<LocalVariablePair> &argument_pairs,
+                                           Value *index = NULL)
 {
   vector<Value*> call_parameters;
   vector<LocalVariablePair>::const_iterator args_iter = argument_pairs.begin();
@@ -318,10 +346,17 @@ static vector<Value*> pack_call_parameters(IRBuilder<> &builder,
     {
       Value *call_parameter = args_iter->value;
 
-      if (args_iter->arg_info.getAggregation() == GeneratorArgumentInfo::ARG_AGG_ARRAY)
+      if (args_iter->arg_info.getIsBound())
+        {
+          /* Folded into the function once it's inlined */
+          call_parameter = bound_argument_value(builder.getContext(), args_iter->arg_info);
+        }
+      else if (args_iter->arg_info.getAggregation() == GeneratorArgumentInfo::ARG_AGG_ARRAY)
         {
           /* If our argument is an array deref to the current value */
           call_parameter = builder.CreateLoad(call_parameter);
+          if (index)
+            call_parameter = builder.CreateGEP(call_parameter, index);
           call_parameter = builder.CreateAlignedLoad(call_parameter, get_arg_alignment(args_iter->arg_info));
         }
       else
@@ -338,9 +373,136 @@ static vector<Value*> pack_call_parameters(IRBuilder<> &builder,
   return call_parameters;
 }
 
+int llvm_guard_argument(Module *module, const string &function_name)
+{
+  NamedMDNode *guards = module->getNamedMetadata(NANJIT_GUARD_METADATA);
+
+  for (unsigned int i = 0; guards && i < guards->getNumOperands(); ++i)
+    {
+      MDNode *node = guards->getOperand(i);
+      Function *guard = dyn_cast_or_null<Function>(node->getOperand(0));
+      ConstantInt *index = dyn_cast_or_null<ConstantInt>(node->getOperand(1));
+
+      if (guard && index && guard->getName() == function_name + NANJIT_GUARD_SUFFIX)
+        return (int)index->getZExtValue();
+    }
+
+  return -1;
+}
+
+/* Start of the loop body for a guarded function. If the guard holds for the
+ * current element, count how many elements in a row it holds for, scanning
+ * GUARD_SCAN_WIDTH elements per step while there's room, then copy that many
+ * from the guarded array to the output and step past them. If the output is
+ * the guarded array nothing needs copying. Otherwise go on to kernel_block.
+ */
+static void build_guard_skip(IRBuilder<> &builder, Function *guard,
+                             vector<LocalVariablePair> &call_pairs, unsigned int guard_arg,
+                             Value *return_location, unsigned int return_alignment, bool in_place,
+                             vector<Value*> &loop_variables, const vector<GeneratorArgumentInfo> &active_arg_list,
+                             Value *remaining_count_variable, Value *run_variable,
+                             BasicBlock *kernel_block, BasicBlock *loop_cond_block)
+{
+  LLVMContext &context = builder.getContext();
+  Function *func = builder.GetInsertBlock()->getParent();
+
+  BasicBlock *run_start_block = BasicBlock::Create(context, "guard_run_start", func);
+  BasicBlock *wide_cond_block = BasicBlock::Create(context, "guard_wide_cond", func);
+  BasicBlock *wide_body_block = BasicBlock::Create(context, "guard_wide_body", func);
+  BasicBlock *wide_next_block = BasicBlock::Create(context, "guard_wide_next", func);
+  BasicBlock *narrow_cond_block = BasicBlock::Create(context, "guard_narrow_cond", func);
+  BasicBlock *narrow_body_block = BasicBlock::Create(context, "guard_narrow_body", func);
+  BasicBlock *narrow_next_block = BasicBlock::Create(context, "guard_narrow_next", func);
+  BasicBlock *run_block = BasicBlock::Create(context, "guard_run", func);
+
+  builder.CreateCondBr(builder.CreateCall(guard, pack_call_parameters(builder, call_pairs)),
+                       run_start_block, kernel_block);
+
+  /* The current element is already known to be part of the run */
+  builder.SetInsertPoint(run_start_block);
+  builder.CreateStore(builder.getInt32(1), run_variable);
+  builder.CreateBr(wide_cond_block);
+
+  /* The loop condition has already taken the current element off the count,
+   * so there are remaining + 1 - run elements left to look at.
+   */
+  builder.SetInsertPoint(wide_cond_block);
+  {
+    Value *run = builder.CreateLoad(run_variable);
+    Value *left = builder.CreateSub(builder.CreateAdd(builder.CreateLoad(remaining_count_variable),
+                                                      builder.getInt32(1)), run);
+    builder.CreateCondBr(builder.CreateICmpUGE(left, builder.getInt32(GUARD_SCAN_WIDTH)),
+                         wide_body_block, narrow_cond_block);
+  }
+
+  builder.SetInsertPoint(wide_body_block);
+  {
+    Value *run = builder.CreateLoad(run_variable);
+    Value *all = NULL;
+
+    for (int i = 0; i < GUARD_SCAN_WIDTH; ++i)
+      {
+        Value *index = builder.CreateAdd(run, builder.getInt32(i));
+        Value *taken = builder.CreateCall(guard, pack_call_parameters(builder, call_pairs, index));
+        all = all ? builder.CreateAnd(all, taken) : taken;
+      }
+
+    builder.CreateCondBr(all, wide_next_block, narrow_cond_block);
+  }
+
+  builder.SetInsertPoint(wide_next_block);
+  builder.CreateStore(builder.CreateAdd(builder.CreateLoad(run_variable), builder.getInt32(GUARD_SCAN_WIDTH)), run_variable);
+  builder.CreateBr(wide_cond_block);
+
+  /* Finish the run one element at a time */
+  builder.SetInsertPoint(narrow_cond_block);
+  {
+    Value *run = builder.CreateLoad(run_variable);
+    Value *remaining = builder.CreateLoad(remaining_count_variable);
+    builder.CreateCondBr(builder.CreateICmpULE(run, remaining), narrow_body_block, run_block);
+  }
+
+  builder.SetInsertPoint(narrow_body_block);
+  {
+    Value *run = builder.CreateLoad(run_variable);
+    builder.CreateCondBr(builder.CreateCall(guard, pack_call_parameters(builder, call_pairs, run)),
+                         narrow_next_block, run_block);
+  }
+
+  builder.SetInsertPoint(narrow_next_block);
+  builder.CreateStore(builder.CreateAdd(builder.CreateLoad(run_variable), builder.getInt32(1)), run_variable);
+  builder.CreateBr(narrow_cond_block);
+
+  builder.SetInsertPoint(run_block);
+  {
+    Value *run = builder.CreateLoad(run_variable);
+
+    if (!in_place)
+      {
+        const LocalVariablePair &source = call_pairs[guard_arg];
+        Type *element_type = source.arg_info.getLLVMBaseType(context);
+        Value *size = builder.CreateMul(builder.CreateZExt(run, builder.getInt64Ty()),
+                                        ConstantExpr::getSizeOf(element_type));
+        unsigned int alignment = std::min(return_alignment, get_arg_alignment(source.arg_info));
+
+        /* The caller may pass the same array without asking for an alias */
+        builder.CreateMemMove(builder.CreateLoad(return_location), builder.CreateLoad(source.value),
+                              size, alignment);
+      }
+
+    increment_array_variables(builder, loop_variables, active_arg_list, run);
+
+    Value *remaining = builder.CreateLoad(remaining_count_variable);
+    builder.CreateStore(builder.CreateSub(remaining, builder.CreateSub(run, builder.getInt32(1))),
+                        remaining_count_variable);
+    builder.CreateBr(loop_cond_block);
+  }
+}
+
 llvm::Function *llvm_def_for(Module *module,
                              const string &function_name,
-                             list<GeneratorArgumentInfo> &target_arg_list)
+                             list<GeneratorArgumentInfo> &target_arg_list,
+                             int guard_arg)
 {
   /* find our target function */
   Function *target_func = module->getFunction(function_name);
@@ -353,14 +515,14 @@ llvm::Function *llvm_def_for(Module *module,
   validate_arguments(target_func, target_arg_list, magic_arguments);
 
   /* generate wrapper function */
-  IRBuilder<> builder(getGlobalContext());
+  IRBuilder<> builder(module->getContext());
 
   Function *func = define_for_function(module, function_name, target_arg_list);
 
   bool alias_return_value = target_arg_list.begin()->getIsAlias();
 
   /* Build iteration */
-  BasicBlock *func_body_block = BasicBlock::Create(getGlobalContext(), "entry", func);
+  BasicBlock *func_body_block = BasicBlock::Create(module->getContext(), "entry", func);
   builder.SetInsertPoint(func_body_block);
 
   vector<Value*> loop_variables = load_arguments_to_variables(builder, func);
@@ -382,10 +544,26 @@ llvm::Function *llvm_def_for(Module *module,
 
   Value *remaining_count_variable = *(loop_variables.end() - 1);
 
+  /* Runs can only be copied from an array of the guarded argument */
+  Function *guard_func = NULL;
+  Value *run_variable = NULL;
+
+  if (guard_arg >= 0)
+    {
+      list<GeneratorArgumentInfo>::iterator guarded = target_arg_list.begin();
+      advance(guarded, guard_arg + 1);
+
+      if (guarded->getAggregation() == GeneratorArgumentInfo::ARG_AGG_ARRAY)
+        guard_func = module->getFunction(function_name + NANJIT_GUARD_SUFFIX);
+
+      if (guard_func)
+        run_variable = builder.CreateAlloca(builder.getInt32Ty());
+    }
+
   /* Begin loop */
-  BasicBlock *BodyBB = BasicBlock::Create(getGlobalContext(), "loop_body", func);
-  BasicBlock *LoopCondBB = BasicBlock::Create(getGlobalContext(), "loop_cond", func);
-  BasicBlock *ExitBB = BasicBlock::Create(getGlobalContext(), "exit", func);
+  BasicBlock *BodyBB = BasicBlock::Create(module->getContext(), "loop_body", func);
+  BasicBlock *LoopCondBB = BasicBlock::Create(module->getContext(), "loop_cond", func);
+  BasicBlock *ExitBB = BasicBlock::Create(module->getContext(), "exit", func);
   builder.CreateBr(LoopCondBB);
 
   builder.SetInsertPoint(BodyBB);
@@ -407,6 +585,20 @@ llvm::Function *llvm_def_for(Module *module,
 
     map<string, LocalVariablePair> magic_arguments_map;
     vector<LocalVariablePair> call_pairs = inject_magic_arguments(target_func, call_values, call_arginfo, magic_arguments_map);
+
+    if (guard_func)
+      {
+        BasicBlock *kernel_block = BasicBlock::Create(module->getContext(), "kernel", func);
+        bool in_place = alias_return_value && (target_arg_list.begin()->getAlias() - 1 == guard_arg);
+
+        build_guard_skip(builder, guard_func, call_pairs, guard_arg,
+                         return_location, get_arg_alignment(*target_arg_list.begin()), in_place,
+                         loop_variables, active_arg_list, remaining_count_variable, run_variable,
+                         kernel_block, LoopCondBB);
+
+        builder.SetInsertPoint(kernel_block);
+      }
+
     vector<Value*> call_parameters = pack_call_parameters(builder, call_pairs);
 
     Value *call_result = builder.CreateCall(target_func, call_parameters);
@@ -434,9 +626,146 @@ llvm::Function *llvm_def_for(Module *module,
   return func;
 }
 
+llvm::Function *llvm_def_for_pattern(Module *module,
+                                     const string &function_name,
+                                     list<GeneratorArgumentInfo> &target_arg_list,
+                                     const KernelPattern &pattern)
+{
+  if (pattern.kind == KERNEL_GENERIC)
+    return NULL;
+
+  Function *target_func = module->getFunction(function_name);
+  if (!target_func)
+  {
+    throw GeneratorException("Module has no function \"" + function_name + "\"");
+  }
+
+  list<string> magic_arguments;
+  validate_arguments(target_func, target_arg_list, magic_arguments);
+
+  vector<GeneratorArgumentInfo> arg_infos(target_arg_list.begin(), target_arg_list.end());
+  const GeneratorArgumentInfo &output_info = arg_infos[0];
+  bool alias_return_value = output_info.getIsAlias();
+  bool read_array = false;
+
+  if (pattern.kind != KERNEL_CONSTANT)
+    {
+      read_array = arg_infos[pattern.argument + 1].getAggregation() == GeneratorArgumentInfo::ARG_AGG_ARRAY;
+
+      /* An affine kernel of a single value is left to the generic loop */
+      if (pattern.kind == KERNEL_AFFINE && !read_array)
+        return NULL;
+    }
+
+  LLVMContext &context = module->getContext();
+  IRBuilder<> builder(context);
+
+  Function *func = define_for_function(module, function_name, target_arg_list);
+
+  /* The wrapper has no argument for an aliased output */
+  vector<Value*> wrapper_args;
+  for (Function::arg_iterator arg = func->arg_begin(); arg != func->arg_end(); ++arg)
+    wrapper_args.push_back(arg);
+
+  int first_input = alias_return_value ? 0 : 1;
+  Value *output = alias_return_value ? wrapper_args[output_info.getAlias() - 1] : wrapper_args[0];
+  Value *count = wrapper_args.back();
+
+  BasicBlock *func_body_block = BasicBlock::Create(context, "entry", func);
+  builder.SetInsertPoint(func_body_block);
+
+  Type *element_type = output_info.getLLVMBaseType(context);
+  unsigned int output_alignment = get_arg_alignment(output_info);
+  Value *size = builder.CreateMul(builder.CreateZExt(count, builder.getInt64Ty()),
+                                  ConstantExpr::getSizeOf(element_type));
+  Value *fill_value = NULL;
+  Value *input = NULL;
+  unsigned int input_alignment = 1;
+
+  if (pattern.kind == KERNEL_CONSTANT)
+    {
+      if (pattern.value->isNullValue())
+        {
+          builder.CreateMemSet(output, builder.getInt8(0), size, output_alignment);
+          builder.CreateRetVoid();
+          return func;
+        }
+
+      fill_value = pattern.value;
+    }
+  else
+    {
+      const GeneratorArgumentInfo &input_info = arg_infos[pattern.argument + 1];
+      input = wrapper_args[pattern.argument + first_input];
+      input_alignment = get_arg_alignment(input_info);
+
+      if (input_info.getIsBound())
+        fill_value = bound_argument_value(context, input_info);
+      else if (input_info.getAggregation() == GeneratorArgumentInfo::ARG_AGG_REF)
+        fill_value = builder.CreateAlignedLoad(input, input_alignment);
+      else if (input_info.getAggregation() == GeneratorArgumentInfo::ARG_AGG_SINGLE)
+        fill_value = input;
+    }
+
+  if (pattern.kind == KERNEL_IDENTITY && read_array)
+    {
+      /* An aliased output is already what the kernel would return */
+      if (!alias_return_value || output_info.getAlias() - 1 != (int)pattern.argument)
+        builder.CreateMemMove(output, input, size, std::min(output_alignment, input_alignment));
+
+      builder.CreateRetVoid();
+      return func;
+    }
+
+  /* Fill with a value or apply an affine kernel, indexing the arrays directly
+   * so the loop is easy to vectorize.
+   */
+  Value *index_variable = builder.CreateAlloca(builder.getInt32Ty());
+  builder.CreateStore(builder.getInt32(0), index_variable);
+
+  BasicBlock *loop_body_block = BasicBlock::Create(context, "loop_body", func);
+  BasicBlock *loop_cond_block = BasicBlock::Create(context, "loop_cond", func);
+  BasicBlock *exit_block = BasicBlock::Create(context, "exit", func);
+  builder.CreateBr(loop_cond_block);
+
+  builder.SetInsertPoint(loop_body_block);
+  {
+    Value *index = builder.CreateLoad(index_variable);
+    Value *value = fill_value;
+
+    if (!value)
+      {
+        value = builder.CreateAlignedLoad(builder.CreateGEP(input, index), input_alignment);
+
+        for (vector<BinaryOperator *>::const_iterator step = pattern.steps.begin(); step != pattern.steps.end(); ++step)
+          {
+            Instruction *inst = (*step)->clone();
+            int operand = isa<Constant>(inst->getOperand(0)) ? 1 : 0;
+            inst->setOperand(operand, value);
+            value = builder.Insert(inst);
+          }
+      }
+
+    builder.CreateAlignedStore(value, builder.CreateGEP(output, index), output_alignment);
+    builder.CreateStore(builder.CreateAdd(index, builder.getInt32(1)), index_variable);
+    builder.CreateBr(loop_cond_block);
+  }
+
+  builder.SetInsertPoint(loop_cond_block);
+  {
+    Value *index = builder.CreateLoad(index_variable);
+    builder.CreateCondBr(builder.CreateICmpULT(index, count), loop_body_block, exit_block);
+  }
+
+  builder.SetInsertPoint(exit_block);
+  builder.CreateRetVoid();
+
+  return func;
+}
+
 static Function *define_for_range_function(Module *module, const string &function_name, list<GeneratorArgumentInfo> &target_arg_list)
 {
-  IRBuilder<> Builder(getGlobalContext());
+  IRBuilder<> Builder(module->getContext());
 
   vector<Type*> call_arg_types;
 
@@ -445,7 +774,7 @@ static Function *define_for_range_function(Module *module, const string &functio
        ++args_iter)
     {
       if(!args_iter->getIsAlias())
-        call_arg_types.push_back(args_iter->getLLVMType());
+        call_arg_types.push_back(args_iter->getLLVMType(module->getContext()));
     }
 
   /* Add the x.from and x.to parameters */
@@ -463,11 +792,11 @@ llvm::Function *llvm_void_def_for_range(Module *module,
                                         const string &function_name,
                                         list<GeneratorArgumentInfo> &target_arg_list)
 {
-  IRBuilder<> Builder(getGlobalContext());
+  IRBuilder<> Builder(module->getContext());
 
   Function *func = define_for_range_function(module, function_name, target_arg_list);
 
-  BasicBlock *func_body_block = BasicBlock::Create(getGlobalContext(), "entry", func);
+  BasicBlock *func_body_block = BasicBlock::Create(module->getContext(), "entry", func);
   Builder.SetInsertPoint(func_body_block);
   Builder.CreateRetVoid();
 
@@ -492,14 +821,14 @@ llvm::Function *llvm_def_for_range(Module *module,
 
   validate_arguments(target_func, target_arg_list, magic_arguments);
 
-  IRBuilder<> builder(getGlobalContext());
+  IRBuilder<> builder(module->getContext());
 
   Function *func = define_for_range_function(module, function_name, target_arg_list);
 
   bool alias_return_value = target_arg_list.begin()->getIsAlias();
 
   /* Build iteration */
-  BasicBlock *func_body_block = BasicBlock::Create(getGlobalContext(), "entry", func);
+  BasicBlock *func_body_block = BasicBlock::Create(module->getContext(), "entry", func);
   builder.SetInsertPoint(func_body_block);
 
   vector<Value*> loop_variables = load_arguments_to_variables(builder, func);
@@ -526,9 +855,9 @@ llvm::Function *llvm_def_for_range(Module *module,
   builder.CreateStore(builder.CreateLoad(x_start), x_variable);
 
   /* Begin loop */
-  BasicBlock *loop_body_block = BasicBlock::Create(getGlobalContext(), "loop_body", func);
-  BasicBlock *loop_cond_block = BasicBlock::Create(getGlobalContext(), "loop_cond", func);
-  BasicBlock *exit_block = BasicBlock::Create(getGlobalContext(), "exit", func);
+  BasicBlock *loop_body_block = BasicBlock::Create(module->getContext(), "loop_body", func);
+  BasicBlock *loop_cond_block = BasicBlock::Create(module->getContext(), "loop_cond", func);
+  BasicBlock *exit_block = BasicBlock::Create(module->getContext(), "exit", func);
   builder.CreateBr(loop_cond_block);
 
   builder.SetInsertPoint(loop_body_block);
@@ -6,8 +6,11 @@
 namespace llvm
 {
   class Function;
+  class LLVMContext;
 };
 
+struct KernelPattern;
+
 class GeneratorException : public std::exception
 {
   std::string error_string;
@@ -33,6 +36,8 @@ private:
   nanjit::TypeInfo type;
   bool aligned;
   int alias_index;
+  bool bound;
+  double bound_value;
 public:
 
   GeneratorArgumentInfo();
@@ -40,6 +45,8 @@ public:
   void setAligned(bool is_aligned);
   void setAggregation(ArgAggEnum agg);
   void setAlias(int a);
+  /* Pass value to the function instead of the argument given to the iteration */
+  void setBoundValue(double value);
   void parse(std::string str);
   std::string toStr() const;
 
@@ -47,14 +54,33 @@ public:
   ArgAggEnum getAggregation() const;
   bool getIsAlias() const;
   int getAlias() const;
+  bool getIsBound() const;
+  double getBoundValue() const;
   nanjit::TypeInfo getType() const;
-  llvm::Type *getLLVMBaseType() const;
-  llvm::Type *getLLVMType() const;
+  llvm::Type *getLLVMBaseType(llvm::LLVMContext &context) const;
+  llvm::Type *getLLVMType(llvm::LLVMContext &context) const;
 };
 
 std::string llvm_type_to_string(const Type *type);
 
-llvm::Function *llvm_def_for(Module *module, const std::string &function_name, std::list<GeneratorArgumentInfo> &target_arg_list);
+/* The index of the argument function_name's guard returns, or -1 if it has
+ * no guard, see NANJIT_GUARD_SUFFIX.
+ */
+int llvm_guard_argument(Module *module, const std::string &function_name);
+
+/* With guard_arg set to llvm_guard_argument() and the guard in module, runs
+ * of elements the guard holds for are copied or skipped without calling the
+ * function.
+ */
+llvm::Function *llvm_def_for(Module *module, const std::string &function_name, std::list<GeneratorArgumentInfo> &target_arg_list,
+                             int guard_arg = -1);
+/* An iteration doing what a function classified as pattern does without
+ * calling it: copying or filling the output in bulk or running a plain loop
+ * over the one array it reads. NULL if pattern is generic or the arguments
+ * don't suit it, llvm_def_for handles those.
+ */
+llvm::Function *llvm_def_for_pattern(Module *module, const std::string &function_name, std::list<GeneratorArgumentInfo> &target_arg_list,
+                                     const KernelPattern &pattern);
 llvm::Function *llvm_void_def_for(Module *module, const std::string &function_name, std::list<GeneratorArgumentInfo> &target_arg_list);
 
 llvm::Function *llvm_def_for_range(Module *module, const std::string &function_name, std::list<GeneratorArgumentInfo> &target_arg_list);